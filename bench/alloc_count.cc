@@ -0,0 +1,126 @@
+// Counts calls to the global allocator on the request path. A connection is
+// driven through a socketpair exactly like the event loop does it (read and
+// parse, execute, write) and the allocations of the steady state, after a
+// warm-up, are reported per request.
+//
+// Exits with status 1 if a request that should be allocation free isn't.
+// Requests marked "copy" allocate once by design: a stored value longer than
+// the small string buffer is copied into the reply or into the keyspace.
+//
+// Build and run:
+//   c++ -std=c++23 -O2 -pthread -Isrc bench/alloc_count.cc
+//       $(ls src/*.cc | grep -v main.cc) -o alloc_count
+//   ./alloc_count
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "connection.h"
+
+namespace {
+
+std::string encode_command(const std::vector<std::string> &args) {
+  std::string out = "*" + std::to_string(args.size()) + "\r\n";
+  for (const auto &arg : args) {
+    out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+  }
+  return out;
+}
+
+struct Client {
+  int client_fd;
+  Connection &con;
+  std::vector<char> reply = std::vector<char>(1 << 16);
+
+  // One event loop round trip for `request`, which may hold several
+  // pipelined commands.
+  void round_trip(const std::string &request) {
+    if (write(client_fd, request.data(), request.size()) !=
+        static_cast<ssize_t>(request.size())) {
+      std::perror("write");
+      std::exit(2);
+    }
+    read_commands(con);
+    execute_commands(con);
+    handle_write(con);
+    if (read(client_fd, reply.data(), reply.size()) <= 0) {
+      std::perror("read");
+      std::exit(2);
+    }
+  }
+};
+
+struct Scenario {
+  const char *name;
+  std::vector<std::string> command;
+  size_t pipelined = 1;
+  bool copies_value = false;
+};
+
+}  // namespace
+
+int main() {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    std::perror("socketpair");
+    return 2;
+  }
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  Connection con(fds[0]);
+  Client client{.client_fd = fds[1], .con = con};
+
+  const std::string small_value = "hello";
+  const std::string large_value(100, 'x');
+  client.round_trip(encode_command({"SET", "key:small", small_value}));
+  client.round_trip(encode_command({"SET", "key:large", large_value}));
+
+  const std::vector<Scenario> scenarios = {
+      {.name = "PING", .command = {"PING"}},
+      {.name = "GET small", .command = {"GET", "key:small"}},
+      {.name = "GET missing", .command = {"GET", "key:missing"}},
+      {.name = "GET small x16", .command = {"GET", "key:small"}, .pipelined = 16},
+      {.name = "SET small", .command = {"SET", "key:small", small_value}},
+      {.name = "GET large (copy)",
+       .command = {"GET", "key:large"},
+       .copies_value = true},
+      {.name = "SET large (copy)",
+       .command = {"SET", "key:large", large_value},
+       .copies_value = true},
+  };
+  constexpr size_t warmup = 1000;
+  constexpr size_t iterations = 10000;
+  bool failed = false;
+  for (const auto &scenario : scenarios) {
+    std::string request;
+    for (size_t i = 0; i < scenario.pipelined; ++i) {
+      request += encode_command(scenario.command);
+    }
+    for (size_t i = 0; i < warmup; ++i) {
+      client.round_trip(request);
+    }
+    const size_t before = allocations.load();
+    for (size_t i = 0; i < iterations; ++i) {
+      client.round_trip(request);
+    }
+    const size_t counted = allocations.load() - before;
+    const double per_request =
+        static_cast<double>(counted) / (iterations * scenario.pipelined);
+    std::printf("%-20s %8.3f allocations/request\n", scenario.name,
+                per_request);
+    if (!scenario.copies_value && counted != 0) {
+      failed = true;
+    }
+  }
+  if (failed) {
+    std::printf("FAILED: allocations on an allocation free path\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+// Compares the bitmap kernels in src/bitops.cc with byte-at-a-time baselines
+// on multi-megabyte buffers.
+//
+// Build and run (add -march=native to enable the AVX2 kernels on x86):
+//   c++ -std=c++23 -O2 -Isrc bench/bitops_bench.cc src/bitops.cc -o bitops_bench
+//   ./bitops_bench [size_in_mb]
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitops.h"
+
+namespace {
+
+size_t bit_count_bytewise(const uint8_t *data, size_t len) {
+  static const auto table = [] {
+    std::array<uint8_t, 256> t{};
+    for (int i = 0; i < 256; ++i) {
+      t[i] = static_cast<uint8_t>(__builtin_popcount(i));
+    }
+    return t;
+  }();
+  size_t count = 0;
+  for (size_t i = 0; i < len; ++i) {
+    count += table[data[i]];
+  }
+  return count;
+}
+
+void bit_and_bytewise(uint8_t *dest, size_t len,
+                      const std::vector<std::string_view> &sources) {
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t acc = i < sources[0].size() ? sources[0][i] : 0;
+    for (size_t s = 1; s < sources.size(); ++s) {
+      acc &= i < sources[s].size() ? sources[s][i] : 0;
+    }
+    dest[i] = acc;
+  }
+}
+
+// Prevents the optimizer from discarding benchmark results.
+volatile size_t sink;
+
+template <typename Func>
+void run(const std::string &name, size_t bytes, Func &&func) {
+  constexpr int iterations = 20;
+  func();  // Warm up caches and page in the buffers.
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    func();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const double gb_per_s = bytes * iterations / elapsed.count() / 1e9;
+  std::cout << name << ": " << elapsed.count() / iterations * 1e3
+            << " ms/op, " << gb_per_s << " GB/s" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const size_t size = (argc > 1 ? std::atol(argv[1]) : 64) << 20;
+  std::mt19937_64 rng(42);
+  std::vector<std::string> inputs(3, std::string(size, '\0'));
+  for (auto &input : inputs) {
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+      const uint64_t word = rng();
+      std::memcpy(input.data() + i, &word, sizeof(word));
+    }
+  }
+  const auto *data = reinterpret_cast<const uint8_t *>(inputs[0].data());
+  const std::vector<std::string_view> sources(inputs.begin(), inputs.end());
+  std::vector<uint8_t> dest(size);
+
+  std::cout << "Buffer size " << (size >> 20) << " MB" << std::endl;
+  run("BITCOUNT bytewise", size, [&] { sink = bit_count_bytewise(data, size); });
+  run("BITCOUNT kernel  ", size, [&] { sink = bit_count(data, size); });
+  const size_t op_bytes = size * (sources.size() + 1);
+  run("BITOP AND bytewise", op_bytes,
+      [&] { bit_and_bytewise(dest.data(), size, sources); });
+  run("BITOP AND kernel  ", op_bytes,
+      [&] { bit_op(BitOp::And, dest.data(), size, sources); });
+  run("BITOP XOR kernel  ", op_bytes,
+      [&] { bit_op(BitOp::Xor, dest.data(), size, sources); });
+  if (bit_count(data, size) != bit_count_bytewise(data, size)) {
+    std::cerr << "BITCOUNT mismatch" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Throughput of the coroutine client in client/. `--workers` coroutines each
+// run a loop of SET and GET, awaiting every reply before sending the next
+// command, over a pool of `--connections` connections. The client pipelines
+// whatever the workers issue in one event loop iteration, so throughput
+// grows with the number of workers without any batching in the loop below.
+//
+// Build and run against a locally started server:
+//   c++ -std=c++23 -O2 -Isrc -Iclient bench/client_bench.cc
+//       client/redisxx_client.cc src/resp_parser.cc src/resp_types.cc
+//       src/compression.cc src/lzf.cc src/stats.cc -o client_bench
+//   ./redisxx &
+//   ./client_bench [--workers 100] [--connections 1] [--requests 1000000]
+//                  [--host 127.0.0.1] [--port 1234] [--socket <path>]
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "redisxx_client.h"
+
+namespace {
+
+struct BenchOptions {
+  redisxx::ClientOptions client;
+  size_t workers = 100;
+  size_t connections = 1;
+  uint64_t requests = 1'000'000;
+};
+
+template <typename Number>
+bool parse_number(std::string_view text, Number &result) {
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), result);
+  return error == std::errc() && end == text.data() + text.size() &&
+         result > 0;
+}
+
+std::optional<BenchOptions> parse_options(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string_view arg = argv[i];
+    const std::string_view value = argv[i + 1];
+    bool valid = true;
+    if (arg == "--workers") {
+      valid = parse_number(value, options.workers);
+    } else if (arg == "--connections") {
+      valid = parse_number(value, options.connections);
+    } else if (arg == "--requests") {
+      valid = parse_number(value, options.requests);
+    } else if (arg == "--host") {
+      options.client.host = value;
+    } else if (arg == "--port") {
+      options.client.port = value;
+    } else if (arg == "--socket") {
+      options.client.unix_socket = value;
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      std::cerr << "Invalid option " << arg << " " << value << "\n";
+      return std::nullopt;
+    }
+  }
+  if (argc % 2 == 0) {
+    std::cerr << "Missing value for " << argv[argc - 1] << "\n";
+    return std::nullopt;
+  }
+  return options;
+}
+
+// SETs and GETs its own key `count` times, counting unexpected replies.
+redisxx::Task<> worker(redisxx::ClientPool &pool, size_t id, uint64_t count,
+                       uint64_t &errors) {
+  const std::string key = "client_bench:" + std::to_string(id);
+  for (uint64_t i = 0; i < count; i += 2) {
+    const std::string value = std::to_string(i);
+    co_await pool.next().set(key, value);
+    const RespValue reply = co_await pool.next().get(key);
+    const auto *str = std::get_if<RespString>(&reply.value);
+    if (!str || *str != value) {
+      ++errors;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    return 1;
+  }
+  redisxx::EventLoop loop;
+  auto pool =
+      redisxx::ClientPool::connect(loop, options->client, options->connections);
+  if (!pool) {
+    return 1;
+  }
+  uint64_t errors = 0;
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t share = options->requests / options->workers;
+  for (size_t id = 0; id < options->workers; ++id) {
+    loop.spawn(worker(*pool, id, share, errors));
+  }
+  loop.run();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // Each worker rounds its share up to whole SET and GET pairs.
+  const uint64_t requests = (share + 1) / 2 * 2 * options->workers;
+  std::cout << requests << " requests in " << elapsed.count() << " s, "
+            << static_cast<uint64_t>(requests / elapsed.count())
+            << " requests/s, " << errors << " errors\n";
+  return errors == 0 ? 0 : 1;
+}
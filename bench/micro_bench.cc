@@ -0,0 +1,262 @@
+// Microbenchmarks for the request hot paths: RESP parsing, reply
+// serialization, the keyspace and command dispatch. Reports ns/op, bytes/s
+// where an operation has a natural size, and allocations/op counted through
+// the global allocator.
+//
+// The keyspace benchmarks fill the database to 1K, 10K, ... up to
+// --max-keys keys with 0%, 10% and 100% of them carrying a TTL (one hour, so
+// nothing expires during the run). SET scans the expiring keys, so filling
+// is quadratic in their number; sizes with more than --max-expiring of them
+// are skipped.
+//
+// Build and run:
+//   c++ -std=c++23 -O2 -pthread -Isrc bench/micro_bench.cc
+//       $(ls src/*.cc | grep -v main.cc) -o micro_bench
+//   ./micro_bench [--filter <substring>] [--min-time <seconds>]
+//                 [--max-keys <n>] [--max-expiring <n>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "commands.h"
+#include "database.h"
+#include "epoch.h"
+#include "resp_parser.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+  std::string filter;
+  double min_time = 0.2;
+  size_t max_keys = 1'000'000;
+  size_t max_expiring = 100'000;
+};
+
+BenchOptions options;
+
+// Keeps the compiler from dropping a computation whose result is unused.
+template <typename T>
+void do_not_optimize(const T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+std::string encode_command(const std::vector<std::string> &args) {
+  std::string out = "*" + std::to_string(args.size()) + "\r\n";
+  for (const auto &arg : args) {
+    out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+  }
+  return out;
+}
+
+// Runs `op` in growing batches until a batch takes at least `min_time`,
+// then prints the numbers of that batch. `bytes` is the size one op
+// processes, 0 if it has none.
+template <typename Op>
+void measure(std::string_view name, size_t bytes, Op &&op) {
+  if (name.find(options.filter) == std::string_view::npos) {
+    return;
+  }
+  op();
+  for (size_t iterations = 1;; iterations *= 2) {
+    const size_t allocations_before = allocations.load();
+    const auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      op();
+    }
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    const size_t allocated = allocations.load() - allocations_before;
+    if (seconds < options.min_time && iterations < (size_t{1} << 40)) {
+      continue;
+    }
+    const double ns_per_op = seconds * 1e9 / iterations;
+    std::printf("%-44s %12.1f ns/op", std::string(name).c_str(), ns_per_op);
+    if (bytes) {
+      std::printf(" %10.1f MB/s", bytes * iterations / seconds / 1e6);
+    } else {
+      std::printf(" %10s     ", "-");
+    }
+    std::printf(" %8.2f allocs/op\n",
+                static_cast<double>(allocated) / iterations);
+    return;
+  }
+}
+
+void bench_parser() {
+  const std::string ping = encode_command({"PING"});
+  const std::string set = encode_command({"SET", "key:1234", "hello world"});
+  measure("parse_resp_code PING", ping.size(),
+          [&] { do_not_optimize(parse_resp_code(ping)); });
+  measure("parse_resp_code SET", set.size(),
+          [&] { do_not_optimize(parse_resp_code(set)); });
+
+  std::string batch;
+  for (int i = 0; i < 64; ++i) {
+    batch += encode_command({"GET", "key:" + std::to_string(i)});
+  }
+  measure("parse_resp_prefix pipelined 64 x GET", batch.size(), [&] {
+    std::string_view rest = batch;
+    while (!rest.empty()) {
+      const auto parsed = parse_resp_prefix(rest);
+      do_not_optimize(parsed);
+      rest.remove_prefix(parsed->second);
+    }
+  });
+  std::pmr::unsynchronized_pool_resource pool;
+  CommandView args(&pool);
+  measure("parse_command pipelined 64 x GET", batch.size(), [&] {
+    std::string_view rest = batch;
+    while (!rest.empty()) {
+      const auto length = parse_command(rest, args);
+      do_not_optimize(args);
+      rest.remove_prefix(*length);
+    }
+  });
+
+  const std::string large =
+      encode_command({"SET", "key:large", std::string(1 << 20, 'x')});
+  measure("parse_resp_code SET 1 MiB", large.size(),
+          [&] { do_not_optimize(parse_resp_code(large)); });
+  measure("parse_command SET 1 MiB", large.size(), [&] {
+    const auto length = parse_command(large, args);
+    do_not_optimize(length);
+  });
+}
+
+void bench_serializer() {
+  const auto serialize = [](std::string_view name, const RespValue &value) {
+    const size_t bytes = value.to_protocol_representation().size();
+    measure(name, bytes,
+            [&] { do_not_optimize(value.to_protocol_representation()); });
+  };
+  serialize("to_protocol_representation OK", RespValue::make_string("OK"));
+  serialize("to_protocol_representation integer",
+            RespValue::make_integer(1234567));
+  serialize("to_protocol_representation 1 KiB string",
+            RespValue::make_string(std::string(1024, 'x')));
+  RespArray array;
+  for (int i = 0; i < 100; ++i) {
+    array.push_back(RespValue::make_string("value:" + std::to_string(i)));
+  }
+  serialize("to_protocol_representation 100 x array",
+            RespValue::make_array(array));
+  std::unordered_map<RespString, RespValue> map;
+  for (int i = 0; i < 20; ++i) {
+    map["field:" + std::to_string(i)] = RespValue::make_integer(i);
+  }
+  serialize("to_protocol_representation 20 x map", RespValue::make_map(map));
+}
+
+std::string key_name(size_t index) { return "key:" + std::to_string(index); }
+
+void bench_keyspace() {
+  auto &database = Database::instance();
+  const auto ttl = std::chrono::milliseconds(std::chrono::hours(1));
+  const RespValue value = RespValue::make_string("hello world");
+  std::mt19937_64 random(1);
+  for (const int ttl_percent : {0, 10, 100}) {
+    size_t filled = 0;
+    for (size_t keys = 1000; keys <= options.max_keys; keys *= 10) {
+      const std::string suffix = " " + std::to_string(keys) + " keys " +
+                                 std::to_string(ttl_percent) + "% TTL";
+      if (keys * ttl_percent / 100 > options.max_expiring) {
+        std::printf("%-44s skipped, raise --max-expiring\n",
+                    ("Database" + suffix).c_str());
+        continue;
+      }
+      // Keys without TTL first, while SET has no expiring keys to scan.
+      const size_t expiring = keys * ttl_percent / 100;
+      std::vector<std::pair<size_t, bool>> pending;
+      for (size_t i = filled; i < keys; ++i) {
+        pending.emplace_back(i, i % 100 < static_cast<size_t>(ttl_percent));
+      }
+      std::stable_partition(pending.begin(), pending.end(),
+                            [](const auto &key) { return !key.second; });
+      for (const auto &[i, with_ttl] : pending) {
+        database.set(key_name(i), value,
+                     with_ttl ? std::optional(ttl) : std::nullopt);
+      }
+      filled = keys;
+
+      std::vector<std::string> sample;
+      for (int i = 0; i < 4096; ++i) {
+        sample.push_back(key_name(random() % keys));
+      }
+      size_t next = 0;
+      measure("Database::get" + suffix, 0, [&] {
+        do_not_optimize(database.get(sample[next++ % sample.size()]));
+      });
+      measure("Database::set" + suffix, 0, [&] {
+        database.set(sample[next++ % sample.size()], value, std::nullopt);
+      });
+      if (expiring) {
+        measure("Database::expire_keys" + suffix, 0,
+                [&] { database.expire_keys(); });
+      }
+    }
+    for (size_t i = 0; i < filled; ++i) {
+      database.erase(key_name(i));
+    }
+    EpochManager::instance().reclaim();
+  }
+}
+
+void bench_dispatch() {
+  const RespArray no_arguments;
+  const RespArray get_arguments = {RespValue::make_string("key:dispatch")};
+  const RespArray set_arguments = {RespValue::make_string("key:dispatch"),
+                                   RespValue::make_string("hello world")};
+  dispatch_commands("SET", set_arguments);
+  measure("dispatch_commands PING", 0,
+          [&] { do_not_optimize(dispatch_commands("PING", no_arguments)); });
+  measure("dispatch_commands GET", 0,
+          [&] { do_not_optimize(dispatch_commands("GET", get_arguments)); });
+  measure("dispatch_commands SET", 0,
+          [&] { do_not_optimize(dispatch_commands("SET", set_arguments)); });
+  Database::instance().erase("key:dispatch");
+}
+
+bool parse_options(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string_view arg(argv[i]);
+    if (arg == "--filter") {
+      options.filter = argv[i + 1];
+    } else if (arg == "--min-time") {
+      options.min_time = std::atof(argv[i + 1]);
+    } else if (arg == "--max-keys") {
+      options.max_keys = std::strtoull(argv[i + 1], nullptr, 10);
+    } else if (arg == "--max-expiring") {
+      options.max_expiring = std::strtoull(argv[i + 1], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    std::fprintf(stderr,
+                 "Usage: %s [--filter <substring>] [--min-time <seconds>] "
+                 "[--max-keys <n>] [--max-expiring <n>]\n",
+                 argv[0]);
+    return 2;
+  }
+  bench_parser();
+  bench_serializer();
+  bench_dispatch();
+  bench_keyspace();
+  return 0;
+}
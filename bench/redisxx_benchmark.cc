@@ -0,0 +1,809 @@
+// Load generator for a running redisxx (or any RESP server). Opens
+// `--clients` connections spread over `--threads` threads, each keeping
+// `--pipeline` requests in flight, and drives a weighted mix of PING, SET,
+// GET, INCR and MGET over a uniform or Zipfian key space. Reports throughput
+// and latency percentiles overall and per command, as text or as JSON to
+// compare runs across commits.
+//
+// Latency is measured per request from the moment its batch is sent until
+// its reply is parsed, and kept in the server's own `LatencyHistogram`
+// (12.5% precision), while the maximum is exact.
+//
+// Build and run against a locally started server:
+//   c++ -std=c++23 -O2 -pthread -Isrc bench/redisxx_benchmark.cc
+//       src/stats.cc src/resp_types.cc src/compression.cc src/lzf.cc
+//       -o redisxx-benchmark
+//   ./redisxx &
+//   ./redisxx-benchmark --clients 50 --threads 4 --pipeline 16
+//       --mix get:8,set:2 --distribution zipf --prefill
+//       --json --label "$(git rev-parse --short HEAD)"
+//
+// Run with --help for all options.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Command : uint8_t { Ping, Set, Get, Incr, Mget };
+constexpr size_t command_count = 5;
+constexpr std::array<std::string_view, command_count> command_names = {
+    "ping", "set", "get", "incr", "mget"};
+
+enum class Distribution { Uniform, Zipf };
+
+// A run fails if no reply arrives for this long, e.g. for a command the
+// server doesn't know and never answers.
+constexpr auto stall_timeout = std::chrono::seconds(5);
+
+struct BenchmarkOptions {
+  std::string host = "127.0.0.1";
+  std::string port = "1234";
+  size_t clients = 50;
+  size_t threads = 4;
+  // Total requests, ignored when `duration` is set.
+  uint64_t requests = 1'000'000;
+  std::chrono::duration<double> duration{0};
+  size_t pipeline = 1;
+  uint64_t keyspace = 100'000;
+  size_t value_size = 64;
+  Distribution distribution = Distribution::Uniform;
+  double zipf_theta = 0.99;
+  std::string mix = "get:1,set:1";
+  size_t mget_keys = 10;
+  // SET every key once before measuring so GET and MGET hit.
+  bool prefill = false;
+  bool json = false;
+  std::string label;
+  uint64_t seed = 1;
+};
+
+void usage() {
+  std::cerr
+      << "Usage: redisxx-benchmark [options]\n"
+         "  --host <host>            server address (127.0.0.1)\n"
+         "  --port <port>            server port (1234)\n"
+         "  --clients <n>            connections (50)\n"
+         "  --threads <n>            client threads (4)\n"
+         "  --requests <n>           total requests (1000000)\n"
+         "  --duration <seconds>     run for a fixed time instead\n"
+         "  --pipeline <n>           requests in flight per connection (1)\n"
+         "  --keyspace <n>           distinct keys (100000)\n"
+         "  --value-size <bytes>     SET value size (64)\n"
+         "  --distribution <d>       uniform or zipf (uniform)\n"
+         "  --zipf-theta <theta>     Zipf skew, 0 < theta < 1 (0.99)\n"
+         "  --mix <cmd:weight,...>   of ping, set, get, incr, mget "
+         "(get:1,set:1)\n"
+         "  --mget-keys <n>          keys per MGET (10)\n"
+         "  --prefill                SET every key before measuring\n"
+         "  --json                   print results as JSON\n"
+         "  --label <text>           label stored in the JSON output\n"
+         "  --seed <n>               random seed (1)\n";
+}
+
+std::optional<Command> parse_command(std::string_view name) {
+  for (size_t i = 0; i < command_count; ++i) {
+    if (command_names[i] == name) {
+      return static_cast<Command>(i);
+    }
+  }
+  return std::nullopt;
+}
+
+template <typename Number>
+bool parse_number(std::string_view text, Number &result) {
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), result);
+  return error == std::errc() && end == text.data() + text.size();
+}
+
+// Cumulative weights of "get:8,set:2", indexed by `Command`.
+std::optional<std::array<uint64_t, command_count>> parse_mix(
+    std::string_view mix) {
+  std::array<uint64_t, command_count> weights{};
+  while (!mix.empty()) {
+    const auto comma = mix.find(',');
+    const auto item = mix.substr(0, comma);
+    mix = comma == std::string_view::npos ? "" : mix.substr(comma + 1);
+    const auto colon = item.find(':');
+    const auto command = parse_command(item.substr(0, colon));
+    uint64_t weight = 1;
+    if (!command || (colon != std::string_view::npos &&
+                     !parse_number(item.substr(colon + 1), weight))) {
+      return std::nullopt;
+    }
+    weights[static_cast<size_t>(*command)] += weight;
+  }
+  for (size_t i = 1; i < command_count; ++i) {
+    weights[i] += weights[i - 1];
+  }
+  if (weights.back() == 0) {
+    return std::nullopt;
+  }
+  return weights;
+}
+
+std::optional<BenchmarkOptions> parse_options(int argc, char **argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg(argv[i]);
+    const bool has_value = i + 1 < argc;
+    const std::string_view value = has_value ? argv[i + 1] : "";
+    bool valid = true;
+    if (arg == "--prefill") {
+      options.prefill = true;
+      continue;
+    } else if (arg == "--json") {
+      options.json = true;
+      continue;
+    } else if (!has_value) {
+      valid = false;
+    } else if (arg == "--host") {
+      options.host = value;
+    } else if (arg == "--port") {
+      options.port = value;
+    } else if (arg == "--clients") {
+      valid = parse_number(value, options.clients) && options.clients > 0;
+    } else if (arg == "--threads") {
+      valid = parse_number(value, options.threads) && options.threads > 0;
+    } else if (arg == "--requests") {
+      valid = parse_number(value, options.requests);
+    } else if (arg == "--duration") {
+      double seconds;
+      valid = parse_number(value, seconds) && seconds > 0;
+      options.duration = std::chrono::duration<double>(seconds);
+    } else if (arg == "--pipeline") {
+      valid = parse_number(value, options.pipeline) && options.pipeline > 0;
+    } else if (arg == "--keyspace") {
+      valid = parse_number(value, options.keyspace) && options.keyspace > 0;
+    } else if (arg == "--value-size") {
+      valid = parse_number(value, options.value_size);
+    } else if (arg == "--distribution") {
+      if (value == "uniform") {
+        options.distribution = Distribution::Uniform;
+      } else if (value == "zipf") {
+        options.distribution = Distribution::Zipf;
+      } else {
+        valid = false;
+      }
+    } else if (arg == "--zipf-theta") {
+      valid = parse_number(value, options.zipf_theta) &&
+              options.zipf_theta > 0 && options.zipf_theta < 1;
+    } else if (arg == "--mix") {
+      options.mix = value;
+      valid = parse_mix(value).has_value();
+    } else if (arg == "--mget-keys") {
+      valid = parse_number(value, options.mget_keys) && options.mget_keys > 0;
+    } else if (arg == "--label") {
+      options.label = value;
+    } else if (arg == "--seed") {
+      valid = parse_number(value, options.seed);
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      std::cerr << "Invalid option " << arg << (has_value ? " " : "")
+                << value << "\n";
+      return std::nullopt;
+    }
+    ++i;
+  }
+  options.threads = std::min(options.threads, options.clients);
+  return options;
+}
+
+// Zipfian ranks in [0, n) as in YCSB (Gray et al., "Quickly generating
+// billion-record synthetic databases"): rank 0 is the most popular key.
+class ZipfGenerator {
+ public:
+  ZipfGenerator(uint64_t n, double theta)
+      : n{n}, theta{theta}, alpha{1 / (1 - theta)}, zeta_n{zeta(n, theta)} {
+    const double zeta_2 = zeta(2, theta);
+    eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta_2 / zeta_n);
+  }
+
+  template <typename Random>
+  uint64_t operator()(Random &random) const {
+    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+    const double uz = u * zeta_n;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta)) {
+      return std::min<uint64_t>(1, n - 1);
+    }
+    const auto rank =
+        static_cast<uint64_t>(n * std::pow(eta * u - eta + 1, alpha));
+    return std::min(rank, n - 1);
+  }
+
+ private:
+  static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      sum += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+  const uint64_t n;
+  const double theta;
+  const double alpha;
+  const double zeta_n;
+  double eta;
+};
+
+// Length of the complete RESP2/RESP3 reply at the start of `data`, 0 while
+// it is incomplete.
+size_t reply_length(std::string_view data) {
+  const auto line_end = data.find("\r\n");
+  if (line_end == std::string_view::npos) {
+    return 0;
+  }
+  const size_t header = line_end + 2;
+  const char type = data[0];
+  if (type != '$' && type != '!' && type != '=' && type != '*' &&
+      type != '~' && type != '>' && type != '%' && type != '|') {
+    return header;
+  }
+  long length = 0;
+  parse_number(data.substr(1, line_end - 1), length);
+  if (length < 0) {
+    return header;
+  }
+  if (type == '$' || type == '!' || type == '=') {
+    const size_t end = header + length + 2;
+    return data.size() < end ? 0 : end;
+  }
+  // Maps and attributes hold key/value pairs, an attribute is followed by
+  // the reply it annotates.
+  size_t elements = length;
+  if (type == '%' || type == '|') {
+    elements *= 2;
+  }
+  if (type == '|') {
+    ++elements;
+  }
+  size_t offset = header;
+  for (size_t i = 0; i < elements; ++i) {
+    const size_t element = reply_length(data.substr(offset));
+    if (element == 0) {
+      return 0;
+    }
+    offset += element;
+  }
+  return offset;
+}
+
+void append_bulk(std::string &out, std::string_view value) {
+  out += '$';
+  out += std::to_string(value.size());
+  out += "\r\n";
+  out += value;
+  out += "\r\n";
+}
+
+void append_request(std::string &out,
+                    std::initializer_list<std::string_view> arguments) {
+  out += '*';
+  out += std::to_string(arguments.size());
+  out += "\r\n";
+  for (const auto argument : arguments) {
+    append_bulk(out, argument);
+  }
+}
+
+std::optional<int> connect_to(const BenchmarkOptions &options) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (const int rv = getaddrinfo(options.host.c_str(), options.port.c_str(),
+                                 &hints, &addresses);
+      rv != 0) {
+    std::cerr << "Failed to resolve " << options.host << ": "
+              << gai_strerror(rv) << "\n";
+    return std::nullopt;
+  }
+  std::optional<int> result;
+  for (auto *address = addresses; address && !result;
+       address = address->ai_next) {
+    const int fd = socket(address->ai_family, address->ai_socktype,
+                          address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      result = fd;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(addresses);
+  if (!result) {
+    std::cerr << "Failed to connect to " << options.host << ":"
+              << options.port << ": " << strerror(errno) << "\n";
+  }
+  return result;
+}
+
+std::string key_name(uint64_t index) { return "key:" + std::to_string(index); }
+
+// SETs every key over one blocking connection, 1000 per batch.
+bool prefill(const BenchmarkOptions &options, const std::string &value) {
+  const auto fd = connect_to(options);
+  if (!fd) {
+    return false;
+  }
+  constexpr uint64_t batch_size = 1000;
+  std::string out;
+  std::string in;
+  for (uint64_t first = 0; first < options.keyspace; first += batch_size) {
+    const uint64_t last = std::min(first + batch_size, options.keyspace);
+    out.clear();
+    for (uint64_t i = first; i < last; ++i) {
+      append_request(out, {"SET", key_name(i), value});
+    }
+    for (size_t sent = 0; sent < out.size();) {
+      const ssize_t n = write(*fd, out.data() + sent, out.size() - sent);
+      if (n <= 0) {
+        close(*fd);
+        return false;
+      }
+      sent += n;
+    }
+    for (uint64_t replies = first; replies < last;) {
+      if (const size_t length = reply_length(in)) {
+        in.erase(0, length);
+        ++replies;
+        continue;
+      }
+      char buffer[16384];
+      const ssize_t n = read(*fd, buffer, sizeof(buffer));
+      if (n <= 0) {
+        close(*fd);
+        return false;
+      }
+      in.append(buffer, n);
+    }
+  }
+  close(*fd);
+  return true;
+}
+
+struct CommandResults {
+  LatencyHistogram latency;
+  uint64_t errors = 0;
+  std::chrono::nanoseconds max{0};
+};
+
+struct ThreadResults {
+  std::array<CommandResults, command_count> commands;
+  bool failed = false;
+};
+
+struct Client {
+  int fd;
+  std::string out;
+  size_t out_offset = 0;
+  std::string in;
+  size_t in_offset = 0;
+  struct Pending {
+    Command command;
+    Clock::time_point start;
+  };
+  std::deque<Pending> pending;
+};
+
+class Worker {
+ public:
+  Worker(const BenchmarkOptions &options,
+         const std::array<uint64_t, command_count> &mix,
+         const ZipfGenerator *zipf, const std::string &value,
+         std::atomic<int64_t> &budget, Clock::time_point deadline,
+         uint64_t seed)
+      : options{options},
+        mix{mix},
+        zipf{zipf},
+        value{value},
+        budget{budget},
+        deadline{deadline},
+        random{seed} {}
+
+  void add_client(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    clients.push_back(Client{.fd = fd,
+                             .out = {},
+                             .out_offset = 0,
+                             .in = {},
+                             .in_offset = 0,
+                             .pending = {}});
+  }
+
+  void run() {
+    std::vector<pollfd> fds(clients.size());
+    auto last_progress = Clock::now();
+    while (true) {
+      bool busy = false;
+      for (size_t i = 0; i < clients.size(); ++i) {
+        auto &client = clients[i];
+        if (client.pending.empty()) {
+          send_batch(client);
+        }
+        busy |= !client.pending.empty();
+        fds[i] = pollfd{.fd = client.fd,
+                        .events = static_cast<short>(
+                            POLLIN | (client.out_offset < client.out.size()
+                                          ? POLLOUT
+                                          : 0)),
+                        .revents = 0};
+      }
+      if (!busy) {
+        return;
+      }
+      if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+        return fail("poll failed: ", strerror(errno));
+      }
+      for (size_t i = 0; i < clients.size(); ++i) {
+        if (fds[i].revents & POLLOUT && !flush(clients[i])) {
+          return fail("write failed: ", strerror(errno));
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+          if (!receive(clients[i])) {
+            return fail("connection closed by the server", "");
+          }
+          last_progress = Clock::now();
+        }
+      }
+      if (Clock::now() - last_progress > stall_timeout) {
+        return fail("no reply for 5 seconds", "");
+      }
+    }
+  }
+
+  ThreadResults results;
+
+ private:
+  void fail(std::string_view message, std::string_view detail) {
+    std::cerr << "Benchmark failed, " << message << detail << "\n";
+    results.failed = true;
+  }
+
+  // Claims up to `pipeline` requests from the shared budget.
+  size_t claim() {
+    if (options.duration.count() > 0) {
+      return Clock::now() < deadline ? options.pipeline : 0;
+    }
+    const auto pipeline = static_cast<int64_t>(options.pipeline);
+    const int64_t before = budget.fetch_sub(pipeline);
+    return std::clamp<int64_t>(before, 0, pipeline);
+  }
+
+  std::string next_key() {
+    if (zipf) {
+      return key_name((*zipf)(random));
+    }
+    return key_name(
+        std::uniform_int_distribution<uint64_t>(0, options.keyspace - 1)(
+            random));
+  }
+
+  Command next_command() {
+    const uint64_t pick =
+        std::uniform_int_distribution<uint64_t>(0, mix.back() - 1)(random);
+    size_t i = 0;
+    while (pick >= mix[i]) {
+      ++i;
+    }
+    return static_cast<Command>(i);
+  }
+
+  void send_batch(Client &client) {
+    const size_t count = claim();
+    if (count == 0) {
+      return;
+    }
+    client.out.clear();
+    client.out_offset = 0;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      const Command command = next_command();
+      switch (command) {
+        case Command::Ping:
+          append_request(client.out, {"PING"});
+          break;
+        case Command::Set:
+          append_request(client.out, {"SET", next_key(), value});
+          break;
+        case Command::Get:
+          append_request(client.out, {"GET", next_key()});
+          break;
+        case Command::Incr:
+          // Separate keys, the SET values aren't integers.
+          append_request(client.out, {"INCR", "counter:" + next_key()});
+          break;
+        case Command::Mget:
+          client.out += "*" + std::to_string(options.mget_keys + 1) + "\r\n";
+          append_bulk(client.out, "MGET");
+          for (size_t k = 0; k < options.mget_keys; ++k) {
+            append_bulk(client.out, next_key());
+          }
+          break;
+      }
+      client.pending.push_back({command, start});
+    }
+    flush(client);
+  }
+
+  bool flush(Client &client) {
+    while (client.out_offset < client.out.size()) {
+      const ssize_t n = write(client.fd, client.out.data() + client.out_offset,
+                              client.out.size() - client.out_offset);
+      if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      client.out_offset += n;
+    }
+    return true;
+  }
+
+  bool receive(Client &client) {
+    char buffer[65536];
+    const ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return false;
+    }
+    if (n < 0) {
+      return true;
+    }
+    client.in.append(buffer, n);
+    const auto now = Clock::now();
+    while (!client.pending.empty()) {
+      const std::string_view data =
+          std::string_view(client.in).substr(client.in_offset);
+      const size_t length = reply_length(data);
+      if (length == 0) {
+        break;
+      }
+      const auto request = client.pending.front();
+      client.pending.pop_front();
+      auto &command = results.commands[static_cast<size_t>(request.command)];
+      const auto latency = now - request.start;
+      command.latency.record(latency);
+      command.max = std::max(command.max, latency);
+      if (data[0] == '-' || data[0] == '!') {
+        ++command.errors;
+      }
+      client.in_offset += length;
+    }
+    if (client.in_offset == client.in.size()) {
+      client.in.clear();
+      client.in_offset = 0;
+    }
+    return true;
+  }
+
+  const BenchmarkOptions &options;
+  const std::array<uint64_t, command_count> &mix;
+  const ZipfGenerator *zipf;
+  const std::string &value;
+  std::atomic<int64_t> &budget;
+  const Clock::time_point deadline;
+  std::mt19937_64 random;
+  std::vector<Client> clients;
+};
+
+std::string json_string(std::string_view text) {
+  std::string out = "\"";
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+double to_us(std::chrono::nanoseconds duration) {
+  return duration.count() / 1000.0;
+}
+
+struct Summary {
+  uint64_t requests;
+  uint64_t errors;
+  double mean_us;
+  double p50_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+};
+
+Summary summarize(const CommandResults &results) {
+  const uint64_t n = results.latency.count();
+  return Summary{
+      .requests = n,
+      .errors = results.errors,
+      .mean_us = n ? to_us(results.latency.sum()) / n : 0,
+      .p50_us = to_us(results.latency.percentile(50)),
+      .p99_us = to_us(results.latency.percentile(99)),
+      .p999_us = to_us(results.latency.percentile(99.9)),
+      .max_us = to_us(results.max),
+  };
+}
+
+void print_json_summary(std::ostream &out, const Summary &summary,
+                        double seconds) {
+  out << "{\"requests\":" << summary.requests
+      << ",\"errors\":" << summary.errors
+      << ",\"ops_per_sec\":" << summary.requests / seconds
+      << ",\"latency_us\":{\"mean\":" << summary.mean_us
+      << ",\"p50\":" << summary.p50_us << ",\"p99\":" << summary.p99_us
+      << ",\"p999\":" << summary.p999_us << ",\"max\":" << summary.max_us
+      << "}}";
+}
+
+void print_json(const BenchmarkOptions &options, const Summary &total,
+                const std::array<Summary, command_count> &commands,
+                double seconds) {
+  std::ostringstream out;
+  out.precision(6);
+  out << "{\"label\":" << json_string(options.label)
+      << ",\"config\":{\"host\":" << json_string(options.host)
+      << ",\"port\":" << json_string(options.port)
+      << ",\"clients\":" << options.clients
+      << ",\"threads\":" << options.threads
+      << ",\"pipeline\":" << options.pipeline
+      << ",\"keyspace\":" << options.keyspace
+      << ",\"value_size\":" << options.value_size << ",\"distribution\":"
+      << (options.distribution == Distribution::Zipf ? "\"zipf\""
+                                                     : "\"uniform\"")
+      << ",\"zipf_theta\":" << options.zipf_theta
+      << ",\"mix\":" << json_string(options.mix)
+      << ",\"mget_keys\":" << options.mget_keys
+      << ",\"prefill\":" << (options.prefill ? "true" : "false")
+      << "},\"seconds\":" << seconds << ",\"total\":";
+  print_json_summary(out, total, seconds);
+  out << ",\"commands\":{";
+  bool first = true;
+  for (size_t i = 0; i < command_count; ++i) {
+    if (commands[i].requests == 0) {
+      continue;
+    }
+    out << (first ? "" : ",") << json_string(command_names[i]) << ":";
+    print_json_summary(out, commands[i], seconds);
+    first = false;
+  }
+  out << "}}\n";
+  std::cout << out.str();
+}
+
+void print_text(const Summary &summary, std::string_view name,
+                double seconds) {
+  std::printf("%-6s %10llu requests %12.0f ops/s  mean %8.1f  p50 %8.1f  "
+              "p99 %8.1f  p99.9 %8.1f  max %9.1f us",
+              std::string(name).c_str(),
+              static_cast<unsigned long long>(summary.requests),
+              summary.requests / seconds, summary.mean_us, summary.p50_us,
+              summary.p99_us, summary.p999_us, summary.max_us);
+  if (summary.errors) {
+    std::printf("  %llu errors",
+                static_cast<unsigned long long>(summary.errors));
+  }
+  std::printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    usage();
+    return 2;
+  }
+  const auto mix = *parse_mix(options->mix);
+  const std::string value(options->value_size, 'x');
+  std::optional<ZipfGenerator> zipf;
+  if (options->distribution == Distribution::Zipf) {
+    zipf.emplace(options->keyspace, options->zipf_theta);
+  }
+  if (options->prefill && !prefill(*options, value)) {
+    std::cerr << "Failed to prefill the key space\n";
+    return 1;
+  }
+
+  std::atomic<int64_t> budget{static_cast<int64_t>(options->requests)};
+  const auto start = Clock::now();
+  const auto deadline =
+      start + std::chrono::duration_cast<Clock::duration>(options->duration);
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < options->threads; ++i) {
+    workers.push_back(std::make_unique<Worker>(
+        *options, mix, zipf ? &*zipf : nullptr, value, budget, deadline,
+        options->seed + i));
+  }
+  for (size_t i = 0; i < options->clients; ++i) {
+    const auto fd = connect_to(*options);
+    if (!fd) {
+      return 1;
+    }
+    workers[i % workers.size()]->add_client(*fd);
+  }
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&worker] { worker->run(); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  CommandResults total;
+  std::array<CommandResults, command_count> commands;
+  bool failed = false;
+  for (const auto &worker : workers) {
+    failed |= worker->results.failed;
+    for (size_t i = 0; i < command_count; ++i) {
+      const auto &results = worker->results.commands[i];
+      for (auto *merged : {&commands[i], &total}) {
+        merged->latency.merge(results.latency);
+        merged->errors += results.errors;
+        merged->max = std::max(merged->max, results.max);
+      }
+    }
+  }
+  std::array<Summary, command_count> summaries;
+  for (size_t i = 0; i < command_count; ++i) {
+    summaries[i] = summarize(commands[i]);
+  }
+  if (options->json) {
+    print_json(*options, summarize(total), summaries, seconds);
+  } else {
+    for (size_t i = 0; i < command_count; ++i) {
+      if (summaries[i].requests) {
+        print_text(summaries[i], command_names[i], seconds);
+      }
+    }
+    print_text(summarize(total), "total", seconds);
+  }
+  return failed ? 1 : 0;
+}
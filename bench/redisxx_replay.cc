@@ -0,0 +1,505 @@
+// Replays a capture recorded with `redisxx --capture <file>` against a
+// running server, with one connection per connection in the capture and
+// each connection's commands in their original order.
+//
+// By default commands are sent at their recorded times (scaled with
+// --speed) without waiting for earlier replies, and latency is measured
+// from the scheduled send time, so a server that falls behind shows up as
+// latency instead of as a slower replay. With --fast every connection sends
+// as fast as the server answers, keeping up to --pipeline commands in
+// flight.
+//
+// Push frames (Pub/Sub messages and subscription confirmations) aren't
+// replies, and the SUBSCRIBE family doesn't wait for one.
+//
+// Build and run:
+//   c++ -std=c++23 -O2 -pthread -Isrc bench/redisxx_replay.cc
+//       src/capture.cc src/log.cc src/stats.cc src/resp_types.cc
+//       src/compression.cc src/lzf.cc -o redisxx-replay
+//   ./redisxx --capture traffic.cap   # record, then stop the server
+//   ./redisxx-replay traffic.cap [--fast] [--speed 2] [--json]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.h"
+#include "stats.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto stall_timeout = std::chrono::seconds(5);
+
+struct ReplayOptions {
+  std::string path;
+  std::string host = "127.0.0.1";
+  std::string port = "1234";
+  size_t threads = 4;
+  // Divides the recorded delays, ignored with `fast`.
+  double speed = 1;
+  bool fast = false;
+  size_t pipeline = 1;
+  bool json = false;
+};
+
+void usage() {
+  std::cerr << "Usage: redisxx-replay <capture> [options]\n"
+               "  --host <host>       server address (127.0.0.1)\n"
+               "  --port <port>       server port (1234)\n"
+               "  --threads <n>       client threads (4)\n"
+               "  --speed <factor>    replay this much faster than "
+               "recorded (1)\n"
+               "  --fast              send as fast as the server replies\n"
+               "  --pipeline <n>      commands in flight with --fast (1)\n"
+               "  --json              print results as JSON\n";
+}
+
+template <typename Number>
+bool parse_number(std::string_view text, Number &result) {
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), result);
+  return error == std::errc() && end == text.data() + text.size();
+}
+
+std::optional<ReplayOptions> parse_options(int argc, char **argv) {
+  ReplayOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg(argv[i]);
+    const bool has_value = i + 1 < argc;
+    const std::string_view value = has_value ? argv[i + 1] : "";
+    bool valid = true;
+    if (arg == "--fast") {
+      options.fast = true;
+      continue;
+    } else if (arg == "--json") {
+      options.json = true;
+      continue;
+    } else if (!arg.starts_with("--")) {
+      valid = options.path.empty();
+      options.path = arg;
+      if (valid) {
+        continue;
+      }
+    } else if (!has_value) {
+      valid = false;
+    } else if (arg == "--host") {
+      options.host = value;
+    } else if (arg == "--port") {
+      options.port = value;
+    } else if (arg == "--threads") {
+      valid = parse_number(value, options.threads) && options.threads > 0;
+    } else if (arg == "--speed") {
+      valid = parse_number(value, options.speed) && options.speed > 0;
+    } else if (arg == "--pipeline") {
+      valid = parse_number(value, options.pipeline) && options.pipeline > 0;
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      std::cerr << "Invalid option " << arg << "\n";
+      return std::nullopt;
+    }
+    ++i;
+  }
+  if (options.path.empty()) {
+    return std::nullopt;
+  }
+  return options;
+}
+
+// Length of the complete RESP2/RESP3 value at the start of `data`, 0 while
+// it is incomplete.
+size_t reply_length(std::string_view data) {
+  const auto line_end = data.find("\r\n");
+  if (line_end == std::string_view::npos) {
+    return 0;
+  }
+  const size_t header = line_end + 2;
+  const char type = data[0];
+  if (type != '$' && type != '!' && type != '=' && type != '*' &&
+      type != '~' && type != '>' && type != '%' && type != '|') {
+    return header;
+  }
+  long length = 0;
+  parse_number(data.substr(1, line_end - 1), length);
+  if (length < 0) {
+    return header;
+  }
+  if (type == '$' || type == '!' || type == '=') {
+    const size_t end = header + length + 2;
+    return data.size() < end ? 0 : end;
+  }
+  size_t elements = length;
+  if (type == '%' || type == '|') {
+    elements *= 2;
+  }
+  if (type == '|') {
+    ++elements;
+  }
+  size_t offset = header;
+  for (size_t i = 0; i < elements; ++i) {
+    const size_t element = reply_length(data.substr(offset));
+    if (element == 0) {
+      return 0;
+    }
+    offset += element;
+  }
+  return offset;
+}
+
+bool expects_reply(std::string_view name) {
+  std::string lower(name);
+  std::ranges::transform(lower, lower.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return lower != "subscribe" && lower != "unsubscribe" &&
+         lower != "psubscribe" && lower != "punsubscribe";
+}
+
+struct Request {
+  // Since the start of the capture, at recorded speed.
+  std::chrono::microseconds at;
+  std::string encoded;
+  bool expects_reply;
+};
+
+struct Client {
+  int fd = -1;
+  std::vector<Request> requests;
+  size_t next = 0;
+  std::string out;
+  size_t out_offset = 0;
+  std::string in;
+  // Send times of the requests waiting for a reply.
+  std::deque<Clock::time_point> pending;
+};
+
+std::optional<int> connect_to(const ReplayOptions &options) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints,
+                  &addresses) != 0) {
+    std::cerr << "Failed to resolve " << options.host << "\n";
+    return std::nullopt;
+  }
+  std::optional<int> result;
+  for (auto *address = addresses; address && !result;
+       address = address->ai_next) {
+    const int fd = socket(address->ai_family, address->ai_socktype,
+                          address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+      result = fd;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(addresses);
+  if (!result) {
+    std::cerr << "Failed to connect to " << options.host << ":"
+              << options.port << ": " << strerror(errno) << "\n";
+  }
+  return result;
+}
+
+struct Results {
+  LatencyHistogram latency;
+  std::chrono::nanoseconds max{0};
+  uint64_t errors = 0;
+  bool failed = false;
+};
+
+class Worker {
+ public:
+  Worker(const ReplayOptions &options, std::vector<Client *> clients)
+      : options{options}, clients{std::move(clients)} {}
+
+  void run(Clock::time_point start) {
+    std::vector<pollfd> fds(clients.size());
+    auto last_progress = Clock::now();
+    while (true) {
+      const auto now = Clock::now();
+      bool done = true;
+      // Time until the next scheduled request, capped so replies are read.
+      auto wait = std::chrono::milliseconds(10);
+      for (size_t i = 0; i < clients.size(); ++i) {
+        auto &client = *clients[i];
+        queue_due(client, start, now, wait);
+        done &= client.next == client.requests.size() &&
+                client.pending.empty() &&
+                client.out_offset == client.out.size();
+        fds[i] = pollfd{.fd = client.fd,
+                        .events = static_cast<short>(
+                            POLLIN | (client.out_offset < client.out.size()
+                                          ? POLLOUT
+                                          : 0)),
+                        .revents = 0};
+      }
+      if (done) {
+        return;
+      }
+      if (poll(fds.data(), fds.size(), wait.count()) < 0 && errno != EINTR) {
+        return fail("poll failed");
+      }
+      for (size_t i = 0; i < clients.size(); ++i) {
+        auto &client = *clients[i];
+        if (fds[i].revents & POLLOUT && !flush(client)) {
+          return fail("write failed");
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+          if (!receive(client)) {
+            return fail("connection closed by the server");
+          }
+          last_progress = Clock::now();
+        }
+      }
+      const bool waiting =
+          std::ranges::any_of(clients, [](const Client *client) {
+            return !client->pending.empty();
+          });
+      if (!waiting) {
+        last_progress = Clock::now();
+      } else if (Clock::now() - last_progress > stall_timeout) {
+        return fail("no reply for 5 seconds");
+      }
+    }
+  }
+
+  Results results;
+
+ private:
+  void fail(std::string_view message) {
+    std::cerr << "Replay failed, " << message << "\n";
+    results.failed = true;
+  }
+
+  // Appends the requests of `client` that are due to its output and lowers
+  // `wait` to the time until its next one.
+  void queue_due(Client &client, Clock::time_point start,
+                 Clock::time_point now, std::chrono::milliseconds &wait) {
+    bool queued = false;
+    while (client.next < client.requests.size()) {
+      const auto &request = client.requests[client.next];
+      auto send_at = now;
+      if (options.fast) {
+        if (client.pending.size() >= options.pipeline) {
+          break;
+        }
+      } else {
+        send_at = start + std::chrono::duration_cast<Clock::duration>(
+                              request.at / options.speed);
+        if (send_at > now) {
+          wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(
+                                    send_at - now));
+          break;
+        }
+      }
+      if (client.out_offset == client.out.size()) {
+        client.out.clear();
+        client.out_offset = 0;
+      }
+      client.out += request.encoded;
+      if (request.expects_reply) {
+        client.pending.push_back(send_at);
+      }
+      ++client.next;
+      queued = true;
+    }
+    if (queued && !flush(client)) {
+      fail("write failed");
+    }
+  }
+
+  bool flush(Client &client) {
+    while (client.out_offset < client.out.size()) {
+      const ssize_t n = write(client.fd, client.out.data() + client.out_offset,
+                              client.out.size() - client.out_offset);
+      if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      client.out_offset += n;
+    }
+    return true;
+  }
+
+  bool receive(Client &client) {
+    char buffer[65536];
+    const ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return false;
+    }
+    if (n < 0) {
+      return true;
+    }
+    client.in.append(buffer, n);
+    const auto now = Clock::now();
+    size_t offset = 0;
+    while (true) {
+      const std::string_view data = std::string_view(client.in).substr(offset);
+      const size_t length = reply_length(data);
+      if (length == 0) {
+        break;
+      }
+      offset += length;
+      if (data[0] == '>' || client.pending.empty()) {
+        continue;
+      }
+      const auto latency = now - client.pending.front();
+      client.pending.pop_front();
+      results.latency.record(latency);
+      results.max = std::max(results.max, latency);
+      if (data[0] == '-' || data[0] == '!') {
+        ++results.errors;
+      }
+    }
+    client.in.erase(0, offset);
+    return true;
+  }
+
+  const ReplayOptions &options;
+  std::vector<Client *> clients;
+};
+
+std::string encode(const std::vector<std::string> &command) {
+  std::string out = "*" + std::to_string(command.size()) + "\r\n";
+  for (const auto &argument : command) {
+    out += "$" + std::to_string(argument.size()) + "\r\n" + argument + "\r\n";
+  }
+  return out;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    usage();
+    return 2;
+  }
+  CaptureReader reader;
+  if (!reader.open(options->path)) {
+    std::cerr << "Not a capture file: " << options->path << "\n";
+    return 1;
+  }
+  // Connections in the order they first appear in the capture.
+  std::vector<std::unique_ptr<Client>> clients;
+  std::unordered_map<uint64_t, Client *> by_connection;
+  std::chrono::microseconds at{0};
+  uint64_t commands = 0;
+  while (const auto record = reader.next()) {
+    at += record->delta;
+    auto &client = by_connection[record->connection];
+    if (!client) {
+      clients.push_back(std::make_unique<Client>());
+      client = clients.back().get();
+    }
+    if (record->command.empty()) {
+      continue;
+    }
+    client->requests.push_back(Request{
+        .at = at,
+        .encoded = encode(record->command),
+        .expects_reply = expects_reply(record->command.front()),
+    });
+    ++commands;
+  }
+  if (clients.empty()) {
+    std::cerr << "The capture holds no commands\n";
+    return 1;
+  }
+
+  const size_t thread_count = std::min(options->threads, clients.size());
+  std::vector<std::vector<Client *>> assignment(thread_count);
+  for (size_t i = 0; i < clients.size(); ++i) {
+    const auto fd = connect_to(*options);
+    if (!fd) {
+      return 1;
+    }
+    clients[i]->fd = *fd;
+    assignment[i % thread_count].push_back(clients[i].get());
+  }
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (auto &assigned : assignment) {
+    workers.push_back(std::make_unique<Worker>(*options, std::move(assigned)));
+  }
+  const auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&worker, start] { worker->run(start); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  Results total;
+  for (const auto &worker : workers) {
+    total.latency.merge(worker->results.latency);
+    total.max = std::max(total.max, worker->results.max);
+    total.errors += worker->results.errors;
+    total.failed |= worker->results.failed;
+  }
+  const auto us = [](std::chrono::nanoseconds duration) {
+    return duration.count() / 1000.0;
+  };
+  const uint64_t replies = total.latency.count();
+  const double mean = replies ? us(total.latency.sum()) / replies : 0;
+  if (options->json) {
+    std::printf(
+        "{\"capture\":\"%s\",\"connections\":%zu,\"commands\":%llu,"
+        "\"mode\":\"%s\",\"speed\":%g,\"pipeline\":%zu,\"seconds\":%g,"
+        "\"replies\":%llu,\"errors\":%llu,\"ops_per_sec\":%g,"
+        "\"latency_us\":{\"mean\":%g,\"p50\":%g,\"p99\":%g,\"p999\":%g,"
+        "\"max\":%g}}\n",
+        options->path.c_str(), clients.size(),
+        static_cast<unsigned long long>(commands),
+        options->fast ? "fast" : "timed", options->speed, options->pipeline,
+        seconds, static_cast<unsigned long long>(replies),
+        static_cast<unsigned long long>(total.errors), commands / seconds,
+        mean, us(total.latency.percentile(50)),
+        us(total.latency.percentile(99)), us(total.latency.percentile(99.9)),
+        us(total.max));
+  } else {
+    std::printf("Replayed %llu commands over %zu connections in %.3fs "
+                "(%.0f ops/s), %llu errors\n",
+                static_cast<unsigned long long>(commands), clients.size(),
+                seconds, commands / seconds,
+                static_cast<unsigned long long>(total.errors));
+    std::printf("latency us: mean %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  "
+                "max %.1f\n",
+                mean, us(total.latency.percentile(50)),
+                us(total.latency.percentile(99)),
+                us(total.latency.percentile(99.9)), us(total.max));
+  }
+  return total.failed ? 1 : 0;
+}
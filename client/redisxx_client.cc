@@ -0,0 +1,411 @@
+#include "redisxx_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "resp_parser.h"
+
+namespace redisxx {
+
+namespace {
+
+// Bytes read per system call.
+constexpr size_t read_size = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;
+#endif
+
+std::optional<int> connect_unix(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Unix socket path too long: " << path << "\n";
+    return std::nullopt;
+  }
+  path.copy(addr.sun_path, path.size());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket: " << strerror(errno) << "\n";
+    return std::nullopt;
+  }
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "Failed to connect to " << path << ": " << strerror(errno)
+              << "\n";
+    close(fd);
+    return std::nullopt;
+  }
+  return fd;
+}
+
+std::optional<int> connect_tcp(const std::string &host,
+                               const std::string &port) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (const int rv =
+          getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+      rv != 0) {
+    std::cerr << "Failed to resolve " << host << ": " << gai_strerror(rv)
+              << "\n";
+    return std::nullopt;
+  }
+  std::optional<int> result;
+  for (auto *address = addresses; address && !result;
+       address = address->ai_next) {
+    const int fd = socket(address->ai_family, address->ai_socktype,
+                          address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      result = fd;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(addresses);
+  if (!result) {
+    std::cerr << "Failed to connect to " << host << ":" << port << ": "
+              << strerror(errno) << "\n";
+  }
+  return result;
+}
+
+void append_length(std::string &out, char type, size_t length) {
+  char digits[24];
+  const auto result = std::to_chars(digits, digits + sizeof(digits), length);
+  out += type;
+  out.append(digits, result.ptr);
+  out += "\r\n";
+}
+
+}  // namespace
+
+void EventLoop::spawn(Task<> task) {
+  schedule(task.handle);
+  spawned.push_back(std::move(task));
+}
+
+void EventLoop::run() {
+  while (!spawned.empty()) {
+    if (!iterate()) {
+      stalled();
+    }
+  }
+}
+
+void EventLoop::run_until(std::coroutine_handle<> handle) {
+  while (!handle.done()) {
+    if (!iterate()) {
+      stalled();
+    }
+  }
+}
+
+void EventLoop::stalled() {
+  std::cerr << "redisxx client: tasks wait for nothing that can complete "
+               "them\n";
+  std::abort();
+}
+
+bool EventLoop::iterate() {
+  const bool runnable = !ready.empty();
+  // Coroutines resumed here queue commands, which only complete after the
+  // write below, and may spawn others.
+  while (!ready.empty()) {
+    resuming.swap(ready);
+    for (const auto handle : resuming) {
+      handle.resume();
+    }
+    resuming.clear();
+  }
+  reap_spawned();
+  // One write per connection for all commands queued above.
+  for (auto *client : std::exchange(unflushed, {})) {
+    client->flush();
+  }
+  if (!ready.empty()) {
+    return true;
+  }
+  polled.clear();
+  polled_clients.clear();
+  for (auto *client : clients) {
+    if (client->waiting()) {
+      const short events = client->output.empty() ? POLLIN : POLLIN | POLLOUT;
+      polled.push_back(
+          pollfd{.fd = client->fd, .events = events, .revents = 0});
+      polled_clients.push_back(client);
+    }
+  }
+  if (polled.empty()) {
+    return runnable;
+  }
+  if (poll(polled.data(), polled.size(), -1) < 0) {
+    return errno == EINTR;
+  }
+  for (size_t i = 0; i < polled.size(); ++i) {
+    auto *client = polled_clients[i];
+    const short events = polled[i].revents;
+    if (events & POLLOUT) {
+      client->flush();
+    }
+    if (client->connected() && (events & (POLLIN | POLLHUP | POLLERR))) {
+      client->receive();
+    }
+  }
+  return true;
+}
+
+void EventLoop::reap_spawned() {
+  const auto finished = std::ranges::partition(
+      spawned, [](const Task<> &task) { return !task.done(); });
+  std::vector<Task<>> done;
+  done.reserve(finished.size());
+  std::ranges::move(finished, std::back_inserter(done));
+  spawned.erase(finished.begin(), finished.end());
+  for (auto &task : done) {
+    task.handle.promise().take_result();
+  }
+}
+
+void EventLoop::remove(Client *client) {
+  std::erase(clients, client);
+  std::erase(unflushed, client);
+}
+
+bool PushAwaiter::await_ready() const noexcept {
+  return !client.pushes.empty() || !client.connected();
+}
+
+void PushAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept {
+  client.push_waiter = handle;
+}
+
+std::optional<RespPush> PushAwaiter::await_resume() {
+  if (client.pushes.empty()) {
+    return std::nullopt;
+  }
+  auto push = std::move(client.pushes.front());
+  client.pushes.pop_front();
+  return push;
+}
+
+std::unique_ptr<Client> Client::connect(EventLoop &loop,
+                                        const ClientOptions &options) {
+  const auto fd = options.unix_socket.empty()
+                      ? connect_tcp(options.host, options.port)
+                      : connect_unix(options.unix_socket);
+  if (!fd) {
+    return nullptr;
+  }
+#ifdef SO_NOSIGPIPE
+  const int one = 1;
+  setsockopt(*fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL, 0) | O_NONBLOCK);
+  return std::unique_ptr<Client>(new Client(loop, *fd));
+}
+
+Client::Client(EventLoop &loop, int fd) : loop(loop), fd(fd) {
+  loop.add(this);
+}
+
+Client::~Client() {
+  disconnect();
+  loop.remove(this);
+}
+
+Reply Client::command(std::span<const std::string> arguments) {
+  begin_command(arguments.size());
+  for (const auto &argument : arguments) {
+    append_argument(argument);
+  }
+  return expect_reply();
+}
+
+Reply Client::mget(std::span<const std::string> keys) {
+  begin_command(keys.size() + 1);
+  append_argument("MGET");
+  for (const auto &key : keys) {
+    append_argument(key);
+  }
+  return expect_reply();
+}
+
+void Client::begin_command(size_t arguments) {
+  if (!connected()) {
+    return;
+  }
+  if (output.empty()) {
+    loop.flush_later(this);
+  }
+  append_length(output, '*', arguments);
+}
+
+void Client::append_argument(std::string_view argument) {
+  if (!connected()) {
+    return;
+  }
+  append_length(output, '$', argument.size());
+  output += argument;
+  output += "\r\n";
+}
+
+Reply Client::expect_reply() {
+  auto state = std::make_shared<Reply::State>();
+  if (connected()) {
+    replies.push_back(state);
+  } else {
+    state->value = RespValue::make_error("ERR connection lost");
+  }
+  return Reply(std::move(state));
+}
+
+void Client::flush() {
+  size_t sent = 0;
+  while (connected() && sent < output.size()) {
+    const ssize_t n =
+        send(fd, output.data() + sent, output.size() - sent, send_flags);
+    if (n > 0) {
+      sent += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The rest goes out once the socket is writable again.
+      break;
+    } else {
+      disconnect();
+    }
+  }
+  output.erase(0, sent);
+}
+
+void Client::receive() {
+  while (connected()) {
+    const size_t used = input.size();
+    input.resize(used + read_size);
+    const ssize_t n = recv(fd, input.data() + used, read_size, 0);
+    input.resize(used + std::max<ssize_t>(n, 0));
+    if (n > 0) {
+      if (static_cast<size_t>(n) < read_size) {
+        break;
+      }
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    disconnect();
+  }
+  while (connected() && input_start < input.size()) {
+    RespValue value;
+    const auto length =
+        parse_reply(std::string_view(input).substr(input_start), value);
+    if (!length) {
+      std::cerr << "redisxx client: malformed reply\n";
+      disconnect();
+      break;
+    }
+    if (*length == 0) {
+      break;
+    }
+    input_start += *length;
+    dispatch(std::move(value));
+  }
+  if (input_start == input.size() || !connected()) {
+    input.clear();
+    input_start = 0;
+  } else if (input_start > input.size() / 2) {
+    input.erase(0, input_start);
+    input_start = 0;
+  }
+}
+
+void Client::dispatch(RespValue value) {
+  if (auto *push = std::get_if<RespPush>(&value.value)) {
+    pushes.push_back(std::move(*push));
+    if (push_waiter) {
+      loop.schedule(std::exchange(push_waiter, {}));
+    }
+    return;
+  }
+  if (replies.empty()) {
+    std::cerr << "redisxx client: reply to no command\n";
+    disconnect();
+    return;
+  }
+  auto state = std::move(replies.front());
+  replies.pop_front();
+  state->value = std::move(value);
+  if (state->waiter) {
+    loop.schedule(std::exchange(state->waiter, {}));
+  }
+}
+
+void Client::disconnect() {
+  if (!connected()) {
+    return;
+  }
+  close(fd);
+  fd = -1;
+  output.clear();
+  for (auto &state : replies) {
+    state->value = RespValue::make_error("ERR connection lost");
+    if (state->waiter) {
+      loop.schedule(std::exchange(state->waiter, {}));
+    }
+  }
+  replies.clear();
+  if (push_waiter) {
+    loop.schedule(std::exchange(push_waiter, {}));
+  }
+}
+
+std::unique_ptr<ClientPool> ClientPool::connect(EventLoop &loop,
+                                                const ClientOptions &options,
+                                                size_t size) {
+  std::vector<std::unique_ptr<Client>> clients;
+  clients.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    auto client = Client::connect(loop, options);
+    if (!client) {
+      return nullptr;
+    }
+    clients.push_back(std::move(client));
+  }
+  return std::unique_ptr<ClientPool>(new ClientPool(std::move(clients)));
+}
+
+Client &ClientPool::next() {
+  Client *best = clients.front().get();
+  for (const auto &client : clients) {
+    if (client->connected() &&
+        (!best->connected() || client->pending() < best->pending())) {
+      best = client.get();
+    }
+  }
+  return *best;
+}
+
+}  // namespace redisxx
@@ -0,0 +1,379 @@
+#pragma once
+#include <poll.h>
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "resp_types.h"
+
+// Asynchronous client for redisxx built on C++20 coroutines:
+//
+//   redisxx::Task<> greet(redisxx::Client &client, std::string key) {
+//     co_await client.set(key, "hello");
+//     const RespValue value = co_await client.get(key);
+//   }
+//   redisxx::EventLoop loop;
+//   auto client = redisxx::Client::connect(loop, {});
+//   loop.run(greet(*client, "greeting"));
+//
+// Commands are pipelined automatically: a command is queued when it is
+// called, and everything the coroutines of one `EventLoop` iteration queued
+// on a connection goes out in a single write. Commands issued before
+// awaiting any of them share a write too, e.g.
+//
+//   auto a = client.get("a");
+//   auto b = client.get("b");
+//   const RespValue first = co_await a;
+//   const RespValue second = co_await b;
+//
+// Replies are `RespValue`s parsed with `parse_reply`; server errors are
+// `RespError`s. Out-of-band RESP3 push frames (Pub/Sub messages,
+// subscription confirmations, key invalidations) are never mistaken for
+// replies, see `Client::next_push`. Everything runs on the thread calling
+// `EventLoop::run`.
+//
+// Build with -Isrc -Iclient and link client/redisxx_client.cc along with the
+// sources the RESP types need: src/resp_parser.cc, src/resp_types.cc,
+// src/compression.cc, src/lzf.cc and src/stats.cc.
+
+namespace redisxx {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+// Resumes the coroutine awaiting a task once it finished.
+struct FinalAwaiter {
+  bool await_ready() const noexcept { return false; }
+  template <typename Promise>
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<Promise> handle) const noexcept {
+    if (const auto continuation = handle.promise().continuation) {
+      return continuation;
+    }
+    return std::noop_coroutine();
+  }
+  void await_resume() const noexcept {}
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+  void rethrow_exception() const {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  std::optional<T> result;
+
+  Task<T> get_return_object();
+  template <typename U>
+  void return_value(U &&value) {
+    result.emplace(std::forward<U>(value));
+  }
+  T take_result() {
+    rethrow_exception();
+    return std::move(*result);
+  }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() {}
+  void take_result() const { rethrow_exception(); }
+};
+
+}  // namespace detail
+
+// Coroutine that starts when it is awaited or handed to an `EventLoop`.
+// Exceptions it doesn't handle are rethrown to whoever awaits it.
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = detail::Promise<T>;
+
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool done() const { return handle.done(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> caller) noexcept {
+    handle.promise().continuation = caller;
+    return handle;
+  }
+  T await_resume() { return handle.promise().take_result(); }
+
+ private:
+  friend promise_type;
+  friend class EventLoop;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+class Client;
+
+// Runs coroutines and the connections they use on the calling thread. Each
+// iteration resumes every coroutine that can make progress, then sends what
+// they queued with one write per connection and waits for replies.
+class EventLoop {
+ public:
+  EventLoop() = default;
+  // Delete copy/move operations
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  EventLoop(EventLoop &&) = delete;
+  EventLoop &operator=(EventLoop &&) = delete;
+
+  // Runs the loop, along with the spawned tasks, until `task` finished and
+  // returns its result.
+  template <typename T>
+  T run(Task<T> task) {
+    schedule(task.handle);
+    run_until(task.handle);
+    return task.handle.promise().take_result();
+  }
+
+  // Runs the loop until every spawned task finished.
+  void run();
+
+  // Runs `task` alongside the others, from the next iteration on.
+  void spawn(Task<> task);
+
+  // Resumes `handle` in the next iteration.
+  void schedule(std::coroutine_handle<> handle) { ready.push_back(handle); }
+
+ private:
+  friend class Client;
+
+  void run_until(std::coroutine_handle<> handle);
+  // One iteration, false if there was nothing to run or wait for.
+  bool iterate();
+  void reap_spawned();
+  // Aborts: awaiting a reply that was never sent, for example.
+  [[noreturn]] void stalled();
+
+  void add(Client *client) { clients.push_back(client); }
+  void remove(Client *client);
+  // Sends `client`'s queued commands at the end of this iteration.
+  void flush_later(Client *client) { unflushed.push_back(client); }
+
+  std::vector<std::coroutine_handle<>> ready;
+  std::vector<std::coroutine_handle<>> resuming;
+  std::vector<Task<>> spawned;
+  std::vector<Client *> clients;
+  std::vector<Client *> unflushed;
+  std::vector<pollfd> polled;
+  std::vector<Client *> polled_clients;
+};
+
+// Where `Client::connect` connects to.
+struct ClientOptions {
+  std::string host = "127.0.0.1";
+  std::string port = "1234";
+  // A Unix domain socket to use instead of TCP, see --unixsocket.
+  std::string unix_socket;
+};
+
+// The reply to one command, await it once.
+class Reply {
+ public:
+  bool await_ready() const noexcept { return state->value.has_value(); }
+  void await_suspend(std::coroutine_handle<> handle) noexcept {
+    state->waiter = handle;
+  }
+  RespValue await_resume() { return std::move(*state->value); }
+
+ private:
+  friend class Client;
+
+  struct State {
+    std::optional<RespValue> value;
+    std::coroutine_handle<> waiter;
+  };
+
+  explicit Reply(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+  std::shared_ptr<State> state;
+};
+
+// The next push frame of a connection, nullopt once it is closed.
+class PushAwaiter {
+ public:
+  bool await_ready() const noexcept;
+  void await_suspend(std::coroutine_handle<> handle) noexcept;
+  std::optional<RespPush> await_resume();
+
+ private:
+  friend class Client;
+
+  explicit PushAwaiter(Client &client) : client(client) {}
+
+  Client &client;
+};
+
+// One connection. Commands on it are answered in order; once it is lost,
+// unanswered and new commands complete with an error.
+class Client {
+ public:
+  // Connects, blocking until it is established. Returns nullptr on failure,
+  // with the reason on stderr.
+  static std::unique_ptr<Client> connect(EventLoop &loop,
+                                         const ClientOptions &options);
+  ~Client();
+  // Delete copy/move operations
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+  Client(Client &&) = delete;
+  Client &operator=(Client &&) = delete;
+
+  // Any command, e.g. `command("HSET", key, field, value)`.
+  template <typename... Arguments>
+    requires(std::convertible_to<const Arguments &, std::string_view> && ...)
+  Reply command(const Arguments &...arguments) {
+    begin_command(sizeof...(arguments));
+    (append_argument(arguments), ...);
+    return expect_reply();
+  }
+  Reply command(std::span<const std::string> arguments);
+
+  Reply ping() { return command("PING"); }
+  Reply get(std::string_view key) { return command("GET", key); }
+  Reply set(std::string_view key, std::string_view value) {
+    return command("SET", key, value);
+  }
+  Reply del(std::string_view key) { return command("DEL", key); }
+  Reply incr(std::string_view key) { return command("INCR", key); }
+  Reply mget(std::span<const std::string> keys);
+  Reply publish(std::string_view channel, std::string_view message) {
+    return command("PUBLISH", channel, message);
+  }
+
+  // Subscription changes are confirmed with push frames, not replies.
+  template <typename... Channels>
+  void subscribe(const Channels &...channels) {
+    begin_command(sizeof...(channels) + 1);
+    append_argument("SUBSCRIBE");
+    (append_argument(channels), ...);
+  }
+  template <typename... Channels>
+  void unsubscribe(const Channels &...channels) {
+    begin_command(sizeof...(channels) + 1);
+    append_argument("UNSUBSCRIBE");
+    (append_argument(channels), ...);
+  }
+
+  // Waits for the next push frame. Frames that arrive while nobody waits are
+  // queued, and only one coroutine may wait at a time.
+  PushAwaiter next_push() { return PushAwaiter(*this); }
+
+  bool connected() const { return fd >= 0; }
+  // Commands sent or queued that weren't answered yet.
+  size_t pending() const { return replies.size(); }
+
+ private:
+  friend class EventLoop;
+  friend class PushAwaiter;
+
+  Client(EventLoop &loop, int fd);
+
+  void begin_command(size_t arguments);
+  void append_argument(std::string_view argument);
+  Reply expect_reply();
+
+  // Whether the event loop has to wait for the socket.
+  bool waiting() const {
+    return connected() && (!replies.empty() || push_waiter || !output.empty());
+  }
+  // Sends as much of `output` as the socket takes.
+  void flush();
+  // Reads and dispatches what arrived.
+  void receive();
+  void dispatch(RespValue value);
+  // Completes what waits for this connection after it is lost.
+  void disconnect();
+
+  EventLoop &loop;
+  int fd;
+  std::string output;
+  std::string input;
+  size_t input_start = 0;
+  std::deque<std::shared_ptr<Reply::State>> replies;
+  std::deque<RespPush> pushes;
+  std::coroutine_handle<> push_waiter;
+};
+
+// Connections to the same server. Commands spread over them are worked on
+// by several of the server's I/O threads, and each connection still
+// pipelines what it gets.
+class ClientPool {
+ public:
+  // Connects `size` clients, nullptr if any of them fails.
+  static std::unique_ptr<ClientPool> connect(EventLoop &loop,
+                                             const ClientOptions &options,
+                                             size_t size);
+
+  // The connected client with the fewest unanswered commands, any client if
+  // all of them are lost.
+  Client &next();
+  size_t size() const { return clients.size(); }
+
+ private:
+  explicit ClientPool(std::vector<std::unique_ptr<Client>> clients)
+      : clients(std::move(clients)) {}
+
+  std::vector<std::unique_ptr<Client>> clients;
+};
+
+}  // namespace redisxx
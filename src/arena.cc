@@ -0,0 +1,54 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena(size_t initial_size) {
+  blocks.push_back(Block{.data = std::make_unique<std::byte[]>(initial_size),
+                         .size = initial_size});
+}
+
+void Arena::reset() {
+  size_t kept = 1;
+  size_t kept_size = blocks.front().size;
+  while (kept < blocks.size() &&
+         kept_size + blocks[kept].size <= retained_size) {
+    kept_size += blocks[kept].size;
+    ++kept;
+  }
+  blocks.resize(kept);
+  current = 0;
+  offset = 0;
+}
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for (const auto& block : blocks) {
+    total += block.size;
+  }
+  return total;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+  while (true) {
+    auto& block = blocks[current];
+    const auto base = reinterpret_cast<uintptr_t>(block.data.get());
+    const uintptr_t aligned = (base + offset + alignment - 1) & ~(alignment - 1);
+    if (aligned + bytes <= base + block.size) {
+      offset = aligned + bytes - base;
+      return reinterpret_cast<void*>(aligned);
+    }
+    if (current + 1 == blocks.size()) {
+      break;
+    }
+    ++current;
+    offset = 0;
+  }
+  // Grow geometrically so a connection needs few blocks in steady state.
+  const size_t size = std::max(blocks.back().size * 2, bytes + alignment);
+  blocks.push_back(
+      Block{.data = std::make_unique<std::byte[]>(size), .size = size});
+  current = blocks.size() - 1;
+  offset = 0;
+  return do_allocate(bytes, alignment);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Monotonic bump allocator for memory that lives as long as one batch of
+// commands. Deallocation is a no-op and `reset` makes all memory available
+// again while keeping the blocks up to `retained_size`, so an arena stops
+// calling the global allocator once it has grown to the connection's working
+// set, but doesn't hold on to the peak of one unusually large batch.
+class Arena : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t retained_size = 64 * 1024;
+
+  explicit Arena(size_t initial_size = 4096);
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Everything allocated before becomes invalid. Frees the blocks beyond
+  // `retained_size`, the first block is always kept.
+  void reset();
+
+  size_t capacity() const;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void*, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept
+      override {
+    return this == &other;
+  }
+
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks;
+  // Block allocations currently come from and the offset into it.
+  size_t current = 0;
+  size_t offset = 0;
+};
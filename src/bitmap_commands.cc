@@ -0,0 +1,553 @@
+#include <string_view>
+#include <vector>
+
+#include "bitops.h"
+#include "commands.h"
+#include "database.h"
+
+// Bitmap commands. All of them work on the string stored in the `Database`
+// in place; nothing is copied out of the keyspace to read or modify it.
+
+namespace {
+
+// Largest addressable bit, same as Redis' 512MB string limit.
+constexpr RespInteger max_bit_offset = (RespInteger{1} << 32) - 1;
+
+std::optional<uint64_t> parse_bit_offset(const RespValue &value) {
+  const auto offset = parse_integer(value);
+  if (!offset || *offset < 0 || *offset > max_bit_offset) {
+    return std::nullopt;
+  }
+  return *offset;
+}
+
+bool get_bit(const RespString &str, uint64_t offset) {
+  const uint64_t byte = offset >> 3;
+  if (byte >= str.size()) {
+    return false;
+  }
+  return (static_cast<uint8_t>(str[byte]) >> (7 - (offset & 7))) & 1;
+}
+
+void set_bit(RespString &str, uint64_t offset, bool bit) {
+  const uint64_t byte = offset >> 3;
+  if (byte >= str.size()) {
+    str.resize(byte + 1, '\0');
+  }
+  const uint8_t mask = 1 << (7 - (offset & 7));
+  auto &target = reinterpret_cast<uint8_t &>(str[byte]);
+  target = bit ? (target | mask) : (target & ~mask);
+}
+
+// Resolves a Redis style inclusive [start, end] range that may count from the
+// end of a sequence of `length` elements. Returns nullopt if it is empty.
+std::optional<std::pair<uint64_t, uint64_t>> resolve_range(RespInteger start,
+                                                           RespInteger end,
+                                                           RespInteger length) {
+  if (start < 0) {
+    start += length;
+  }
+  if (end < 0) {
+    end += length;
+  }
+  start = std::max<RespInteger>(start, 0);
+  end = std::min<RespInteger>(end, length - 1);
+  if (length == 0 || end < 0 || start > end) {
+    return std::nullopt;
+  }
+  return std::make_pair(start, end);
+}
+
+enum class RangeUnit { Byte, Bit };
+
+std::optional<RangeUnit> parse_range_unit(const RespValue &value) {
+  const auto unit = to_lower(value.to_string());
+  if (unit == "byte") {
+    return RangeUnit::Byte;
+  }
+  if (unit == "bit") {
+    return RangeUnit::Bit;
+  }
+  return std::nullopt;
+}
+
+// Counts the set bits in the inclusive bit range [first, last].
+uint64_t count_bits_in_range(const uint8_t *data, uint64_t first,
+                             uint64_t last) {
+  const uint64_t first_byte = first >> 3;
+  const uint64_t last_byte = last >> 3;
+  uint64_t count = bit_count(data + first_byte, last_byte - first_byte + 1);
+  const uint8_t leading_mask = 0xff00 >> (first & 7);
+  const uint8_t trailing_mask = (1u << (7 - (last & 7))) - 1;
+  count -= __builtin_popcount(data[first_byte] & leading_mask);
+  count -= __builtin_popcount(data[last_byte] & trailing_mask);
+  return count;
+}
+
+// Position of the first bit equal to `bit` in the inclusive bit range
+// [first, last].
+std::optional<uint64_t> find_bit_in_range(const RespString &str,
+                                          uint64_t first, uint64_t last,
+                                          bool bit) {
+  const auto *data = reinterpret_cast<const uint8_t *>(str.data());
+  uint64_t pos = first;
+  for (; pos <= last && (pos & 7); ++pos) {
+    if (get_bit(str, pos) == bit) {
+      return pos;
+    }
+  }
+  const uint64_t full_bytes_end = (last + 1) >> 3;
+  if (pos <= last && (pos >> 3) < full_bytes_end) {
+    const auto found =
+        bit_position(data + (pos >> 3), full_bytes_end - (pos >> 3), bit);
+    if (found) {
+      return pos + *found;
+    }
+    pos = full_bytes_end << 3;
+  }
+  for (; pos <= last; ++pos) {
+    if (get_bit(str, pos) == bit) {
+      return pos;
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+RespValue handle_setbit(const RespArray &arguments) {
+  if (arguments.size() != 3) {
+    return RespValue::make_error("ERR wrong number of arguments for SETBIT");
+  }
+  const auto offset = parse_bit_offset(arguments[1]);
+  if (!offset) {
+    return RespValue::make_error(
+        "ERR bit offset is not an integer or out of range");
+  }
+  const auto bit = parse_integer(arguments[2]);
+  if (!bit || (*bit != 0 && *bit != 1)) {
+    return RespValue::make_error("ERR bit is not an integer or out of range");
+  }
+  auto &value = Database::instance().find_or_insert(arguments[0].to_string(),
+                                                    RespValue::make_string(""));
+  auto *str = value.string_in_place();
+  if (!str) {
+    return wrong_type_error();
+  }
+  const bool old_bit = get_bit(*str, *offset);
+  set_bit(*str, *offset, *bit);
+  Database::instance().signal_modified(arguments[0].to_string());
+  return RespValue::make_integer(old_bit);
+}
+CommandRegistrar _handle_setbit("setbit", handle_setbit,
+                                CommandAccess::Write, KeySpec{1, 1, 1});
+
+RespValue handle_getbit(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for GETBIT");
+  }
+  const auto offset = parse_bit_offset(arguments[1]);
+  if (!offset) {
+    return RespValue::make_error(
+        "ERR bit offset is not an integer or out of range");
+  }
+  const auto *value = Database::instance().lookup(arguments[0].to_string());
+  if (!value) {
+    return RespValue::make_integer(0);
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  return RespValue::make_integer(get_bit(*str, *offset));
+}
+CommandRegistrar _handle_getbit("getbit", handle_getbit,
+                                CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+RespValue handle_bitcount(const RespArray &arguments) {
+  if (arguments.size() != 1 && arguments.size() != 3 &&
+      arguments.size() != 4) {
+    return RespValue::make_error("ERR wrong number of arguments for BITCOUNT");
+  }
+  std::optional<RespInteger> start = 0;
+  std::optional<RespInteger> end = -1;
+  RangeUnit unit = RangeUnit::Byte;
+  if (arguments.size() > 1) {
+    start = parse_integer(arguments[1]);
+    end = parse_integer(arguments[2]);
+    if (!start || !end) {
+      return RespValue::make_error(
+          "ERR value is not an integer or out of range");
+    }
+  }
+  if (arguments.size() == 4) {
+    const auto parsed_unit = parse_range_unit(arguments[3]);
+    if (!parsed_unit) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    unit = *parsed_unit;
+  }
+  const auto *value = Database::instance().lookup(arguments[0].to_string());
+  if (!value) {
+    return RespValue::make_integer(0);
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  const auto *data = reinterpret_cast<const uint8_t *>(str->data());
+  const RespInteger length =
+      static_cast<RespInteger>(str->size()) * (unit == RangeUnit::Bit ? 8 : 1);
+  const auto range = resolve_range(*start, *end, length);
+  if (!range) {
+    return RespValue::make_integer(0);
+  }
+  if (unit == RangeUnit::Byte) {
+    return RespValue::make_integer(
+        bit_count(data + range->first, range->second - range->first + 1));
+  }
+  return RespValue::make_integer(
+      count_bits_in_range(data, range->first, range->second));
+}
+CommandRegistrar _handle_bitcount("bitcount", handle_bitcount,
+                                  CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+RespValue handle_bitpos(const RespArray &arguments) {
+  if (arguments.size() < 2 || arguments.size() > 5) {
+    return RespValue::make_error("ERR wrong number of arguments for BITPOS");
+  }
+  const auto bit = parse_integer(arguments[1]);
+  if (!bit || (*bit != 0 && *bit != 1)) {
+    return RespValue::make_error("ERR The bit argument must be 1 or 0.");
+  }
+  std::optional<RespInteger> start = 0;
+  std::optional<RespInteger> end = -1;
+  const bool end_given = arguments.size() >= 4;
+  RangeUnit unit = RangeUnit::Byte;
+  if (arguments.size() >= 3) {
+    start = parse_integer(arguments[2]);
+  }
+  if (end_given) {
+    end = parse_integer(arguments[3]);
+  }
+  if (!start || !end) {
+    return RespValue::make_error("ERR value is not an integer or out of range");
+  }
+  if (arguments.size() == 5) {
+    const auto parsed_unit = parse_range_unit(arguments[4]);
+    if (!parsed_unit) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    unit = *parsed_unit;
+  }
+  const auto *value = Database::instance().lookup(arguments[0].to_string());
+  if (!value) {
+    return RespValue(RespInteger(*bit ? -1 : 0));
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  const RespInteger length =
+      static_cast<RespInteger>(str->size()) * (unit == RangeUnit::Bit ? 8 : 1);
+  const auto range = resolve_range(*start, *end, length);
+  if (!range) {
+    return RespValue(RespInteger(-1));
+  }
+  auto [first, last] = *range;
+  if (unit == RangeUnit::Byte) {
+    first *= 8;
+    last = last * 8 + 7;
+  }
+  const auto found = find_bit_in_range(*str, first, last, *bit);
+  if (found) {
+    return RespValue(RespInteger(*found));
+  }
+  // Looking for a clear bit without an explicit end: the string is treated as
+  // padded with zeros on the right.
+  if (!*bit && !end_given) {
+    return RespValue(RespInteger(str->size() * 8));
+  }
+  return RespValue(RespInteger(-1));
+}
+CommandRegistrar _handle_bitpos("bitpos", handle_bitpos,
+                                CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+RespValue handle_bitop(const RespArray &arguments) {
+  if (arguments.size() < 3) {
+    return RespValue::make_error("ERR wrong number of arguments for BITOP");
+  }
+  const auto op_name = to_lower(arguments[0].to_string());
+  BitOp op;
+  if (op_name == "and") {
+    op = BitOp::And;
+  } else if (op_name == "or") {
+    op = BitOp::Or;
+  } else if (op_name == "xor") {
+    op = BitOp::Xor;
+  } else if (op_name == "not") {
+    op = BitOp::Not;
+  } else {
+    return RespValue::make_error("ERR syntax error");
+  }
+  if (op == BitOp::Not && arguments.size() != 3) {
+    return RespValue::make_error(
+        "ERR BITOP NOT must be called with a single source key.");
+  }
+  auto &db = Database::instance();
+  std::vector<std::string_view> sources;
+  sources.reserve(arguments.size() - 2);
+  // Integer values are rendered here, the views into them have to stay valid.
+  std::vector<RespString> scratch(arguments.size() - 2);
+  size_t length = 0;
+  for (size_t i = 2; i < arguments.size(); ++i) {
+    const auto *value = db.lookup(arguments[i].to_string());
+    if (!value) {
+      sources.emplace_back();
+      continue;
+    }
+    const auto *str = value->read_string(scratch[i - 2]);
+    if (!str) {
+      return wrong_type_error();
+    }
+    sources.emplace_back(*str);
+    length = std::max(length, str->size());
+  }
+  const auto dest = arguments[1].to_string();
+  if (length == 0) {
+    db.erase(dest);
+    return RespValue::make_integer(0);
+  }
+  RespString result(length, '\0');
+  bit_op(op, reinterpret_cast<uint8_t *>(result.data()), length, sources);
+  // BITOP replaces the destination, including any TTL it had.
+  db.erase(dest);
+  db.set(dest, RespValue::make_string(std::move(result)), std::nullopt);
+  return RespValue::make_integer(length);
+}
+CommandRegistrar _handle_bitop("bitop", handle_bitop,
+                               CommandAccess::Write, KeySpec{2, -1, 1});
+
+namespace {
+
+struct BitfieldType {
+  bool is_signed;
+  int bits;
+};
+
+std::optional<BitfieldType> parse_bitfield_type(const RespValue &value) {
+  const auto str = to_lower(value.to_string());
+  if (str.size() < 2 || (str[0] != 'i' && str[0] != 'u')) {
+    return std::nullopt;
+  }
+  const auto bits = parse_integer(RespValue::make_string(str.substr(1)));
+  const bool is_signed = str[0] == 'i';
+  if (!bits || *bits < 1 || *bits > (is_signed ? 64 : 63)) {
+    return std::nullopt;
+  }
+  return BitfieldType{.is_signed = is_signed, .bits = static_cast<int>(*bits)};
+}
+
+// Offsets prefixed with `#` are multiplied by the field width.
+std::optional<uint64_t> parse_bitfield_offset(const RespValue &value,
+                                              int bits) {
+  const auto str = value.to_string();
+  const bool scaled = !str.empty() && str[0] == '#';
+  const auto offset = parse_integer(
+      RespValue::make_string(scaled ? str.substr(1) : str));
+  if (!offset || *offset < 0) {
+    return std::nullopt;
+  }
+  const uint64_t result = scaled ? *offset * bits : *offset;
+  if (result + bits - 1 > static_cast<uint64_t>(max_bit_offset)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+enum class Overflow { Wrap, Sat, Fail };
+
+int64_t read_field(const RespString &str, uint64_t offset, BitfieldType type) {
+  uint64_t value = 0;
+  for (int i = 0; i < type.bits; ++i) {
+    value = (value << 1) | get_bit(str, offset + i);
+  }
+  if (type.is_signed && type.bits < 64 && (value >> (type.bits - 1)) & 1) {
+    value |= ~uint64_t{0} << type.bits;
+  }
+  return static_cast<int64_t>(value);
+}
+
+void write_field(RespString &str, uint64_t offset, BitfieldType type,
+                 int64_t value) {
+  const auto bits = static_cast<uint64_t>(value);
+  for (int i = 0; i < type.bits; ++i) {
+    set_bit(str, offset + i, (bits >> (type.bits - 1 - i)) & 1);
+  }
+}
+
+// Fits `value` into the field type according to `overflow`. Returns nullopt
+// if the value overflows and the policy is FAIL.
+std::optional<int64_t> fit_field(__int128 value, BitfieldType type,
+                                 Overflow overflow) {
+  const __int128 min =
+      type.is_signed ? -(static_cast<__int128>(1) << (type.bits - 1)) : 0;
+  const __int128 max = type.is_signed
+                           ? (static_cast<__int128>(1) << (type.bits - 1)) - 1
+                           : (static_cast<__int128>(1) << type.bits) - 1;
+  if (value >= min && value <= max) {
+    return static_cast<int64_t>(value);
+  }
+  switch (overflow) {
+    case Overflow::Fail:
+      return std::nullopt;
+    case Overflow::Sat:
+      return static_cast<int64_t>(value < min ? min : max);
+    case Overflow::Wrap: {
+      const unsigned __int128 mask =
+          (static_cast<unsigned __int128>(1) << type.bits) - 1;
+      auto wrapped = static_cast<uint64_t>(value & mask);
+      if (type.is_signed && type.bits < 64 &&
+          (wrapped >> (type.bits - 1)) & 1) {
+        wrapped |= ~uint64_t{0} << type.bits;
+      }
+      return static_cast<int64_t>(wrapped);
+    }
+  }
+  return std::nullopt;
+}
+
+struct BitfieldOp {
+  enum class Kind { Get, Set, Incrby } kind;
+  BitfieldType type;
+  uint64_t offset;
+  int64_t argument = 0;
+  Overflow overflow = Overflow::Wrap;
+};
+
+}  // namespace
+
+RespValue handle_bitfield(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for BITFIELD");
+  }
+  // Parse the whole command first so nothing is modified on a syntax error.
+  std::vector<BitfieldOp> ops;
+  Overflow overflow = Overflow::Wrap;
+  bool writes = false;
+  for (size_t i = 1; i < arguments.size();) {
+    const auto sub = to_lower(arguments[i].to_string());
+    if (sub == "overflow") {
+      if (i + 1 >= arguments.size()) {
+        return RespValue::make_error("ERR syntax error");
+      }
+      const auto policy = to_lower(arguments[i + 1].to_string());
+      if (policy == "wrap") {
+        overflow = Overflow::Wrap;
+      } else if (policy == "sat") {
+        overflow = Overflow::Sat;
+      } else if (policy == "fail") {
+        overflow = Overflow::Fail;
+      } else {
+        return RespValue::make_error("ERR Invalid OVERFLOW type specified");
+      }
+      i += 2;
+      continue;
+    }
+    BitfieldOp op{};
+    size_t arity;
+    if (sub == "get") {
+      op.kind = BitfieldOp::Kind::Get;
+      arity = 3;
+    } else if (sub == "set") {
+      op.kind = BitfieldOp::Kind::Set;
+      arity = 4;
+    } else if (sub == "incrby") {
+      op.kind = BitfieldOp::Kind::Incrby;
+      arity = 4;
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+    if (i + arity > arguments.size()) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    const auto type = parse_bitfield_type(arguments[i + 1]);
+    if (!type) {
+      return RespValue::make_error(
+          "ERR Invalid bitfield type. Use something like i16 u8. Note that "
+          "u64 is not supported but i64 is.");
+    }
+    const auto offset = parse_bitfield_offset(arguments[i + 2], type->bits);
+    if (!offset) {
+      return RespValue::make_error(
+          "ERR bit offset is not an integer or out of range");
+    }
+    if (arity == 4) {
+      const auto argument = parse_integer(arguments[i + 3]);
+      if (!argument) {
+        return RespValue::make_error(
+            "ERR value is not an integer or out of range");
+      }
+      op.argument = *argument;
+      writes = true;
+    }
+    op.type = *type;
+    op.offset = *offset;
+    op.overflow = overflow;
+    ops.push_back(op);
+    i += arity;
+  }
+
+  if (writes && refuses_writes()) {
+    return readonly_error();
+  }
+  auto &db = Database::instance();
+  const auto key = arguments[0].to_string();
+  static const RespString empty;
+  RespString scratch;
+  RespString *str = nullptr;
+  const RespString *current = &empty;
+  if (writes) {
+    str = db.find_or_insert(key, RespValue::make_string("")).string_in_place();
+    current = str;
+  } else if (const auto *value = db.lookup(key)) {
+    current = value->read_string(scratch);
+  }
+  if (!current) {
+    return wrong_type_error();
+  }
+
+  RespArray results;
+  results.reserve(ops.size());
+  bool modified = false;
+  for (const auto &op : ops) {
+    const int64_t old_value = read_field(*current, op.offset, op.type);
+    if (op.kind == BitfieldOp::Kind::Get) {
+      results.push_back(RespValue(RespInteger(old_value)));
+      continue;
+    }
+    const __int128 target =
+        op.kind == BitfieldOp::Kind::Set
+            ? static_cast<__int128>(op.argument)
+            : static_cast<__int128>(old_value) + op.argument;
+    const auto fitted = fit_field(target, op.type, op.overflow);
+    if (!fitted) {
+      results.push_back(RespValue::make_null());
+      continue;
+    }
+    write_field(*str, op.offset, op.type, *fitted);
+    modified = true;
+    results.push_back(RespValue(RespInteger(
+        op.kind == BitfieldOp::Kind::Set ? old_value : *fitted)));
+  }
+  if (modified) {
+    db.signal_modified(key);
+  }
+  return RespValue::make_array(std::move(results));
+}
+// Only SET and INCRBY write, replicas serve GET.
+CommandRegistrar _handle_bitfield("bitfield", handle_bitfield,
+                                  CommandAccess::MayWrite, KeySpec{1, 1, 1});
@@ -0,0 +1,208 @@
+#include "bitops.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+size_t bit_count_scalar(const uint8_t *data, size_t len) {
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    uint64_t words[4];
+    std::memcpy(words, data + i, sizeof(words));
+    count += __builtin_popcountll(words[0]) + __builtin_popcountll(words[1]) +
+             __builtin_popcountll(words[2]) + __builtin_popcountll(words[3]);
+  }
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < len; ++i) {
+    count += __builtin_popcount(data[i]);
+  }
+  return count;
+}
+
+// Per-byte counters in the vector loops can count at most 8 bits per
+// iteration, so they are folded into wide lanes every 31 iterations before
+// they can overflow.
+constexpr size_t max_inner_iterations = 255 / 8;
+
+template <BitOp op>
+inline uint64_t apply_word(uint64_t a, uint64_t b) {
+  if constexpr (op == BitOp::And) {
+    return a & b;
+  } else if constexpr (op == BitOp::Or) {
+    return a | b;
+  } else if constexpr (op == BitOp::Xor) {
+    return a ^ b;
+  } else {
+    return ~b;
+  }
+}
+
+// dst[i] = dst[i] `op` src[i] for i in [0, len). For `Not`, dst[i] = ~src[i].
+template <BitOp op>
+void combine(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i r;
+    if constexpr (op == BitOp::And) {
+      r = _mm256_and_si256(a, b);
+    } else if constexpr (op == BitOp::Or) {
+      r = _mm256_or_si256(a, b);
+    } else if constexpr (op == BitOp::Xor) {
+      r = _mm256_xor_si256(a, b);
+    } else {
+      r = _mm256_xor_si256(b, _mm256_set1_epi8(-1));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), r);
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    const uint8x16_t a = vld1q_u8(dst + i);
+    const uint8x16_t b = vld1q_u8(src + i);
+    uint8x16_t r;
+    if constexpr (op == BitOp::And) {
+      r = vandq_u8(a, b);
+    } else if constexpr (op == BitOp::Or) {
+      r = vorrq_u8(a, b);
+    } else if constexpr (op == BitOp::Xor) {
+      r = veorq_u8(a, b);
+    } else {
+      r = vmvnq_u8(b);
+    }
+    vst1q_u8(dst + i, r);
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    uint64_t a, b;
+    std::memcpy(&a, dst + i, sizeof(a));
+    std::memcpy(&b, src + i, sizeof(b));
+    a = apply_word<op>(a, b);
+    std::memcpy(dst + i, &a, sizeof(a));
+  }
+  for (; i < len; ++i) {
+    dst[i] = static_cast<uint8_t>(apply_word<op>(dst[i], src[i]));
+  }
+}
+
+template <BitOp op>
+void fold_sources(uint8_t *dest, size_t len,
+                  std::span<const std::string_view> sources) {
+  const auto &first = sources.front();
+  std::memcpy(dest, first.data(), first.size());
+  std::memset(dest + first.size(), 0, len - first.size());
+  for (const auto &source : sources.subspan(1)) {
+    combine<op>(dest, reinterpret_cast<const uint8_t *>(source.data()),
+                source.size());
+    if constexpr (op == BitOp::And) {
+      // Missing bytes of a shorter source are zero.
+      std::memset(dest + source.size(), 0, len - source.size());
+    }
+  }
+}
+
+}  // namespace
+
+size_t bit_count(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  size_t count = 0;
+#if defined(__AVX2__)
+  // Nibble lookup popcount (Mula et al.), summed with `vpsadbw`.
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  const size_t vector_end = len - len % 32;
+  while (i < vector_end) {
+    __m256i acc = _mm256_setzero_si256();
+    const size_t block_end = std::min(vector_end, i + max_inner_iterations * 32);
+    for (; i < block_end; i += 32) {
+      const __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      const __m256i lo = _mm256_and_si256(v, low_mask);
+      const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+      acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lookup, lo));
+      acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lookup, hi));
+    }
+    total = _mm256_add_epi64(total,
+                             _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+  }
+  count += _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+           _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+#elif defined(__ARM_NEON)
+  uint64x2_t total = vdupq_n_u64(0);
+  const size_t vector_end = len - len % 16;
+  while (i < vector_end) {
+    uint8x16_t acc = vdupq_n_u8(0);
+    const size_t block_end = std::min(vector_end, i + max_inner_iterations * 16);
+    for (; i < block_end; i += 16) {
+      acc = vaddq_u8(acc, vcntq_u8(vld1q_u8(data + i)));
+    }
+    total = vpadalq_u32(total, vpaddlq_u16(vpaddlq_u8(acc)));
+  }
+  count += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+  return count + bit_count_scalar(data + i, len - i);
+}
+
+void bit_op(BitOp op, uint8_t *dest, size_t len,
+            std::span<const std::string_view> sources) {
+  if (sources.empty()) {
+    std::memset(dest, 0, len);
+    return;
+  }
+  switch (op) {
+    case BitOp::And:
+      fold_sources<BitOp::And>(dest, len, sources);
+      break;
+    case BitOp::Or:
+      fold_sources<BitOp::Or>(dest, len, sources);
+      break;
+    case BitOp::Xor:
+      fold_sources<BitOp::Xor>(dest, len, sources);
+      break;
+    case BitOp::Not: {
+      const auto &source = sources.front();
+      combine<BitOp::Not>(dest, reinterpret_cast<const uint8_t *>(source.data()),
+                          source.size());
+      std::memset(dest + source.size(), 0xff, len - source.size());
+      break;
+    }
+  }
+}
+
+std::optional<size_t> bit_position(const uint8_t *data, size_t len, bool bit) {
+  // Whole words that cannot contain the bit are skipped.
+  const uint64_t skip = bit ? 0 : ~uint64_t{0};
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    if (word != skip) {
+      break;
+    }
+  }
+  for (; i < len; ++i) {
+    const unsigned byte = bit ? data[i] : static_cast<uint8_t>(~data[i]);
+    if (byte) {
+      return i * 8 + (__builtin_clz(byte) - 24);
+    }
+  }
+  return std::nullopt;
+}
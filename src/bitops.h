@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+// Bit-level kernels over byte buffers used by the bitmap commands. Bits are
+// numbered like Redis does it: bit 0 is the most significant bit of byte 0.
+
+enum class BitOp { And, Or, Xor, Not };
+
+// Number of set bits in `data`.
+size_t bit_count(const uint8_t *data, size_t len);
+
+// Computes `op` over `sources` into `dest`, which must hold `len` bytes.
+// Sources shorter than `len` are treated as zero padded. `Not` takes exactly
+// one source.
+void bit_op(BitOp op, uint8_t *dest, size_t len,
+            std::span<const std::string_view> sources);
+
+// Position of the first bit equal to `bit` in `data`, if any.
+std::optional<size_t> bit_position(const uint8_t *data, size_t len, bool bit);
@@ -0,0 +1,171 @@
+#include "capture.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "log.h"
+
+namespace {
+
+// How often the writer flushes the buffer.
+constexpr auto flush_interval = std::chrono::milliseconds(10);
+
+constexpr uint64_t max_arguments = 1 << 20;
+constexpr uint64_t max_argument_length = uint64_t{1} << 32;
+
+void append_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+bool write_all(int fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    const ssize_t written = write(fd, bytes.data(), bytes.size());
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    bytes.remove_prefix(written);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Capture::start(const std::string &path) {
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(Error) << "Failed to open capture file " << path << ": "
+               << strerror(errno);
+    return false;
+  }
+  if (!write_all(fd, magic)) {
+    LOG(Error) << "Failed to write capture file " << path << ": "
+               << strerror(errno);
+    return false;
+  }
+  last_record = std::chrono::steady_clock::now();
+  writer = std::thread([this] { run(); });
+  active.store(true, std::memory_order_relaxed);
+  LOG(Info) << "Capturing commands to " << path;
+  return true;
+}
+
+Capture::~Capture() {
+  if (!writer.joinable()) {
+    return;
+  }
+  active.store(false, std::memory_order_relaxed);
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  writer.join();
+  close(fd);
+}
+
+void Capture::record(uint64_t connection,
+                     std::span<const std::string_view> command) {
+  std::lock_guard lock(mutex);
+  if (pending.size() >= max_pending_bytes) {
+    ++dropped;
+    return;
+  }
+  // Taken under the lock, so deltas are never negative.
+  const auto now = std::chrono::steady_clock::now();
+  const auto delta =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - last_record);
+  // Carry the remainder over instead of losing it to truncation.
+  last_record += delta;
+  append_varint(pending, delta.count());
+  append_varint(pending, connection);
+  append_varint(pending, command.size());
+  for (const auto argument : command) {
+    append_varint(pending, argument.size());
+    pending += argument;
+  }
+}
+
+void Capture::run() {
+  std::string buffer;
+  bool failed = false;
+  while (true) {
+    uint64_t newly_dropped;
+    bool stop;
+    {
+      std::unique_lock lock(mutex);
+      wake.wait_for(lock, flush_interval);
+      buffer.swap(pending);
+      newly_dropped = std::exchange(dropped, 0);
+      stop = stopping;
+    }
+    if (newly_dropped) {
+      LOG(Warning) << "Capture dropped " << newly_dropped
+                   << " commands, the writer is falling behind";
+    }
+    if (!failed && !write_all(fd, buffer)) {
+      LOG(Error) << "Failed to write capture: " << strerror(errno);
+      failed = true;
+    }
+    buffer.clear();
+    if (stop) {
+      return;
+    }
+  }
+}
+
+bool CaptureReader::open(const std::string &path) {
+  in.open(path, std::ios::binary);
+  std::string header(Capture::magic.size(), '\0');
+  return in.read(header.data(), header.size()) && header == Capture::magic;
+}
+
+std::optional<uint64_t> CaptureReader::read_varint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int byte = in.get();
+    if (byte == std::ifstream::traits_type::eof()) {
+      return std::nullopt;
+    }
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<CaptureReader::Record> CaptureReader::next() {
+  const auto delta = read_varint();
+  const auto connection = read_varint();
+  const auto argc = read_varint();
+  // Bound what a corrupt file makes us allocate.
+  if (!delta || !connection || !argc || *argc > max_arguments) {
+    return std::nullopt;
+  }
+  Record record{.delta = std::chrono::microseconds(*delta),
+                .connection = *connection,
+                .command = {}};
+  record.command.resize(*argc);
+  for (auto &argument : record.command) {
+    const auto length = read_varint();
+    if (!length || *length > max_argument_length) {
+      return std::nullopt;
+    }
+    argument.resize(*length);
+    if (!in.read(argument.data(), *length)) {
+      return std::nullopt;
+    }
+  }
+  return record;
+}
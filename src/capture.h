@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Records the commands the server executes to a file, for replay with
+// bench/redisxx_replay.cc. Commands are appended to an in-memory buffer
+// under a short lock and a background thread writes it out, so recording
+// never waits for the disk. While the writer falls behind by more than
+// `max_pending_bytes` commands are dropped and counted.
+//
+// File format, every integer an unsigned LEB128 varint:
+//
+//   "RDXCAP01"
+//   per command: delta_us connection argc (length bytes){argc}
+//
+// `delta_us` is the time since the previous command, or since the capture
+// started for the first one, and `connection` the server's `Connection::id`.
+class Capture {
+ public:
+  static Capture& instance() {
+    static Capture instance;
+    return instance;
+  }
+
+  static constexpr std::string_view magic = "RDXCAP01";
+  static constexpr size_t max_pending_bytes = 64 << 20;
+
+  // Creates or truncates `path` and starts recording.
+  bool start(const std::string& path);
+  bool enabled() const { return active.load(std::memory_order_relaxed); }
+  // Any thread. `command` holds the name and the arguments.
+  void record(uint64_t connection, std::span<const std::string_view> command);
+
+ private:
+  Capture() = default;
+  // Writes what is still buffered and closes the file.
+  ~Capture();
+  // Delete copy/move operations
+  Capture(const Capture&) = delete;
+  Capture& operator=(const Capture&) = delete;
+  Capture(Capture&&) = delete;
+  Capture& operator=(Capture&&) = delete;
+
+  void run();
+
+  std::atomic<bool> active{false};
+  int fd = -1;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::string pending;
+  std::chrono::steady_clock::time_point last_record;
+  uint64_t dropped = 0;
+  bool stopping = false;
+  std::thread writer;
+};
+
+// Reads the commands of a capture file in order.
+class CaptureReader {
+ public:
+  struct Record {
+    std::chrono::microseconds delta;
+    uint64_t connection;
+    std::vector<std::string> command;
+  };
+
+  // Opens `path` and checks its header.
+  bool open(const std::string& path);
+  // The next command, nullopt at the end of the file or if it is truncated.
+  std::optional<Record> next();
+
+ private:
+  std::optional<uint64_t> read_varint();
+
+  std::ifstream in;
+};
@@ -0,0 +1,311 @@
+#include "cluster.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "commands.h"
+#include "database.h"
+#include "log.h"
+#include "replication.h"
+
+namespace {
+
+// CRC16-CCITT (XModem), the variant Redis Cluster uses.
+constexpr std::array<uint16_t, 256> make_crc16_table() {
+  std::array<uint16_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint16_t crc = i << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+constexpr auto crc16_table = make_crc16_table();
+
+uint16_t crc16(std::string_view bytes) {
+  uint16_t crc = 0;
+  for (const unsigned char c : bytes) {
+    crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ c) & 0xff];
+  }
+  return crc;
+}
+
+// 40 hex digits like a Redis node ID, derived from the endpoint with FNV-1a
+// so every node computes the same ID for it.
+std::string node_id(const std::string &host, int port) {
+  static constexpr char digits[] = "0123456789abcdef";
+  const auto endpoint = host + ":" + std::to_string(port);
+  std::string id;
+  for (uint64_t seed = 0; id.size() < 40; ++seed) {
+    uint64_t hash = 0xcbf29ce484222325 ^ seed;
+    for (const unsigned char c : endpoint) {
+      hash = (hash ^ c) * 0x100000001b3;
+    }
+    for (int i = 0; i < 16 && id.size() < 40; ++i, hash >>= 4) {
+      id += digits[hash & 0xf];
+    }
+  }
+  return id;
+}
+
+bool send_all(int fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    const ssize_t sent = send(fd, bytes.data(), bytes.size(), 0);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes.remove_prefix(sent);
+  }
+  return true;
+}
+
+void append_command(std::string &out,
+                    std::initializer_list<std::string_view> command) {
+  out += '*' + std::to_string(command.size()) + "\r\n";
+  for (const auto argument : command) {
+    out += '$' + std::to_string(argument.size()) + "\r\n";
+    out += argument;
+    out += "\r\n";
+  }
+}
+
+}  // namespace
+
+uint16_t key_hash_slot(std::string_view key) {
+  if (const auto open = key.find('{'); open != std::string_view::npos) {
+    const auto close = key.find('}', open + 1);
+    if (close != std::string_view::npos && close > open + 1) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+  return crc16(key) & (cluster_slots - 1);
+}
+
+Cluster::Cluster() {
+  for (size_t slot = 0; slot < cluster_slots; ++slot) {
+    store(owners[slot], std::nullopt);
+    store(migrating_to[slot], std::nullopt);
+    store(importing_from[slot], std::nullopt);
+  }
+}
+
+void Cluster::enable(std::string host, int port) {
+  is_enabled = true;
+  Database::instance().enable_slot_index();
+  meet(host, port);
+  LOG(Info) << "Cluster mode, node " << nodes[self].id << " at " << host
+            << ":" << port;
+}
+
+std::optional<size_t> Cluster::meet(const std::string &host, int port) {
+  const auto id = node_id(host, port);
+  if (const auto known = find_node(id)) {
+    return known;
+  }
+  const size_t index = known_nodes.load(std::memory_order_relaxed);
+  if (index == max_nodes) {
+    return std::nullopt;
+  }
+  nodes[index] = Node{.id = id, .host = host, .port = port};
+  known_nodes.store(index + 1, std::memory_order_release);
+  return index;
+}
+
+std::optional<size_t> Cluster::find_node(std::string_view id) const {
+  const size_t count = node_count();
+  for (size_t i = 0; i < count; ++i) {
+    if (nodes[i].id == id) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::pair<uint16_t, uint16_t>> Cluster::slot_ranges(
+    size_t node) const {
+  std::vector<std::pair<uint16_t, uint16_t>> ranges;
+  for (size_t slot = 0; slot < cluster_slots; ++slot) {
+    if (owner(slot) != node) {
+      continue;
+    }
+    if (!ranges.empty() && size_t{ranges.back().second} + 1 == slot) {
+      ranges.back().second = slot;
+    } else {
+      ranges.emplace_back(slot, slot);
+    }
+  }
+  return ranges;
+}
+
+std::optional<RespValue> Cluster::check(const CommandView &command,
+                                        bool asking) const {
+  const auto *keys = CommandRegistry::instance().key_spec(command.front());
+  if (!keys || keys->first == 0) {
+    return std::nullopt;
+  }
+  const int argc = static_cast<int>(command.size());
+  const int last = keys->last < 0 ? argc + keys->last : keys->last;
+  std::optional<uint16_t> slot;
+  for (int i = keys->first; i <= last && i < argc; i += keys->step) {
+    const auto key_slot = key_hash_slot(command[i]);
+    if (slot && *slot != key_slot) {
+      return RespValue::make_error(
+          "CROSSSLOT Keys in request don't hash to the same slot");
+    }
+    slot = key_slot;
+  }
+  if (!slot) {
+    return std::nullopt;
+  }
+  const auto served_by = owner(*slot);
+  if (served_by == self) {
+    const auto target = migrating(*slot);
+    if (!target) {
+      return std::nullopt;
+    }
+    // Keys that already moved are only found at the target.
+    auto &db = Database::instance();
+    size_t missing = 0;
+    size_t total = 0;
+    for (int i = keys->first; i <= last && i < argc; i += keys->step) {
+      ++total;
+      missing += db.peek(std::string(command[i])) ? 0 : 1;
+    }
+    if (missing == 0) {
+      return std::nullopt;
+    }
+    if (missing < total) {
+      return RespValue::make_error(
+          "TRYAGAIN Multiple keys request during rehashing of slot");
+    }
+    const auto &node = nodes[*target];
+    return RespValue::make_error("ASK " + std::to_string(*slot) + " " +
+                                 node.host + ":" + std::to_string(node.port));
+  }
+  if (asking && importing(*slot)) {
+    return std::nullopt;
+  }
+  if (!served_by) {
+    return RespValue::make_error("CLUSTERDOWN Hash slot not served");
+  }
+  const auto &node = nodes[*served_by];
+  return RespValue::make_error("MOVED " + std::to_string(*slot) + " " +
+                               node.host + ":" + std::to_string(node.port));
+}
+
+RespValue Cluster::migrate(const std::string &host, int port,
+                           const std::vector<std::string> &keys,
+                           std::chrono::milliseconds timeout, bool copy) {
+  auto &db = Database::instance();
+  // ASKING lets the target accept keys of a slot it is still importing.
+  std::string request;
+  std::vector<std::string> found;
+  std::string scratch;
+  for (const auto &key : keys) {
+    const auto *value = db.lookup(key);
+    if (!value) {
+      continue;
+    }
+    const auto *string = value->read_string(scratch);
+    if (!string) {
+      continue;
+    }
+    append_command(request, {"ASKING"});
+    if (const auto expire_in = db.time_to_live(key)) {
+      append_command(request, {"SET", key, *string, "PX",
+                               std::to_string(expire_in->count())});
+    } else {
+      append_command(request, {"SET", key, *string});
+    }
+    found.push_back(key);
+  }
+  if (found.empty()) {
+    return RespValue::make_string("NOKEY");
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addresses)) {
+    return RespValue::make_error(
+        "IOERR error or timeout connecting to the client");
+  }
+  const int fd = socket(addresses->ai_family, SOCK_STREAM, 0);
+  const auto micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+  timeval tv{.tv_sec = static_cast<time_t>(micros / 1000000),
+             .tv_usec = static_cast<suseconds_t>(micros % 1000000)};
+  bool ok = fd >= 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+            connect(fd, addresses->ai_addr, addresses->ai_addrlen) == 0;
+  freeaddrinfo(addresses);
+  if (!ok) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return RespValue::make_error(
+        "IOERR error or timeout connecting to the client");
+  }
+
+  // Every reply is a single line: +OK or an error.
+  std::optional<RespValue> error;
+  ok = send_all(fd, request);
+  size_t replies = 0;
+  std::string input;
+  char buffer[4096];
+  while (ok && replies < 2 * found.size()) {
+    const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      ok = false;
+      break;
+    }
+    input.append(buffer, received);
+    size_t line_end;
+    while ((line_end = input.find("\r\n")) != std::string::npos) {
+      if (input[0] == '-' && !error) {
+        error = RespValue::make_error(
+            "ERR Target instance replied with error: " +
+            input.substr(1, line_end - 1));
+      }
+      input.erase(0, line_end + 2);
+      ++replies;
+    }
+  }
+  close(fd);
+  if (!ok) {
+    return RespValue::make_error(
+        "IOERR error or timeout reading to target instance");
+  }
+  if (error) {
+    return *error;
+  }
+  if (!copy) {
+    // Replicas delete the keys too, replaying MIGRATE would send them again.
+    std::vector<std::string_view> del{"DEL"};
+    for (const auto &key : found) {
+      if (db.erase(key)) {
+        del.push_back(key);
+      }
+    }
+    if (del.size() > 1) {
+      Replication::instance().replicate(del);
+    }
+  }
+  return RespValue::make_string("OK");
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "resp_parser.h"
+#include "resp_types.h"
+
+constexpr size_t cluster_slots = 16384;
+
+// Hash slot of `key`: CRC16 of the key, or of its hashtag if it contains a
+// non-empty `{...}`, like Redis.
+uint16_t key_hash_slot(std::string_view key);
+
+// Cluster mode. The hash slots are assigned to nodes, and commands on keys of
+// a slot this node doesn't serve are answered with `-MOVED <slot>
+// <host>:<port>` so clients send them to the right node. Keys of one command
+// must share a slot.
+//
+// A slot moves from a node while it is marked migrating there and importing
+// at the target: `MIGRATE` copies its keys over, and commands on keys that
+// already left are sent to the target with `-ASK`, which the target only
+// accepts right after `ASKING`.
+//
+// There is no cluster bus. Nodes are named by a digest of their announced
+// endpoint, so every node derives the same ID for a peer, and the slot map
+// is configured on every node with CLUSTER MEET, ADDSLOTS and SETSLOT.
+//
+// Slot ownership is read by every thread that executes commands and only
+// changed by the main thread.
+class Cluster {
+ public:
+  static Cluster& instance() {
+    static Cluster instance;
+    return instance;
+  }
+
+  static constexpr size_t max_nodes = 1024;
+
+  struct Node {
+    std::string id;
+    std::string host;
+    int port = 0;
+  };
+
+  // Enables cluster mode, announcing this node as `host`:`port`. Must be
+  // called before serving.
+  void enable(std::string host, int port);
+  bool enabled() const { return is_enabled; }
+
+  // Adds the node at `host`:`port` unless it is known already. Returns its
+  // index, or nothing if there are `max_nodes` already.
+  std::optional<size_t> meet(const std::string& host, int port);
+  std::optional<size_t> find_node(std::string_view id) const;
+  size_t node_count() const {
+    return known_nodes.load(std::memory_order_acquire);
+  }
+  const Node& node(size_t index) const { return nodes[index]; }
+  // Index of this node.
+  static constexpr size_t self = 0;
+
+  // The node serving `slot`, or nothing if it is unassigned.
+  std::optional<size_t> owner(uint16_t slot) const {
+    return load(owners[slot]);
+  }
+  std::optional<size_t> migrating(uint16_t slot) const {
+    return load(migrating_to[slot]);
+  }
+  std::optional<size_t> importing(uint16_t slot) const {
+    return load(importing_from[slot]);
+  }
+  void assign(uint16_t slot, std::optional<size_t> node) {
+    store(owners[slot], node);
+  }
+  void set_migrating(uint16_t slot, std::optional<size_t> node) {
+    store(migrating_to[slot], node);
+  }
+  void set_importing(uint16_t slot, std::optional<size_t> node) {
+    store(importing_from[slot], node);
+  }
+  // Consecutive slots served by `node`, as inclusive ranges.
+  std::vector<std::pair<uint16_t, uint16_t>> slot_ranges(size_t node) const;
+
+  // The redirection or error `command` gets instead of executing here, if
+  // any. `asking` tells whether ASKING came right before it. Any thread.
+  std::optional<RespValue> check(const CommandView& command,
+                                 bool asking) const;
+
+  // Copies `keys` to the node at `host`:`port` and removes them here unless
+  // `copy` is set, blocking for up to `timeout` per network operation.
+  // Returns the MIGRATE reply; on errors all keys stay here. Main thread
+  // only.
+  RespValue migrate(const std::string& host, int port,
+                    const std::vector<std::string>& keys,
+                    std::chrono::milliseconds timeout, bool copy);
+
+ private:
+  Cluster();
+  // Delete copy/move operations
+  Cluster(const Cluster&) = delete;
+  Cluster& operator=(const Cluster&) = delete;
+  Cluster(Cluster&&) = delete;
+  Cluster& operator=(Cluster&&) = delete;
+
+  using SlotNodes = std::array<std::atomic<int16_t>, cluster_slots>;
+
+  static std::optional<size_t> load(const std::atomic<int16_t>& node) {
+    const auto index = node.load(std::memory_order_relaxed);
+    return index < 0 ? std::nullopt : std::optional<size_t>(index);
+  }
+  static void store(std::atomic<int16_t>& node, std::optional<size_t> index) {
+    node.store(index ? static_cast<int16_t>(*index) : -1,
+               std::memory_order_relaxed);
+  }
+
+  bool is_enabled = false;
+  // Entries below `known_nodes` are immutable, so readers need no lock.
+  std::array<Node, max_nodes> nodes;
+  std::atomic<size_t> known_nodes{0};
+  SlotNodes owners;
+  SlotNodes migrating_to;
+  SlotNodes importing_from;
+};
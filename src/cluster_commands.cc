@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <sstream>
+
+#include "cluster.h"
+#include "commands.h"
+#include "connection.h"
+#include "database.h"
+#include "replication.h"
+
+// CLUSTER subcommands, ASKING and MIGRATE, see `Cluster`.
+
+namespace {
+
+RespValue disabled_error() {
+  return RespValue::make_error(
+      "ERR This instance has cluster support disabled");
+}
+
+std::optional<uint16_t> parse_slot(const RespValue &value) {
+  const auto slot = parse_integer(value);
+  if (!slot || *slot < 0 || *slot >= static_cast<RespInteger>(cluster_slots)) {
+    return std::nullopt;
+  }
+  return static_cast<uint16_t>(*slot);
+}
+
+RespValue invalid_slot(const RespValue &value) {
+  return RespValue::make_error("ERR Invalid or out of range slot " +
+                               value.to_string());
+}
+
+RespValue cluster_info() {
+  auto &cluster = Cluster::instance();
+  size_t assigned = 0;
+  std::vector<bool> serving(cluster.node_count());
+  for (size_t slot = 0; slot < cluster_slots; ++slot) {
+    if (const auto owner = cluster.owner(slot)) {
+      ++assigned;
+      serving[*owner] = true;
+    }
+  }
+  std::ostringstream oss;
+  oss << "cluster_enabled:1\r\n"
+      << "cluster_state:" << (assigned == cluster_slots ? "ok" : "fail")
+      << "\r\n"
+      << "cluster_slots_assigned:" << assigned << "\r\n"
+      << "cluster_slots_ok:" << assigned << "\r\n"
+      << "cluster_slots_pfail:0\r\n"
+      << "cluster_slots_fail:0\r\n"
+      << "cluster_known_nodes:" << cluster.node_count() << "\r\n"
+      << "cluster_size:" << std::ranges::count(serving, true) << "\r\n";
+  return RespValue::make_string(oss.str());
+}
+
+// CLUSTER NODES format: id, address, flags, primary, ping and pong times,
+// epoch, link state and slots, with the slots in migration of this node.
+RespValue cluster_nodes() {
+  auto &cluster = Cluster::instance();
+  std::ostringstream oss;
+  for (size_t i = 0; i < cluster.node_count(); ++i) {
+    const auto &node = cluster.node(i);
+    oss << node.id << " " << node.host << ":" << node.port << "@"
+        << node.port + 10000 << " "
+        << (i == Cluster::self ? "myself,master" : "master")
+        << " - 0 0 0 connected";
+    for (const auto &[first, last] : cluster.slot_ranges(i)) {
+      oss << " " << first;
+      if (last != first) {
+        oss << "-" << last;
+      }
+    }
+    if (i == Cluster::self) {
+      for (size_t slot = 0; slot < cluster_slots; ++slot) {
+        if (const auto target = cluster.migrating(slot)) {
+          oss << " [" << slot << "->-" << cluster.node(*target).id << "]";
+        }
+        if (const auto source = cluster.importing(slot)) {
+          oss << " [" << slot << "-<-" << cluster.node(*source).id << "]";
+        }
+      }
+    }
+    oss << "\n";
+  }
+  return RespValue::make_string(oss.str());
+}
+
+RespValue cluster_slots_reply() {
+  auto &cluster = Cluster::instance();
+  RespArray ranges;
+  for (size_t i = 0; i < cluster.node_count(); ++i) {
+    const auto &node = cluster.node(i);
+    for (const auto &[first, last] : cluster.slot_ranges(i)) {
+      ranges.push_back(RespValue::make_array(
+          {RespValue::make_integer(first), RespValue::make_integer(last),
+           RespValue::make_array({RespValue::make_string(node.host),
+                                  RespValue::make_integer(node.port),
+                                  RespValue::make_string(node.id)})}));
+    }
+  }
+  return RespValue::make_array(std::move(ranges));
+}
+
+// One shard per node, as there are no replicas in the cluster.
+RespValue cluster_shards() {
+  auto &cluster = Cluster::instance();
+  RespArray shards;
+  for (size_t i = 0; i < cluster.node_count(); ++i) {
+    const auto &node = cluster.node(i);
+    RespArray slots;
+    for (const auto &[first, last] : cluster.slot_ranges(i)) {
+      slots.push_back(RespValue::make_integer(first));
+      slots.push_back(RespValue::make_integer(last));
+    }
+    const auto endpoint = RespValue::make_string(node.host);
+    RespMap description{
+        {"id", RespValue::make_string(node.id)},
+        {"port", RespValue::make_integer(node.port)},
+        {"ip", endpoint},
+        {"endpoint", endpoint},
+        {"role", RespValue::make_string("master")},
+        {"replication-offset", RespValue::make_integer(0)},
+        {"health", RespValue::make_string("online")}};
+    shards.push_back(RespValue::make_map(
+        {{"slots", RespValue::make_array(std::move(slots))},
+         {"nodes", RespValue::make_array(
+                       {RespValue::make_map(std::move(description))})}}));
+  }
+  return RespValue::make_array(std::move(shards));
+}
+
+// CLUSTER ADDSLOTS/DELSLOTS slot... and their RANGE variants with pairs of
+// first and last slot. Nothing changes unless every slot is valid.
+RespValue change_slots(const RespArray &arguments, bool add, bool ranges) {
+  if (arguments.size() < 2 || (ranges && arguments.size() % 2 == 0)) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLUSTER " +
+        arguments[0].to_string());
+  }
+  auto &cluster = Cluster::instance();
+  std::vector<uint16_t> slots;
+  for (size_t i = 1; i < arguments.size(); i += ranges ? 2 : 1) {
+    const auto first = parse_slot(arguments[i]);
+    if (!first) {
+      return invalid_slot(arguments[i]);
+    }
+    auto last = first;
+    if (ranges) {
+      last = parse_slot(arguments[i + 1]);
+      if (!last) {
+        return invalid_slot(arguments[i + 1]);
+      }
+    }
+    for (size_t slot = *first; slot <= *last; ++slot) {
+      const auto owner = cluster.owner(slot);
+      if (add && owner) {
+        return RespValue::make_error("ERR Slot " + std::to_string(slot) +
+                                     " is already busy");
+      }
+      if (!add && !owner) {
+        return RespValue::make_error("ERR Slot " + std::to_string(slot) +
+                                     " is already unassigned");
+      }
+      slots.push_back(slot);
+    }
+  }
+  for (const auto slot : slots) {
+    cluster.assign(slot, add ? std::optional(Cluster::self) : std::nullopt);
+  }
+  return RespValue::make_string("OK");
+}
+
+// CLUSTER SETSLOT slot IMPORTING|MIGRATING|NODE node-id | STABLE
+RespValue set_slot(const RespArray &arguments) {
+  if (arguments.size() < 3) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLUSTER SETSLOT");
+  }
+  auto &cluster = Cluster::instance();
+  const auto slot = parse_slot(arguments[1]);
+  if (!slot) {
+    return invalid_slot(arguments[1]);
+  }
+  const auto action = arguments[2].to_string();
+  if (equals_ignore_case(action, "stable")) {
+    cluster.set_migrating(*slot, std::nullopt);
+    cluster.set_importing(*slot, std::nullopt);
+    return RespValue::make_string("OK");
+  }
+  if (arguments.size() != 4) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLUSTER SETSLOT");
+  }
+  const auto node_id = arguments[3].to_string();
+  const auto node = cluster.find_node(node_id);
+  if (!node) {
+    return RespValue::make_error("ERR I don't know about node " + node_id);
+  }
+  if (equals_ignore_case(action, "migrating")) {
+    if (cluster.owner(*slot) != Cluster::self) {
+      return RespValue::make_error("ERR I'm not the owner of hash slot " +
+                                   std::to_string(*slot));
+    }
+    cluster.set_migrating(*slot, node);
+  } else if (equals_ignore_case(action, "importing")) {
+    if (cluster.owner(*slot) == Cluster::self) {
+      return RespValue::make_error(
+          "ERR I'm already the owner of hash slot " + std::to_string(*slot));
+    }
+    cluster.set_importing(*slot, node);
+  } else if (equals_ignore_case(action, "node")) {
+    if (cluster.owner(*slot) == Cluster::self && *node != Cluster::self &&
+        Database::instance().count_keys_in_slot(*slot) > 0) {
+      return RespValue::make_error(
+          "ERR Can't assign hashslot " + std::to_string(*slot) +
+          " to a different node while I still hold keys for this hash slot.");
+    }
+    cluster.assign(*slot, node);
+    cluster.set_migrating(*slot, std::nullopt);
+    cluster.set_importing(*slot, std::nullopt);
+  } else {
+    return RespValue::make_error("ERR Invalid CLUSTER SETSLOT action " +
+                                 action);
+  }
+  return RespValue::make_string("OK");
+}
+
+}  // namespace
+
+RespValue handle_cluster(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for CLUSTER");
+  }
+  auto &cluster = Cluster::instance();
+  if (!cluster.enabled()) {
+    return disabled_error();
+  }
+  const auto subcommand = arguments[0].to_string();
+  const auto wrong_arguments = [&subcommand] {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLUSTER " + subcommand);
+  };
+  if (equals_ignore_case(subcommand, "info")) {
+    return cluster_info();
+  }
+  if (equals_ignore_case(subcommand, "myid")) {
+    return RespValue::make_string(cluster.node(Cluster::self).id);
+  }
+  if (equals_ignore_case(subcommand, "nodes")) {
+    return cluster_nodes();
+  }
+  if (equals_ignore_case(subcommand, "slots")) {
+    return cluster_slots_reply();
+  }
+  if (equals_ignore_case(subcommand, "shards")) {
+    return cluster_shards();
+  }
+  if (equals_ignore_case(subcommand, "meet")) {
+    if (arguments.size() != 3) {
+      return wrong_arguments();
+    }
+    const auto port = parse_integer(arguments[2]);
+    if (!port || *port <= 0 || *port > 65535) {
+      return RespValue::make_error("ERR Invalid node address specified: " +
+                                   arguments[1].to_string() + ":" +
+                                   arguments[2].to_string());
+    }
+    if (!cluster.meet(arguments[1].to_string(), static_cast<int>(*port))) {
+      return RespValue::make_error("ERR Too many cluster nodes");
+    }
+    return RespValue::make_string("OK");
+  }
+  if (equals_ignore_case(subcommand, "addslots")) {
+    return change_slots(arguments, true, false);
+  }
+  if (equals_ignore_case(subcommand, "addslotsrange")) {
+    return change_slots(arguments, true, true);
+  }
+  if (equals_ignore_case(subcommand, "delslots")) {
+    return change_slots(arguments, false, false);
+  }
+  if (equals_ignore_case(subcommand, "delslotsrange")) {
+    return change_slots(arguments, false, true);
+  }
+  if (equals_ignore_case(subcommand, "setslot")) {
+    return set_slot(arguments);
+  }
+  if (equals_ignore_case(subcommand, "keyslot")) {
+    if (arguments.size() != 2) {
+      return wrong_arguments();
+    }
+    return RespValue::make_integer(key_hash_slot(arguments[1].to_string()));
+  }
+  if (equals_ignore_case(subcommand, "countkeysinslot")) {
+    if (arguments.size() != 2) {
+      return wrong_arguments();
+    }
+    const auto slot = parse_slot(arguments[1]);
+    if (!slot) {
+      return invalid_slot(arguments[1]);
+    }
+    return RespValue::make_integer(
+        Database::instance().count_keys_in_slot(*slot));
+  }
+  if (equals_ignore_case(subcommand, "getkeysinslot")) {
+    if (arguments.size() != 3) {
+      return wrong_arguments();
+    }
+    const auto slot = parse_slot(arguments[1]);
+    if (!slot) {
+      return invalid_slot(arguments[1]);
+    }
+    const auto count = parse_integer(arguments[2]);
+    if (!count || *count < 0) {
+      return RespValue::make_error("ERR Invalid number of keys");
+    }
+    RespArray keys;
+    for (auto &key : Database::instance().keys_in_slot(*slot, *count)) {
+      keys.push_back(RespValue::make_string(std::move(key)));
+    }
+    return RespValue::make_array(std::move(keys));
+  }
+  return RespValue::make_error("ERR unsupported sub command for CLUSTER: " +
+                               subcommand);
+}
+CommandRegistrar _handle_cluster("cluster", handle_cluster,
+                                 CommandAccess::Server);
+
+RespValue handle_asking(const RespArray &arguments) {
+  if (!arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for ASKING");
+  }
+  if (!Cluster::instance().enabled()) {
+    return disabled_error();
+  }
+  Connection *con = current_connection();
+  if (!con) {
+    return RespValue::make_error("ERR ASKING requires a connection");
+  }
+  con->asking = true;
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_asking("asking", handle_asking,
+                                CommandAccess::Server);
+
+// MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE]
+// [KEYS key...]. Only database 0 exists, and existing keys at the target
+// are always replaced.
+RespValue handle_migrate(const RespArray &arguments) {
+  if (arguments.size() < 5) {
+    return RespValue::make_error("ERR wrong number of arguments for MIGRATE");
+  }
+  // Replicated as DEL, replicas would send the keys again.
+  if (Replication::instance().is_replica()) {
+    return RespValue::make_error(
+        "READONLY You can't write against a read only replica.");
+  }
+  const auto port = parse_integer(arguments[1]);
+  const auto db = parse_integer(arguments[3]);
+  const auto timeout = parse_integer(arguments[4]);
+  if (!port || !db || !timeout || *timeout < 0) {
+    return RespValue::make_error("ERR value is not an integer or out of range");
+  }
+  if (*db != 0) {
+    return RespValue::make_error("ERR DB index is out of range");
+  }
+  bool copy = false;
+  std::vector<std::string> keys;
+  if (const auto key = arguments[2].to_string(); !key.empty()) {
+    keys.push_back(key);
+  }
+  for (size_t i = 5; i < arguments.size(); ++i) {
+    const auto option = arguments[i].to_string();
+    if (equals_ignore_case(option, "copy")) {
+      copy = true;
+    } else if (equals_ignore_case(option, "replace")) {
+      // Always the case.
+    } else if (equals_ignore_case(option, "keys") && keys.empty()) {
+      for (++i; i < arguments.size(); ++i) {
+        keys.push_back(arguments[i].to_string());
+      }
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+  }
+  return Cluster::instance().migrate(
+      arguments[0].to_string(), static_cast<int>(*port), keys,
+      std::chrono::milliseconds(std::max<RespInteger>(*timeout, 1)), copy);
+}
+CommandRegistrar _handle_migrate("migrate", handle_migrate,
+                                 CommandAccess::Server);
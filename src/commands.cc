@@ -1,9 +1,13 @@
 #include "commands.h"
 
 #include <algorithm>
-#include <iostream>
+#include <limits>
 
+#include "connection.h"
 #include "database.h"
+#include "log.h"
+#include "replication.h"
+#include "tracking.h"
 
 std::string to_lower(const std::string &s) {
   std::string out;
@@ -12,10 +16,32 @@ std::string to_lower(const std::string &s) {
   return out;
 }
 
-bool check_for_option(const RespArray &arguments, RespString option) {
+std::optional<RespInteger> parse_integer(const RespValue &value) {
+  if (const auto *num = std::get_if<RespInteger>(&value.value)) {
+    return *num;
+  }
+  const auto *str = std::get_if<RespString>(&value.value);
+  if (!str) {
+    return std::nullopt;
+  }
+  return RespValue::parse_int(*str);
+}
+
+RespValue wrong_type_error() {
+  return RespValue::make_error(
+      "WRONGTYPE Operation against a key holding the wrong kind of value");
+}
+
+bool equals_ignore_case(std::string_view lhs, std::string_view rhs) {
+  return std::ranges::equal(lhs, rhs, [](char a, char b) {
+    return std::tolower(a) == std::tolower(b);
+  });
+}
+
+bool check_for_option(const RespArray &arguments, std::string_view option) {
   for (const auto &arg : arguments) {
-    if (std::holds_alternative<RespString>(arg.value)) {
-      if (to_lower(std::get<RespString>(arg.value)) == option) {
+    if (const auto *str = std::get_if<RespString>(&arg.value)) {
+      if (equals_ignore_case(*str, option)) {
         return true;
       }
     }
@@ -24,16 +50,15 @@ bool check_for_option(const RespArray &arguments, RespString option) {
 }
 
 std::optional<RespValue> extract_option_value(const RespArray &arguments,
-                                              RespString option) {
+                                              std::string_view option) {
   for (auto it = arguments.begin(); it != arguments.end(); ++it) {
-    std::cout << "[extract_option_value(" << option << ")] " << it->to_string()
-              << std::endl;
-    if (std::holds_alternative<RespString>(it->value)) {
-      if (to_lower(std::get<RespString>(it->value)) == option) {
-        std::cout << "Found a match on " << option << std::endl;
+    LOG(Debug) << "[extract_option_value(" << option << ")] " << *it;
+    if (const auto *str = std::get_if<RespString>(&it->value)) {
+      if (equals_ignore_case(*str, option)) {
+        LOG(Debug) << "Found a match on " << option;
         const auto next = it + 1;
-        std::cout << "Returning " << next->to_string() << std::endl;
         if (next != arguments.end()) {
+          LOG(Debug) << "Returning " << *next;
           return *next;
         }
       }
@@ -42,18 +67,91 @@ std::optional<RespValue> extract_option_value(const RespArray &arguments,
   return std::nullopt;
 }
 
-std::optional<RespValue> dispatch_commands(RespString command,
-                                           const RespArray &arguments) {
-  std::cout << "Attempting to handle command `" << command
-            << "` with arguments\n";
-  for (const auto &arg : arguments) {
-    std::cout << "- " << arg.debug_format_type() << " :: " << arg.to_string()
-              << "\n";
+size_t CommandNameHash::operator()(std::string_view name) const {
+  // FNV-1a over the lowercased name.
+  size_t hash = 14695981039346656037ull;
+  for (const char c : name) {
+    hash = (hash ^ static_cast<unsigned char>(std::tolower(c))) *
+           1099511628211ull;
   }
+  return hash;
+}
+
+bool CommandNameEqual::operator()(std::string_view lhs,
+                                  std::string_view rhs) const {
+  return equals_ignore_case(lhs, rhs);
+}
+
+std::optional<RespValue> CommandRegistry::execute_command(
+    std::string_view name, const RespArray &arguments) const {
+  auto it = commands.find(name);
+  if (it == commands.end()) {
+    return std::nullopt;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  auto result = it->second.handler(arguments);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  auto &stats = *it->second.stats;
+  stats.calls.fetch_add(1, std::memory_order_relaxed);
+  if (std::holds_alternative<RespError>(result.value)) {
+    stats.failed_calls.fetch_add(1, std::memory_order_relaxed);
+  }
+  stats.latency.record(elapsed);
+  if (auto &slowlog = SlowLog::instance(); slowlog.is_slow(elapsed)) {
+    slowlog.add(elapsed, name, arguments);
+  }
+  return result;
+}
+
+std::vector<std::pair<std::string, const CommandStats *>>
+CommandRegistry::command_stats() const {
+  std::vector<std::pair<std::string, const CommandStats *>> result;
+  for (const auto &[name, command] : commands) {
+    result.emplace_back(name, command.stats.get());
+  }
+  std::ranges::sort(result);
+  return result;
+}
+
+void CommandRegistry::reset_stats() {
+  for (auto &[_, command] : commands) {
+    command.stats->calls.store(0, std::memory_order_relaxed);
+    command.stats->failed_calls.store(0, std::memory_order_relaxed);
+    command.stats->latency.reset();
+  }
+}
+
+bool is_read_only_command(std::string_view name) {
+  return CommandRegistry::instance().is_read_only(name);
+}
+
+bool is_write_command(std::string_view name) {
+  return CommandRegistry::instance().is_write(name);
+}
+
+bool may_write_command(std::string_view name) {
+  return CommandRegistry::instance().may_write(name);
+}
+
+bool refuses_writes() {
+  const Connection *con = current_connection();
+  return Replication::instance().is_replica() &&
+         !(con && con->replication_link);
+}
+
+RespValue readonly_error() {
+  return RespValue::make_error(
+      "READONLY You can't write against a read only replica.");
+}
+
+std::optional<RespValue> dispatch_commands(std::string_view command,
+                                           const RespArray &arguments) {
+  LOG(Debug) << "Attempting to handle command `" << command
+             << "` with arguments " << log_join(arguments);
   const auto result =
-      CommandRegistry::instance().execute_command(to_lower(command), arguments);
+      CommandRegistry::instance().execute_command(command, arguments);
   if (!result) {
-    std::cout << "Failed to handle command `" << command << "`\n";
+    LOG(Debug) << "Failed to handle command `" << command << "`";
   }
   return result;
 }
@@ -67,7 +165,7 @@ RespValue handle_ping(const RespArray &arguments) {
   }
   return RespValue::make_string(arguments.front().to_string());
 }
-CommandRegistrar _handle_ping("ping", handle_ping);
+CommandRegistrar _handle_ping("ping", handle_ping, CommandAccess::ReadOnly);
 
 RespValue handle_command(const RespArray &arguments) {
   if (arguments.size() != 1) {
@@ -82,7 +180,8 @@ RespValue handle_command(const RespArray &arguments) {
   }
   return RespValue::make_map(map);
 }
-CommandRegistrar _handle_command("command", handle_command);
+CommandRegistrar _handle_command("command", handle_command,
+                                 CommandAccess::ReadOnly);
 
 RespValue handle_echo(const RespArray &arguments) {
   if (arguments.size() != 1) {
@@ -90,7 +189,7 @@ RespValue handle_echo(const RespArray &arguments) {
   }
   return RespValue::make_string(arguments.front().to_string());
 }
-CommandRegistrar _handle_echo("echo", handle_ping);
+CommandRegistrar _handle_echo("echo", handle_ping, CommandAccess::ReadOnly);
 
 RespValue handle_set(const RespArray &arguments) {
   if (arguments.size() < 2) {
@@ -100,25 +199,25 @@ RespValue handle_set(const RespArray &arguments) {
     return RespValue::make_error("ERR Only one of EX or PX is allowed");
   }
   const auto expire_in =
-      extract_option_value(arguments, RespString("px"))
+      extract_option_value(arguments, "px")
           .and_then(
               [](RespValue val) -> std::optional<std::chrono::milliseconds> {
-                std::cout << "Processing " << val.to_string() << std::endl;
+                LOG(Debug) << "Processing " << val;
                 if (std::holds_alternative<RespInteger>(val.value)) {
-                  std::cout << "Got integer" << std::endl;
+                  LOG(Debug) << "Got integer";
                   return std::chrono::milliseconds(
                       std::get<RespInteger>(val.value));
                 } else if (std::holds_alternative<RespString>(val.value)) {
-                  std::cout << "That was unexpected: " << val.to_string();
+                  LOG(Debug) << "That was unexpected: " << val;
                   return std::chrono::milliseconds(
                       std::stoi(std::get<RespString>(val.value)));
                 } else {
-                  std::cout << "Got nothing" << std::endl;
+                  LOG(Debug) << "Got nothing";
                   return std::nullopt;
                 }
               })
           .or_else([&arguments]() {
-            return extract_option_value(arguments, RespString("ex"))
+            return extract_option_value(arguments, "ex")
                 .and_then([](RespValue val)
                               -> std::optional<std::chrono::milliseconds> {
                   if (std::holds_alternative<RespInteger>(val.value)) {
@@ -129,28 +228,156 @@ RespValue handle_set(const RespArray &arguments) {
                   }
                 });
           });
-  const auto old_value = Database::instance().set(arguments[0].to_string(),
-                                                  arguments[1], expire_in);
+  Database::instance().set(arguments[0].to_string(), arguments[1], expire_in);
   return RespValue::make_string("OK");
 }
-CommandRegistrar _handle_set("set", handle_set);
+CommandRegistrar _handle_set("set", handle_set,
+                             CommandAccess::Write, KeySpec{1, 1, 1});
 
 RespValue handle_get(const RespArray &arguments) {
   if (arguments.size() < 1) {
     return RespValue::make_error("ERR Too few arguments for SET.");
   }
-  const auto value = Database::instance().get(arguments[0].to_string());
+  RespString scratch;
+  const auto *key = arguments[0].read_string(scratch);
+  if (!key) {
+    return RespValue::make_error("ERR invalid key");
+  }
+  const auto *value = Database::instance().lookup(*key);
   if (!value) {
     return RespValue::make_null();
   }
-  return RespValue::make_string(value->to_string());
+  // Large values are shared with the reply, others copied straight into it.
+  if (std::holds_alternative<RespSharedString>(value->value)) {
+    return *value;
+  }
+  RespString value_scratch;
+  const auto *str = value->read_string(value_scratch);
+  if (!str) {
+    return RespValue::make_string(value->to_string());
+  }
+  // Decompressed or rendered values are moved rather than copied.
+  if (str == &value_scratch) {
+    return RespValue::make_string(std::move(value_scratch));
+  }
+  return RespValue::make_string(*str);
+}
+CommandRegistrar _handle_get("get", handle_get,
+                             CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+RespValue handle_mget(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for MGET");
+  }
+  RespArray result;
+  result.reserve(arguments.size());
+  RespString scratch;
+  RespString value_scratch;
+  for (const auto &argument : arguments) {
+    const auto *key = argument.read_string(scratch);
+    const auto *value = key ? Database::instance().lookup(*key) : nullptr;
+    const auto *str = value ? value->read_string(value_scratch) : nullptr;
+    if (!value) {
+      result.push_back(RespValue::make_null());
+    } else if (std::holds_alternative<RespSharedString>(value->value)) {
+      result.push_back(*value);
+    } else if (str == &value_scratch) {
+      result.push_back(RespValue::make_string(std::move(value_scratch)));
+    } else if (str) {
+      result.push_back(RespValue::make_string(*str));
+    } else {
+      result.push_back(RespValue::make_string(value->to_string()));
+    }
+  }
+  return RespValue::make_array(std::move(result));
+}
+CommandRegistrar _handle_mget("mget", handle_mget,
+                              CommandAccess::ReadOnly, KeySpec{1, -1, 1});
+
+RespValue client_tracking(Connection &con, const RespArray &arguments) {
+  if (arguments.size() < 2) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLIENT TRACKING");
+  }
+  const auto mode = to_lower(arguments[1].to_string());
+  if (mode == "off") {
+    Tracking::instance().disable(con);
+    return RespValue::make_string("OK");
+  }
+  if (mode != "on") {
+    return RespValue::make_error("ERR syntax error");
+  }
+  Tracking::Options options;
+  for (size_t i = 2; i < arguments.size(); ++i) {
+    const auto option = to_lower(arguments[i].to_string());
+    if (option == "bcast") {
+      options.bcast = true;
+    } else if (option == "optin") {
+      options.optin = true;
+    } else if (option == "optout") {
+      options.optout = true;
+    } else if (option == "noloop") {
+      options.noloop = true;
+    } else if (option == "prefix" && i + 1 < arguments.size()) {
+      options.prefixes.push_back(arguments[++i].to_string());
+    } else if (option == "redirect") {
+      return RespValue::make_error(
+          "ERR REDIRECT is not supported, invalidations are pushed on the "
+          "tracking connection");
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+  }
+  if (!options.prefixes.empty() && !options.bcast) {
+    return RespValue::make_error(
+        "ERR PREFIX option requires BCAST mode to be enabled");
+  }
+  if (options.optin && options.optout) {
+    return RespValue::make_error("ERR You can't use OPTIN and OPTOUT together");
+  }
+  if (options.bcast && (options.optin || options.optout)) {
+    return RespValue::make_error(
+        "ERR OPTIN and OPTOUT are not compatible with BCAST");
+  }
+  Tracking::instance().enable(con, std::move(options));
+  return RespValue::make_string("OK");
+}
+
+RespValue client_caching(Connection &con, const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for CLIENT CACHING");
+  }
+  const auto mode = to_lower(arguments[1].to_string());
+  if (mode != "yes" && mode != "no") {
+    return RespValue::make_error("ERR syntax error");
+  }
+  if (!Tracking::instance().set_caching(con, mode == "yes")) {
+    return RespValue::make_error(
+        "ERR CLIENT CACHING can be called only when the client is in "
+        "tracking mode with OPTIN or OPTOUT mode enabled");
+  }
+  return RespValue::make_string("OK");
 }
-CommandRegistrar _handle_get("get", handle_get);
 
 RespValue handle_client(const RespArray &arguments) {
+  Connection *con = current_connection();
+  if (arguments.empty() || !con) {
+    return RespValue::make_string("OK");
+  }
+  const auto sub_command = to_lower(arguments[0].to_string());
+  if (sub_command == "id") {
+    return RespValue::make_integer(con->id);
+  }
+  if (sub_command == "tracking") {
+    return client_tracking(*con, arguments);
+  }
+  if (sub_command == "caching") {
+    return client_caching(*con, arguments);
+  }
   return RespValue::make_string("OK");
 }
-CommandRegistrar _handle_client("client", handle_client);
+CommandRegistrar _handle_client("client", handle_client, CommandAccess::Server);
 
 RespValue handle_hello(const RespArray &arguments) {
   if (arguments.size() < 1) {
@@ -163,25 +390,28 @@ RespValue handle_hello(const RespArray &arguments) {
   return RespValue::make_map(
       RespMap({{RespString("proto"), RespValue::make_integer(3)}}));
 }
-CommandRegistrar _handle_hello("hello", handle_hello);
+CommandRegistrar _handle_hello("hello", handle_hello, CommandAccess::ReadOnly);
 
 RespValue inner_incrby(RespString key, RespInteger increment) {
-  const auto value = Database::instance().get(key);
+  auto &db = Database::instance();
+  auto *value = db.find(key);
   if (!value) {
-    const long new_value = increment;
-    Database::instance().set(key, RespValue::make_integer(new_value),
-                             std::nullopt);
-    return new_value;
-  } else {
-    const auto int_value = value->to_int_safe();
-    if (!int_value) {
-      return RespValue::make_error("ERR value is not an integer");
-    }
-    const long new_value = (*int_value) + increment;
-    Database::instance().set(key, RespValue::make_integer(new_value),
-                             std::nullopt);
-    return new_value;
+    db.set(key, RespValue::make_integer(increment), std::nullopt);
+    return increment;
+  }
+  // Shared and compressed strings are far too long to hold an integer.
+  const auto int_value = parse_integer(*value);
+  if (!int_value) {
+    return RespValue::make_error("ERR value is not an integer or out of range");
   }
+  RespInteger new_value;
+  if (__builtin_add_overflow(*int_value, increment, &new_value)) {
+    return RespValue::make_error("ERR increment or decrement would overflow");
+  }
+  // In place, so the key keeps its expiry.
+  *value = RespValue::make_integer(new_value);
+  db.signal_modified(key);
+  return new_value;
 }
 
 RespValue handle_incr(const RespArray &arguments) {
@@ -191,20 +421,22 @@ RespValue handle_incr(const RespArray &arguments) {
   const auto key = arguments[0].to_string();
   return inner_incrby(key, RespInteger(1));
 }
-CommandRegistrar _handle_incr("incr", handle_incr);
+CommandRegistrar _handle_incr("incr", handle_incr,
+                              CommandAccess::Write, KeySpec{1, 1, 1});
 
 RespValue handle_incrby(const RespArray &arguments) {
   if (arguments.size() != 2) {
     return RespValue::make_error("ERR wrong number of arguments for INCRBY");
   }
   const auto key = arguments[0].to_string();
-  const auto increment = arguments[1].to_int_safe();
+  const auto increment = parse_integer(arguments[1]);
   if (!increment) {
-    return RespValue::make_error("ERR invalid increment");
+    return RespValue::make_error("ERR value is not an integer or out of range");
   }
   return inner_incrby(key, *increment);
 }
-CommandRegistrar _handle_incrby("incrby", handle_incrby);
+CommandRegistrar _handle_incrby("incrby", handle_incrby,
+                                CommandAccess::Write, KeySpec{1, 1, 1});
 
 RespValue handle_decr(const RespArray &arguments) {
   if (arguments.size() != 1) {
@@ -213,22 +445,33 @@ RespValue handle_decr(const RespArray &arguments) {
   const auto key = arguments[0].to_string();
   return inner_incrby(key, RespInteger(-1));
 }
-CommandRegistrar _handle_decr("decr", handle_decr);
+CommandRegistrar _handle_decr("decr", handle_decr,
+                              CommandAccess::Write, KeySpec{1, 1, 1});
 
 RespValue handle_decrby(const RespArray &arguments) {
   if (arguments.size() != 2) {
     return RespValue::make_error("ERR wrong number of arguments for DECRBY");
   }
   const auto key = arguments[0].to_string();
-  const auto increment = arguments[1].to_int_safe();
-  if (!increment) {
-    return RespValue::make_error("ERR invalid increment");
+  const auto decrement = parse_integer(arguments[1]);
+  if (!decrement) {
+    return RespValue::make_error("ERR value is not an integer or out of range");
   }
-  return inner_incrby(key, -(*increment));
+  if (*decrement == std::numeric_limits<RespInteger>::min()) {
+    return RespValue::make_error("ERR decrement would overflow");
+  }
+  return inner_incrby(key, -*decrement);
 }
-CommandRegistrar _handle_decrby("decrby", handle_decrby);
+CommandRegistrar _handle_decrby("decrby", handle_decrby,
+                                CommandAccess::Write, KeySpec{1, 1, 1});
 
 RespValue handle_config(const RespArray &arguments) {
+  if (arguments.size() == 1 &&
+      equals_ignore_case(arguments[0].to_string(), "resetstat")) {
+    CommandRegistry::instance().reset_stats();
+    ServerStats::instance().reset();
+    return RespValue::make_string("OK");
+  }
   if (arguments.size() != 2) {
     return RespValue::make_error("ERR wrong number of arguments for CONFIG");
   }
@@ -240,9 +483,10 @@ RespValue handle_config(const RespArray &arguments) {
       {{"save", ""}, {"appendonly", "no"}});
   auto config_val = config_map.find(arguments[1].to_string());
   if (config_val == config_map.end()) {
-    std::cout << "Unknown config key: `" << arguments[1].to_string() << "`\n";
+    LOG(Debug) << "Unknown config key: `" << arguments[1] << "`";
     return RespValue::make_string("");
   }
   return RespValue::make_string(config_val->second);
 }
-CommandRegistrar _handle_config("config", handle_config);
\ No newline at end of file
+CommandRegistrar _handle_config("config", handle_config,
+                                CommandAccess::ReadOnly);
\ No newline at end of file
@@ -1,13 +1,47 @@
 #pragma once
 #include <concepts>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <ranges>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "resp_types.h"
+#include "stats.h"
+
+// Commands that only read the keyspace may execute on reader threads next to
+// the writer, see `Database::ConcurrentRead`. Server commands don't touch the
+// keyspace but other state of the main thread, so they neither execute
+// concurrently nor count as writes for replication. Commands that may write
+// only modify the keyspace for some arguments or cache derived state in a
+// value. They run on the writer and replicate like writes, but replicas serve
+// them to clients too; their handlers refuse to modify keys there, see
+// `refuses_writes`.
+enum class CommandAccess { Write, MayWrite, ReadOnly, Server };
+
+// Positions of a command's key arguments like Redis describes them, counting
+// the command name as 0: keys from `first` to `last` in steps of `step`, with
+// a negative `last` counting back from the last argument. `first == 0` means
+// the command takes no keys.
+struct KeySpec {
+  int first = 0;
+  int last = 0;
+  int step = 1;
+};
+
+// Case-insensitive hashing and comparison, so commands are looked up without
+// lowercasing the name first.
+struct CommandNameHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view name) const;
+};
+struct CommandNameEqual {
+  using is_transparent = void;
+  bool operator()(std::string_view lhs, std::string_view rhs) const;
+};
 
 class CommandRegistry {
  public:
@@ -16,17 +50,43 @@ class CommandRegistry {
     return instance;
   }
   template <std::invocable<const RespArray&> Func>
-  void register_command(std::string name, Func&& func) {
-    commands[std::string(name)] = std::forward<Func>(func);
+  void register_command(std::string name, Func&& func, CommandAccess access,
+                        KeySpec keys) {
+    commands[std::string(name)] =
+        Command{.handler = std::forward<Func>(func),
+                .access = access,
+                .keys = keys,
+                .stats = std::make_unique<CommandStats>()};
   }
 
-  std::optional<RespValue> execute_command(std::string name,
-                                           const RespArray& arguments) const {
+  // Runs the command and records its latency, and adds it to the `SlowLog`
+  // if it was slow.
+  std::optional<RespValue> execute_command(std::string_view name,
+                                           const RespArray& arguments) const;
+
+  // Unknown commands count as writes.
+  bool is_read_only(std::string_view name) const {
     auto it = commands.find(name);
-    if (it == commands.end()) {
-      return std::nullopt;
-    }
-    return it->second(arguments);
+    return it != commands.end() && it->second.access == CommandAccess::ReadOnly;
+  }
+
+  // Only known commands registered as `CommandAccess::Write` or `MayWrite`.
+  bool is_write(std::string_view name) const {
+    auto it = commands.find(name);
+    return it != commands.end() &&
+           (it->second.access == CommandAccess::Write ||
+            it->second.access == CommandAccess::MayWrite);
+  }
+
+  bool may_write(std::string_view name) const {
+    auto it = commands.find(name);
+    return it != commands.end() && it->second.access == CommandAccess::MayWrite;
+  }
+
+  // Null for unknown commands.
+  const KeySpec* key_spec(std::string_view name) const {
+    auto it = commands.find(name);
+    return it == commands.end() ? nullptr : &it->second.keys;
   }
 
   std::vector<std::string> list_commands() {
@@ -38,6 +98,12 @@ class CommandRegistry {
     return result;
   }
 
+  // Statistics of every command, sorted by name.
+  std::vector<std::pair<std::string, const CommandStats*>> command_stats()
+      const;
+  // Resets the statistics of every command.
+  void reset_stats();
+
  private:
   CommandRegistry() = default;
   // Delete copy/move operations
@@ -46,20 +112,45 @@ class CommandRegistry {
   CommandRegistry(CommandRegistry&&) = delete;
   CommandRegistry& operator=(CommandRegistry&&) = delete;
 
-  std::unordered_map<std::string, std::function<RespValue(const RespArray&)>>
+  struct Command {
+    std::function<RespValue(const RespArray&)> handler;
+    CommandAccess access;
+    KeySpec keys;
+    std::unique_ptr<CommandStats> stats;
+  };
+
+  std::unordered_map<std::string, Command, CommandNameHash, CommandNameEqual>
       commands;
 };
 
 struct CommandRegistrar {
  public:
   template <std::invocable<const RespArray&> Func>
-  CommandRegistrar(std::string name, Func&& func) {
-    CommandRegistry::instance().register_command(name,
-                                                 std::forward<Func>(func));
+  CommandRegistrar(std::string name, Func&& func,
+                   CommandAccess access = CommandAccess::Write,
+                   KeySpec keys = {}) {
+    CommandRegistry::instance().register_command(
+        name, std::forward<Func>(func), access, keys);
   }
 };
 
 std::string to_lower(const std::string& s);
+bool equals_ignore_case(std::string_view lhs, std::string_view rhs);
+
+// Strict integer conversion of a command argument, see
+// `RespValue::parse_int`.
+std::optional<RespInteger> parse_integer(const RespValue& value);
+
+RespValue wrong_type_error();
+
+bool is_read_only_command(std::string_view name);
+bool is_write_command(std::string_view name);
+bool may_write_command(std::string_view name);
+
+// True on a replica unless the command came from its primary. `MayWrite`
+// commands answer `readonly_error` instead of modifying the keyspace then.
+bool refuses_writes();
+RespValue readonly_error();
 
-std::optional<RespValue> dispatch_commands(RespString command,
+std::optional<RespValue> dispatch_commands(std::string_view command,
                                            const RespArray& arguments);
@@ -0,0 +1,68 @@
+#include "compression.h"
+
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <utility>
+
+#include "lzf.h"
+#include "stats.h"
+
+namespace {
+
+size_t min_compressed_size = 0;
+
+// Values that LZF shrinks by less than an eighth are stored as they are.
+size_t max_compressed_size(size_t size) { return size - size / 8; }
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - since)
+      .count();
+}
+
+}  // namespace
+
+void set_value_compression(size_t min_size) { min_compressed_size = min_size; }
+
+std::optional<RespCompressedString> compress_value(const RespString &value) {
+  if (!min_compressed_size || value.size() < min_compressed_size) {
+    return std::nullopt;
+  }
+  auto &stats = ServerStats::instance();
+  const auto start = std::chrono::steady_clock::now();
+  // Not zero-filled first, and shrunk to the compressed size afterwards.
+  std::string buffer;
+  size_t size = 0;
+  buffer.resize_and_overwrite(max_compressed_size(value.size()),
+                              [&](char *data, size_t capacity) {
+                                size = lzf_compress(value, data, capacity);
+                                return size;
+                              });
+  std::optional<RespCompressedString> result;
+  if (size) {
+    buffer.shrink_to_fit();
+    result.emplace(
+        RespCompressedString{.data = std::move(buffer), .size = value.size()});
+    stats.compressed_values.fetch_add(1, std::memory_order_relaxed);
+    stats.compression_input_bytes.fetch_add(value.size(),
+                                            std::memory_order_relaxed);
+    stats.compression_output_bytes.fetch_add(size, std::memory_order_relaxed);
+  } else {
+    stats.incompressible_values.fetch_add(1, std::memory_order_relaxed);
+  }
+  stats.compression_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+  return result;
+}
+
+void RespCompressedString::decompress(RespString &out) const {
+  auto &stats = ServerStats::instance();
+  const auto start = std::chrono::steady_clock::now();
+  out.resize(size);
+  // Only ever decompresses what `compress_value` produced.
+  [[maybe_unused]] const bool valid = lzf_decompress(data, out.data(), size);
+  assert(valid);
+  stats.decompressions.fetch_add(1, std::memory_order_relaxed);
+  stats.decompression_ns.fetch_add(elapsed_ns(start),
+                                   std::memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+
+#include "resp_types.h"
+
+// Transparent compression of large string values. `Database::set` stores
+// values of at least the configured size as `RespCompressedString` if LZF
+// shrinks them noticeably; reads decompress them on every access.
+
+// Values of at least `min_size` bytes are compressed; zero, the default,
+// disables compression. Set before serving.
+void set_value_compression(size_t min_size);
+
+// `value` compressed, unless compression is disabled, `value` is too small or
+// it doesn't compress well.
+std::optional<RespCompressedString> compress_value(const RespString &value);
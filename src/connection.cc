@@ -1,68 +1,384 @@
 #include "connection.h"
 
+#include <errno.h>
+
+#include <algorithm>
+#include <charconv>
 #include <span>
+#include <utility>
 
+#include "capture.h"
+#include "cluster.h"
 #include "commands.h"
+#include "database.h"
+#include "log.h"
+#include "pubsub.h"
+#include "replication.h"
 #include "resp_parser.h"
+#include "stats.h"
+#include "trace.h"
+#include "tracking.h"
+
+namespace {
+
+thread_local Connection *executing_connection = nullptr;
+std::vector<int> write_requests;
+
+// Limit of iovecs passed to a single `writev`.
+constexpr size_t max_write_segments = 64;
+
+}  // namespace
+
+std::string &OutputChain::owned_tail() {
+  if (segments.empty() || segments.back().shared) {
+    segments.emplace_back();
+  }
+  return segments.back().owned;
+}
+
+void OutputChain::append(std::string_view bytes) {
+  if (bytes.empty()) {
+    return;
+  }
+  owned_tail().append(bytes);
+  pending_bytes += bytes.size();
+}
+
+void OutputChain::append(const RespValue &value) {
+  // Shared strings are referenced by the chain, possibly inside arrays like
+  // MGET replies. Everything else is encoded into the owned tail.
+  if (const auto *shared = std::get_if<RespSharedString>(&value.value)) {
+    char header[24] = {'$'};
+    auto *end = std::to_chars(header + 1, header + sizeof(header) - 2,
+                              shared->data->size())
+                    .ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    append(std::string_view(header, end));
+    append_shared(shared->data);
+    append(std::string_view("\r\n"));
+    return;
+  }
+  if (const auto *array = std::get_if<RespArray>(&value.value);
+      array && std::ranges::any_of(*array, [](const RespValue &element) {
+        return std::holds_alternative<RespSharedString>(element.value);
+      })) {
+    append(std::string_view("*" + std::to_string(array->size()) + "\r\n"));
+    for (const auto &element : *array) {
+      append(element);
+    }
+    return;
+  }
+  auto &tail = owned_tail();
+  const size_t size_before = tail.size();
+  value.encode(tail);
+  pending_bytes += tail.size() - size_before;
+}
+
+void OutputChain::append_shared(std::shared_ptr<const std::string> buffer) {
+  if (!buffer || buffer->empty()) {
+    return;
+  }
+  pending_bytes += buffer->size();
+  segments.push_back(Segment{.owned = {}, .shared = std::move(buffer)});
+}
 
-EventState handle_read(Connection &con) {
-  std::cout << "Handling `read` on socket " << con.fd << std::endl;
-  uint8_t buffer[1024] = {0};
-  const size_t bytes_read = recv(con.fd, buffer, sizeof(buffer), 0);
-  std::cout << "Received " << bytes_read << " bytes:\n"
-            << (const char *)buffer << "\n";
+size_t OutputChain::gather(struct iovec *iov, size_t max_count) const {
+  size_t count = 0;
+  size_t offset = front_offset;
+  for (const auto &segment : segments) {
+    if (count == max_count) {
+      break;
+    }
+    const auto view = segment.view().substr(offset);
+    iov[count].iov_base = const_cast<char *>(view.data());
+    iov[count].iov_len = view.size();
+    ++count;
+    offset = 0;
+  }
+  return count;
+}
+
+void OutputChain::consume(size_t bytes) {
+  pending_bytes -= bytes;
+  sent_bytes += bytes;
+  while (bytes > 0) {
+    const size_t remaining = segments.front().view().size() - front_offset;
+    if (bytes < remaining) {
+      front_offset += bytes;
+      return;
+    }
+    bytes -= remaining;
+    front_offset = 0;
+    if (segments.size() == 1 && !segments.front().shared) {
+      segments.front().owned.clear();
+      return;
+    }
+    segments.pop_front();
+  }
+}
+
+Connection *current_connection() { return executing_connection; }
+
+void request_write(Connection &con) {
+  if (!con.write_requested) {
+    con.write_requested = true;
+    write_requests.push_back(con.fd);
+  }
+}
+
+void take_write_requests(std::vector<int> &fds) {
+  fds.clear();
+  fds.swap(write_requests);
+}
+
+bool has_write_requests() { return !write_requests.empty(); }
+
+EventState read_commands(Connection &con) {
+  LOG(Debug) << "Handling `read` on socket " << con.fd;
+  uint8_t buffer[16 * 1024];
+  ssize_t bytes_read;
+  {
+    TraceSpan span("io", "read", con.fd);
+    bytes_read = recv(con.fd, buffer, sizeof(buffer), 0);
+    span.set_count(std::max<ssize_t>(bytes_read, 0));
+  }
+  if (bytes_read <= 0) {
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return EventState::Read;
+    }
+    return EventState::Close;
+  }
+  LOG(Debug) << "Received " << bytes_read << " bytes";
+  ServerStats::instance().bytes_in.fetch_add(bytes_read,
+                                             std::memory_order_relaxed);
   con.incoming.insert(con.incoming.end(), &buffer[0], &buffer[0] + bytes_read);
+  if (con.incoming.size() > ClientLimits::instance().max_query_buffer) {
+    LOG_RATE_LIMITED(Warning, 10)
+        << "Closing client " << con.fd << ", its query buffer of "
+        << con.incoming.size() << " bytes exceeds the limit";
+    ServerStats::instance().query_limit_disconnections.fetch_add(
+        1, std::memory_order_relaxed);
+    return EventState::Close;
+  }
 
-  // Attempt to parse
-  std::string input_str(con.incoming.begin(), con.incoming.end());
-  auto parsed = parse_resp_code(input_str);
-  if (!parsed) {
-    return EventState::Read;
+  // Parse as many complete commands as the buffer holds. Their arguments
+  // point into `incoming`, which keeps the bytes of a trailing partial
+  // command for the next read.
+  TraceSpan span("io", "parse", con.fd);
+  const std::string_view input(
+      reinterpret_cast<const char *>(con.incoming.data()), con.incoming.size());
+  size_t consumed = 0;
+  while (consumed < input.size()) {
+    auto &args = con.pending_commands.emplace_back();
+    const auto rest = input.substr(consumed);
+    if (const auto length = parse_command(rest, args)) {
+      if (*length == 0) {
+        con.pending_commands.pop_back();
+        break;
+      }
+      consumed += *length;
+      continue;
+    }
+    // Anything but an array of bulk strings goes through the general parser,
+    // its arguments are copied into the arena.
+    args.clear();
+    auto parsed = parse_resp_prefix(rest);
+    if (!parsed) {
+      con.pending_commands.pop_back();
+      break;
+    }
+    consumed += parsed->second;
+    for (const auto &value : parsed->first.to_array_safe()) {
+      const auto str = value.to_string();
+      auto *copy = static_cast<char *>(con.arena.allocate(str.size(), 1));
+      std::copy(str.begin(), str.end(), copy);
+      args.emplace_back(copy, str.size());
+    }
   }
-  // Remove parsed bytes from input stream
-  // TODO: Return unparsed bytes from parser and keep those in stream.
-  con.incoming.erase(con.incoming.begin(),
-                     con.incoming.begin() + input_str.size());
-  con.outgoing.clear();
+  con.parsed_bytes = consumed;
+  span.set_count(con.pending_commands.size());
+  return con.pending_commands.empty() ? EventState::Read : EventState::Write;
+}
 
-  std::cout << "Parsed: " << parsed->to_string() << std::endl;
-  auto command_args = parsed->to_array_safe();
-  if (command_args.empty()) {
-    std::cout << "Empty command\n";
-    return EventState::Idle;
+namespace {
+
+void execute_command(Connection &con, const CommandView &command) {
+  LOG(Debug) << "Parsed: " << log_join(command);
+  if (command.empty()) {
+    LOG(Debug) << "Empty command";
+    return;
   }
-  if (!std::holds_alternative<RespString>(command_args.front().value)) {
-    std::cerr << "Unexpected entry, command string expected: "
-              << command_args.front().to_string() << std::endl;
-    return EventState::Idle;
+  // Reassigning the strings of the reused argument array keeps their buffers.
+  auto &arguments = con.arguments;
+  arguments.resize(command.size() - 1);
+  for (size_t i = 1; i < command.size(); ++i) {
+    if (auto *str = std::get_if<RespString>(&arguments[i - 1].value)) {
+      str->assign(command[i]);
+    } else {
+      arguments[i - 1] = RespValue::make_string(std::string(command[i]));
+    }
+  }
+  ++con.commands_processed;
+  // Only writes and replication links touch the replication state, and
+  // neither executes concurrently, so check for a write first.
+  auto &replication = Replication::instance();
+  if (con.replication_link && replication.handle_sync_reply(con, command)) {
+    return;
+  }
+  const bool asking = std::exchange(con.asking, false);
+  if (auto &cluster = Cluster::instance();
+      cluster.enabled() && !con.replication_link) {
+    if (auto redirect = cluster.check(command, asking)) {
+      con.outgoing.append(*redirect);
+      return;
+    }
+  }
+  const bool replicated =
+      is_write_command(command.front()) && replication.active();
+  if (replicated && replication.is_replica() && !con.replication_link &&
+      !may_write_command(command.front())) {
+    con.outgoing.append(readonly_error());
+    return;
+  }
+  auto &db = Database::instance();
+  const uint64_t modifications = replicated ? db.modifications() : 0;
+  std::optional<RespValue> command_response;
+  {
+    TraceSpan span("command", command.front(), con.fd);
+    executing_connection = &con;
+    command_response = dispatch_commands(command.front(), arguments);
+    executing_connection = nullptr;
+  }
+  if (replicated) {
+    replication.on_write(con, command, db.modifications() != modifications);
   }
-  const std::string command_string = command_args.front().to_string();
-  command_args.erase(command_args.begin());
-  auto command_response = dispatch_commands(command_string, command_args);
   if (!command_response) {
-    std::cerr << "Failed to handle command `" << command_string << "`\n";
-    return EventState::Idle;
+    LOG_RATE_LIMITED(Warning, 10)
+        << "Failed to handle command `" << command.front() << "`";
+    return;
+  }
+  if (con.replication_link) {
+    return;
+  }
+  // Only commands that got a reply, a replay would wait forever for the
+  // others.
+  if (auto &capture = Capture::instance(); capture.enabled()) {
+    capture.record(con.id, command);
+  }
+  // Encode the response into the outgoing buffer. Anything queued earlier
+  // (e.g. Pub/Sub messages) is sent first.
+  con.outgoing.append(*command_response);
+}
+
+}  // namespace
+
+bool can_execute_concurrently(Connection &con) {
+  // Tracking and Pub/Sub clients receive pushes from the writer at any time,
+  // and replication links the stream.
+  if (con.replication_link || Tracking::instance().is_enabled(con) ||
+      PubSub::instance().is_subscribed(con)) {
+    return false;
+  }
+  const auto remaining =
+      std::span(con.pending_commands).subspan(con.next_command);
+  return std::ranges::all_of(remaining, [](const auto &command) {
+    return !command.empty() && is_read_only_command(command.front());
+  });
+}
+
+EventState execute_commands(Connection &con) {
+  const auto &limits = ClientLimits::instance();
+  const size_t budget = limits.max_commands_per_wakeup;
+  const size_t end =
+      budget ? std::min(con.pending_commands.size(), con.next_command + budget)
+             : con.pending_commands.size();
+  while (con.next_command < end) {
+    // The rest waits until the client reads what it has, see
+    // `ClientLimits::max_pending_output`.
+    if (limits.max_pending_output && !con.replication_link &&
+        con.outgoing.size() > limits.max_pending_output) {
+      break;
+    }
+    execute_command(con, con.pending_commands[con.next_command++]);
+  }
+  // Once per batch, so a value modified by many pipelined commands is only
+  // copied for concurrent readers once. No reply has been sent yet.
+  Database::instance().commit();
+  if (con.next_command == con.pending_commands.size()) {
+    discard_commands(con);
   }
-  // Convert response into protocol representation and add to outgoing buffer.
-  const auto command_response_encoded =
-      command_response->to_protocol_representation();
-  std::copy(command_response_encoded.begin(), command_response_encoded.end(),
-            std::back_inserter(con.outgoing));
   if (con.outgoing.empty()) {
     return EventState::Idle;
   }
   return EventState::Write;
 }
 
+bool has_pending_commands(const Connection &con) {
+  return con.next_command < con.pending_commands.size();
+}
+
+void discard_commands(Connection &con) {
+  // The vector's storage lives in the arena, release it before the reset.
+  std::pmr::vector<CommandView>(&con.arena).swap(con.pending_commands);
+  con.next_command = 0;
+  con.arena.reset();
+  con.incoming.erase(con.incoming.begin(),
+                     con.incoming.begin() + con.parsed_bytes);
+  con.parsed_bytes = 0;
+}
+
 EventState handle_write(Connection &con) {
-  std::cout << "Handling `write` on socket " << con.fd << std::endl;
-  const auto bytes_written =
-      send(con.fd, con.outgoing.data(), con.outgoing.size(), 0);
-  std::cout << "Wrote " << bytes_written << " bytes." << std::endl;
-  con.outgoing.erase(con.outgoing.begin(),
-                     con.outgoing.begin() + bytes_written);
+  LOG(Debug) << "Handling `write` on socket " << con.fd;
+  con.write_requested = false;
+  struct iovec iov[max_write_segments];
+  const size_t iov_count = con.outgoing.gather(iov, max_write_segments);
+  TraceSpan span("io", "write", con.fd);
+  const auto bytes_written = writev(con.fd, iov, iov_count);
+  span.set_count(std::max<ssize_t>(bytes_written, 0));
+  LOG(Debug) << "Wrote " << bytes_written << " bytes.";
+  if (bytes_written > 0) {
+    ServerStats::instance().bytes_out.fetch_add(bytes_written,
+                                                std::memory_order_relaxed);
+    con.outgoing.consume(bytes_written);
+  }
   if (!con.outgoing.empty()) {
     return EventState::Write;
   }
   return EventState::Idle;
-}
\ No newline at end of file
+}
+
+bool output_limit_exceeded(Connection &con) {
+  auto client_class = ClientClass::Normal;
+  if (con.replication_link) {
+    // The snapshot of a full sync doesn't count.
+    if (Replication::instance().sending_snapshot(con)) {
+      return false;
+    }
+    client_class = ClientClass::Replica;
+  } else if (PubSub::instance().is_subscribed(con)) {
+    client_class = ClientClass::PubSub;
+  }
+  const auto &limit =
+      ClientLimits::instance()
+          .output_buffer[static_cast<size_t>(client_class)];
+  const size_t pending = con.outgoing.size();
+  if (limit.hard && pending > limit.hard) {
+    return true;
+  }
+  if (!limit.soft || pending <= limit.soft) {
+    con.soft_limit_since.reset();
+    return false;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (!con.soft_limit_since) {
+    con.soft_limit_since = now;
+  }
+  return now - *con.soft_limit_since >= limit.soft_seconds;
+}
+
+void handle_close(Connection &con) {
+  PubSub::instance().unsubscribe_all(con);
+  Tracking::instance().disable(con);
+  Replication::instance().on_close(con);
+}
@@ -1,19 +1,190 @@
 #pragma once
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#include <array>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "arena.h"
+#include "resp_parser.h"
+#include "resp_types.h"
+
+// Bytes queued for sending on a connection. Regular replies are copied into
+// owned segments, shared buffers (e.g. a published message encoded once for
+// all subscribers) are only referenced.
+class OutputChain {
+ public:
+  void append(std::string_view bytes);
+  // Encodes `value` directly into the chain.
+  void append(const RespValue& value);
+  void append_shared(std::shared_ptr<const std::string> buffer);
+
+  bool empty() const { return pending_bytes == 0; }
+  size_t size() const { return pending_bytes; }
+  // Bytes consumed so far.
+  uint64_t sent() const { return sent_bytes; }
+
+  // Fills up to `max_count` iovecs with the front of the chain and returns
+  // how many were used.
+  size_t gather(struct iovec *iov, size_t max_count) const;
+  // Drops `bytes` sent bytes from the front of the chain. The last owned
+  // segment is kept for reuse, so steady request/reply traffic doesn't
+  // allocate.
+  void consume(size_t bytes);
+
+ private:
+  struct Segment {
+    std::string owned;
+    std::shared_ptr<const std::string> shared;
+
+    std::string_view view() const {
+      return shared ? std::string_view(*shared) : std::string_view(owned);
+    }
+  };
+
+  // The owned segment at the end of the chain, appended if necessary.
+  std::string& owned_tail();
+
+  std::deque<Segment> segments;
+  size_t front_offset = 0;
+  size_t pending_bytes = 0;
+  uint64_t sent_bytes = 0;
+};
+
+// Client classes with separate output buffer limits.
+enum class ClientClass { Normal, PubSub, Replica };
+constexpr size_t client_class_count = 3;
+
+// Limits that keep single clients from growing the server's memory without
+// bound or monopolizing the event loop. Set before serving.
+class ClientLimits {
+ public:
+  static ClientLimits& instance() {
+    static ClientLimits instance;
+    return instance;
+  }
+
+  // Pending output that closes a client: right away above `hard`, or when it
+  // stays above `soft` for `soft_seconds`. Zero disables a limit.
+  struct OutputBufferLimit {
+    size_t hard = 0;
+    size_t soft = 0;
+    std::chrono::seconds soft_seconds{0};
+  };
+  // Same defaults as Redis: normal clients are held back by
+  // `max_pending_output` instead, subscribers and replicas can't be.
+  std::array<OutputBufferLimit, client_class_count> output_buffer = {
+      OutputBufferLimit{},
+      OutputBufferLimit{32 << 20, 8 << 20, std::chrono::seconds(60)},
+      OutputBufferLimit{256 << 20, 64 << 20, std::chrono::seconds(60)}};
+  // The event loop stops reading from a connection while more output than
+  // this waits to be sent, and resumes once half of it is. Zero disables.
+  size_t max_pending_output = 1 << 20;
+  // Commands of one connection executed per event loop iteration, the rest
+  // wait for the next one so a long pipeline can't starve other clients.
+  // Zero disables.
+  size_t max_commands_per_wakeup = 512;
+  // Unparsed or unexecuted input that closes a client.
+  size_t max_query_buffer = size_t{1} << 30;
+
+ private:
+  ClientLimits() = default;
+  // Delete copy/move operations
+  ClientLimits(const ClientLimits&) = delete;
+  ClientLimits& operator=(const ClientLimits&) = delete;
+  ClientLimits(ClientLimits&&) = delete;
+  ClientLimits& operator=(ClientLimits&&) = delete;
+};
+
 struct Connection {
   int fd = -1;
+  // Unique for the lifetime of the server, unlike `fd`.
+  uint64_t id = 0;
   std::vector<uint8_t> incoming;
-  std::vector<uint8_t> outgoing;
+  // Bytes at the front of `incoming` that `pending_commands` point into.
+  size_t parsed_bytes = 0;
+  // Scratch memory for the commands of one read, reset once they executed.
+  Arena arena;
+  // Commands parsed from `incoming` that wait for execution.
+  std::pmr::vector<CommandView> pending_commands{&arena};
+  // Index of the next of `pending_commands` to execute.
+  size_t next_command = 0;
+  // Arguments of the executing command. Reused so their strings keep their
+  // capacity across commands.
+  RespArray arguments;
+  OutputChain outgoing;
+  // Output was queued from outside this connection's own events.
+  bool write_requested = false;
+  // The peer went away or the socket failed, close after this iteration.
+  bool closing = false;
+  // The event loop stopped polling for input until `outgoing` drains.
+  bool reading_paused = false;
+  // When `outgoing` went above the soft output buffer limit.
+  std::optional<std::chrono::steady_clock::time_point> soft_limit_since;
+  uint64_t commands_processed = 0;
+  // Carries the replication stream, see `Replication`: the link to this
+  // replica's primary or a replica of this server. Commands on it get no
+  // replies and aren't subject to backpressure.
+  bool replication_link = false;
+  // ASKING came right before the next command, see `Cluster`.
+  bool asking = false;
 
  public:
-  Connection(int handle) : fd{handle}, incoming{}, outgoing{} {}
+  Connection(int handle) : fd{handle}, id{next_connection_id()} {}
+
+  // `pending_commands` refers to `arena`, so connections stay in place.
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+ private:
+  static uint64_t next_connection_id() {
+    static uint64_t next_id = 0;
+    return ++next_id;
+  }
 };
 
 enum class EventState { Idle, Read, Write, Close };
 
-EventState handle_read(Connection &con);
-EventState handle_write(Connection &con);
\ No newline at end of file
+// Receives available bytes and parses all complete commands into
+// `pending_commands`. Touches nothing but `con`, so it may run on an I/O
+// thread. Must not be called while commands are pending. Closes clients
+// whose input exceeds `ClientLimits::max_query_buffer`.
+EventState read_commands(Connection &con);
+// Executes the next `ClientLimits::max_commands_per_wakeup` of
+// `pending_commands` in order and queues the replies, stopping early once
+// `ClientLimits::max_pending_output` is exceeded. Main thread only,
+// unless `can_execute_concurrently` allowed it inside a
+// `Database::ConcurrentRead`.
+EventState execute_commands(Connection &con);
+bool has_pending_commands(const Connection &con);
+// Drops `pending_commands` and the input they were parsed from.
+void discard_commands(Connection &con);
+// True if all remaining `pending_commands` are read-only and nothing but this
+// connection's own commands queues output on it. Main thread only.
+bool can_execute_concurrently(Connection &con);
+// Sends queued output. May run on an I/O thread.
+EventState handle_write(Connection &con);
+// True if the pending output of `con` exceeds the output buffer limits of
+// its class. Main thread only.
+bool output_limit_exceeded(Connection &con);
+// Releases per-connection state held by other modules before it is closed.
+void handle_close(Connection &con);
+
+// The connection whose command is currently being executed, if any.
+Connection *current_connection();
+
+// Marks `con` as having output that the event loop needs to flush.
+void request_write(Connection &con);
+// Moves the file descriptors passed to `request_write` into `fds`, keeping
+// the capacity of both vectors.
+void take_write_requests(std::vector<int> &fds);
+bool has_write_requests();
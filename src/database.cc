@@ -1,46 +1,484 @@
 #include "database.h"
 
-#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-std::optional<RespValue> Database::get(const std::string key) {
-  expire_keys();
-  const auto it = map.find(key);
-  if (it == map.end()) {
+#include "cluster.h"
+#include "compression.h"
+#include "lazy_free.h"
+#include "log.h"
+#include "slab.h"
+#include "tracking.h"
+
+namespace {
+
+// Fragmentation that is worth a defragmentation pass: at least this much
+// unused slab memory which is also this share of all slab memory.
+constexpr size_t defragment_min_wasted_bytes = 1 << 20;
+constexpr size_t defragment_min_wasted_percent = 10;
+
+// Strings of at least this size are stored as `RespSharedString`, so replies
+// reference them instead of copying.
+constexpr size_t shared_string_min_size = 16 * 1024;
+
+// Set on threads inside a `Database::ConcurrentRead`.
+thread_local bool concurrent_reader = false;
+
+bool is_expired(const HashTable::Node &node) {
+  const auto expires_at = node.expires_at.load(std::memory_order_relaxed);
+  return expires_at != 0 &&
+         expires_at <=
+             std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// Redis' LFU defaults: keys start with a counter of 5 that grows
+// logarithmically with factor 10 and decays by one per idle minute.
+constexpr uint8_t initial_frequency = 5;
+constexpr double frequency_log_factor = 10;
+constexpr uint32_t frequency_decay_seconds = 60;
+
+uint8_t decayed_frequency(const HashTable::Node &node, uint32_t now) {
+  const uint8_t counter = node.frequency.load(std::memory_order_relaxed);
+  const uint32_t periods =
+      (now - node.accessed_at.load(std::memory_order_relaxed)) /
+      frequency_decay_seconds;
+  return periods >= counter ? 0 : counter - periods;
+}
+
+// Records an access to `node`. Only writes what changed, so readers of a hot
+// key rarely store to its node.
+void touch(const HashTable::Node &node, uint32_t now) {
+  uint8_t counter = decayed_frequency(node, now);
+  if (counter < UINT8_MAX) {
+    thread_local std::minstd_rand random{std::random_device{}()};
+    const double base = std::max(counter - initial_frequency, 0);
+    if (std::uniform_real_distribution<>()(random) <
+        1 / (base * frequency_log_factor + 1)) {
+      ++counter;
+    }
+  }
+  if (node.frequency.load(std::memory_order_relaxed) != counter) {
+    node.frequency.store(counter, std::memory_order_relaxed);
+  }
+  if (node.accessed_at.load(std::memory_order_relaxed) != now) {
+    node.accessed_at.store(now, std::memory_order_relaxed);
+  }
+}
+
+void start_access_stats(const HashTable::Node &node, uint32_t now) {
+  node.accessed_at.store(now, std::memory_order_relaxed);
+  node.frequency.store(initial_frequency, std::memory_order_relaxed);
+}
+
+// Heap bytes a string owns beyond its object, none while it fits inline.
+size_t heap_bytes(const std::string &str) {
+  return str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0;
+}
+
+// Heap bytes owned by `value`. Collections are extrapolated from their first
+// `samples` elements, or fully counted if `samples` is zero.
+size_t value_bytes(const RespValue &value, size_t samples) {
+  const auto sampled = [samples](const auto &elements, auto element_bytes) {
+    size_t bytes = 0;
+    size_t counted = 0;
+    for (const auto &element : elements) {
+      if (samples && counted == samples) {
+        break;
+      }
+      bytes += element_bytes(element);
+      ++counted;
+    }
+    return counted ? bytes * elements.size() / counted : 0;
+  };
+  return std::visit(
+      [&](const auto &v) -> size_t {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, RespString>) {
+          return heap_bytes(v);
+        } else if constexpr (std::is_same_v<T, RespSharedString>) {
+          // The string object and the reference count share one allocation.
+          return sizeof(std::string) + 2 * sizeof(void *) + heap_bytes(*v.data);
+        } else if constexpr (std::is_same_v<T, RespCompressedString>) {
+          return heap_bytes(v.data);
+        } else if constexpr (std::is_same_v<T, RespError>) {
+          return heap_bytes(v.message);
+        } else if constexpr (std::is_same_v<T, RespArray>) {
+          return v.capacity() * sizeof(RespValue) +
+                 sampled(v, [samples](const RespValue &element) {
+                   return value_bytes(element, samples);
+                 });
+        } else if constexpr (std::is_same_v<T, RespPush>) {
+          return v.values.capacity() * sizeof(RespValue) +
+                 sampled(v.values, [samples](const RespValue &element) {
+                   return value_bytes(element, samples);
+                 });
+        } else if constexpr (std::is_same_v<T, RespMap>) {
+          // A bucket pointer each, and a node with the cached hash.
+          return v.bucket_count() * sizeof(void *) +
+                 sampled(v, [samples](const auto &element) {
+                   return sizeof(void *) + sizeof(element) + sizeof(size_t) +
+                          heap_bytes(element.first) +
+                          value_bytes(element.second, samples);
+                 });
+        } else {
+          return 0;
+        }
+      },
+      value.value);
+}
+
+}  // namespace
+
+void Database::enable_concurrent_reads() {
+  EpochManager::instance().set_concurrent(true);
+  table.set_concurrent(true);
+}
+
+Database::ConcurrentRead::ConcurrentRead() { concurrent_reader = true; }
+
+Database::ConcurrentRead::~ConcurrentRead() { concurrent_reader = false; }
+
+void Database::enable_slot_index() {
+  slot_keys.resize(cluster_slots);
+}
+
+size_t Database::count_keys_in_slot(uint16_t slot) const {
+  return slot_keys.empty() ? 0 : slot_keys[slot].size();
+}
+
+std::vector<std::string> Database::keys_in_slot(uint16_t slot,
+                                                size_t count) const {
+  std::vector<std::string> keys;
+  if (slot_keys.empty()) {
+    return keys;
+  }
+  for (const auto &key : slot_keys[slot]) {
+    if (keys.size() == count) {
+      break;
+    }
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+void Database::on_key_added(const std::string &key) {
+  if (!slot_keys.empty()) {
+    slot_keys[key_hash_slot(key)].insert(key);
+  }
+}
+
+void Database::on_key_removed(const std::string &key) {
+  if (!slot_keys.empty()) {
+    slot_keys[key_hash_slot(key)].erase(key);
+  }
+}
+
+std::optional<RespValue> Database::get(const std::string &key) {
+  if (!concurrent_reader) {
+    expire_keys();
+  }
+  const auto *value = lookup(key);
+  if (!value) {
     return std::nullopt;
   }
-  return it->second;
+  return *value;
 }
 
-std::optional<RespValue> Database::set(
-    const std::string key, RespValue value,
-    std::optional<std::chrono::milliseconds> expire_in) {
+void Database::set(const std::string key, RespValue value,
+                   std::optional<std::chrono::milliseconds> expire_in) {
+  assert(!concurrent_reader);
   expire_keys();
+  if (auto *str = std::get_if<RespString>(&value.value)) {
+    if (auto compressed = compress_value(*str)) {
+      value = RespValue(std::move(*compressed));
+    } else if (str->size() >= shared_string_min_size) {
+      value = RespValue::make_shared_string(
+          std::make_shared<const std::string>(std::move(*str)));
+    }
+  }
+  auto *node = table.find_mutable(key);
+  if (node) {
+    table.assign(*node, std::move(value));
+  } else {
+    node = &table.insert(key, std::move(value));
+    start_access_stats(*node, access_clock.load(std::memory_order_relaxed));
+    on_key_added(key);
+  }
+  touch(*node, access_clock.load(std::memory_order_relaxed));
   if (expire_in) {
-    std::cout << "Marking key " << key << " to expire in " << *expire_in
-              << "ms." << std::endl;
+    LOG(Debug) << "Marking key " << key << " to expire in "
+               << expire_in->count() << "ms.";
     const auto now = std::chrono::steady_clock::now();
     const auto expire_on = now + *expire_in;
-    expiring_keys.insert({key, expire_on});
+    expiring_keys.insert_or_assign(key, expire_on);
+    node->expires_at.store(expire_on.time_since_epoch().count(),
+                           std::memory_order_relaxed);
+  }
+  signal_modified(key);
+}
+
+bool Database::erase(const std::string &key) {
+  assert(!concurrent_reader);
+  expiring_keys.erase(key);
+  if (!table.erase(key)) {
+    return false;
+  }
+  on_key_removed(key);
+  signal_modified(key);
+  return true;
+}
+
+const RespValue *Database::lookup(const std::string &key) {
+  if (concurrent_reader) {
+    const auto *node = table.find(key);
+    if (!node || is_expired(*node)) {
+      return nullptr;
+    }
+    touch(*node, access_clock.load(std::memory_order_relaxed));
+    return &node->entry.load(std::memory_order_acquire)->value;
   }
-  auto it = map.find(key);
-  std::optional<RespValue> old_value = std::nullopt;
-  if (it != map.end()) {
-    old_value = it->second;
-    it->second = value;
+  expire_if_needed(key);
+  Tracking::instance().on_key_read(key);
+  const auto *node = table.find(key);
+  if (!node) {
+    return nullptr;
+  }
+  touch(*node, access_clock.load(std::memory_order_relaxed));
+  return &HashTable::value(*node);
+}
+
+const RespValue *Database::peek(const std::string &key,
+                                AccessStats *access) const {
+  const auto *node = table.find(key);
+  if (!node || is_expired(*node)) {
+    return nullptr;
+  }
+  if (access) {
+    const uint32_t now = access_clock.load(std::memory_order_relaxed);
+    access->idle = std::chrono::seconds(
+        now - node->accessed_at.load(std::memory_order_relaxed));
+    access->frequency = decayed_frequency(*node, now);
+  }
+  return concurrent_reader ? &node->entry.load(std::memory_order_acquire)->value
+                           : &HashTable::value(*node);
+}
+
+std::optional<size_t> Database::memory_usage(const std::string &key,
+                                             size_t samples) const {
+  const auto *value = peek(key);
+  if (!value) {
+    return std::nullopt;
+  }
+  return memory_usage(key, *value, samples);
+}
+
+size_t Database::memory_usage(const std::string &key, const RespValue &value,
+                              size_t samples) const {
+  // Each key's share of the bucket array.
+  const size_t bucket_bytes =
+      table.bucket_count() * sizeof(void *) / std::max<size_t>(size(), 1);
+  return HashTable::node_bytes() + bucket_bytes + heap_bytes(key) +
+         value_bytes(value, samples);
+}
+
+size_t Database::overhead_bytes() const {
+  // The expiry index holds a copy of every expiring key with its deadline,
+  // counted without the heap bytes of long keys.
+  const size_t expires =
+      expiring_keys.bucket_count() * sizeof(void *) +
+      expiring_keys.size() * (sizeof(decltype(expiring_keys)::value_type) +
+                              2 * sizeof(void *));
+  return table.overhead_bytes() + expires;
+}
+
+void Database::update_access_clock(
+    std::chrono::steady_clock::time_point now) {
+  access_clock.store(
+      std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch())
+          .count(),
+      std::memory_order_relaxed);
+}
+
+RespValue *Database::find(const std::string &key) {
+  assert(!concurrent_reader);
+  expire_if_needed(key);
+  Tracking::instance().on_key_read(key);
+  auto *node = table.find_mutable(key);
+  if (!node) {
+    return nullptr;
+  }
+  touch(*node, access_clock.load(std::memory_order_relaxed));
+  return &table.modify(*node);
+}
+
+RespValue &Database::find_or_insert(const std::string &key,
+                                    RespValue initial) {
+  assert(!concurrent_reader);
+  expire_if_needed(key);
+  auto *node = table.find_mutable(key);
+  if (!node) {
+    node = &table.insert(key, std::move(initial));
+    start_access_stats(*node, access_clock.load(std::memory_order_relaxed));
+    on_key_added(key);
+  }
+  touch(*node, access_clock.load(std::memory_order_relaxed));
+  return table.modify(*node);
+}
+
+bool Database::expire_if_needed(const std::string &key) {
+  const auto it = expiring_keys.find(key);
+  if (it == expiring_keys.end() ||
+      it->second > std::chrono::steady_clock::now()) {
+    return false;
+  }
+  table.erase(key);
+  on_key_removed(key);
+  expiring_keys.erase(it);
+  Tracking::instance().on_key_expired(key);
+  return true;
+}
+
+bool Database::set_expiry(const std::string &key,
+                          std::optional<std::chrono::milliseconds> expire_in) {
+  assert(!concurrent_reader);
+  expire_if_needed(key);
+  auto *node = table.find_mutable(key);
+  if (!node) {
+    return false;
+  }
+  if (expire_in) {
+    const auto expire_on = std::chrono::steady_clock::now() + *expire_in;
+    expiring_keys.insert_or_assign(key, expire_on);
+    node->expires_at.store(expire_on.time_since_epoch().count(),
+                           std::memory_order_relaxed);
   } else {
-    map.insert({key, value});
+    expiring_keys.erase(key);
+    node->expires_at.store(0, std::memory_order_relaxed);
+  }
+  signal_modified(key);
+  return true;
+}
+
+std::optional<std::chrono::milliseconds> Database::time_to_live(
+    const std::string &key) const {
+  const auto it = expiring_keys.find(key);
+  if (it == expiring_keys.end()) {
+    return std::nullopt;
+  }
+  const auto left = it->second - std::chrono::steady_clock::now();
+  return std::max(std::chrono::milliseconds(1),
+                  std::chrono::ceil<std::chrono::milliseconds>(left));
+}
+
+void Database::clear(bool lazily) {
+  assert(!concurrent_reader);
+  table.clear(lazily);
+  if (lazily) {
+    auto &lazy_free = LazyFree::instance();
+    lazy_free.release_in_background(std::exchange(expiring_keys, {}));
+    if (!slot_keys.empty()) {
+      lazy_free.release_in_background(std::exchange(
+          slot_keys,
+          std::vector<std::unordered_set<std::string>>(cluster_slots)));
+    }
+  } else {
+    expiring_keys.clear();
+    for (auto &keys : slot_keys) {
+      keys.clear();
+    }
+  }
+  ++modification_count;
+  Tracking::instance().on_flush();
+}
+
+void Database::for_each(
+    const std::function<void(const std::string &, const RespValue &,
+                             std::optional<std::chrono::milliseconds>)>
+        &visit) const {
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  table.for_each([&](const HashTable::Node &node) {
+    std::optional<std::chrono::milliseconds> expire_in;
+    if (const auto expires_at =
+            node.expires_at.load(std::memory_order_relaxed)) {
+      const std::chrono::steady_clock::duration left(expires_at - now.count());
+      if (left <= left.zero()) {
+        return;
+      }
+      expire_in = std::chrono::ceil<std::chrono::milliseconds>(left);
+    }
+    visit(node.entry.load(std::memory_order_relaxed)->key,
+          HashTable::value(node), expire_in);
+  });
+}
+
+uint64_t Database::scan(
+    uint64_t cursor, size_t count,
+    const std::function<void(const std::string &, const RespValue &)> &visit)
+    const {
+  size_t visited = 0;
+  size_t buckets = 0;
+  do {
+    cursor = table.scan(cursor, [&](const HashTable::Node &node) {
+      ++visited;
+      if (is_expired(node)) {
+        return;
+      }
+      const auto *entry = node.entry.load(std::memory_order_acquire);
+      visit(entry->key,
+            concurrent_reader ? entry->value : HashTable::value(node));
+    });
+  } while (cursor != 0 && visited < count && ++buckets < count * 10);
+  return cursor;
+}
+
+void Database::signal_modified(const std::string &key) {
+  ++modification_count;
+  Tracking::instance().on_key_modified(key);
+}
+
+void Database::commit() {
+  if (!concurrent_reader) {
+    table.commit_drafts();
+  }
+}
+
+bool Database::needs_defragmentation() const {
+  if (defragmenting) {
+    return true;
+  }
+  const auto &slabs = SlabAllocator::instance();
+  if (slabs.frees() == frees_after_defragment) {
+    return false;
+  }
+  const size_t mapped = slabs.slab_bytes();
+  const size_t wasted = mapped - slabs.used_bytes();
+  return wasted >= defragment_min_wasted_bytes &&
+         wasted * 100 >= mapped * defragment_min_wasted_percent;
+}
+
+void Database::defragment(size_t budget) {
+  assert(!concurrent_reader);
+  defragmenting = !table.defragment(budget);
+  if (!defragmenting) {
+    frees_after_defragment = SlabAllocator::instance().frees();
   }
-  return old_value;
 }
 
 void Database::expire_keys() {
   const auto now = std::chrono::steady_clock::now();
   for (auto it = expiring_keys.begin(); it != expiring_keys.end(); /* */) {
     if (it->second <= now) {  // Key is expiring
-      map.erase(it->first);
+      table.erase(it->first);
+      on_key_removed(it->first);
+      Tracking::instance().on_key_expired(it->first);
       it = expiring_keys.erase(it);
     } else {
       ++it;
     }
   }
-}
\ No newline at end of file
+}
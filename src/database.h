@@ -1,8 +1,15 @@
 #pragma once
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <optional>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "epoch.h"
+#include "hash_table.h"
 #include "resp_types.h"
 
 class Database {
@@ -12,12 +19,124 @@ class Database {
     return instance;
   }
 
-  std::optional<RespValue> get(std::string key);
-  std::optional<RespValue> set(
-      std::string key, RespValue value,
-      std::optional<std::chrono::milliseconds> expire_in);
+  // Allows reader threads to look up keys through `ConcurrentRead` while the
+  // main thread keeps writing. Values are then copied on write instead of
+  // modified in place. Must be called before any reader thread starts.
+  void enable_concurrent_reads();
+
+  // Marks the calling thread as a reader running next to the writer for its
+  // lifetime. Lookups inside only see published values, treat expired keys as
+  // missing without removing them and skip client tracking.
+  class ConcurrentRead {
+   public:
+    ConcurrentRead();
+    ~ConcurrentRead();
+
+   private:
+    EpochGuard guard;
+  };
+
+  // Keeps the keys of every cluster hash slot in an index, so a slot's keys
+  // are counted and listed without scanning the keyspace. Must be called
+  // before any key is stored.
+  void enable_slot_index();
+  size_t count_keys_in_slot(uint16_t slot) const;
+  // Up to `count` keys of `slot`. Writer only.
+  std::vector<std::string> keys_in_slot(uint16_t slot, size_t count) const;
+
+  std::optional<RespValue> get(const std::string& key);
+  void set(std::string key, RespValue value,
+           std::optional<std::chrono::milliseconds> expire_in);
+  bool erase(const std::string& key);
+  // Removes every key. With `lazily` set their memory is freed in the
+  // background, partly by `free_lazily`.
+  void clear(bool lazily);
+  // Whether keys removed by `clear` still wait for `free_lazily`.
+  bool has_lazy_free_work() const { return table.has_detached(); }
+  // Frees at most `budget` of them. Writer only.
+  void free_lazily(size_t budget) { table.free_detached(budget); }
+
+  // Read-only access, also allowed inside a `ConcurrentRead`. The pointer
+  // stays valid until the keyspace is modified or the `ConcurrentRead` ends.
+  const RespValue* lookup(const std::string& key);
+
+  // Access statistics of a key, for OBJECT IDLETIME and FREQ.
+  struct AccessStats {
+    std::chrono::seconds idle;
+    // Logarithmic access counter like Redis' LFU counter.
+    uint8_t frequency;
+  };
+  // Like `lookup`, but doesn't count as an access, remove an expired key or
+  // track the read. Fills `access` if given. Any thread.
+  const RespValue* peek(const std::string& key,
+                        AccessStats* access = nullptr) const;
+
+  // Bytes `key` takes with its value, node, entry and share of the bucket
+  // array. Collections are estimated from `samples` of their elements, or
+  // all of them if it is zero. Nothing if `key` doesn't exist. Any thread.
+  std::optional<size_t> memory_usage(const std::string& key,
+                                     size_t samples) const;
+  size_t memory_usage(const std::string& key, const RespValue& value,
+                      size_t samples) const;
+  // Bytes of the keyspace's own structures, without keys and values.
+  size_t overhead_bytes() const;
+  // Sets the clock of the access statistics, once per event loop iteration.
+  void update_access_clock(std::chrono::steady_clock::time_point now);
+
+  // In-place access to stored values, writer only. The returned
+  // pointer/reference stays valid until the keyspace is modified.
+  RespValue* find(const std::string& key);
+  RespValue& find_or_insert(const std::string& key, RespValue initial);
+  // Must be called after modifying a value obtained from `find` or
+  // `find_or_insert` in place.
+  void signal_modified(const std::string& key);
+  // Publishes the values modified in place by the current commands to
+  // concurrent readers. Called after every batch of commands, before their
+  // replies are sent.
+  void commit();
+  // Counts modifications signalled so far, so callers can tell whether a
+  // command changed the keyspace.
+  uint64_t modifications() const { return modification_count; }
+
+  // Calls `visit` with every key that hasn't expired, its value and its
+  // remaining time to live. Writer only, `visit` must not modify the
+  // keyspace.
+  void for_each(
+      const std::function<void(const std::string&, const RespValue&,
+                               std::optional<std::chrono::milliseconds>)>&
+          visit) const;
+
+  // Continues a scan of the keyspace at `cursor`, 0 to start one. Calls
+  // `visit` with the keys of the next buckets that haven't expired and their
+  // values, stopping after about `count` keys or 10 times as many empty
+  // buckets. Returns the cursor to continue with, 0 once the scan is
+  // complete. Any thread.
+  uint64_t scan(uint64_t cursor, size_t count,
+                const std::function<void(const std::string&,
+                                         const RespValue&)>& visit) const;
+
+  // Makes `key` expire in `expire_in`, or never if it is nothing. Returns
+  // false if the key doesn't exist. Writer only.
+  bool set_expiry(const std::string& key,
+                  std::optional<std::chrono::milliseconds> expire_in);
+
+  // Remaining time to live of `key`, nothing if it doesn't expire. Writer
+  // only.
+  std::optional<std::chrono::milliseconds> time_to_live(
+      const std::string& key) const;
+
+  size_t size() const { return table.size(); }
+  size_t expiring_size() const { return expiring_keys.size(); }
+
+  // Incremental defragmentation of the keyspace while the event loop is idle.
+  // A pass is due when churn left the slabs fragmented.
+  bool needs_defragmentation() const;
+  // Runs the next step of the pass, visiting at most `budget` keys.
+  void defragment(size_t budget);
 
   void expire_keys();
+  // Removes `key` if its expiry has passed. Returns true if it was removed.
+  bool expire_if_needed(const std::string& key);
 
  private:
   Database() = default;
@@ -27,8 +146,20 @@ class Database {
   Database(Database&&) = delete;
   Database& operator=(Database&&) = delete;
 
-  std::unordered_map<std::string, RespValue> map;
+  // Maintain the slot index, if enabled.
+  void on_key_added(const std::string& key);
+  void on_key_removed(const std::string& key);
+
+  HashTable table;
+  // Keys per cluster hash slot, empty unless `enable_slot_index` was called.
+  std::vector<std::unordered_set<std::string>> slot_keys;
   std::unordered_map<std::string,
                      std::chrono::time_point<std::chrono::steady_clock>>
       expiring_keys;
-};
\ No newline at end of file
+  uint64_t modification_count = 0;
+  // Seconds of `steady_clock` as of the current event loop iteration.
+  std::atomic<uint32_t> access_clock{0};
+  bool defragmenting = false;
+  // `SlabAllocator::frees` when the last pass finished.
+  uint64_t frees_after_defragment = 0;
+};
@@ -0,0 +1,94 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "log.h"
+
+namespace {
+
+thread_local size_t guard_depth = 0;
+
+}  // namespace
+
+EpochManager::ThreadSlot& EpochManager::local_slot() {
+  // Frees the slot again when the thread exits.
+  struct SlotOwner {
+    ThreadSlot* slot = nullptr;
+    ~SlotOwner() {
+      if (slot) {
+        slot->in_use.store(false, std::memory_order_release);
+      }
+    }
+  };
+  thread_local SlotOwner owner;
+  if (!owner.slot) {
+    for (auto& slot : slots) {
+      bool expected = false;
+      if (slot.in_use.compare_exchange_strong(expected, true)) {
+        owner.slot = &slot;
+        break;
+      }
+    }
+    if (!owner.slot) {
+      LOG(Error) << "More than " << max_threads
+                 << " threads use epoch based reclamation";
+      Logger::instance().flush();
+      std::abort();
+    }
+  }
+  return *owner.slot;
+}
+
+void EpochManager::enter() {
+  if (guard_depth++ > 0) {
+    return;
+  }
+  // Sequentially consistent so that the writer either sees this slot as
+  // active or this thread sees everything unlinked before the writer looked.
+  local_slot().epoch.store(global_epoch.load());
+}
+
+void EpochManager::leave() {
+  if (--guard_depth > 0) {
+    return;
+  }
+  local_slot().epoch.store(0, std::memory_order_release);
+}
+
+void EpochManager::retire(void* object, void (*destroy)(void*)) {
+  if (!concurrent) {
+    destroy(object);
+    return;
+  }
+  retired.push_back(
+      Retired{.epoch = global_epoch.load(std::memory_order_relaxed),
+              .object = object,
+              .destroy = destroy});
+}
+
+void EpochManager::reclaim() {
+  if (retired.empty()) {
+    return;
+  }
+  const uint64_t current = global_epoch.load(std::memory_order_relaxed);
+  uint64_t oldest = current;
+  for (const auto& slot : slots) {
+    const uint64_t epoch = slot.epoch.load();
+    if (epoch != 0) {
+      oldest = std::min(oldest, epoch);
+    }
+  }
+  if (oldest == current) {
+    global_epoch.store(current + 1);
+  }
+  // A reader that entered in epoch `oldest` or later started after every
+  // object retired in an earlier epoch was unlinked.
+  const auto end = std::find_if(
+      retired.begin(), retired.end(),
+      [oldest](const Retired& entry) { return entry.epoch >= oldest; });
+  for (auto it = retired.begin(); it != end; ++it) {
+    it->destroy(it->object);
+  }
+  retired.erase(retired.begin(), end);
+}
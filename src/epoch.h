@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Epoch based reclamation for memory shared with lock-free readers. Readers
+// wrap their accesses in an `EpochGuard`. The writer unlinks an object first
+// and then hands it to `retire`; it is destroyed by `reclaim` once every
+// reader that might still hold a pointer to it has left its guard.
+class EpochManager {
+ public:
+  static EpochManager& instance() {
+    static EpochManager instance;
+    return instance;
+  }
+
+  // Without concurrent readers `retire` destroys objects right away. Must be
+  // set before any reader thread starts.
+  void set_concurrent(bool enabled) { concurrent = enabled; }
+  bool is_concurrent() const { return concurrent; }
+
+  // Writer only.
+  template <typename T>
+  void retire(T* object) {
+    retire(object, [](void* pointer) { delete static_cast<T*>(pointer); });
+  }
+  void retire(void* object, void (*destroy)(void*));
+  // Advances the global epoch when all active readers observed the current
+  // one and destroys the retired objects no reader can reach anymore.
+  void reclaim();
+
+  size_t retired_count() const { return retired.size(); }
+
+ private:
+  friend class EpochGuard;
+
+  EpochManager() = default;
+  // Delete copy/move operations
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+  EpochManager(EpochManager&&) = delete;
+  EpochManager& operator=(EpochManager&&) = delete;
+
+  static constexpr size_t max_threads = 256;
+
+  // Epoch a reader thread entered its guard in, 0 while it holds none.
+  struct alignas(64) ThreadSlot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{false};
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  void enter();
+  void leave();
+  ThreadSlot& local_slot();
+
+  std::atomic<uint64_t> global_epoch{1};
+  ThreadSlot slots[max_threads];
+  // Ordered by epoch, only touched by the writer.
+  std::vector<Retired> retired;
+  bool concurrent = false;
+};
+
+// Pins the current epoch for the calling thread. Guards may be nested.
+class EpochGuard {
+ public:
+  EpochGuard() { EpochManager::instance().enter(); }
+  ~EpochGuard() { EpochManager::instance().leave(); }
+
+  EpochGuard(const EpochGuard&) = delete;
+  EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -0,0 +1,126 @@
+#include "glob.h"
+
+namespace {
+
+unsigned char byte_at(std::string_view str, size_t i) {
+  return static_cast<unsigned char>(str[i]);
+}
+
+}  // namespace
+
+GlobPattern::GlobPattern(std::string_view pattern) {
+  const auto make_token = [](Token::Kind kind) {
+    return Token{.kind = kind, .literal = {}, .char_class = {}};
+  };
+  auto append_literal = [this, &make_token](char c) {
+    if (tokens.empty() || tokens.back().kind != Token::Kind::Literal) {
+      tokens.push_back(make_token(Token::Kind::Literal));
+    }
+    tokens.back().literal.push_back(c);
+  };
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    switch (pattern[i]) {
+      case '*':
+        // Consecutive stars are equivalent to one.
+        if (tokens.empty() || tokens.back().kind != Token::Kind::AnySequence) {
+          tokens.push_back(make_token(Token::Kind::AnySequence));
+        }
+        break;
+      case '?':
+        tokens.push_back(make_token(Token::Kind::AnyChar));
+        break;
+      case '\\':
+        if (i + 1 < pattern.size()) {
+          ++i;
+        }
+        append_literal(pattern[i]);
+        break;
+      case '[': {
+        Token token = make_token(Token::Kind::CharClass);
+        ++i;
+        const bool negate = i < pattern.size() && pattern[i] == '^';
+        if (negate) {
+          ++i;
+        }
+        for (; i < pattern.size() && pattern[i] != ']'; ++i) {
+          if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+            token.char_class.set(byte_at(pattern, ++i));
+          } else if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+                     pattern[i + 2] != ']') {
+            unsigned char lo = byte_at(pattern, i);
+            unsigned char hi = byte_at(pattern, i + 2);
+            if (lo > hi) {
+              std::swap(lo, hi);
+            }
+            for (unsigned c = lo; c <= hi; ++c) {
+              token.char_class.set(c);
+            }
+            i += 2;
+          } else {
+            token.char_class.set(byte_at(pattern, i));
+          }
+        }
+        if (negate) {
+          token.char_class.flip();
+        }
+        tokens.push_back(std::move(token));
+        break;
+      }
+      default:
+        append_literal(pattern[i]);
+    }
+  }
+  if (!tokens.empty() && tokens.front().kind == Token::Kind::Literal) {
+    prefix = tokens.front().literal;
+  }
+}
+
+bool GlobPattern::matches(std::string_view str) const {
+  // Linear matching that only ever backtracks to the most recent `*`.
+  size_t t = 0;
+  size_t i = 0;
+  size_t star_token = tokens.size();
+  size_t star_pos = 0;
+  while (true) {
+    if (t < tokens.size()) {
+      const auto& token = tokens[t];
+      bool matched = false;
+      switch (token.kind) {
+        case Token::Kind::AnySequence:
+          // A trailing `*` matches whatever is left.
+          if (t + 1 == tokens.size()) {
+            return true;
+          }
+          star_token = t++;
+          star_pos = i;
+          continue;
+        case Token::Kind::Literal:
+          matched = str.substr(i).starts_with(token.literal);
+          if (matched) {
+            i += token.literal.size();
+          }
+          break;
+        case Token::Kind::AnyChar:
+          matched = i < str.size();
+          i += matched;
+          break;
+        case Token::Kind::CharClass:
+          matched = i < str.size() && token.char_class.test(byte_at(str, i));
+          i += matched;
+          break;
+      }
+      if (matched) {
+        ++t;
+        continue;
+      }
+    } else if (i == str.size()) {
+      return true;
+    }
+    // Mismatch: let the last `*` swallow one more character and retry.
+    if (star_token == tokens.size() || star_pos >= str.size()) {
+      return false;
+    }
+    t = star_token + 1;
+    i = ++star_pos;
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A glob-style pattern as accepted by Redis (`*`, `?`, `[a-z]`, `[^...]` and
+// `\` escapes), compiled once so it can be matched against many strings.
+class GlobPattern {
+ public:
+  explicit GlobPattern(std::string_view pattern);
+
+  bool matches(std::string_view str) const;
+
+  // Literal text every match has to start with.
+  const std::string& literal_prefix() const { return prefix; }
+  // Whether the only match is `literal_prefix()` itself, so callers can look
+  // it up instead of matching.
+  bool is_literal() const {
+    return tokens.empty() ||
+           (tokens.size() == 1 && tokens[0].kind == Token::Kind::Literal);
+  }
+
+ private:
+  struct Token {
+    enum class Kind { Literal, AnyChar, AnySequence, CharClass } kind;
+    std::string literal;
+    std::bitset<256> char_class;
+  };
+
+  std::vector<Token> tokens;
+  std::string prefix;
+};
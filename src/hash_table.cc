@@ -0,0 +1,374 @@
+#include "hash_table.h"
+
+#include <bit>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "epoch.h"
+#include "lazy_free.h"
+
+namespace {
+
+constexpr size_t initial_buckets = 16;
+
+size_t hash_key(std::string_view key) {
+  return std::hash<std::string_view>{}(key);
+}
+
+uint64_t reverse_bits(uint64_t bits) {
+  constexpr uint64_t ones = 0x5555555555555555;
+  constexpr uint64_t pairs = 0x3333333333333333;
+  constexpr uint64_t nibbles = 0x0f0f0f0f0f0f0f0f;
+  bits = ((bits >> 1) & ones) | ((bits & ones) << 1);
+  bits = ((bits >> 2) & pairs) | ((bits & pairs) << 2);
+  bits = ((bits >> 4) & nibbles) | ((bits & nibbles) << 4);
+  return std::byteswap(bits);
+}
+
+// Carries the expiry and access statistics over to a copy of `from`.
+void copy_metadata(const HashTable::Node& from, HashTable::Node& to) {
+  to.expires_at.store(from.expires_at.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+  to.accessed_at.store(from.accessed_at.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+  to.frequency.store(from.frequency.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+}
+
+// Destroys a retired entry, leaving an expensive value to `LazyFree`.
+void destroy_entry(void *pointer) {
+  auto *entry = static_cast<HashTable::Entry *>(pointer);
+  LazyFree::instance().release(std::move(entry->value));
+  delete entry;
+}
+
+}  // namespace
+
+// Power of two sized bucket array. Owns its nodes but not their entries, which
+// are shared with the table that replaces it when growing concurrently.
+struct HashTable::Table {
+  explicit Table(size_t bucket_count)
+      : mask{bucket_count - 1},
+        buckets{std::make_unique<std::atomic<Node*>[]>(bucket_count)} {}
+
+  ~Table() {
+    for (size_t i = 0; i <= mask; ++i) {
+      Node* node = buckets[i].load(std::memory_order_relaxed);
+      while (node) {
+        Node* next = node->next.load(std::memory_order_relaxed);
+        delete node;
+        node = next;
+      }
+    }
+  }
+
+  std::atomic<Node*>& bucket(size_t hash) { return buckets[hash & mask]; }
+
+  const size_t mask;
+  std::unique_ptr<std::atomic<Node*>[]> buckets;
+};
+
+HashTable::HashTable() : table{new Table(initial_buckets)} {
+  // Constructed first so it outlives the nodes and entries of every table.
+  SlabAllocator::instance();
+}
+
+HashTable::~HashTable() {
+  destroy(table.load(std::memory_order_relaxed));
+  for (Table* old_table : detached) {
+    destroy(old_table);
+  }
+}
+
+void HashTable::destroy(Table* table) {
+  for (size_t i = 0; i <= table->mask; ++i) {
+    for (Node* node = table->buckets[i].load(std::memory_order_relaxed); node;
+         node = node->next.load(std::memory_order_relaxed)) {
+      delete node->entry.load(std::memory_order_relaxed);
+      delete node->draft;
+    }
+  }
+  delete table;
+}
+
+size_t HashTable::bucket_count() const {
+  return table.load(std::memory_order_acquire)->mask + 1;
+}
+
+size_t HashTable::overhead_bytes() const {
+  return bucket_count() * sizeof(std::atomic<Node*>) + size() * node_bytes();
+}
+
+size_t HashTable::node_bytes() {
+  const auto& slabs = SlabAllocator::instance();
+  return slabs.allocation_size(sizeof(Node)) +
+         slabs.allocation_size(sizeof(Entry));
+}
+
+const HashTable::Node* HashTable::find(std::string_view key) const {
+  const size_t hash = hash_key(key);
+  Table* current = table.load(std::memory_order_acquire);
+  for (const Node* node = current->bucket(hash).load(std::memory_order_acquire);
+       node; node = node->next.load(std::memory_order_acquire)) {
+    if (node->hash == hash &&
+        node->entry.load(std::memory_order_acquire)->key == key) {
+      return node;
+    }
+  }
+  return nullptr;
+}
+
+HashTable::Node& HashTable::insert(std::string key, RespValue value) {
+  if (size() >= table.load(std::memory_order_relaxed)->mask + 1) {
+    grow();
+  }
+  const size_t hash = hash_key(key);
+  auto* entry = new Entry{.key = std::move(key), .value = std::move(value)};
+  auto* node = new Node(hash, entry);
+  auto& bucket = table.load(std::memory_order_relaxed)->bucket(hash);
+  node->next.store(bucket.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  bucket.store(node, std::memory_order_release);
+  count.fetch_add(1, std::memory_order_relaxed);
+  return *node;
+}
+
+void HashTable::assign(Node& node, RespValue value) {
+  if (node.draft) {
+    destroy_entry(std::exchange(node.draft, nullptr));
+  }
+  Entry* old_entry = node.entry.load(std::memory_order_relaxed);
+  if (!concurrent) {
+    LazyFree::instance().release(
+        std::exchange(old_entry->value, std::move(value)));
+    return;
+  }
+  node.entry.store(new Entry{.key = old_entry->key, .value = std::move(value)},
+                   std::memory_order_release);
+  EpochManager::instance().retire(old_entry, destroy_entry);
+}
+
+RespValue& HashTable::modify(Node& node) {
+  Entry* entry = node.entry.load(std::memory_order_relaxed);
+  if (!concurrent) {
+    return entry->value;
+  }
+  if (!node.draft) {
+    node.draft = new Entry(*entry);
+    drafts.push_back(&node);
+  }
+  return node.draft->value;
+}
+
+void HashTable::commit_drafts() {
+  for (Node* node : drafts) {
+    if (!node->draft) {
+      continue;
+    }
+    Entry* old_entry = node->entry.load(std::memory_order_relaxed);
+    node->entry.store(node->draft, std::memory_order_release);
+    node->draft = nullptr;
+    EpochManager::instance().retire(old_entry, destroy_entry);
+  }
+  drafts.clear();
+}
+
+bool HashTable::erase(std::string_view key) {
+  const size_t hash = hash_key(key);
+  Table* current = table.load(std::memory_order_relaxed);
+  std::atomic<Node*>* link = &current->bucket(hash);
+  for (Node* node = link->load(std::memory_order_relaxed); node;
+       link = &node->next, node = link->load(std::memory_order_relaxed)) {
+    Entry* entry = node->entry.load(std::memory_order_relaxed);
+    if (node->hash != hash || entry->key != key) {
+      continue;
+    }
+    // Readers standing on `node` can still follow its `next` pointer.
+    link->store(node->next.load(std::memory_order_relaxed),
+                std::memory_order_release);
+    count.fetch_sub(1, std::memory_order_relaxed);
+    if (node->draft) {
+      destroy_entry(std::exchange(node->draft, nullptr));
+    }
+    auto& epochs = EpochManager::instance();
+    epochs.retire(entry, destroy_entry);
+    epochs.retire(node);
+    return true;
+  }
+  return false;
+}
+
+void HashTable::clear(bool lazily) {
+  Table* old_table = table.load(std::memory_order_relaxed);
+  table.store(new Table(initial_buckets), std::memory_order_release);
+  count.store(0, std::memory_order_relaxed);
+  // Pending drafts are freed with their nodes.
+  drafts.clear();
+  defrag_cursor = 0;
+  struct Detached {
+    HashTable* owner;
+    Table* table;
+    bool lazily;
+  };
+  EpochManager::instance().retire(
+      new Detached{.owner = this, .table = old_table, .lazily = lazily},
+      [](void* pointer) {
+        auto* detached = static_cast<Detached*>(pointer);
+        if (detached->lazily) {
+          detached->owner->detached.push_back(detached->table);
+        } else {
+          destroy(detached->table);
+        }
+        delete detached;
+      });
+}
+
+bool HashTable::free_detached(size_t budget) {
+  // Keys and values are destroyed in one batch in the background, the slab
+  // allocated nodes and entries only by the writer.
+  std::vector<std::string> keys;
+  std::vector<RespValue> values;
+  size_t freed = 0;
+  while (!detached.empty() && freed < budget) {
+    Table* old_table = detached.front();
+    if (detached_cursor > old_table->mask) {
+      delete old_table;
+      detached.erase(detached.begin());
+      detached_cursor = 0;
+      continue;
+    }
+    Node* node = old_table->buckets[detached_cursor++].exchange(
+        nullptr, std::memory_order_relaxed);
+    for (; node; ++freed) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      Entry* entry = node->entry.load(std::memory_order_relaxed);
+      keys.push_back(std::move(entry->key));
+      values.push_back(std::move(entry->value));
+      delete entry;
+      if (node->draft) {
+        values.push_back(std::move(node->draft->value));
+        delete node->draft;
+      }
+      delete node;
+      node = next;
+    }
+  }
+  if (!values.empty()) {
+    LazyFree::instance().release_in_background(
+        std::pair(std::move(keys), std::move(values)));
+  }
+  return detached.empty();
+}
+
+bool HashTable::defragment(size_t budget) {
+  assert(drafts.empty());
+  auto& slabs = SlabAllocator::instance();
+  auto& epochs = EpochManager::instance();
+  Table* current = table.load(std::memory_order_relaxed);
+  size_t visited = 0;
+  while (visited < budget && defrag_cursor <= current->mask) {
+    std::atomic<Node*>* link = &current->buckets[defrag_cursor++];
+    for (Node* node = link->load(std::memory_order_relaxed); node;
+         link = &node->next, node = link->load(std::memory_order_relaxed)) {
+      ++visited;
+      Entry* entry = node->entry.load(std::memory_order_relaxed);
+      if (slabs.should_move(entry, sizeof(Entry))) {
+        // Readers may still be looking at the old entry.
+        auto* moved = concurrent ? new Entry(*entry)
+                                 : new Entry(std::move(*entry));
+        node->entry.store(moved, std::memory_order_release);
+        epochs.retire(entry, destroy_entry);
+      }
+      if (slabs.should_move(node, sizeof(Node))) {
+        auto* moved =
+            new Node(node->hash, node->entry.load(std::memory_order_relaxed));
+        copy_metadata(*node, *moved);
+        moved->next.store(node->next.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        link->store(moved, std::memory_order_release);
+        epochs.retire(node);
+        node = moved;
+      }
+    }
+  }
+  if (defrag_cursor <= current->mask) {
+    return false;
+  }
+  defrag_cursor = 0;
+  return true;
+}
+
+void HashTable::for_each(
+    const std::function<void(const Node&)>& visit) const {
+  const Table* current = table.load(std::memory_order_relaxed);
+  for (size_t i = 0; i <= current->mask; ++i) {
+    for (const Node* node = current->buckets[i].load(std::memory_order_relaxed);
+         node; node = node->next.load(std::memory_order_relaxed)) {
+      visit(*node);
+    }
+  }
+}
+
+size_t HashTable::scan(size_t cursor,
+                       const std::function<void(const Node&)>& visit) const {
+  const Table* current = table.load(std::memory_order_acquire);
+  for (const Node* node =
+           current->buckets[cursor & current->mask].load(
+               std::memory_order_acquire);
+       node; node = node->next.load(std::memory_order_acquire)) {
+    visit(*node);
+  }
+  // Increment the bucket index from its most significant bit. The buckets
+  // a bucket splits into when the table doubles differ in the next higher
+  // bit, so they all come after the cursor.
+  cursor |= ~current->mask;
+  cursor = reverse_bits(cursor);
+  ++cursor;
+  return reverse_bits(cursor);
+}
+
+void HashTable::grow() {
+  Table* old_table = table.load(std::memory_order_relaxed);
+  auto* new_table = new Table((old_table->mask + 1) * 2);
+  if (!concurrent) {
+    // Nobody else walks the chains, so the nodes just move over.
+    for (size_t i = 0; i <= old_table->mask; ++i) {
+      Node* node = old_table->buckets[i].exchange(nullptr,
+                                                  std::memory_order_relaxed);
+      while (node) {
+        Node* next = node->next.load(std::memory_order_relaxed);
+        auto& bucket = new_table->bucket(node->hash);
+        node->next.store(bucket.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+        bucket.store(node, std::memory_order_relaxed);
+        node = next;
+      }
+    }
+    table.store(new_table, std::memory_order_release);
+    delete old_table;
+    return;
+  }
+  drafts.clear();
+  for (size_t i = 0; i <= old_table->mask; ++i) {
+    for (Node* node = old_table->buckets[i].load(std::memory_order_relaxed);
+         node; node = node->next.load(std::memory_order_relaxed)) {
+      auto* copy =
+          new Node(node->hash, node->entry.load(std::memory_order_relaxed));
+      copy_metadata(*node, *copy);
+      copy->draft = std::exchange(node->draft, nullptr);
+      if (copy->draft) {
+        drafts.push_back(copy);
+      }
+      auto& bucket = new_table->bucket(node->hash);
+      copy->next.store(bucket.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+      bucket.store(copy, std::memory_order_relaxed);
+    }
+  }
+  // Readers still walking the old table see a consistent snapshot until it
+  // is reclaimed.
+  table.store(new_table, std::memory_order_release);
+  EpochManager::instance().retire(old_table);
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "resp_types.h"
+#include "slab.h"
+
+// Chained hash table from key to value with one writer and any number of
+// lock-free readers. Readers only follow atomic pointers and have to hold an
+// `EpochGuard`; the writer never frees memory a reader may reach but retires
+// it to the `EpochManager`.
+//
+// With concurrent readers enabled, published entries are immutable. Values
+// modified in place are copied into a draft first that `commit_drafts`
+// publishes. Growing the table builds a new bucket array with new nodes that
+// share the entries of the old one; without concurrent readers the nodes
+// are relinked into it instead.
+//
+// Nodes and entries live in the `SlabAllocator`; `defragment` moves them out
+// of sparse slabs. Values that are expensive to destroy are handed to
+// `LazyFree` when their entries are.
+class HashTable {
+ public:
+  struct Entry {
+    static void* operator new(size_t size) {
+      return SlabAllocator::instance().allocate(size);
+    }
+    static void operator delete(void* pointer, size_t size) {
+      SlabAllocator::instance().deallocate(pointer, size);
+    }
+
+    std::string key;
+    RespValue value;
+  };
+
+  struct Node {
+    Node(size_t hash, Entry* entry) : hash{hash}, entry{entry} {}
+
+    static void* operator new(size_t size) {
+      return SlabAllocator::instance().allocate(size);
+    }
+    static void operator delete(void* pointer, size_t size) {
+      SlabAllocator::instance().deallocate(pointer, size);
+    }
+
+    const size_t hash;
+    std::atomic<Entry*> entry;
+    // `steady_clock` ticks at which the key expires, 0 if it doesn't.
+    std::atomic<int64_t> expires_at{0};
+    // For OBJECT IDLETIME and FREQ, updated by readers too: the
+    // `Database` clock at the last access and a logarithmic access counter.
+    mutable std::atomic<uint32_t> accessed_at{0};
+    mutable std::atomic<uint8_t> frequency{0};
+    std::atomic<Node*> next{nullptr};
+    // Unpublished copy of `entry` the writer is modifying.
+    Entry* draft = nullptr;
+  };
+
+  HashTable();
+  ~HashTable();
+
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+
+  // Must be called before any reader thread starts.
+  void set_concurrent(bool enabled) { concurrent = enabled; }
+
+  // Any thread.
+  const Node* find(std::string_view key) const;
+  size_t size() const { return count.load(std::memory_order_relaxed); }
+  size_t bucket_count() const;
+  // Bytes of the bucket array, nodes and entries, without keys and values.
+  size_t overhead_bytes() const;
+  // Bytes a single node and entry take in the `SlabAllocator`.
+  static size_t node_bytes();
+
+  // Writer only. Nodes stay valid until the table is modified.
+  Node* find_mutable(std::string_view key) {
+    return const_cast<Node*>(find(key));
+  }
+  // `key` must not be present yet.
+  Node& insert(std::string key, RespValue value);
+  // Replaces the value of `node`, discarding a pending draft.
+  void assign(Node& node, RespValue value);
+  // The value of `node` for in-place modification.
+  RespValue& modify(Node& node);
+  bool erase(std::string_view key);
+  // Removes every key. The bucket array is swapped for an empty one right
+  // away. Unless `lazily` is set, the old one is freed here if no reader can
+  // still see it; otherwise `free_detached` takes it apart later.
+  void clear(bool lazily);
+  // Frees at most `budget` nodes of the bucket arrays `clear` detached,
+  // handing their keys and values to `LazyFree`. Returns true once nothing
+  // is left.
+  bool free_detached(size_t budget);
+  bool has_detached() const { return !detached.empty(); }
+  // Publishes all values modified through `modify`.
+  void commit_drafts();
+  // Continues an incremental pass over the buckets that reallocates nodes and
+  // entries the `SlabAllocator` wants moved, visiting at most `budget` nodes.
+  // Returns true when the pass has visited every bucket and starts over.
+  // Must not be called with unpublished drafts.
+  bool defragment(size_t budget);
+  // Calls `visit` for every node. Writer only, `visit` must not modify the
+  // table.
+  void for_each(const std::function<void(const Node&)>& visit) const;
+  // Calls `visit` for every node of the bucket at `cursor` and returns the
+  // cursor of the next bucket, 0 after the last one. Start with 0. Cursors
+  // advance in reverse binary, so a scan visits every key present during
+  // the whole scan even if the table grows in between (some keys maybe
+  // twice). Any thread.
+  size_t scan(size_t cursor,
+              const std::function<void(const Node&)>& visit) const;
+
+  // The writer's view of `node`, including an unpublished draft.
+  static const RespValue& value(const Node& node) {
+    return node.draft ? node.draft->value
+                      : node.entry.load(std::memory_order_relaxed)->value;
+  }
+
+ private:
+  struct Table;
+
+  void grow();
+  // Deletes `table` with all its nodes and entries.
+  static void destroy(Table* table);
+
+  std::atomic<Table*> table;
+  std::atomic<size_t> count{0};
+  std::vector<Node*> drafts;
+  bool concurrent = false;
+  // Next bucket `defragment` visits.
+  size_t defrag_cursor = 0;
+  // Bucket arrays removed by `clear` whose nodes and entries are still
+  // allocated, with the next bucket `free_detached` visits in the first.
+  std::vector<Table*> detached;
+  size_t detached_cursor = 0;
+};
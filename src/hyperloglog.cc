@@ -0,0 +1,508 @@
+#include "hyperloglog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <optional>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr size_t header_size = 16;
+constexpr size_t encoding_offset = 4;
+constexpr size_t cache_offset = 8;
+constexpr uint8_t encoding_dense = 0;
+constexpr uint8_t encoding_sparse = 1;
+
+constexpr int register_bits = 6;
+constexpr uint8_t register_max = (1 << register_bits) - 1;
+constexpr size_t dense_size =
+    header_size + hll_register_count * register_bits / 8;
+// Number of hash bits left to count leading zeros in after taking the index.
+constexpr int q_bits = 64 - hll_precision;
+
+// Sparse encodings larger than this are converted to dense.
+constexpr size_t sparse_max_bytes = 3000;
+
+// Sparse opcodes:
+//   ZERO  00xxxxxx           run of 1..64 zero registers
+//   XZERO 01xxxxxx yyyyyyyy  run of 1..16384 zero registers
+//   VAL   1vvvvvxx           run of 1..4 registers with value 1..32
+constexpr uint8_t xzero_bit = 0x40;
+constexpr uint8_t val_bit = 0x80;
+constexpr size_t zero_max_len = 64;
+constexpr size_t xzero_max_len = 16384;
+constexpr uint8_t val_max_value = 32;
+constexpr size_t val_max_len = 4;
+
+struct SparseOp {
+  uint8_t value;
+  size_t run;
+  size_t size;  // Encoded bytes.
+};
+
+// Decodes the opcode at `pos`, nullopt if truncated.
+std::optional<SparseOp> decode_op(std::string_view body, size_t pos) {
+  const uint8_t op = body[pos];
+  if (op & val_bit) {
+    return SparseOp{.value = static_cast<uint8_t>(((op >> 2) & 0x1f) + 1),
+                    .run = static_cast<size_t>(op & 0x3) + 1,
+                    .size = 1};
+  }
+  if (op & xzero_bit) {
+    if (pos + 1 >= body.size()) {
+      return std::nullopt;
+    }
+    return SparseOp{
+        .value = 0,
+        .run = ((static_cast<size_t>(op & 0x3f) << 8) |
+                static_cast<uint8_t>(body[pos + 1])) +
+               1,
+        .size = 2};
+  }
+  return SparseOp{.value = 0, .run = static_cast<size_t>(op & 0x3f) + 1,
+                  .size = 1};
+}
+
+// Calls `func(value, run)` for each run of the sparse body. Returns false if
+// the encoding is malformed or does not cover exactly all registers.
+template <typename Func>
+bool for_each_run(std::string_view body, Func &&func) {
+  size_t covered = 0;
+  for (size_t pos = 0; pos < body.size();) {
+    const auto op = decode_op(body, pos);
+    if (!op || covered + op->run > hll_register_count) {
+      return false;
+    }
+    func(op->value, op->run);
+    covered += op->run;
+    pos += op->size;
+  }
+  return covered == hll_register_count;
+}
+
+void append_run(std::string &out, uint8_t value, size_t run) {
+  while (run > 0) {
+    if (value == 0) {
+      const size_t len = std::min(run, xzero_max_len);
+      if (len <= zero_max_len) {
+        out.push_back(static_cast<char>(len - 1));
+      } else {
+        out.push_back(static_cast<char>(xzero_bit | ((len - 1) >> 8)));
+        out.push_back(static_cast<char>((len - 1) & 0xff));
+      }
+      run -= len;
+    } else {
+      const size_t len = std::min(run, val_max_len);
+      out.push_back(
+          static_cast<char>(val_bit | ((value - 1) << 2) | (len - 1)));
+      run -= len;
+    }
+  }
+}
+
+std::string make_header(uint8_t encoding) {
+  std::string header(header_size, '\0');
+  std::memcpy(header.data(), "HYLL", 4);
+  header[encoding_offset] = static_cast<char>(encoding);
+  return header;
+}
+
+uint8_t encoding_of(std::string_view hll) {
+  return static_cast<uint8_t>(hll[encoding_offset]);
+}
+
+void invalidate_cache(RespString &hll) {
+  hll[cache_offset + 7] = static_cast<char>(hll[cache_offset + 7] | 0x80);
+}
+
+std::optional<uint64_t> cached_count(std::string_view hll) {
+  if (hll[cache_offset + 7] & 0x80) {
+    return std::nullopt;
+  }
+  uint64_t count = 0;
+  for (int i = 7; i >= 0; --i) {
+    count = (count << 8) | static_cast<uint8_t>(hll[cache_offset + i]);
+  }
+  return count;
+}
+
+void store_cached_count(RespString &hll, uint64_t count) {
+  for (int i = 0; i < 8; ++i) {
+    hll[cache_offset + i] = static_cast<char>((count >> (8 * i)) & 0xff);
+  }
+}
+
+// MurmurHash64A, with the seed Redis uses for HyperLogLog.
+uint64_t murmur_hash64a(std::string_view data) {
+  constexpr uint64_t m = 0xc6a4a7935bd1e995ULL;
+  constexpr int r = 47;
+  uint64_t h = 0xadc83b19ULL ^ (data.size() * m);
+  const auto *p = reinterpret_cast<const uint8_t *>(data.data());
+  const auto *end = p + (data.size() & ~size_t{7});
+  for (; p != end; p += 8) {
+    uint64_t k;
+    std::memcpy(&k, p, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch (data.size() & 7) {
+    case 7:
+      h ^= static_cast<uint64_t>(p[6]) << 48;
+      [[fallthrough]];
+    case 6:
+      h ^= static_cast<uint64_t>(p[5]) << 40;
+      [[fallthrough]];
+    case 5:
+      h ^= static_cast<uint64_t>(p[4]) << 32;
+      [[fallthrough]];
+    case 4:
+      h ^= static_cast<uint64_t>(p[3]) << 24;
+      [[fallthrough]];
+    case 3:
+      h ^= static_cast<uint64_t>(p[2]) << 16;
+      [[fallthrough]];
+    case 2:
+      h ^= static_cast<uint64_t>(p[1]) << 8;
+      [[fallthrough]];
+    case 1:
+      h ^= static_cast<uint64_t>(p[0]);
+      h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Register index and run length of the zero-bit pattern for `element`.
+std::pair<size_t, uint8_t> hash_element(std::string_view element) {
+  uint64_t hash = murmur_hash64a(element);
+  const size_t index = hash & (hll_register_count - 1);
+  hash >>= hll_precision;
+  hash |= uint64_t{1} << q_bits;  // Caps the count at q_bits + 1.
+  return {index, static_cast<uint8_t>(__builtin_ctzll(hash) + 1)};
+}
+
+// Dense registers are packed LSB first, four registers per three bytes.
+uint8_t dense_get(const uint8_t *regs, size_t index) {
+  const size_t bit = index * register_bits;
+  const size_t byte = bit / 8;
+  const unsigned shift = bit & 7;
+  const unsigned hi = shift > 8 - register_bits ? regs[byte + 1] : 0;
+  return ((regs[byte] >> shift) | (hi << (8 - shift))) & register_max;
+}
+
+void dense_set(uint8_t *regs, size_t index, uint8_t value) {
+  const size_t bit = index * register_bits;
+  const size_t byte = bit / 8;
+  const unsigned shift = bit & 7;
+  regs[byte] &= ~(register_max << shift);
+  regs[byte] |= value << shift;
+  if (shift > 8 - register_bits) {
+    regs[byte + 1] &= ~(register_max >> (8 - shift));
+    regs[byte + 1] |= value >> (8 - shift);
+  }
+}
+
+void dense_unpack(const uint8_t *regs, uint8_t *out) {
+  for (size_t i = 0; i < hll_register_count; i += 4, regs += 3) {
+    const unsigned b0 = regs[0], b1 = regs[1], b2 = regs[2];
+    out[i] = b0 & register_max;
+    out[i + 1] = ((b0 >> 6) | (b1 << 2)) & register_max;
+    out[i + 2] = ((b1 >> 4) | (b2 << 4)) & register_max;
+    out[i + 3] = b2 >> 2;
+  }
+}
+
+void dense_pack(const uint8_t *registers, uint8_t *out) {
+  for (size_t i = 0; i < hll_register_count; i += 4, out += 3) {
+    const unsigned r0 = registers[i], r1 = registers[i + 1],
+                   r2 = registers[i + 2], r3 = registers[i + 3];
+    out[0] = static_cast<uint8_t>(r0 | (r1 << 6));
+    out[1] = static_cast<uint8_t>((r1 >> 2) | (r2 << 4));
+    out[2] = static_cast<uint8_t>((r2 >> 4) | (r3 << 2));
+  }
+}
+
+uint8_t *dense_registers(RespString &hll) {
+  return reinterpret_cast<uint8_t *>(hll.data()) + header_size;
+}
+
+const uint8_t *dense_registers(std::string_view hll) {
+  return reinterpret_cast<const uint8_t *>(hll.data()) + header_size;
+}
+
+// dst[i] = max(dst[i], src[i]).
+void registers_max(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_max_epu8(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+  }
+#endif
+  for (; i < len; ++i) {
+    dst[i] = std::max(dst[i], src[i]);
+  }
+}
+
+using Histogram = std::array<uint32_t, q_bits + 2>;
+
+Histogram histogram(const uint8_t *registers) {
+  // Four interleaved partial histograms avoid store-to-load stalls when
+  // consecutive registers share a value. They cover every value a register
+  // can hold, since a dense HLL stored with SET may hold any.
+  std::array<std::array<uint32_t, register_max + 1>, 4> partial{};
+  for (size_t i = 0; i < hll_register_count; i += 4) {
+    ++partial[0][registers[i]];
+    ++partial[1][registers[i + 1]];
+    ++partial[2][registers[i + 2]];
+    ++partial[3][registers[i + 3]];
+  }
+  Histogram result{};
+  for (size_t j = 0; j < partial[0].size(); ++j) {
+    // Values no hash can produce count as the largest one that it can.
+    result[std::min(j, result.size() - 1)] +=
+        partial[0][j] + partial[1][j] + partial[2][j] + partial[3][j];
+  }
+  return result;
+}
+
+double tau(double x) {
+  if (x == 0. || x == 1.) {
+    return 0.;
+  }
+  double z_prime;
+  double y = 1.0;
+  double z = 1 - x;
+  do {
+    x = std::sqrt(x);
+    z_prime = z;
+    y *= 0.5;
+    z -= std::pow(1 - x, 2) * y;
+  } while (z_prime != z);
+  return z / 3;
+}
+
+double sigma(double x) {
+  if (x == 1.) {
+    return INFINITY;
+  }
+  double z_prime;
+  double y = 1;
+  double z = x;
+  do {
+    x *= x;
+    z_prime = z;
+    z += x * y;
+    y += y;
+  } while (z_prime != z);
+  return z;
+}
+
+// Cardinality estimator from Otmar Ertl, "New cardinality estimation
+// algorithms for HyperLogLog sketches" (2017), as used by Redis.
+uint64_t estimate(const Histogram &histogram) {
+  constexpr double alpha_inf = 0.721347520444481703680;
+  const double m = hll_register_count;
+  double z = m * tau((m - histogram[q_bits + 1]) / m);
+  for (int j = q_bits; j >= 1; --j) {
+    z += histogram[j];
+    z *= 0.5;
+  }
+  z += m * sigma(histogram[0] / m);
+  return static_cast<uint64_t>(std::llround(alpha_inf * m * m / z));
+}
+
+void sparse_to_registers(std::string_view hll, uint8_t *registers) {
+  size_t index = 0;
+  for_each_run(hll.substr(header_size), [&](uint8_t value, size_t run) {
+    std::memset(registers + index, value, run);
+    index += run;
+  });
+}
+
+void convert_to_dense(RespString &hll) {
+  HllRegisters registers{};
+  sparse_to_registers(hll, registers.data());
+  RespString dense = make_header(encoding_dense);
+  dense.resize(dense_size);
+  dense_pack(registers.data(), dense_registers(dense));
+  invalidate_cache(dense);
+  hll = std::move(dense);
+}
+
+enum class SparseUpdate { Unchanged, Updated, NeedsDense };
+
+SparseUpdate sparse_set(RespString &hll, size_t index, uint8_t count) {
+  if (count > val_max_value) {
+    return SparseUpdate::NeedsDense;
+  }
+  const std::string_view body(hll);
+  size_t pos = header_size;
+  size_t previous_pos = pos;
+  size_t first = 0;
+  SparseOp op{};
+  while (pos < body.size()) {
+    op = *decode_op(body, pos);
+    if (index < first + op.run) {
+      break;
+    }
+    first += op.run;
+    previous_pos = pos;
+    pos += op.size;
+  }
+  if (op.value >= count) {
+    return SparseUpdate::Unchanged;
+  }
+  // Split the run containing `index` into up to three runs.
+  std::string replacement;
+  append_run(replacement, op.value, index - first);
+  append_run(replacement, count, 1);
+  append_run(replacement, op.value, first + op.run - index - 1);
+  hll.replace(pos, op.size, replacement);
+
+  // Merge neighbouring VAL opcodes of the same value that the split produced.
+  size_t merge_end = std::min(hll.size(), pos + replacement.size() + 1);
+  for (size_t i = previous_pos; i + 1 < merge_end;) {
+    const uint8_t a = hll[i];
+    const uint8_t b = hll[i + 1];
+    const bool same_value =
+        (a & val_bit) && (b & val_bit) && ((a ^ b) & 0x7c) == 0;
+    if (same_value && size_t{(a & 0x3u) + (b & 0x3u) + 2} <= val_max_len) {
+      hll[i] = static_cast<char>(a + (b & 0x3) + 1);
+      hll.erase(i + 1, 1);
+      --merge_end;
+      continue;
+    }
+    // XZERO opcodes are two bytes long, skip their second byte.
+    i += (!(a & val_bit) && (a & xzero_bit)) ? 2 : 1;
+  }
+  if (hll.size() > sparse_max_bytes) {
+    return SparseUpdate::NeedsDense;
+  }
+  return SparseUpdate::Updated;
+}
+
+}  // namespace
+
+RespString hll_create() {
+  RespString hll = make_header(encoding_sparse);
+  append_run(hll, 0, hll_register_count);
+  return hll;
+}
+
+bool hll_is_valid(std::string_view str) {
+  if (str.size() < header_size || str.substr(0, 4) != "HYLL") {
+    return false;
+  }
+  switch (encoding_of(str)) {
+    case encoding_dense:
+      return str.size() == dense_size;
+    case encoding_sparse:
+      return for_each_run(str.substr(header_size), [](uint8_t, size_t) {});
+    default:
+      return false;
+  }
+}
+
+bool hll_add(RespString &hll, std::string_view element) {
+  const auto [index, count] = hash_element(element);
+  if (encoding_of(hll) == encoding_sparse) {
+    switch (sparse_set(hll, index, count)) {
+      case SparseUpdate::Unchanged:
+        return false;
+      case SparseUpdate::Updated:
+        invalidate_cache(hll);
+        return true;
+      case SparseUpdate::NeedsDense:
+        convert_to_dense(hll);
+        break;
+    }
+  }
+  uint8_t *regs = dense_registers(hll);
+  if (dense_get(regs, index) >= count) {
+    return false;
+  }
+  dense_set(regs, index, count);
+  invalidate_cache(hll);
+  return true;
+}
+
+uint64_t hll_count(RespString &hll) {
+  if (const auto cached = cached_count(hll)) {
+    return *cached;
+  }
+  HllRegisters registers;
+  if (encoding_of(hll) == encoding_dense) {
+    dense_unpack(dense_registers(hll), registers.data());
+  } else {
+    sparse_to_registers(hll, registers.data());
+  }
+  const uint64_t count = hll_count_registers(registers);
+  store_cached_count(hll, count);
+  return count;
+}
+
+void hll_merge(HllRegisters &registers, std::string_view hll) {
+  HllRegisters other;
+  if (encoding_of(hll) == encoding_dense) {
+    dense_unpack(dense_registers(hll), other.data());
+    registers_max(registers.data(), other.data(), registers.size());
+    return;
+  }
+  // Sparse counters are mostly zero runs, which cannot raise any register.
+  size_t index = 0;
+  for_each_run(hll.substr(header_size), [&](uint8_t value, size_t run) {
+    if (value) {
+      for (size_t i = index; i < index + run; ++i) {
+        registers[i] = std::max(registers[i], value);
+      }
+    }
+    index += run;
+  });
+}
+
+uint64_t hll_count_registers(const HllRegisters &registers) {
+  return estimate(histogram(registers.data()));
+}
+
+RespString hll_from_registers(const HllRegisters &registers) {
+  const bool sparse_values = std::all_of(
+      registers.begin(), registers.end(),
+      [](uint8_t value) { return value <= val_max_value; });
+  if (sparse_values) {
+    RespString hll = make_header(encoding_sparse);
+    for (size_t i = 0; i < registers.size() && hll.size() <= sparse_max_bytes;) {
+      size_t run = 1;
+      while (i + run < registers.size() && registers[i + run] == registers[i]) {
+        ++run;
+      }
+      append_run(hll, registers[i], run);
+      i += run;
+    }
+    if (hll.size() <= sparse_max_bytes) {
+      invalidate_cache(hll);
+      return hll;
+    }
+  }
+  RespString hll = make_header(encoding_dense);
+  hll.resize(dense_size);
+  dense_pack(registers.data(), dense_registers(hll));
+  invalidate_cache(hll);
+  return hll;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "resp_types.h"
+
+// HyperLogLog counters stored in plain string values, using the same layout
+// as Redis so dumps stay interchangeable:
+//
+//   "HYLL" | encoding | 3 unused bytes | 8 byte cached cardinality | registers
+//
+// Small counters use a run-length encoded sparse representation and are
+// promoted to 16384 packed 6-bit registers (12KB) once they grow.
+
+constexpr int hll_precision = 14;
+constexpr size_t hll_register_count = size_t{1} << hll_precision;
+
+// Registers unpacked to one byte each, used to merge several counters.
+using HllRegisters = std::array<uint8_t, hll_register_count>;
+
+// A new, empty counter in sparse encoding.
+RespString hll_create();
+
+// Whether `str` holds a well formed counter.
+bool hll_is_valid(std::string_view str);
+
+// Adds `element`. Returns true if the estimate may have changed.
+bool hll_add(RespString &hll, std::string_view element);
+
+// Estimated cardinality. Served from the cached value in the header if the
+// counter was not modified since the last call, and refreshes it otherwise.
+uint64_t hll_count(RespString &hll);
+
+// registers[i] = max(registers[i], register i of `hll`).
+void hll_merge(HllRegisters &registers, std::string_view hll);
+
+// Estimated cardinality of unpacked registers.
+uint64_t hll_count_registers(const HllRegisters &registers);
+
+// Encodes registers as a counter, sparse if they fit.
+RespString hll_from_registers(const HllRegisters &registers);
@@ -0,0 +1,142 @@
+#include <memory>
+#include <utility>
+
+#include "commands.h"
+#include "database.h"
+#include "hyperloglog.h"
+
+// HyperLogLog commands. Counters are plain strings in the `Database` and are
+// updated in place.
+
+namespace {
+
+RespValue invalid_hll_error() {
+  return RespValue::make_error(
+      "WRONGTYPE Key is not a valid HyperLogLog string value.");
+}
+
+// The counter stored at `value`, decompressing into `scratch` if need be, or
+// nullptr if it is not one.
+const RespString *as_hll(const RespValue &value, RespString &scratch) {
+  const auto *str = value.read_string(scratch);
+  if (!str || !hll_is_valid(*str)) {
+    return nullptr;
+  }
+  return str;
+}
+
+// Mutable counterpart. Checks before `string_in_place`, which decompresses,
+// unshares or stringifies the value for good.
+RespString *as_hll(RespValue &value) {
+  RespString scratch;
+  if (!as_hll(std::as_const(value), scratch)) {
+    return nullptr;
+  }
+  return value.string_in_place();
+}
+
+}  // namespace
+
+RespValue handle_pfadd(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for PFADD");
+  }
+  auto &db = Database::instance();
+  const auto key = arguments[0].to_string();
+  bool updated = false;
+  auto *value = db.find(key);
+  if (!value) {
+    value = &db.find_or_insert(key, RespValue::make_string(hll_create()));
+    updated = true;
+  }
+  auto *hll = as_hll(*value);
+  if (!hll) {
+    return invalid_hll_error();
+  }
+  for (size_t i = 1; i < arguments.size(); ++i) {
+    const auto *element = std::get_if<RespString>(&arguments[i].value);
+    if (element) {
+      updated |= hll_add(*hll, *element);
+    } else {
+      updated |= hll_add(*hll, arguments[i].to_string());
+    }
+  }
+  if (updated) {
+    db.signal_modified(key);
+  }
+  return RespValue::make_integer(updated);
+}
+CommandRegistrar _handle_pfadd("pfadd", handle_pfadd,
+                               CommandAccess::Write, KeySpec{1, 1, 1});
+
+RespValue handle_pfcount(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for PFCOUNT");
+  }
+  auto &db = Database::instance();
+  if (arguments.size() == 1) {
+    auto *value = db.find(arguments[0].to_string());
+    if (!value) {
+      return RespValue::make_integer(0);
+    }
+    auto *hll = as_hll(*value);
+    if (!hll) {
+      return invalid_hll_error();
+    }
+    return RespValue::make_integer(hll_count(*hll));
+  }
+  // The union is estimated from the register-wise maximum of all counters.
+  auto registers = std::make_unique<HllRegisters>();
+  registers->fill(0);
+  RespString scratch;
+  for (const auto &key : arguments) {
+    const auto *value = db.lookup(key.to_string());
+    if (!value) {
+      continue;
+    }
+    const auto *hll = as_hll(*value, scratch);
+    if (!hll) {
+      return invalid_hll_error();
+    }
+    hll_merge(*registers, *hll);
+  }
+  return RespValue::make_integer(hll_count_registers(*registers));
+}
+// Not read-only: counting one key caches the estimate in its header. That
+// changes no count, so replicas serve it too.
+CommandRegistrar _handle_pfcount("pfcount", handle_pfcount,
+                                 CommandAccess::MayWrite, KeySpec{1, -1, 1});
+
+RespValue handle_pfmerge(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for PFMERGE");
+  }
+  auto &db = Database::instance();
+  auto registers = std::make_unique<HllRegisters>();
+  registers->fill(0);
+  // The destination takes part in the union if it exists.
+  RespString scratch;
+  for (const auto &key : arguments) {
+    const auto *value = db.lookup(key.to_string());
+    if (!value) {
+      continue;
+    }
+    const auto *hll = as_hll(*value, scratch);
+    if (!hll) {
+      return invalid_hll_error();
+    }
+    hll_merge(*registers, *hll);
+  }
+  auto merged = hll_from_registers(*registers);
+  const auto dest = arguments[0].to_string();
+  if (auto *value = db.find(dest)) {
+    // Overwrite in place so the destination keeps its TTL.
+    *value->string_in_place() = std::move(merged);
+    db.signal_modified(dest);
+  } else {
+    db.set(dest, RespValue::make_string(std::move(merged)), std::nullopt);
+  }
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_pfmerge("pfmerge", handle_pfmerge,
+                                 CommandAccess::Write, KeySpec{1, -1, 1});
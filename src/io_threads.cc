@@ -0,0 +1,104 @@
+#include "io_threads.h"
+
+#include <string>
+
+#include "trace.h"
+
+IoThreads::IoThreads(size_t count) {
+  for (size_t i = 1; i < count; ++i) {
+    workers.emplace_back([this, i] { worker_loop(i); });
+  }
+}
+
+IoThreads::~IoThreads() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void IoThreads::run(std::span<Connection* const> batch,
+                    const std::function<void(Connection&)>& job) {
+  // Handing off costs more than it saves for small batches.
+  if (workers.empty() || batch.size() < size()) {
+    for (Connection* con : batch) {
+      job(*con);
+    }
+    return;
+  }
+  dispatch(batch, job, 0);
+  run_share(0);
+  wait();
+}
+
+void IoThreads::start(std::span<Connection* const> batch,
+                      std::function<void(Connection&)> job) {
+  if (batch.empty()) {
+    return;
+  }
+  if (workers.empty()) {
+    for (Connection* con : batch) {
+      job(*con);
+    }
+    return;
+  }
+  dispatch(batch, std::move(job), 1);
+}
+
+void IoThreads::wait() {
+  std::unique_lock lock(mutex);
+  done_cv.wait(lock, [this] { return busy_workers == 0; });
+  current_job = nullptr;
+}
+
+void IoThreads::dispatch(std::span<Connection* const> batch,
+                         std::function<void(Connection&)> job,
+                         size_t first) {
+  {
+    std::lock_guard lock(mutex);
+    current_batch = batch;
+    current_job = std::move(job);
+    first_thread = first;
+    busy_workers = workers.size();
+    ++generation;
+  }
+  start_cv.notify_all();
+}
+
+void IoThreads::run_share(size_t index) {
+  if (index < first_thread) {
+    return;
+  }
+  const size_t stride = size() - first_thread;
+  for (size_t i = index - first_thread; i < current_batch.size();
+       i += stride) {
+    current_job(*current_batch[i]);
+  }
+}
+
+void IoThreads::worker_loop(size_t index) {
+  Tracer::instance().name_thread("io " + std::to_string(index));
+  uint64_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      start_cv.wait(lock, [&] {
+        return stopping || generation != seen_generation;
+      });
+      if (stopping) {
+        return;
+      }
+      seen_generation = generation;
+    }
+    run_share(index);
+    {
+      std::lock_guard lock(mutex);
+      --busy_workers;
+    }
+    done_cv.notify_one();
+  }
+}
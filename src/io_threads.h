@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "connection.h"
+
+// Pool of threads that perform socket reads, RESP parsing and socket writes
+// for a batch of ready connections in parallel. Commands are executed on the
+// main thread, except for read-only batches with concurrent reads enabled.
+class IoThreads {
+ public:
+  // `count` includes the calling (main) thread, so 1 means no extra threads.
+  explicit IoThreads(size_t count);
+  ~IoThreads();
+
+  IoThreads(const IoThreads&) = delete;
+  IoThreads& operator=(const IoThreads&) = delete;
+
+  // Calls `job` for every connection in `batch`, spread round robin over all
+  // threads, and returns once every call has finished. Each connection is
+  // only touched by one thread.
+  void run(std::span<Connection* const> batch,
+           const std::function<void(Connection&)>& job);
+  // Like `run`, but only the worker threads process the batch and `start`
+  // returns right away so the calling thread can do other work until `wait`.
+  void start(std::span<Connection* const> batch,
+             std::function<void(Connection&)> job);
+  void wait();
+
+  size_t size() const { return workers.size() + 1; }
+
+ private:
+  void worker_loop(size_t index);
+  void run_share(size_t index);
+  void dispatch(std::span<Connection* const> batch,
+                std::function<void(Connection&)> job, size_t first_thread);
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  uint64_t generation = 0;
+  size_t busy_workers = 0;
+  bool stopping = false;
+
+  std::span<Connection* const> current_batch;
+  std::function<void(Connection&)> current_job;
+  // Index of the first thread taking part, 0 is the main thread.
+  size_t first_thread = 0;
+};
@@ -0,0 +1,240 @@
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "commands.h"
+#include "database.h"
+#include "glob.h"
+
+// Commands on keys regardless of their values: DEL/UNLINK, FLUSHALL, KEYS,
+// the SCAN family and OBJECT.
+
+namespace {
+
+constexpr size_t default_scan_count = 10;
+// Longest string Redis stores in one allocation with its object header.
+constexpr size_t embedded_string_max_size = 44;
+
+struct ScanOptions {
+  std::optional<GlobPattern> match;
+  size_t count = default_scan_count;
+  std::optional<std::string> type;
+};
+
+// Parses `cursor [MATCH pattern] [COUNT count] [TYPE type]` starting at
+// `arguments[first]`. Returns the error reply if they are invalid.
+std::variant<std::pair<uint64_t, ScanOptions>, RespValue> parse_scan(
+    const RespArray &arguments, size_t first, bool allow_type) {
+  const auto cursor = parse_integer(arguments[first]);
+  if (!cursor || *cursor < 0) {
+    return RespValue::make_error("ERR invalid cursor");
+  }
+  ScanOptions options;
+  for (size_t i = first + 1; i < arguments.size(); i += 2) {
+    const auto option = arguments[i].to_string();
+    if (i + 1 == arguments.size()) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    if (equals_ignore_case(option, "match")) {
+      options.match.emplace(arguments[i + 1].to_string());
+    } else if (equals_ignore_case(option, "count")) {
+      const auto count = parse_integer(arguments[i + 1]);
+      if (!count) {
+        return RespValue::make_error("ERR value is not an integer");
+      }
+      if (*count < 1) {
+        return RespValue::make_error("ERR syntax error");
+      }
+      options.count = static_cast<size_t>(*count);
+    } else if (allow_type && equals_ignore_case(option, "type")) {
+      options.type = arguments[i + 1].to_string();
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+  }
+  return std::pair(static_cast<uint64_t>(*cursor), std::move(options));
+}
+
+RespValue scan_reply(uint64_t cursor, RespArray keys) {
+  return RespValue::make_array({RespValue::make_string(std::to_string(cursor)),
+                                RespValue::make_array(std::move(keys))});
+}
+
+// HSCAN, SSCAN and ZSCAN key cursor [MATCH pattern] [COUNT count]. There are
+// no hash, set or sorted set values, so a key either doesn't exist and scans
+// as empty or has the wrong type.
+RespValue scan_collection(const RespArray &arguments, std::string_view name) {
+  if (arguments.size() < 2) {
+    return RespValue::make_error("ERR wrong number of arguments for " +
+                                 std::string(name));
+  }
+  auto parsed = parse_scan(arguments, 1, false);
+  if (auto *error = std::get_if<RespValue>(&parsed)) {
+    return std::move(*error);
+  }
+  if (Database::instance().lookup(arguments[0].to_string())) {
+    return wrong_type_error();
+  }
+  return scan_reply(0, {});
+}
+
+}  // namespace
+
+// DEL and UNLINK key...: both leave values that take long to free to
+// `LazyFree`.
+RespValue handle_del(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for DEL");
+  }
+  auto &db = Database::instance();
+  RespInteger removed = 0;
+  for (const auto &argument : arguments) {
+    const auto key = argument.to_string();
+    if (!db.expire_if_needed(key) && db.erase(key)) {
+      ++removed;
+    }
+  }
+  return RespValue::make_integer(removed);
+}
+CommandRegistrar _handle_del("del", handle_del, CommandAccess::Write,
+                             KeySpec{1, -1, 1});
+CommandRegistrar _handle_unlink("unlink", handle_del, CommandAccess::Write,
+                                KeySpec{1, -1, 1});
+
+// FLUSHALL and FLUSHDB [ASYNC|SYNC]. ASYNC returns right away and frees the
+// keys in the background.
+RespValue handle_flushall(const RespArray &arguments) {
+  bool lazily = false;
+  if (arguments.size() == 1 &&
+      equals_ignore_case(arguments[0].to_string(), "async")) {
+    lazily = true;
+  } else if (arguments.size() == 1 &&
+             equals_ignore_case(arguments[0].to_string(), "sync")) {
+    lazily = false;
+  } else if (!arguments.empty()) {
+    return RespValue::make_error("ERR syntax error");
+  }
+  Database::instance().clear(lazily);
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_flushall("flushall", handle_flushall);
+CommandRegistrar _handle_flushdb("flushdb", handle_flushall);
+
+// SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+RespValue handle_scan(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for SCAN");
+  }
+  auto parsed = parse_scan(arguments, 0, true);
+  if (auto *error = std::get_if<RespValue>(&parsed)) {
+    return std::move(*error);
+  }
+  auto &[cursor, options] = std::get<0>(parsed);
+  auto &db = Database::instance();
+  RespArray keys;
+  // Every value is a string.
+  if (options.type && !equals_ignore_case(*options.type, "string")) {
+    return scan_reply(0, std::move(keys));
+  }
+  if (options.match && options.match->is_literal()) {
+    if (cursor == 0 && db.lookup(options.match->literal_prefix())) {
+      keys.push_back(RespValue::make_string(options.match->literal_prefix()));
+    }
+    return scan_reply(0, std::move(keys));
+  }
+  const auto next = db.scan(
+      cursor, options.count, [&](const std::string &key, const RespValue &) {
+        if (!options.match || options.match->matches(key)) {
+          keys.push_back(RespValue::make_string(key));
+        }
+      });
+  return scan_reply(next, std::move(keys));
+}
+CommandRegistrar _handle_scan("scan", handle_scan, CommandAccess::ReadOnly);
+
+// KEYS pattern: every matching key at once, so it blocks for as long as the
+// whole keyspace takes to walk unless the pattern has no wildcards.
+RespValue handle_keys(const RespArray &arguments) {
+  if (arguments.size() != 1) {
+    return RespValue::make_error("ERR wrong number of arguments for KEYS");
+  }
+  const GlobPattern pattern(arguments[0].to_string());
+  auto &db = Database::instance();
+  RespArray keys;
+  if (pattern.is_literal()) {
+    if (db.lookup(pattern.literal_prefix())) {
+      keys.push_back(RespValue::make_string(pattern.literal_prefix()));
+    }
+    return RespValue::make_array(std::move(keys));
+  }
+  uint64_t cursor = 0;
+  do {
+    cursor = db.scan(cursor, db.size() + 1,
+                     [&](const std::string &key, const RespValue &) {
+                       if (pattern.matches(key)) {
+                         keys.push_back(RespValue::make_string(key));
+                       }
+                     });
+  } while (cursor != 0);
+  return RespValue::make_array(std::move(keys));
+}
+CommandRegistrar _handle_keys("keys", handle_keys, CommandAccess::ReadOnly);
+
+RespValue handle_hscan(const RespArray &arguments) {
+  return scan_collection(arguments, "HSCAN");
+}
+CommandRegistrar _handle_hscan("hscan", handle_hscan, CommandAccess::ReadOnly,
+                               KeySpec{1, 1, 1});
+
+RespValue handle_sscan(const RespArray &arguments) {
+  return scan_collection(arguments, "SSCAN");
+}
+CommandRegistrar _handle_sscan("sscan", handle_sscan, CommandAccess::ReadOnly,
+                               KeySpec{1, 1, 1});
+
+RespValue handle_zscan(const RespArray &arguments) {
+  return scan_collection(arguments, "ZSCAN");
+}
+CommandRegistrar _handle_zscan("zscan", handle_zscan, CommandAccess::ReadOnly,
+                               KeySpec{1, 1, 1});
+
+// OBJECT ENCODING|FREQ|IDLETIME key: how the value is stored, and the
+// access statistics of the key. Strings are encoded as "int", "embstr" or
+// "raw" like in Redis, or "compressed". Doesn't count as an access.
+RespValue handle_object(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for OBJECT");
+  }
+  const auto subcommand = arguments[0].to_string();
+  Database::AccessStats access{};
+  const auto *value =
+      Database::instance().peek(arguments[1].to_string(), &access);
+  if (equals_ignore_case(subcommand, "freq")) {
+    return value ? RespValue::make_integer(access.frequency)
+                 : RespValue::make_null();
+  }
+  if (equals_ignore_case(subcommand, "idletime")) {
+    return value ? RespValue::make_integer(access.idle.count())
+                 : RespValue::make_null();
+  }
+  if (!equals_ignore_case(subcommand, "encoding")) {
+    return RespValue::make_error("ERR unknown subcommand '" + subcommand +
+                                 "'. Try OBJECT HELP.");
+  }
+  if (!value) {
+    return RespValue::make_null();
+  }
+  if (std::holds_alternative<RespInteger>(value->value)) {
+    return RespValue::make_string("int");
+  }
+  if (std::holds_alternative<RespCompressedString>(value->value)) {
+    return RespValue::make_string("compressed");
+  }
+  const auto *str = std::get_if<RespString>(&value->value);
+  return RespValue::make_string(str && str->size() <= embedded_string_max_size
+                                    ? "embstr"
+                                    : "raw");
+}
+CommandRegistrar _handle_object("object", handle_object,
+                                CommandAccess::ReadOnly, KeySpec{2, 2, 1});
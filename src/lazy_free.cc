@@ -0,0 +1,82 @@
+#include "lazy_free.h"
+
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+size_t LazyFree::free_effort(const RespValue& value) {
+  return std::visit(
+      [](const auto& v) -> size_t {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, RespString>) {
+          return 1 + v.size() / 4096;
+        } else if constexpr (std::is_same_v<T, RespArray>) {
+          size_t effort = 1;
+          for (const auto& element : v) {
+            effort += free_effort(element);
+          }
+          return effort;
+        } else if constexpr (std::is_same_v<T, RespSharedString>) {
+          // Only the last reference frees the string.
+          return v.data.use_count() == 1 ? 1 + v.data->size() / 4096 : 1;
+        } else if constexpr (std::is_same_v<T, RespCompressedString>) {
+          return 1 + v.data.size() / 4096;
+        } else if constexpr (std::is_same_v<T, RespMap>) {
+          size_t effort = 1;
+          for (const auto& [_, element] : v) {
+            effort += 1 + free_effort(element);
+          }
+          return effort;
+        } else {
+          return 1;
+        }
+      },
+      value.value);
+}
+
+void LazyFree::release(RespValue value) {
+  if (free_effort(value) > effort_threshold) {
+    release_in_background(std::move(value));
+  }
+}
+
+void LazyFree::push(std::shared_ptr<void> object) {
+  pending_count.fetch_add(1);
+  {
+    std::lock_guard lock(mutex);
+    queue.push_back(std::move(object));
+    if (!worker.joinable()) {
+      worker = std::thread(&LazyFree::run, this);
+    }
+  }
+  wakeup.notify_one();
+}
+
+void LazyFree::run() {
+  std::vector<std::shared_ptr<void>> batch;
+  std::unique_lock lock(mutex);
+  while (true) {
+    wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return;
+    }
+    batch.swap(queue);
+    lock.unlock();
+    const size_t count = batch.size();
+    batch.clear();
+    pending_count.fetch_sub(count);
+    freed_count.fetch_add(count);
+    lock.lock();
+  }
+}
+
+LazyFree::~LazyFree() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_one();
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "resp_types.h"
+
+// Destroys values that are expensive to free on a background thread, so
+// deleting, overwriting or expiring them doesn't stall the event loop.
+// Objects handed over must only own memory of the global allocator, not of
+// the `SlabAllocator`.
+class LazyFree {
+ public:
+  static LazyFree& instance() {
+    static LazyFree instance;
+    return instance;
+  }
+
+  // Values with a higher free effort are destroyed in the background.
+  static constexpr size_t effort_threshold = 64;
+
+  // Estimated cost of destroying `value`: one per allocation, with strings
+  // counted per 4 KiB page since large allocations are unmapped.
+  static size_t free_effort(const RespValue& value);
+
+  // Destroys `value` in the background if its free effort is above the
+  // threshold, right away otherwise.
+  void release(RespValue value);
+  // Destroys `object` in the background.
+  template <typename T>
+  void release_in_background(T object) {
+    push(std::make_shared<T>(std::move(object)));
+  }
+
+  // Objects waiting to be destroyed and objects destroyed so far.
+  size_t pending() const { return pending_count.load(); }
+  uint64_t freed() const { return freed_count.load(); }
+
+ private:
+  LazyFree() = default;
+  ~LazyFree();
+  // Delete copy/move operations
+  LazyFree(const LazyFree&) = delete;
+  LazyFree& operator=(const LazyFree&) = delete;
+  LazyFree(LazyFree&&) = delete;
+  LazyFree& operator=(LazyFree&&) = delete;
+
+  void push(std::shared_ptr<void> object);
+  void run();
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::vector<std::shared_ptr<void>> queue;
+  bool stopping = false;
+  // Started with the first object.
+  std::thread worker;
+  std::atomic<size_t> pending_count{0};
+  std::atomic<uint64_t> freed_count{0};
+};
@@ -0,0 +1,182 @@
+#include "log.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+namespace {
+
+// How long the writer sleeps when the ring is empty.
+constexpr auto idle_interval = std::chrono::milliseconds(2);
+
+char level_tag(LogLevel level) {
+  switch (level) {
+    case LogLevel::Debug:
+      return 'D';
+    case LogLevel::Info:
+      return 'I';
+    case LogLevel::Warning:
+      return 'W';
+    case LogLevel::Error:
+      return 'E';
+  }
+  return '?';
+}
+
+// Appends "YYYY-mm-dd HH:MM:SS.mmm" in UTC.
+void append_time(std::string& out, int64_t ticks) {
+  const auto time = std::chrono::system_clock::time_point(
+      std::chrono::system_clock::duration(ticks));
+  const std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          time.time_since_epoch())
+                          .count() %
+                      1000;
+  std::tm parts;
+  gmtime_r(&seconds, &parts);
+  char formatted[32];
+  size_t length = std::strftime(formatted, sizeof(formatted),
+                                "%Y-%m-%d %H:%M:%S", &parts);
+  length += std::snprintf(formatted + length, sizeof(formatted) - length,
+                          ".%03d", static_cast<int>(millis));
+  out.append(formatted, length);
+}
+
+void write_all(const std::string& out) {
+  size_t written = 0;
+  while (written < out.size()) {
+    const ssize_t result =
+        write(STDERR_FILENO, out.data() + written, out.size() - written);
+    if (result <= 0) {
+      return;
+    }
+    written += result;
+  }
+}
+
+}  // namespace
+
+Logger::Logger() : slots{std::make_unique<Slot[]>(ring_size)} {
+  for (size_t i = 0; i < ring_size; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  writer = std::thread([this] { run(); });
+}
+
+Logger::~Logger() {
+  stopping.store(true);
+  writer.join();
+}
+
+void Logger::set_level(LogLevel level) {
+  min_level.store(std::max(level, compiled_log_level),
+                  std::memory_order_relaxed);
+}
+
+void Logger::push(LogLevel level, std::string_view text) {
+  uint64_t position = enqueue_position.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots[position % ring_size];
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (enqueue_position.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The writer hasn't freed this slot yet, the ring is full.
+      dropped_count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+  slot->time = std::chrono::system_clock::now().time_since_epoch().count();
+  slot->level = level;
+  slot->length = std::min(text.size(), max_record_length);
+  std::memcpy(slot->text, text.data(), slot->length);
+  slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+  const uint64_t target = enqueue_position.load(std::memory_order_relaxed);
+  while (dequeue_position.load(std::memory_order_acquire) < target) {
+    std::this_thread::sleep_for(idle_interval);
+  }
+}
+
+bool Logger::drain() {
+  std::string out;
+  uint64_t position = dequeue_position.load(std::memory_order_relaxed);
+  while (true) {
+    Slot& slot = slots[position % ring_size];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      break;
+    }
+    append_time(out, slot.time);
+    out += ' ';
+    out += level_tag(slot.level);
+    out += ' ';
+    out.append(slot.text, slot.length);
+    out += '\n';
+    slot.sequence.store(position + ring_size, std::memory_order_release);
+    ++position;
+  }
+  if (const uint64_t dropped = dropped_count.load(std::memory_order_relaxed);
+      dropped != reported_dropped) {
+    out += "Dropped " + std::to_string(dropped - reported_dropped) +
+           " log records\n";
+    reported_dropped = dropped;
+  }
+  if (out.empty()) {
+    return false;
+  }
+  write_all(out);
+  dequeue_position.store(position, std::memory_order_release);
+  return true;
+}
+
+void Logger::run() {
+  while (true) {
+    if (drain()) {
+      continue;
+    }
+    if (stopping.load()) {
+      return;
+    }
+    std::this_thread::sleep_for(idle_interval);
+  }
+}
+
+bool LogRateLimiter::allow() {
+  const int64_t second =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  int64_t window = current_second.load(std::memory_order_relaxed);
+  if (window != second && current_second.compare_exchange_strong(
+                              window, second, std::memory_order_relaxed)) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  if (count.fetch_add(1, std::memory_order_relaxed) < per_second) {
+    return true;
+  }
+  suppressed.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+LogRecord::~LogRecord() {
+  if (limiter) {
+    if (const uint64_t suppressed = limiter->take_suppressed()) {
+      out << " (" << suppressed << " similar records suppressed)";
+    }
+  }
+  const auto text = out.span();
+  Logger::instance().push(level, std::string_view(text.data(), text.size()));
+}
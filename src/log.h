@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <spanstream>
+#include <string_view>
+#include <thread>
+
+// Leveled logging:
+//
+//   LOG(Info) << "Listening on " << address;
+//   LOG_RATE_LIMITED(Warning, 10) << "Unknown command " << name;
+//
+// Statements below `REDISXX_LOG_LEVEL` compile away entirely, arguments
+// included. Enabled records are formatted on the calling thread into a fixed
+// size buffer and pushed to a lock-free ring buffer that a background thread
+// drains to stderr, so logging never waits for I/O. While the ring is full
+// records are dropped and counted.
+
+enum class LogLevel : uint8_t { Debug, Info, Warning, Error };
+
+// 0 = Debug, 1 = Info, 2 = Warning, 3 = Error.
+#ifndef REDISXX_LOG_LEVEL
+#define REDISXX_LOG_LEVEL 1
+#endif
+constexpr LogLevel compiled_log_level =
+    static_cast<LogLevel>(REDISXX_LOG_LEVEL);
+
+class Logger {
+ public:
+  static Logger& instance() {
+    static Logger instance;
+    return instance;
+  }
+
+  static constexpr size_t max_record_length = 240;
+
+  // Raises the minimum level at runtime. Levels below `compiled_log_level`
+  // stay disabled.
+  void set_level(LogLevel level);
+  bool enabled(LogLevel level) const {
+    return level >= min_level.load(std::memory_order_relaxed);
+  }
+
+  // Any thread. Copies `text`, truncated to `max_record_length`.
+  void push(LogLevel level, std::string_view text);
+  // Waits until every record pushed before has been written.
+  void flush();
+
+  uint64_t dropped() const {
+    return dropped_count.load(std::memory_order_relaxed);
+  }
+
+ private:
+  Logger();
+  // Writes the remaining records and stops the background thread.
+  ~Logger();
+  // Delete copy/move operations
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+  Logger(Logger&&) = delete;
+  Logger& operator=(Logger&&) = delete;
+
+  static constexpr size_t ring_size = 4096;
+
+  // Bounded multi-producer queue slot: `sequence` equals the position a
+  // producer may claim it for, and position + 1 once the record is complete.
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> sequence;
+    int64_t time;  // `system_clock` ticks
+    LogLevel level;
+    uint16_t length;
+    char text[max_record_length];
+  };
+
+  void run();
+  // Writes all complete records, returns false if there were none.
+  bool drain();
+
+  std::unique_ptr<Slot[]> slots;
+  alignas(64) std::atomic<uint64_t> enqueue_position{0};
+  alignas(64) std::atomic<uint64_t> dequeue_position{0};
+  std::atomic<uint64_t> dropped_count{0};
+  // Dropped records the writer already reported.
+  uint64_t reported_dropped = 0;
+  std::atomic<LogLevel> min_level{compiled_log_level};
+  std::atomic<bool> stopping{false};
+  std::thread writer;
+};
+
+// Lets `per_second` records from one call site through per second and counts
+// the ones it holds back.
+class LogRateLimiter {
+ public:
+  explicit LogRateLimiter(uint32_t per_second) : per_second{per_second} {}
+
+  bool allow();
+  // Records held back since the last call.
+  uint64_t take_suppressed() {
+    return suppressed.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  const uint32_t per_second;
+  std::atomic<int64_t> current_second{0};
+  std::atomic<uint32_t> count{0};
+  std::atomic<uint64_t> suppressed{0};
+};
+
+// One log statement, pushed to the `Logger` at the end of the full
+// expression.
+class LogRecord {
+ public:
+  explicit LogRecord(LogLevel level, LogRateLimiter* limiter = nullptr)
+      : level{level}, limiter{limiter}, out{std::span<char>(buffer)} {}
+  ~LogRecord();
+
+  LogRecord(const LogRecord&) = delete;
+  LogRecord& operator=(const LogRecord&) = delete;
+
+  std::ostream& stream() { return out; }
+
+ private:
+  const LogLevel level;
+  LogRateLimiter* const limiter;
+  char buffer[Logger::max_record_length];
+  std::ospanstream out;
+};
+
+// Streams the elements of a range separated by spaces.
+template <typename Range>
+struct LogJoin {
+  const Range& range;
+};
+template <typename Range>
+LogJoin<Range> log_join(const Range& range) {
+  return LogJoin<Range>{range};
+}
+template <typename Range>
+std::ostream& operator<<(std::ostream& os, const LogJoin<Range>& join) {
+  bool first = true;
+  for (const auto& element : join.range) {
+    os << (first ? "" : " ") << element;
+    first = false;
+  }
+  return os;
+}
+
+#define LOG(level)                                           \
+  if constexpr (LogLevel::level < compiled_log_level) {      \
+  } else if (!Logger::instance().enabled(LogLevel::level)) { \
+  } else                                                     \
+    LogRecord(LogLevel::level).stream()
+
+#define LOG_RATE_LIMITED(level, per_second)                          \
+  if constexpr (LogLevel::level < compiled_log_level) {              \
+  } else if (!Logger::instance().enabled(LogLevel::level)) {         \
+  } else if (static LogRateLimiter log_limiter{per_second};          \
+             !log_limiter.allow()) {                                 \
+  } else                                                             \
+    LogRecord(LogLevel::level, &log_limiter).stream()
@@ -0,0 +1,136 @@
+#include "lzf.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr size_t hash_bits = 14;
+constexpr size_t max_literal_run = 32;
+constexpr size_t max_offset = 1 << 13;
+// A reference's length is stored minus two, in three bits of the control
+// byte or, from 7 on, with an extra byte.
+constexpr size_t min_match = 3;
+constexpr size_t max_match = 7 + 255 + 2;
+
+uint32_t hash_at(const uint8_t *p) {
+  const uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+}  // namespace
+
+size_t lzf_compress(std::string_view input, char *output, size_t capacity) {
+  const auto *in = reinterpret_cast<const uint8_t *>(input.data());
+  auto *out = reinterpret_cast<uint8_t *>(output);
+  const size_t length = input.size();
+  // Position plus one of the last occurrence of each hashed triple. Not
+  // cleared between calls: every candidate is verified against the input.
+  thread_local std::array<uint32_t, 1 << hash_bits> table{};
+  size_t ip = 0;
+  size_t op = 0;
+  size_t literal_start = 0;
+  // Emits the pending literals before `end` in runs of up to 32 bytes.
+  const auto flush_literals = [&](size_t end) {
+    while (literal_start < end) {
+      const size_t run = std::min(end - literal_start, max_literal_run);
+      if (op + 1 + run > capacity) {
+        return false;
+      }
+      out[op++] = static_cast<uint8_t>(run - 1);
+      std::memcpy(out + op, in + literal_start, run);
+      op += run;
+      literal_start += run;
+    }
+    return true;
+  };
+  while (ip + min_match <= length) {
+    const uint32_t hash = hash_at(in + ip);
+    const size_t candidate = table[hash];
+    table[hash] = static_cast<uint32_t>(ip + 1);
+    if (candidate == 0 || candidate > ip ||
+        ip - (candidate - 1) > max_offset ||
+        std::memcmp(in + candidate - 1, in + ip, min_match) != 0) {
+      ++ip;
+      continue;
+    }
+    const size_t ref = candidate - 1;
+    const size_t limit = std::min(length - ip, max_match);
+    size_t match = min_match;
+    while (match < limit && in[ref + match] == in[ip + match]) {
+      ++match;
+    }
+    if (!flush_literals(ip) || op + 3 > capacity) {
+      return 0;
+    }
+    const size_t offset = ip - ref - 1;
+    const size_t stored = match - 2;
+    if (stored < 7) {
+      out[op++] = static_cast<uint8_t>((stored << 5) | (offset >> 8));
+    } else {
+      out[op++] = static_cast<uint8_t>((7 << 5) | (offset >> 8));
+      out[op++] = static_cast<uint8_t>(stored - 7);
+    }
+    out[op++] = static_cast<uint8_t>(offset);
+    ip += match;
+    literal_start = ip;
+    // Like liblzf, only index the end of the match.
+    for (size_t p = ip - std::min<size_t>(match - 1, 2); p < ip; ++p) {
+      if (p + min_match <= length) {
+        table[hash_at(in + p)] = static_cast<uint32_t>(p + 1);
+      }
+    }
+  }
+  if (!flush_literals(length)) {
+    return 0;
+  }
+  return op;
+}
+
+bool lzf_decompress(std::string_view input, char *output, size_t size) {
+  const auto *in = reinterpret_cast<const uint8_t *>(input.data());
+  auto *out = reinterpret_cast<uint8_t *>(output);
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < input.size()) {
+    const size_t control = in[ip++];
+    if (control < max_literal_run) {
+      const size_t run = control + 1;
+      if (ip + run > input.size() || op + run > size) {
+        return false;
+      }
+      std::memcpy(out + op, in + ip, run);
+      ip += run;
+      op += run;
+      continue;
+    }
+    size_t match = control >> 5;
+    if (match == 7) {
+      if (ip == input.size()) {
+        return false;
+      }
+      match += in[ip++];
+    }
+    match += 2;
+    if (ip == input.size()) {
+      return false;
+    }
+    const size_t distance = ((control & 0x1f) << 8) + in[ip++] + 1;
+    if (distance > op || op + match > size) {
+      return false;
+    }
+    const uint8_t *ref = out + op - distance;
+    if (distance >= match) {
+      std::memcpy(out + op, ref, match);
+    } else {
+      // Overlapping references repeat the bytes just written.
+      for (size_t i = 0; i < match; ++i) {
+        out[op + i] = ref[i];
+      }
+    }
+    op += match;
+  }
+  return op == size;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// LZF, a byte-oriented LZ77 variant that trades ratio for speed, in the
+// format of liblzf. The stream is a sequence of literal runs of up to 32
+// bytes and back references of up to 264 bytes into the last 8 KiB.
+
+// Compresses `input` into `output`, which holds `capacity` bytes. Returns the
+// compressed size, or zero if it doesn't fit.
+size_t lzf_compress(std::string_view input, char *output, size_t capacity);
+
+// Decompresses `input` into `output`, which must decompress to exactly `size`
+// bytes. False if `input` is malformed.
+bool lzf_decompress(std::string_view input, char *output, size_t size);
@@ -1,147 +1,754 @@
 #include <arpa/inet.h>
 #include <assert.h>
+#include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/event.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-#include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <new>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <strstream>
 #include <unordered_map>
+#include <vector>
 
+#include "capture.h"
+#include "cluster.h"
+#include "compression.h"
 #include "connection.h"
+#include "database.h"
+#include "epoch.h"
+#include "io_threads.h"
+#include "log.h"
+#include "memory_accounting.h"
+#include "replication.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
+// The global allocator, counted for INFO and MEMORY STATS. Aligned
+// allocations keep the default implementation and aren't counted. The
+// overloads share malloc and free directly instead of calling each other,
+// which g++ reports as mismatched new and delete.
+namespace {
+
+void *allocate_counted(size_t size) {
+  void *pointer = std::malloc(size ? size : 1);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  MemoryAccounting::instance().on_allocate(pointer);
+  return pointer;
+}
+
+void free_counted(void *pointer) noexcept {
+  MemoryAccounting::instance().on_free(pointer);
+  std::free(pointer);
+}
+
+}  // namespace
+
+void *operator new(size_t size) { return allocate_counted(size); }
+void *operator new[](size_t size) { return allocate_counted(size); }
+void operator delete(void *pointer) noexcept { free_counted(pointer); }
+void operator delete[](void *pointer) noexcept { free_counted(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free_counted(pointer); }
+void operator delete[](void *pointer, size_t) noexcept {
+  free_counted(pointer);
+}
+
 bool set_nonblocking(int fd) {
-  extern int errno;
   int flags = fcntl(fd, F_GETFL, 0);
-  if (errno) {
-    std::cerr << "Failed to get socket flags: " << errno << std::endl;
+  if (flags == -1) {
+    LOG(Error) << "Failed to get socket flags: " << strerror(errno);
     return false;
   }
-  std::cout << "Socket flags 0x" << std::hex << flags << std::dec << std::endl;
+  LOG(Debug) << "Socket flags 0x" << std::hex << flags;
   flags |= O_NONBLOCK;
-  errno = 0;
-  (void)fcntl(fd, F_SETFL, flags);
-  if (errno) {
-    std::cerr << "Failed to set socket flags " << flags << std::endl;
+  if (fcntl(fd, F_SETFL, flags) == -1) {
+    LOG(Error) << "Failed to set socket flags " << flags << ": "
+               << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+// Applied to every listening socket.
+struct SocketOptions {
+  int backlog = SOMAXCONN;
+  // Kernel buffer sizes, zero keeps the system default. Accepted sockets
+  // inherit them from the listening socket.
+  int send_buffer = 0;
+  int receive_buffer = 0;
+};
+
+// Sets `option` to `value`, logs `name` if it fails.
+bool set_socket_option(int fd, int level, int option, int value,
+                       std::string_view name) {
+  if (setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+    LOG(Error) << "Failed to set " << name << ": " << strerror(errno);
     return false;
   }
   return true;
 }
 
-std::optional<int> create_socket(long port) {
-  extern int errno;
-  const int fd = socket(AF_INET6, SOCK_STREAM, 0);
+// Binds `fd` to `addr` and listens on it. Closes `fd` if that fails.
+std::optional<int> listen_on(int fd, const sockaddr *addr, socklen_t length,
+                             const SocketOptions &options) {
+  const bool ok =
+      set_nonblocking(fd) &&
+      (!options.send_buffer ||
+       set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer,
+                         "SO_SNDBUF")) &&
+      (!options.receive_buffer ||
+       set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer,
+                         "SO_RCVBUF"));
+  if (!ok) {
+    close(fd);
+    return std::nullopt;
+  }
+  if (bind(fd, addr, length)) {
+    LOG(Error) << "Failed to bind socket: " << strerror(errno);
+    close(fd);
+    return std::nullopt;
+  }
+  if (listen(fd, options.backlog)) {
+    LOG(Error) << "Failed to listen on socket: " << strerror(errno);
+    close(fd);
+    return std::nullopt;
+  }
+  return fd;
+}
+
+// Listens on TCP `port` of `address`, an IPv6 or IPv4 address. `::`, the
+// default, accepts IPv4 connections as well unless `ipv6_only` is set.
+std::optional<int> create_tcp_listener(const std::string &address, long port,
+                                       bool ipv6_only,
+                                       const SocketOptions &options) {
+  sockaddr_storage addr = {};
+  socklen_t length;
+  auto *addr6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+  auto *addr4 = reinterpret_cast<sockaddr_in *>(&addr);
+  std::string description;
+  if (inet_pton(AF_INET6, address.c_str(), &addr6->sin6_addr) == 1) {
+    addr6->sin6_family = AF_INET6;
+    addr6->sin6_port = htons(port);
+    length = sizeof(sockaddr_in6);
+    description = ipv6_to_string(addr6->sin6_addr, port);
+  } else if (inet_pton(AF_INET, address.c_str(), &addr4->sin_addr) == 1) {
+    addr4->sin_family = AF_INET;
+    addr4->sin_port = htons(port);
+    length = sizeof(sockaddr_in);
+    description = ipv4_to_string(addr4->sin_addr, port);
+  } else {
+    LOG(Error) << "Invalid bind address " << address;
+    return std::nullopt;
+  }
+  const int fd = socket(addr.ss_family, SOCK_STREAM, 0);
   if (fd < 0) {
-    std::cerr << "Failed to open socket." << std::endl;
+    LOG(Error) << "Failed to open socket: " << strerror(errno);
     return std::nullopt;
   }
-  if (!set_nonblocking(fd)) {
-    std::cerr << "Failed to make socket nonblocking." << std::endl;
+  if (!set_socket_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") ||
+      (addr.ss_family == AF_INET6 &&
+       !set_socket_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, ipv6_only,
+                          "IPV6_V6ONLY"))) {
+    close(fd);
     return std::nullopt;
   }
-  const int value = 1;
-  errno = 0;
-  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0) {
-    std::cerr << "Failed to set socket to reuse mode: " << errno << std::endl;
+  const auto listener =
+      listen_on(fd, reinterpret_cast<const sockaddr *>(&addr), length, options);
+  if (listener) {
+    LOG(Info) << "Listening on " << description;
+  }
+  return listener;
+}
+
+// Listens on a Unix domain socket at `path`, replacing a stale socket file.
+// `permissions` of zero leave the mode to the umask.
+std::optional<int> create_unix_listener(const std::string &path,
+                                        mode_t permissions,
+                                        const SocketOptions &options) {
+  sockaddr_un addr = {};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG(Error) << "Unix socket path too long: " << path;
+    return std::nullopt;
+  }
+  addr.sun_family = AF_UNIX;
+  path.copy(addr.sun_path, path.size());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG(Error) << "Failed to open socket: " << strerror(errno);
+    return std::nullopt;
+  }
+  unlink(path.c_str());
+  const auto listener = listen_on(
+      fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr), options);
+  if (!listener) {
     return std::nullopt;
   }
+  if (permissions && chmod(path.c_str(), permissions) < 0) {
+    LOG(Warning) << "Failed to set permissions of " << path << ": "
+                 << strerror(errno);
+  }
+  LOG(Info) << "Listening on " << path;
+  return listener;
+}
 
-  sockaddr_in6 addr = {};
-  addr.sin6_family = AF_INET6;
-  addr.sin6_port = htons(port);
-  addr.sin6_addr = in6addr_any;
-  int rv = bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
-  if (rv) {
-    std::cerr << "Failed to bind socket: " << strerror(errno) << std::endl;
+// Accepts a pending connection on `listener` as a non-blocking socket.
+// Nothing once the backlog is drained or on error.
+std::optional<int> accept_connection(int listener) {
+  sockaddr_storage addr;
+  socklen_t length = sizeof(addr);
+#ifdef SOCK_NONBLOCK
+  const int fd = accept4(listener, reinterpret_cast<sockaddr *>(&addr),
+                         &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  const int fd =
+      accept(listener, reinterpret_cast<sockaddr *>(&addr), &length);
+#endif
+  if (fd < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      LOG(Warning) << "Failed to accept connection: " << strerror(errno);
+    }
     return std::nullopt;
   }
-  rv = listen(fd, SOMAXCONN);
-  if (rv) {
-    std::cerr << "Failed to listen on socket: " << errno << std::endl;
+#ifndef SOCK_NONBLOCK
+  if (!set_nonblocking(fd)) {
+    close(fd);
     return std::nullopt;
   }
-  std::cout << "Listening on " << ipv6_to_string(addr.sin6_addr, port)
-            << std::endl;
+#endif
+  if (addr.ss_family == AF_INET) {
+    const auto *addr_in = reinterpret_cast<const sockaddr_in *>(&addr);
+    LOG(Debug) << "Connection established from "
+               << ipv4_to_string(addr_in->sin_addr, ntohs(addr_in->sin_port))
+               << " -> " << fd;
+  } else if (addr.ss_family == AF_INET6) {
+    const auto *addr_in6 = reinterpret_cast<const sockaddr_in6 *>(&addr);
+    LOG(Debug) << "Connection established from "
+               << ipv6_to_string(addr_in6->sin6_addr,
+                                 ntohs(addr_in6->sin6_port))
+               << " -> " << fd;
+  } else {
+    LOG(Debug) << "Connection established on Unix socket -> " << fd;
+  }
+  // Replies go out as soon as they are written, not after Nagle's delay.
+  if (addr.ss_family != AF_UNIX) {
+    set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
   return fd;
 }
 
 constexpr int event_batch_size = 32;
+// Connections accepted per listener and wakeup, so a connection storm
+// doesn't starve the connected clients.
+constexpr int max_accepts_per_wakeup = 1000;
+// Keys a defragmentation step visits while the event loop is idle.
+constexpr size_t defragment_step_budget = 1000;
+// Keys a step of freeing a flushed keyspace visits while the event loop is
+// idle.
+constexpr size_t lazy_free_step_budget = 10000;
 
-int main(int, char **) {
-  std::cout << "ReDiSxx" << std::endl;
-  auto socket = create_socket(1234);
-  if (!socket) {
-    std::cerr << "Failed to open socket." << std::endl;
+struct ServerOptions {
+  long port = 1234;
+  // Addresses the TCP port is bound on, all of them if none are given.
+  std::vector<std::string> bind_addresses;
+  // Also listen on a Unix domain socket at this path unless it is empty.
+  std::string unix_socket;
+  mode_t unix_socket_permissions = 0;
+  SocketOptions socket;
+  // Replicate from this primary from the start, see `Replication`.
+  std::string replicaof_host;
+  int replicaof_port = 0;
+  bool cluster_enabled = false;
+  // Address of this node in MOVED and ASK redirections.
+  std::string cluster_announce_ip = "127.0.0.1";
+  // Threads doing socket I/O and parsing, including the main thread.
+  size_t io_threads = 1;
+  // Execute read-only batches on the I/O threads next to the writer.
+  bool concurrent_reads = false;
+  LogLevel log_level = LogLevel::Info;
+  // Commands slower than this many microseconds go to the SLOWLOG, negative
+  // disables it.
+  long slowlog_slower_than = 10000;
+  size_t slowlog_max_len = 128;
+  // Records executed commands to this file for bench/redisxx_replay.cc.
+  std::string capture_path;
+  // Record event loop spans from the start, see `Tracer`.
+  bool trace = false;
+  // Where SIGUSR2 and TRACE DUMP write the trace.
+  std::string trace_file = "redisxx-trace.json";
+};
+
+// Parses a byte count with an optional k, kb, m, mb, g or gb suffix, all
+// powers of 1024.
+std::optional<size_t> parse_memory(std::string_view text) {
+  size_t value = 0;
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc()) {
+    return std::nullopt;
+  }
+  std::string unit(end, text.data() + text.size());
+  std::ranges::transform(unit, unit.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  if (unit.empty() || unit == "b") {
+    return value;
+  }
+  if (unit == "k" || unit == "kb") {
+    return value << 10;
+  }
+  if (unit == "m" || unit == "mb") {
+    return value << 20;
+  }
+  if (unit == "g" || unit == "gb") {
+    return value << 30;
+  }
+  return std::nullopt;
+}
+
+// Sets `target` from the memory size in `text`, warns if it's invalid.
+void set_memory_option(std::string_view name, std::string_view text,
+                       size_t &target) {
+  if (const auto value = parse_memory(text)) {
+    target = *value;
+  } else {
+    LOG(Warning) << "Ignoring invalid " << name << " " << text;
+  }
+}
+
+// --client-output-buffer-limit <class> <hard> <soft> <soft seconds>
+void set_output_buffer_limit(char **values) {
+  const std::string_view name(values[0]);
+  ClientClass client_class;
+  if (name == "normal") {
+    client_class = ClientClass::Normal;
+  } else if (name == "pubsub") {
+    client_class = ClientClass::PubSub;
+  } else if (name == "replica" || name == "slave") {
+    client_class = ClientClass::Replica;
+  } else {
+    LOG(Warning) << "Ignoring output buffer limit of unknown class " << name;
+    return;
+  }
+  const auto hard = parse_memory(values[1]);
+  const auto soft = parse_memory(values[2]);
+  const long seconds = std::atol(values[3]);
+  if (!hard || !soft || seconds < 0) {
+    LOG(Warning) << "Ignoring invalid output buffer limit for " << name;
+    return;
+  }
+  ClientLimits::instance().output_buffer[static_cast<size_t>(client_class)] =
+      {.hard = *hard,
+       .soft = *soft,
+       .soft_seconds = std::chrono::seconds(seconds)};
+}
+
+ServerOptions parse_options(int argc, char **argv) {
+  ServerOptions options;
+  auto &limits = ClientLimits::instance();
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg(argv[i]);
+    if (arg == "--port" && i + 1 < argc) {
+      options.port = std::atol(argv[++i]);
+    } else if (arg == "--bind" && i + 1 < argc) {
+      options.bind_addresses.emplace_back(argv[++i]);
+    } else if (arg == "--unixsocket" && i + 1 < argc) {
+      options.unix_socket = argv[++i];
+    } else if (arg == "--unixsocketperm" && i + 1 < argc) {
+      options.unix_socket_permissions = std::strtol(argv[++i], nullptr, 8);
+    } else if (arg == "--tcp-backlog" && i + 1 < argc) {
+      options.socket.backlog = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--socket-sndbuf" && i + 1 < argc) {
+      size_t bytes = 0;
+      set_memory_option(arg, argv[++i], bytes);
+      options.socket.send_buffer = static_cast<int>(bytes);
+    } else if (arg == "--socket-rcvbuf" && i + 1 < argc) {
+      size_t bytes = 0;
+      set_memory_option(arg, argv[++i], bytes);
+      options.socket.receive_buffer = static_cast<int>(bytes);
+    } else if (arg == "--replicaof" && i + 2 < argc) {
+      options.replicaof_host = argv[++i];
+      options.replicaof_port = std::atoi(argv[++i]);
+    } else if (arg == "--repl-backlog-size" && i + 1 < argc) {
+      set_memory_option(arg, argv[++i],
+                        Replication::instance().backlog_size);
+    } else if (arg == "--cluster-enabled") {
+      options.cluster_enabled = true;
+    } else if (arg == "--cluster-announce-ip" && i + 1 < argc) {
+      options.cluster_announce_ip = argv[++i];
+    } else if (arg == "--io-threads" && i + 1 < argc) {
+      options.io_threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--concurrent-reads") {
+      options.concurrent_reads = true;
+    } else if (arg == "--slowlog-slower-than" && i + 1 < argc) {
+      options.slowlog_slower_than = std::atol(argv[++i]);
+    } else if (arg == "--slowlog-max-len" && i + 1 < argc) {
+      options.slowlog_max_len = std::max(0L, std::atol(argv[++i]));
+    } else if (arg == "--client-output-buffer-limit" && i + 4 < argc) {
+      set_output_buffer_limit(&argv[i + 1]);
+      i += 4;
+    } else if (arg == "--max-pending-output" && i + 1 < argc) {
+      set_memory_option(arg, argv[++i], limits.max_pending_output);
+    } else if (arg == "--client-query-buffer-limit" && i + 1 < argc) {
+      set_memory_option(arg, argv[++i], limits.max_query_buffer);
+    } else if (arg == "--compress-values-above" && i + 1 < argc) {
+      size_t min_size = 0;
+      set_memory_option(arg, argv[++i], min_size);
+      set_value_compression(min_size);
+    } else if (arg == "--max-commands-per-wakeup" && i + 1 < argc) {
+      limits.max_commands_per_wakeup = std::max(0L, std::atol(argv[++i]));
+    } else if (arg == "--trace") {
+      options.trace = true;
+    } else if (arg == "--trace-file" && i + 1 < argc) {
+      options.trace_file = argv[++i];
+    } else if (arg == "--capture" && i + 1 < argc) {
+      options.capture_path = argv[++i];
+    } else if (arg == "--log-level" && i + 1 < argc) {
+      const std::string_view level(argv[++i]);
+      if (level == "debug") {
+        options.log_level = LogLevel::Debug;
+      } else if (level == "info") {
+        options.log_level = LogLevel::Info;
+      } else if (level == "warning") {
+        options.log_level = LogLevel::Warning;
+      } else if (level == "error") {
+        options.log_level = LogLevel::Error;
+      } else {
+        LOG(Warning) << "Ignoring unknown log level " << level;
+      }
+    } else {
+      LOG(Warning) << "Ignoring unknown option " << arg;
+    }
+  }
+  return options;
+}
+
+int main(int argc, char **argv) {
+  const auto options = parse_options(argc, argv);
+  Logger::instance().set_level(options.log_level);
+  if (options.log_level < compiled_log_level) {
+    LOG(Warning) << "Lower log levels are compiled out, rebuild with "
+                    "-DREDISXX_LOG_LEVEL="
+                 << static_cast<int>(options.log_level);
+  }
+  LOG(Info) << "ReDiSxx";
+  SlowLog::instance().configure(
+      std::chrono::microseconds(options.slowlog_slower_than),
+      options.slowlog_max_len);
+  auto &tracer = Tracer::instance();
+  tracer.set_enabled(options.trace);
+  tracer.set_dump_path(options.trace_file);
+  tracer.name_thread("main");
+  // No SA_RESTART, so the signal wakes up the event loop to dump.
+  struct sigaction dump_on_signal = {};
+  dump_on_signal.sa_handler = [](int) { Tracer::instance().request_dump(); };
+  sigaction(SIGUSR2, &dump_on_signal, nullptr);
+  // Writes to closed sockets fail with EPIPE instead.
+  signal(SIGPIPE, SIG_IGN);
+  if (!options.capture_path.empty() &&
+      !Capture::instance().start(options.capture_path)) {
     return -1;
   }
-  std::cout << "Opened socket " << *socket << std::endl;
+  std::vector<int> listeners;
+  // Without addresses `::` takes IPv4 connections too, with them every
+  // address family is bound separately.
+  const bool ipv6_only = !options.bind_addresses.empty();
+  for (const auto &address : ipv6_only ? options.bind_addresses
+                                       : std::vector<std::string>{"::"}) {
+    const auto listener = create_tcp_listener(address, options.port,
+                                              ipv6_only, options.socket);
+    if (!listener) {
+      LOG(Error) << "Failed to open socket.";
+      return -1;
+    }
+    listeners.push_back(*listener);
+  }
+  if (!options.unix_socket.empty()) {
+    const auto listener =
+        create_unix_listener(options.unix_socket,
+                             options.unix_socket_permissions, options.socket);
+    if (!listener) {
+      LOG(Error) << "Failed to open Unix socket.";
+      return -1;
+    }
+    listeners.push_back(*listener);
+  }
+  ServerStats::instance().port = static_cast<int>(options.port);
+  if (options.cluster_enabled) {
+    Cluster::instance().enable(options.cluster_announce_ip,
+                               static_cast<int>(options.port));
+  }
+  auto &replication = Replication::instance();
+  if (!options.replicaof_host.empty()) {
+    replication.replicate_from(options.replicaof_host, options.replicaof_port);
+  }
   const int kq_fd = kqueue();
 
   struct kevent evSet;
-  EV_SET(&evSet, *socket, EVFILT_READ, EV_ADD, 0, 0, nullptr);
-  assert(-1 != kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr));
+  for (const int listener : listeners) {
+    EV_SET(&evSet, listener, EVFILT_READ, EV_ADD, 0, 0, nullptr);
+    assert(-1 != kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr));
+  }
   std::unordered_map<int, Connection> connection_map{};
+  IoThreads io_threads(options.io_threads);
+  LOG(Info) << "Using " << io_threads.size() << " I/O threads";
+  const bool concurrent_reads =
+      options.concurrent_reads && io_threads.size() > 1;
+  if (concurrent_reads) {
+    Database::instance().enable_concurrent_reads();
+  } else if (options.concurrent_reads) {
+    LOG(Warning) << "--concurrent-reads needs --io-threads 2 or more";
+  }
+
+  auto &stats = ServerStats::instance();
+  auto close_connection = [&](int fd) {
+    LOG(Debug) << "Disconnected " << fd;
+    handle_close(connection_map.at(fd));
+    close(fd);
+    connection_map.erase(fd);
+    stats.connected_clients.store(connection_map.size(),
+                                  std::memory_order_relaxed);
+  };
+  // Fills `result` with the connections of `fds` that are still open.
+  auto lookup = [&](const std::vector<int> &fds,
+                    std::vector<Connection *> &result) {
+    result.clear();
+    for (const int fd : fds) {
+      if (const auto it = connection_map.find(fd); it != connection_map.end()) {
+        result.push_back(&it->second);
+      }
+    }
+  };
+
+  // Reused across iterations, so the loop itself doesn't allocate.
+  std::vector<int> readable_fds;
+  std::vector<int> writable_fds;
+  std::vector<int> flush_fds;
+  std::vector<Connection *> readable;
+  std::vector<Connection *> flush;
+  std::vector<Connection *> readers;
+  std::vector<Connection *> writers;
+  // Connections with commands left over after using their budget of
+  // `ClientLimits::max_commands_per_wakeup`. They execute the rest in the
+  // next iterations before reading again.
+  std::vector<int> backlog_fds;
+  std::vector<Connection *> backlog;
+  const auto &limits = ClientLimits::instance();
+  // Stops or resumes polling `con` for input.
+  auto set_reading = [&](Connection &con, bool enabled) {
+    EV_SET(&evSet, con.fd, EVFILT_READ, enabled ? EV_ENABLE : EV_DISABLE, 0,
+           0, nullptr);
+    kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+    con.reading_paused = !enabled;
+  };
+  // Replication keeps time, so the loop wakes up at least this often while
+  // it's active.
+  const timespec replication_interval{1, 0};
+  MemoryAccounting::instance().mark_startup();
   while (1) {
+    if (const auto link_fd = replication.connect_if_due()) {
+      EV_SET(&evSet, *link_fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
+      kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+      auto &link = connection_map.try_emplace(*link_fd, *link_fd).first->second;
+      stats.connected_clients.store(connection_map.size(),
+                                    std::memory_order_relaxed);
+      replication.attach_link(link);
+    }
+    replication.cron();
     struct kevent events[event_batch_size];
+    // Only poll while there is work without events: backlogged commands,
+    // output queued between iterations, defragmenting the keyspace, freeing
+    // flushed keys and reclaiming what the last commands retired.
+    auto &epochs = EpochManager::instance();
+    lookup(backlog_fds, backlog);
+    const bool backlogged =
+        std::ranges::any_of(backlog, [](const Connection *con) {
+          return !con->reading_paused;
+        });
+    auto &db = Database::instance();
+    const bool defragment = db.needs_defragmentation();
+    const bool free_lazily = db.has_lazy_free_work();
+    const bool idle_work =
+        defragment || free_lazily || epochs.retired_count() > 0;
+    const bool flush_pending = has_write_requests();
+    const timespec no_wait{};
+    const timespec *timeout = nullptr;
+    if (backlogged || idle_work || flush_pending) {
+      timeout = &no_wait;
+    } else if (replication.active()) {
+      timeout = &replication_interval;
+    }
     const int num_events =
-        kevent(kq_fd, nullptr, 0, events, event_batch_size, nullptr);
-    std::cout << "Got " << num_events << " events." << std::endl;
+        kevent(kq_fd, nullptr, 0, events, event_batch_size, timeout);
+    if (num_events < 0) {
+      // Interrupted by a signal.
+      tracer.handle_requests();
+      continue;
+    }
+    if (num_events == 0 && !backlogged && !flush_pending) {
+      if (defragment) {
+        db.defragment(defragment_step_budget);
+      }
+      if (free_lazily) {
+        db.free_lazily(lazy_free_step_budget);
+      }
+      epochs.reclaim();
+      continue;
+    }
+    LOG(Debug) << "Got " << num_events << " events.";
+    const auto iteration_start = std::chrono::steady_clock::now();
+    Database::instance().update_access_clock(iteration_start);
+    std::optional<TraceSpan> wakeup_span(std::in_place, "loop", "wakeup");
+    wakeup_span->set_count(num_events);
+    stats.record_wakeup(num_events);
+    readable_fds.clear();
+    writable_fds.clear();
     for (int i = 0; i < num_events; ++i) {
       const int in_fd = static_cast<int>(events[i].ident);
-      std::cout << "Event " << i << " flags 0x" << std::hex << events[i].flags
-                << std::dec << " ident " << in_fd << std::endl;
-      // New connection
-      if (events[i].flags & EV_ADD && in_fd == *socket) {
-        struct sockaddr_storage addr;
-        socklen_t socklen = sizeof(addr);
-        const int conn_fd =
-            accept(in_fd, reinterpret_cast<struct sockaddr *>(&addr), &socklen);
-        assert(conn_fd != -1);
-
-        EV_SET(&evSet, conn_fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
-        kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
-        if (addr.ss_family == AF_INET) {
-          const struct sockaddr_in *addr_in = (const struct sockaddr_in *)&addr;
-          std::cout << "Connection established from "
-                    << ipv4_to_string(addr_in->sin_addr,
-                                      ntohl(addr_in->sin_port))
-                    << " -> " << conn_fd << std::endl;
-        } else {
-          const struct sockaddr_in6 *addr_in6 =
-              (const struct sockaddr_in6 *)&addr;
-          std::cout << "Connection established from "
-                    << ipv6_to_string(addr_in6->sin6_addr,
-                                      ntohl(addr_in6->sin6_port))
-                    << " -> " << conn_fd << std::endl;
+      LOG(Debug) << "Event " << i << " flags 0x" << std::hex << events[i].flags
+                 << std::dec << " ident " << in_fd;
+      // New connections
+      if (events[i].flags & EV_ADD &&
+          std::ranges::find(listeners, in_fd) != listeners.end()) {
+        for (int accepted = 0; accepted < max_accepts_per_wakeup; ++accepted) {
+          const auto conn_fd = accept_connection(in_fd);
+          if (!conn_fd) {
+            break;
+          }
+          EV_SET(&evSet, *conn_fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
+          kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+          connection_map.try_emplace(*conn_fd, *conn_fd);
+          stats.connections_received.fetch_add(1, std::memory_order_relaxed);
+          LOG(Debug) << "Registered connection conn_fd=" << *conn_fd
+                     << " in_fd=" << in_fd;
         }
-        assert(set_nonblocking(conn_fd));
-        connection_map.insert({conn_fd, Connection(conn_fd)});
-        std::cout << "Registered connection conn_fd=" << conn_fd
-                  << " in_fd=" << in_fd << std::endl;
+        stats.connected_clients.store(connection_map.size(),
+                                      std::memory_order_relaxed);
       } else if (events[i].flags & EV_EOF) {  // Disconnect
-        std::cout << "Disconnected " << in_fd << std::endl;
-        close(in_fd);
-        connection_map.erase(in_fd);
-      } else if (events[i].filter == EVFILT_READ) {  // Incoming data
-        const auto state = handle_read(connection_map.at(in_fd));
-        if (state == EventState::Write) {
-          EV_SET(&evSet, in_fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0,
-                 nullptr);
-          kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+        if (connection_map.contains(in_fd)) {
+          close_connection(in_fd);
         }
+      } else if (events[i].filter == EVFILT_READ) {  // Incoming data
+        readable_fds.push_back(in_fd);
       } else if (events[i].filter == EVFILT_WRITE) {  // Write outgoing
-        const auto state = handle_write(connection_map.at(in_fd));
-        if (state == EventState::Write) {
-          EV_SET(&evSet, in_fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0,
-                 nullptr);
-          kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+        writable_fds.push_back(in_fd);
+      }
+    }
+
+    // Receive and parse on the I/O threads, then execute all parsed commands
+    // in order on this thread. Backlogged connections only execute.
+    lookup(readable_fds, readable);
+    std::erase_if(readable, [](const Connection *con) {
+      return has_pending_commands(*con);
+    });
+    io_threads.run(readable, [](Connection &con) {
+      if (read_commands(con) == EventState::Close) {
+        con.closing = true;
+      }
+    });
+    lookup(backlog_fds, backlog);
+    backlog_fds.clear();
+    for (Connection *con : backlog) {
+      if (!has_pending_commands(*con)) {
+        continue;
+      }
+      if (con->reading_paused) {
+        // Waits for its output to drain.
+        backlog_fds.push_back(con->fd);
+      } else {
+        readable.push_back(con);
+      }
+    }
+    readers.clear();
+    writers.clear();
+    for (Connection *con : readable) {
+      if (con->closing) {
+        close_connection(con->fd);
+      } else if (concurrent_reads && can_execute_concurrently(*con)) {
+        readers.push_back(con);
+      } else {
+        writers.push_back(con);
+      }
+    }
+    // Read-only batches execute and reply on the I/O threads while this
+    // thread applies everything else.
+    io_threads.start(readers, [](Connection &con) {
+      Database::ConcurrentRead read;
+      execute_commands(con);
+      handle_write(con);
+    });
+    for (Connection *con : writers) {
+      if (execute_commands(*con) == EventState::Write) {
+        request_write(*con);
+      }
+      if (has_pending_commands(*con)) {
+        backlog_fds.push_back(con->fd);
+      }
+    }
+    io_threads.wait();
+    for (Connection *con : readers) {
+      if (!con->outgoing.empty()) {
+        request_write(*con);
+      }
+      if (has_pending_commands(*con)) {
+        backlog_fds.push_back(con->fd);
+      }
+    }
+    epochs.reclaim();
+
+    // Flush replies, published messages and writes that were pending from
+    // earlier iterations on the I/O threads. Connections that could not send
+    // everything wait for the socket to become writable.
+    lookup(writable_fds, flush);
+    for (Connection *con : flush) {
+      request_write(*con);
+    }
+    take_write_requests(flush_fds);
+    lookup(flush_fds, flush);
+    io_threads.run(flush, [](Connection &con) { handle_write(con); });
+    for (Connection *con : flush) {
+      const size_t pending = con->outgoing.size();
+      if (output_limit_exceeded(*con)) {
+        LOG_RATE_LIMITED(Warning, 10)
+            << "Closing client " << con->fd << ", its " << pending
+            << " bytes of pending output exceed the output buffer limit";
+        stats.output_limit_disconnections.fetch_add(
+            1, std::memory_order_relaxed);
+        close_connection(con->fd);
+        continue;
+      }
+      // Backpressure on clients that send faster than they read.
+      if (const size_t max_pending = limits.max_pending_output;
+          max_pending && !con->replication_link) {
+        if (!con->reading_paused && pending > max_pending) {
+          set_reading(*con, false);
+        } else if (con->reading_paused && pending <= max_pending / 2) {
+          set_reading(*con, true);
         }
       }
+      if (!con->outgoing.empty()) {
+        EV_SET(&evSet, con->fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0,
+               nullptr);
+        kevent(kq_fd, &evSet, 1, nullptr, 0, nullptr);
+      }
     }
+    stats.event_loop.record(std::chrono::steady_clock::now() -
+                            iteration_start);
+    wakeup_span.reset();
+    tracer.handle_requests();
   }
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,37 @@
+#include "memory_accounting.h"
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+namespace {
+
+size_t allocation_size(void* pointer) {
+#if defined(__APPLE__)
+  return malloc_size(pointer);
+#else
+  return malloc_usable_size(pointer);
+#endif
+}
+
+}  // namespace
+
+void MemoryAccounting::on_allocate(void* pointer) {
+  add(allocation_size(pointer));
+}
+
+void MemoryAccounting::on_free(void* pointer) {
+  if (pointer) {
+    used.fetch_sub(allocation_size(pointer), std::memory_order_relaxed);
+  }
+}
+
+void MemoryAccounting::add(size_t bytes) {
+  const size_t now = used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t highest = peak.load(std::memory_order_relaxed);
+  while (now > highest &&
+         !peak.compare_exchange_weak(highest, now, std::memory_order_relaxed)) {
+  }
+}
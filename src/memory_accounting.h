@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Memory the process has allocated: through the global operator new, at the
+// size malloc actually reserved, plus the slabs the `SlabAllocator` maps.
+// Both report every allocation here as it happens, so the totals are current
+// without walking any data. The server replaces operator new and delete in
+// main.cc; other programs linking the sources only count slabs.
+class MemoryAccounting {
+ public:
+  static MemoryAccounting& instance() {
+    static MemoryAccounting instance;
+    return instance;
+  }
+
+  // Called by the replacement operator new and delete.
+  void on_allocate(void* pointer);
+  void on_free(void* pointer);
+  // Called by the `SlabAllocator`.
+  void on_map(size_t bytes) { add(bytes); }
+  void on_unmap(size_t bytes) {
+    used.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  size_t used_bytes() const { return used.load(std::memory_order_relaxed); }
+  // The most that was ever used.
+  size_t peak_bytes() const { return peak.load(std::memory_order_relaxed); }
+  // Usage when the server started serving, the baseline of an empty server.
+  size_t startup_bytes() const {
+    return startup.load(std::memory_order_relaxed);
+  }
+  void mark_startup() {
+    startup.store(used_bytes(), std::memory_order_relaxed);
+  }
+
+ private:
+  // Constant-initialized, so allocating before main is fine.
+  MemoryAccounting() = default;
+  // Delete copy/move operations
+  MemoryAccounting(const MemoryAccounting&) = delete;
+  MemoryAccounting& operator=(const MemoryAccounting&) = delete;
+  MemoryAccounting(MemoryAccounting&&) = delete;
+  MemoryAccounting& operator=(MemoryAccounting&&) = delete;
+
+  void add(size_t bytes);
+
+  std::atomic<size_t> used{0};
+  std::atomic<size_t> peak{0};
+  std::atomic<size_t> startup{0};
+};
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "commands.h"
+#include "database.h"
+#include "lazy_free.h"
+#include "memory_accounting.h"
+#include "slab.h"
+
+// MEMORY introspection commands.
+
+namespace {
+
+// Elements of collections MEMORY USAGE looks at by default, like Redis.
+constexpr size_t default_usage_samples = 5;
+constexpr size_t default_top_keys = 10;
+constexpr size_t default_top_samples = 10000;
+
+// Occupancy of the `SlabAllocator`, per size class that has slabs.
+RespValue malloc_stats() {
+  const auto &slabs = SlabAllocator::instance();
+  const size_t mapped = slabs.slab_bytes();
+  const size_t used = slabs.used_bytes();
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(2) << "slab_bytes:" << mapped
+      << "\r\nused_bytes:" << used << "\r\nfragmentation_ratio:"
+      << (used ? static_cast<double>(mapped) / used : 0.0) << "\r\n";
+  for (const auto &size_class : slabs.stats()) {
+    if (size_class.slabs == 0) {
+      continue;
+    }
+    oss << "class_" << size_class.object_size
+        << ":slabs=" << size_class.slabs << ",used=" << size_class.used
+        << ",capacity=" << size_class.capacity << ",occupancy="
+        << 100.0 * size_class.used / size_class.capacity << "%\r\n";
+  }
+  return RespValue::make_string(oss.str());
+}
+
+// MEMORY USAGE key [SAMPLES count]
+RespValue memory_usage(const RespArray &arguments) {
+  if (arguments.size() != 2 && arguments.size() != 4) {
+    return RespValue::make_error("ERR syntax error");
+  }
+  size_t samples = default_usage_samples;
+  if (arguments.size() == 4) {
+    const auto count = parse_integer(arguments[3]);
+    if (!equals_ignore_case(arguments[2].to_string(), "samples")) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    if (!count || *count < 0) {
+      return RespValue::make_error("ERR value is not an integer");
+    }
+    samples = *count;
+  }
+  const auto bytes =
+      Database::instance().memory_usage(arguments[1].to_string(), samples);
+  if (!bytes) {
+    return RespValue::make_null();
+  }
+  return RespValue::make_integer(*bytes);
+}
+
+// MEMORY STATS: where memory goes, from totals kept as memory is allocated.
+RespValue memory_stats() {
+  const auto &accounting = MemoryAccounting::instance();
+  const auto &slabs = SlabAllocator::instance();
+  const auto &db = Database::instance();
+  const size_t total = accounting.used_bytes();
+  const size_t startup = accounting.startup_bytes();
+  const size_t overhead = db.overhead_bytes();
+  const size_t keys = db.size();
+  const size_t net = total > startup ? total - startup : 0;
+  const size_t dataset = net > overhead ? net - overhead : 0;
+  const size_t used_slabs = slabs.used_bytes();
+  RespArray stats;
+  const auto add = [&stats](std::string name, RespValue value) {
+    stats.push_back(RespValue::make_string(std::move(name)));
+    stats.push_back(std::move(value));
+  };
+  const auto format = [](double value) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << value;
+    return RespValue::make_string(oss.str());
+  };
+  add("peak.allocated", RespValue::make_integer(accounting.peak_bytes()));
+  add("total.allocated", RespValue::make_integer(total));
+  add("startup.allocated", RespValue::make_integer(startup));
+  add("slabs.mapped", RespValue::make_integer(slabs.slab_bytes()));
+  add("slabs.used", RespValue::make_integer(used_slabs));
+  add("overhead.hashtable.main", RespValue::make_integer(overhead));
+  add("lazyfree.pending",
+      RespValue::make_integer(LazyFree::instance().pending()));
+  add("keys.count", RespValue::make_integer(keys));
+  add("keys.bytes-per-key", RespValue::make_integer(keys ? net / keys : 0));
+  add("dataset.bytes", RespValue::make_integer(dataset));
+  add("dataset.percentage", format(net ? 100.0 * dataset / net : 0.0));
+  add("peak.percentage",
+      format(accounting.peak_bytes() ? 100.0 * total / accounting.peak_bytes()
+                                     : 0.0));
+  add("slabs.fragmentation",
+      format(used_slabs ? static_cast<double>(slabs.slab_bytes()) / used_slabs
+                        : 0.0));
+  return RespValue::make_array(std::move(stats));
+}
+
+// MEMORY BIGKEYS|HOTKEYS [COUNT count] [SAMPLES samples]: the `count` keys
+// with the most bytes or the highest access frequency among the first
+// `samples` keys of a scan, zero for all of them. Scan cursors advance in
+// reverse binary, so the sample spreads over the whole keyspace.
+RespValue top_keys(const RespArray &arguments, bool by_frequency) {
+  size_t count = default_top_keys;
+  size_t samples = default_top_samples;
+  for (size_t i = 1; i < arguments.size(); i += 2) {
+    if (i + 1 == arguments.size()) {
+      return RespValue::make_error("ERR syntax error");
+    }
+    const auto option = arguments[i].to_string();
+    const auto value = parse_integer(arguments[i + 1]);
+    if (!value || *value < 0) {
+      return RespValue::make_error("ERR value is not an integer");
+    }
+    if (equals_ignore_case(option, "count")) {
+      count = *value;
+    } else if (equals_ignore_case(option, "samples")) {
+      samples = *value;
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+  }
+  auto &db = Database::instance();
+  // Score and key of every sampled key.
+  std::vector<std::pair<size_t, std::string>> sampled;
+  const auto sample = [&](const std::string &key, const RespValue &value) {
+    if (samples && sampled.size() == samples) {
+      return;
+    }
+    size_t score;
+    if (by_frequency) {
+      Database::AccessStats access{};
+      db.peek(key, &access);
+      score = access.frequency;
+    } else {
+      score = db.memory_usage(key, value, default_usage_samples);
+    }
+    sampled.emplace_back(score, key);
+  };
+  uint64_t cursor = 0;
+  do {
+    const size_t wanted = samples ? samples - sampled.size() : db.size() + 1;
+    cursor = db.scan(cursor, wanted, sample);
+  } while (cursor != 0 && (!samples || sampled.size() < samples));
+  count = std::min(count, sampled.size());
+  std::partial_sort(sampled.begin(), sampled.begin() + count, sampled.end(),
+                    std::greater<>());
+  RespArray result;
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(RespValue::make_array(
+        {RespValue::make_string(std::move(sampled[i].second)),
+         RespValue::make_integer(sampled[i].first)}));
+  }
+  return RespValue::make_array(std::move(result));
+}
+
+}  // namespace
+
+RespValue handle_memory(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for MEMORY");
+  }
+  const auto subcommand = arguments[0].to_string();
+  if (equals_ignore_case(subcommand, "malloc-stats")) {
+    return malloc_stats();
+  }
+  if (equals_ignore_case(subcommand, "usage")) {
+    return memory_usage(arguments);
+  }
+  if (equals_ignore_case(subcommand, "stats")) {
+    return memory_stats();
+  }
+  if (equals_ignore_case(subcommand, "bigkeys")) {
+    return top_keys(arguments, false);
+  }
+  if (equals_ignore_case(subcommand, "hotkeys")) {
+    return top_keys(arguments, true);
+  }
+  return RespValue::make_error("ERR unsupported sub command for MEMORY: " +
+                               subcommand);
+}
+CommandRegistrar _handle_memory("memory", handle_memory, CommandAccess::Server);
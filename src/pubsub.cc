@@ -0,0 +1,161 @@
+#include "pubsub.h"
+
+#include <algorithm>
+
+#include "resp_types.h"
+
+size_t PubSub::subscription_count(Connection& con) const {
+  const auto it = clients.find(&con);
+  if (it == clients.end()) {
+    return 0;
+  }
+  return it->second.channels.size() + it->second.patterns.size();
+}
+
+size_t PubSub::subscribe(Connection& con, const std::string& channel) {
+  if (clients[&con].channels.insert(channel).second) {
+    channels[channel].insert(&con);
+  }
+  return subscription_count(con);
+}
+
+size_t PubSub::unsubscribe(Connection& con, const std::string& channel) {
+  const auto client = clients.find(&con);
+  if (client != clients.end() && client->second.channels.erase(channel)) {
+    const auto it = channels.find(channel);
+    it->second.erase(&con);
+    if (it->second.empty()) {
+      channels.erase(it);
+    }
+    if (client->second.channels.empty() && client->second.patterns.empty()) {
+      clients.erase(client);
+    }
+  }
+  return subscription_count(con);
+}
+
+size_t PubSub::psubscribe(Connection& con, const std::string& pattern) {
+  if (!clients[&con].patterns.insert(pattern).second) {
+    return subscription_count(con);
+  }
+  auto& subscription = patterns[pattern];
+  if (!subscription) {
+    subscription = std::make_unique<PatternSubscription>(
+        PatternSubscription{.source = pattern,
+                            .pattern = GlobPattern(pattern),
+                            .subscribers = {}});
+    PatternNode* node = &pattern_index;
+    for (const char c : subscription->pattern.literal_prefix()) {
+      auto& child = node->children[c];
+      if (!child) {
+        child = std::make_unique<PatternNode>();
+      }
+      node = child.get();
+    }
+    node->patterns.push_back(subscription.get());
+  }
+  subscription->subscribers.insert(&con);
+  return subscription_count(con);
+}
+
+size_t PubSub::punsubscribe(Connection& con, const std::string& pattern) {
+  const auto client = clients.find(&con);
+  if (client != clients.end() && client->second.patterns.erase(pattern)) {
+    const auto it = patterns.find(pattern);
+    it->second->subscribers.erase(&con);
+    if (it->second->subscribers.empty()) {
+      remove_pattern(pattern);
+    }
+    if (client->second.channels.empty() && client->second.patterns.empty()) {
+      clients.erase(client);
+    }
+  }
+  return subscription_count(con);
+}
+
+void PubSub::remove_pattern(const std::string& pattern) {
+  const auto it = patterns.find(pattern);
+  PatternSubscription* subscription = it->second.get();
+  // Walk down to the pattern's node, remembering the path so nodes left
+  // empty can be pruned on the way back up.
+  std::vector<PatternNode*> path{&pattern_index};
+  for (const char c : subscription->pattern.literal_prefix()) {
+    path.push_back(path.back()->children.at(c).get());
+  }
+  auto& node_patterns = path.back()->patterns;
+  node_patterns.erase(
+      std::find(node_patterns.begin(), node_patterns.end(), subscription));
+  const auto& prefix = subscription->pattern.literal_prefix();
+  for (size_t depth = prefix.size(); depth > 0; --depth) {
+    const PatternNode* node = path[depth];
+    if (!node->patterns.empty() || !node->children.empty()) {
+      break;
+    }
+    path[depth - 1]->children.erase(prefix[depth - 1]);
+  }
+  patterns.erase(it);
+}
+
+std::vector<std::string> PubSub::channels_of(Connection& con) const {
+  const auto it = clients.find(&con);
+  if (it == clients.end()) {
+    return {};
+  }
+  return {it->second.channels.begin(), it->second.channels.end()};
+}
+
+std::vector<std::string> PubSub::patterns_of(Connection& con) const {
+  const auto it = clients.find(&con);
+  if (it == clients.end()) {
+    return {};
+  }
+  return {it->second.patterns.begin(), it->second.patterns.end()};
+}
+
+void PubSub::unsubscribe_all(Connection& con) {
+  for (const auto& channel : channels_of(con)) {
+    unsubscribe(con, channel);
+  }
+  for (const auto& pattern : patterns_of(con)) {
+    punsubscribe(con, pattern);
+  }
+}
+
+size_t PubSub::publish(const std::string& channel,
+                       const std::string& message) {
+  size_t receivers = 0;
+  auto deliver = [&receivers](const std::unordered_set<Connection*>& targets,
+                              RespArray frame) {
+    const auto encoded = std::make_shared<const std::string>(
+        RespValue::make_push(std::move(frame)).to_protocol_representation());
+    for (Connection* con : targets) {
+      con->outgoing.append_shared(encoded);
+      request_write(*con);
+    }
+    receivers += targets.size();
+  };
+
+  if (const auto it = channels.find(channel); it != channels.end()) {
+    deliver(it->second,
+            {RespValue::make_string("message"), RespValue::make_string(channel),
+             RespValue::make_string(message)});
+  }
+  const PatternNode* node = &pattern_index;
+  for (size_t depth = 0; node; ++depth) {
+    for (const auto* subscription : node->patterns) {
+      if (subscription->pattern.matches(channel)) {
+        deliver(subscription->subscribers,
+                {RespValue::make_string("pmessage"),
+                 RespValue::make_string(subscription->source),
+                 RespValue::make_string(channel),
+                 RespValue::make_string(message)});
+      }
+    }
+    if (depth == channel.size()) {
+      break;
+    }
+    const auto child = node->children.find(channel[depth]);
+    node = child == node->children.end() ? nullptr : child->second.get();
+  }
+  return receivers;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "connection.h"
+#include "glob.h"
+
+// Channel and pattern subscriptions. Published messages are encoded once as
+// a RESP3 push frame and the same buffer is queued on every subscriber.
+class PubSub {
+ public:
+  static PubSub& instance() {
+    static PubSub instance;
+    return instance;
+  }
+
+  // Each of these returns the number of channels plus patterns `con` is
+  // subscribed to afterwards.
+  size_t subscribe(Connection& con, const std::string& channel);
+  size_t unsubscribe(Connection& con, const std::string& channel);
+  size_t psubscribe(Connection& con, const std::string& pattern);
+  size_t punsubscribe(Connection& con, const std::string& pattern);
+
+  std::vector<std::string> channels_of(Connection& con) const;
+  std::vector<std::string> patterns_of(Connection& con) const;
+  void unsubscribe_all(Connection& con);
+  bool is_subscribed(Connection& con) const { return clients.contains(&con); }
+
+  // Returns the number of subscribers that received the message.
+  size_t publish(const std::string& channel, const std::string& message);
+
+ private:
+  PubSub() = default;
+  // Delete copy/move operations
+  PubSub(const PubSub&) = delete;
+  PubSub& operator=(const PubSub&) = delete;
+  PubSub(PubSub&&) = delete;
+  PubSub& operator=(PubSub&&) = delete;
+
+  struct PatternSubscription {
+    std::string source;
+    GlobPattern pattern;
+    std::unordered_set<Connection*> subscribers;
+  };
+
+  // Patterns arranged in a trie by their literal prefix. Publishing walks the
+  // channel name down the trie and only tries the patterns whose prefix
+  // matches, instead of every pattern.
+  struct PatternNode {
+    std::map<char, std::unique_ptr<PatternNode>> children;
+    std::vector<PatternSubscription*> patterns;
+  };
+
+  struct Subscriptions {
+    std::unordered_set<std::string> channels;
+    std::unordered_set<std::string> patterns;
+  };
+
+  size_t subscription_count(Connection& con) const;
+  void remove_pattern(const std::string& pattern);
+
+  std::unordered_map<std::string, std::unordered_set<Connection*>> channels;
+  std::unordered_map<std::string, std::unique_ptr<PatternSubscription>>
+      patterns;
+  PatternNode pattern_index;
+  std::unordered_map<Connection*, Subscriptions> clients;
+};
@@ -0,0 +1,100 @@
+#include "commands.h"
+#include "connection.h"
+#include "pubsub.h"
+
+// Pub/Sub commands. Subscription changes are confirmed with one RESP3 push
+// frame per channel; all but the last are queued on the connection directly
+// and the last one is the command's reply.
+
+namespace {
+
+using SubscriptionFn = size_t (PubSub::*)(Connection &, const std::string &);
+
+RespValue confirmation(const std::string &kind, RespValue channel,
+                       size_t count) {
+  return RespValue::make_push({RespValue::make_string(kind),
+                               std::move(channel),
+                               RespValue::make_integer(count)});
+}
+
+RespValue change_subscriptions(const std::string &kind, SubscriptionFn change,
+                               const std::vector<std::string> &targets) {
+  Connection *con = current_connection();
+  if (!con) {
+    return RespValue::make_error("ERR " + kind + " requires a connection");
+  }
+  auto &pubsub = PubSub::instance();
+  if (targets.empty()) {
+    // Unsubscribing from everything while not subscribed to anything.
+    return confirmation(kind, RespValue::make_null(), 0);
+  }
+  for (size_t i = 0; i + 1 < targets.size(); ++i) {
+    const size_t count = (pubsub.*change)(*con, targets[i]);
+    con->outgoing.append(
+        confirmation(kind, RespValue::make_string(targets[i]), count));
+  }
+  const size_t count = (pubsub.*change)(*con, targets.back());
+  return confirmation(kind, RespValue::make_string(targets.back()), count);
+}
+
+std::vector<std::string> argument_strings(const RespArray &arguments) {
+  std::vector<std::string> result;
+  result.reserve(arguments.size());
+  for (const auto &argument : arguments) {
+    result.push_back(argument.to_string());
+  }
+  return result;
+}
+
+}  // namespace
+
+RespValue handle_subscribe(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for SUBSCRIBE");
+  }
+  return change_subscriptions("subscribe", &PubSub::subscribe,
+                              argument_strings(arguments));
+}
+CommandRegistrar _handle_subscribe("subscribe", handle_subscribe,
+                                   CommandAccess::Server);
+
+RespValue handle_unsubscribe(const RespArray &arguments) {
+  Connection *con = current_connection();
+  const auto channels = arguments.empty() && con
+                            ? PubSub::instance().channels_of(*con)
+                            : argument_strings(arguments);
+  return change_subscriptions("unsubscribe", &PubSub::unsubscribe, channels);
+}
+CommandRegistrar _handle_unsubscribe("unsubscribe", handle_unsubscribe,
+                                     CommandAccess::Server);
+
+RespValue handle_psubscribe(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error(
+        "ERR wrong number of arguments for PSUBSCRIBE");
+  }
+  return change_subscriptions("psubscribe", &PubSub::psubscribe,
+                              argument_strings(arguments));
+}
+CommandRegistrar _handle_psubscribe("psubscribe", handle_psubscribe,
+                                    CommandAccess::Server);
+
+RespValue handle_punsubscribe(const RespArray &arguments) {
+  Connection *con = current_connection();
+  const auto patterns = arguments.empty() && con
+                            ? PubSub::instance().patterns_of(*con)
+                            : argument_strings(arguments);
+  return change_subscriptions("punsubscribe", &PubSub::punsubscribe, patterns);
+}
+CommandRegistrar _handle_punsubscribe("punsubscribe", handle_punsubscribe,
+                                      CommandAccess::Server);
+
+RespValue handle_publish(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for PUBLISH");
+  }
+  return RespValue::make_integer(PubSub::instance().publish(
+      arguments[0].to_string(), arguments[1].to_string()));
+}
+CommandRegistrar _handle_publish("publish", handle_publish,
+                                 CommandAccess::Server);
@@ -0,0 +1,501 @@
+#include "replication.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <span>
+
+#include "commands.h"
+#include "database.h"
+#include "log.h"
+#include "stats.h"
+
+namespace {
+
+// Time between connection attempts to the primary.
+constexpr auto reconnect_interval = std::chrono::seconds(1);
+// Links that make no progress for this long are closed, on a replica while
+// it synchronizes, on a primary once a replica stops acknowledging.
+constexpr auto link_timeout = std::chrono::seconds(60);
+
+void append_command(std::string &out,
+                    std::span<const std::string_view> command) {
+  out += '*';
+  out += std::to_string(command.size());
+  out += "\r\n";
+  for (const auto argument : command) {
+    out += '$';
+    out += std::to_string(argument.size());
+    out += "\r\n";
+    out += argument;
+    out += "\r\n";
+  }
+}
+
+std::string random_replid() {
+  static constexpr char digits[] = "0123456789abcdef";
+  std::random_device device;
+  std::mt19937_64 generator(
+      (static_cast<uint64_t>(device()) << 32) | device());
+  std::string id(40, '0');
+  for (auto &c : id) {
+    c = digits[generator() % 16];
+  }
+  return id;
+}
+
+std::optional<uint64_t> parse_offset(std::string_view text) {
+  uint64_t value = 0;
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc() || end != text.data() + text.size()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+// Makes the event loop see the peer closing, so it closes `con` in order.
+void disconnect(Connection &con) { shutdown(con.fd, SHUT_RDWR); }
+
+std::string peer_address(int fd) {
+  sockaddr_storage addr = {};
+  socklen_t length = sizeof(addr);
+  if (getpeername(fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0) {
+    return "?";
+  }
+  char text[INET6_ADDRSTRLEN] = "?";
+  if (addr.ss_family == AF_INET) {
+    inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(&addr)->sin_addr,
+              text, sizeof(text));
+  } else if (addr.ss_family == AF_INET6) {
+    inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_addr,
+              text, sizeof(text));
+  }
+  return text;
+}
+
+}  // namespace
+
+Replication::Replication() : replid{random_replid()} {}
+
+void Replication::reset_backlog() {
+  backlog.assign(std::max<size_t>(backlog_size, 1), '\0');
+  backlog_origin = offset;
+}
+
+uint64_t Replication::backlog_start() const {
+  return offset - std::min<uint64_t>(offset - backlog_origin, backlog.size());
+}
+
+void Replication::append_backlog(std::string_view bytes) {
+  const size_t size = backlog.size();
+  if (bytes.size() > size) {
+    offset += bytes.size() - size;
+    bytes.remove_prefix(bytes.size() - size);
+  }
+  while (!bytes.empty()) {
+    const size_t at = offset % size;
+    const size_t length = std::min(bytes.size(), size - at);
+    std::copy_n(bytes.data(), length, backlog.data() + at);
+    offset += length;
+    bytes.remove_prefix(length);
+  }
+}
+
+void Replication::send_backlog(Connection &con, uint64_t from) const {
+  const size_t size = backlog.size();
+  while (from < offset) {
+    const size_t at = from % size;
+    const size_t length = std::min<uint64_t>(offset - from, size - at);
+    con.outgoing.append(std::string_view(backlog.data() + at, length));
+    from += length;
+  }
+}
+
+Replication::Replica *Replication::find_replica(const Connection &con) {
+  const auto it = std::ranges::find(replicas, &con, &Replica::con);
+  return it == replicas.end() ? nullptr : &*it;
+}
+
+const Replication::Replica *Replication::find_replica(
+    const Connection &con) const {
+  const auto it = std::ranges::find(replicas, &con, &Replica::con);
+  return it == replicas.end() ? nullptr : &*it;
+}
+
+void Replication::add_replica(Connection &con, std::string_view their_replid,
+                              std::optional<uint64_t> their_offset) {
+  if (backlog.empty()) {
+    reset_backlog();
+  }
+  con.replication_link = true;
+  const auto now = std::chrono::steady_clock::now();
+  Replica replica{.con = &con, .acked_at = now};
+  if (const auto it = pending_ports.find(&con); it != pending_ports.end()) {
+    replica.listening_port = it->second;
+    pending_ports.erase(it);
+  }
+  const bool same_history =
+      their_replid == replid ||
+      (!previous_replid.empty() && their_replid == previous_replid &&
+       their_offset && *their_offset <= previous_replid_end);
+  if (same_history && their_offset && *their_offset >= backlog_start() &&
+      *their_offset <= offset) {
+    const std::string_view reply[] = {"CONTINUE", replid};
+    scratch.clear();
+    append_command(scratch, reply);
+    con.outgoing.append(std::string_view(scratch));
+    send_backlog(con, *their_offset);
+    replica.acked_offset = *their_offset;
+    ++partial_syncs;
+    LOG(Info) << "Replica " << con.fd << " continues at offset "
+              << *their_offset;
+  } else {
+    // The snapshot and the stream after it are consistent because the
+    // snapshot is taken between two commands.
+    auto snapshot = std::make_shared<std::string>();
+    std::string value_scratch;
+    Database::instance().for_each(
+        [&](const std::string &key, const RespValue &value,
+            std::optional<std::chrono::milliseconds> expire_in) {
+          const RespString *string = value.read_string(value_scratch);
+          if (!string) {
+            return;
+          }
+          if (expire_in) {
+            const auto millis = std::to_string(expire_in->count());
+            const std::string_view set[] = {"SET", key, *string, "PX",
+                                            millis};
+            append_command(*snapshot, set);
+          } else {
+            const std::string_view set[] = {"SET", key, *string};
+            append_command(*snapshot, set);
+          }
+        });
+    const auto offset_text = std::to_string(offset);
+    const auto size_text = std::to_string(snapshot->size());
+    const std::string_view reply[] = {"FULLRESYNC", replid, offset_text,
+                                      size_text};
+    scratch.clear();
+    append_command(scratch, reply);
+    con.outgoing.append(std::string_view(scratch));
+    con.outgoing.append_shared(std::move(snapshot));
+    replica.acked_offset = offset;
+    replica.snapshot_end = con.outgoing.sent() + con.outgoing.size();
+    ++full_syncs;
+    LOG(Info) << "Replica " << con.fd << " fully synchronizes at offset "
+              << offset << " with a snapshot of " << size_text << " bytes";
+  }
+  replicas.push_back(replica);
+}
+
+void Replication::set_listening_port(Connection &con, int port) {
+  if (auto *replica = find_replica(con)) {
+    replica->listening_port = port;
+  } else {
+    pending_ports[&con] = port;
+  }
+}
+
+void Replication::acknowledge(Connection &con, uint64_t acked) {
+  if (auto *replica = find_replica(con)) {
+    replica->acked_offset = acked;
+    replica->acked_at = std::chrono::steady_clock::now();
+  }
+}
+
+bool Replication::sending_snapshot(const Connection &con) const {
+  const auto *replica = find_replica(con);
+  return replica && con.outgoing.sent() < replica->snapshot_end;
+}
+
+void Replication::replicate_from(std::string host, int port) {
+  if (host == primary_host && port == primary_port) {
+    return;
+  }
+  LOG(Info) << "Replicating from " << host << ":" << port;
+  primary_host = std::move(host);
+  primary_port = port;
+  disconnect_all();
+  link_state = LinkState::Connecting;
+  next_connect = std::chrono::steady_clock::now();
+  link_down_since = next_connect;
+}
+
+void Replication::stop_replicating() {
+  if (!is_replica()) {
+    return;
+  }
+  LOG(Info) << "Stopped replicating from " << primary_host << ":"
+            << primary_port;
+  primary_host.clear();
+  primary_port = 0;
+  if (link) {
+    disconnect(*link);
+  }
+  start_new_history();
+}
+
+void Replication::start_new_history() {
+  previous_replid = std::exchange(replid, random_replid());
+  previous_replid_end = offset;
+}
+
+void Replication::disconnect_all() {
+  if (link) {
+    disconnect(*link);
+  }
+  for (auto &replica : replicas) {
+    disconnect(*replica.con);
+  }
+}
+
+std::optional<int> Replication::connect_if_due() {
+  const auto now = std::chrono::steady_clock::now();
+  if (!is_replica() || link || now < next_connect) {
+    return std::nullopt;
+  }
+  next_connect = now + reconnect_interval;
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  const auto port = std::to_string(primary_port);
+  if (const int error = getaddrinfo(primary_host.c_str(), port.c_str(),
+                                    &hints, &addresses)) {
+    LOG_RATE_LIMITED(Warning, 10) << "Failed to resolve primary "
+                                  << primary_host << ": "
+                                  << gai_strerror(error);
+    return std::nullopt;
+  }
+  const auto *address = addresses;
+  int fd = socket(address->ai_family, SOCK_STREAM, 0);
+  if (fd >= 0) {
+    // Nonblocking, the event loop learns about failures as a disconnect.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(fd, address->ai_addr, address->ai_addrlen) < 0 &&
+        errno != EINPROGRESS) {
+      LOG_RATE_LIMITED(Warning, 10)
+          << "Failed to connect to primary " << primary_host << ":"
+          << primary_port << ": " << strerror(errno);
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  return fd;
+}
+
+void Replication::attach_link(Connection &con) {
+  link = &con;
+  con.replication_link = true;
+  link_state = LinkState::Handshake;
+  last_io = std::chrono::steady_clock::now();
+  const auto port = std::to_string(ServerStats::instance().port);
+  const std::string_view listening_port[] = {"REPLCONF", "listening-port",
+                                             port};
+  const auto offset_text = std::to_string(offset);
+  const std::string_view psync[] = {"PSYNC", replid, offset_text};
+  scratch.clear();
+  append_command(scratch, listening_port);
+  append_command(scratch, psync);
+  con.outgoing.append(std::string_view(scratch));
+  request_write(con);
+}
+
+bool Replication::handle_sync_reply(Connection &con,
+                                    const CommandView &command) {
+  if (&con != link || link_state != LinkState::Handshake) {
+    return false;
+  }
+  last_io = std::chrono::steady_clock::now();
+  const auto name = command.front();
+  if (equals_ignore_case(name, "fullresync") && command.size() == 4) {
+    const auto primary_offset = parse_offset(command[2]);
+    const auto snapshot_size = parse_offset(command[3]);
+    if (!primary_offset || !snapshot_size) {
+      LOG(Error) << "Invalid FULLRESYNC from primary";
+      disconnect(con);
+      return true;
+    }
+    // Replicas of this server see a different history from now on.
+    for (auto &replica : replicas) {
+      disconnect(*replica.con);
+    }
+    Database::instance().clear(true);
+    replid = command[1];
+    previous_replid.clear();
+    offset = *primary_offset;
+    reset_backlog();
+    snapshot_left = *snapshot_size;
+    link_state = snapshot_left ? LinkState::Syncing : LinkState::Connected;
+    LOG(Info) << "Full sync from primary at offset " << offset << ", "
+              << snapshot_left << " bytes to load";
+  } else if (equals_ignore_case(name, "continue") && command.size() == 2) {
+    if (command[1] != replid) {
+      start_new_history();
+      replid = command[1];
+    }
+    link_state = LinkState::Connected;
+    LOG(Info) << "Partial resync from primary at offset " << offset;
+  }
+  // Anything else answers the handshake's REPLCONF.
+  return true;
+}
+
+void Replication::on_write(Connection &con, const CommandView &command,
+                           bool modified) {
+  if (&con != link && !modified) {
+    return;
+  }
+  scratch.clear();
+  append_command(scratch, command);
+  if (&con == link) {
+    last_io = std::chrono::steady_clock::now();
+    if (snapshot_left) {
+      snapshot_left -= std::min<uint64_t>(snapshot_left, scratch.size());
+      if (!snapshot_left) {
+        link_state = LinkState::Connected;
+        LOG(Info) << "Loaded snapshot, " << Database::instance().size()
+                  << " keys";
+      }
+      return;
+    }
+  }
+  propagate(scratch);
+}
+
+void Replication::replicate(std::span<const std::string_view> command) {
+  if (!active()) {
+    return;
+  }
+  scratch.clear();
+  append_command(scratch, command);
+  propagate(scratch);
+}
+
+void Replication::propagate(std::string_view command) {
+  append_backlog(command);
+  for (auto &replica : replicas) {
+    replica.con->outgoing.append(command);
+    request_write(*replica.con);
+  }
+}
+
+void Replication::on_close(Connection &con) {
+  pending_ports.erase(&con);
+  if (&con == link) {
+    link = nullptr;
+    link_down_since = std::chrono::steady_clock::now();
+    if (link_state == LinkState::Syncing) {
+      // The keyspace holds part of a snapshot, only a full sync fixes it.
+      replid = random_replid();
+      previous_replid.clear();
+      snapshot_left = 0;
+    }
+    link_state = LinkState::Connecting;
+    if (is_replica()) {
+      LOG(Warning) << "Lost link to primary " << primary_host << ":"
+                   << primary_port;
+    }
+    return;
+  }
+  if (std::erase_if(replicas, [&con](const Replica &replica) {
+        return replica.con == &con;
+      })) {
+    LOG(Info) << "Replica " << con.fd << " disconnected";
+  }
+}
+
+void Replication::cron() {
+  const auto now = std::chrono::steady_clock::now();
+  if (now - last_cron < std::chrono::seconds(1)) {
+    return;
+  }
+  last_cron = now;
+  if (link && link_state == LinkState::Connected) {
+    const auto offset_text = std::to_string(offset);
+    const std::string_view ack[] = {"REPLCONF", "ACK", offset_text};
+    scratch.clear();
+    append_command(scratch, ack);
+    link->outgoing.append(std::string_view(scratch));
+    request_write(*link);
+  } else if (link && now - last_io > link_timeout) {
+    LOG(Warning) << "Timed out synchronizing with primary";
+    disconnect(*link);
+  }
+  for (auto &replica : replicas) {
+    if (!sending_snapshot(*replica.con) &&
+        now - replica.acked_at > link_timeout) {
+      LOG(Warning) << "Replica " << replica.con->fd << " timed out";
+      disconnect(*replica.con);
+    }
+  }
+}
+
+void Replication::write_info(std::ostream &out) const {
+  const auto now = std::chrono::steady_clock::now();
+  const auto seconds = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+  };
+  out << "# Replication\r\n"
+      << "role:" << (is_replica() ? "slave" : "master") << "\r\n";
+  if (is_replica()) {
+    const bool up = link && link_state == LinkState::Connected;
+    out << "master_host:" << primary_host << "\r\n"
+        << "master_port:" << primary_port << "\r\n"
+        << "master_link_status:" << (up ? "up" : "down") << "\r\n"
+        << "master_last_io_seconds_ago:"
+        << (link ? seconds(now - last_io) : -1) << "\r\n"
+        << "master_sync_in_progress:"
+        << (link_state == LinkState::Syncing ? 1 : 0) << "\r\n"
+        << "master_sync_left_bytes:" << snapshot_left << "\r\n"
+        << "slave_repl_offset:" << offset << "\r\n";
+    if (!up) {
+      out << "master_link_down_since_seconds:"
+          << seconds(now - link_down_since) << "\r\n";
+    }
+  }
+  out << "connected_slaves:" << replicas.size() << "\r\n";
+  for (size_t i = 0; i < replicas.size(); ++i) {
+    const auto &replica = replicas[i];
+    // Lag in seconds since the last acknowledgement, like Redis, and in
+    // bytes of the stream the replica hasn't acknowledged yet.
+    out << "slave" << i << ":ip=" << peer_address(replica.con->fd)
+        << ",port=" << replica.listening_port << ",state="
+        << (sending_snapshot(*replica.con) ? "send_bulk" : "online")
+        << ",offset=" << replica.acked_offset
+        << ",lag=" << seconds(now - replica.acked_at)
+        << ",lag_bytes=" << offset - std::min(offset, replica.acked_offset)
+        << "\r\n";
+  }
+  out << "master_replid:" << replid << "\r\n"
+      << "master_replid2:"
+      << (previous_replid.empty() ? std::string(40, '0') : previous_replid)
+      << "\r\n"
+      << "master_repl_offset:" << offset << "\r\n"
+      << "second_repl_offset:"
+      << (previous_replid.empty() ? -1
+                                  : static_cast<int64_t>(previous_replid_end))
+      << "\r\n"
+      << "sync_full:" << full_syncs << "\r\n"
+      << "sync_partial_ok:" << partial_syncs << "\r\n"
+      << "repl_backlog_active:" << (backlog.empty() ? 0 : 1) << "\r\n"
+      << "repl_backlog_size:" << backlog_size << "\r\n"
+      << "repl_backlog_first_byte_offset:"
+      << (backlog.empty() ? 0 : backlog_start()) << "\r\n"
+      << "repl_backlog_histlen:"
+      << (backlog.empty() ? 0 : offset - backlog_start()) << "\r\n";
+}
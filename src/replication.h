@@ -0,0 +1,151 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "connection.h"
+
+// Primary–replica replication over the client protocol.
+//
+// A replica connects to its primary like a client and sends
+// `PSYNC <replid> <offset>`. Offsets count the bytes of the replication
+// stream: every write command that modified the keyspace, encoded as a RESP
+// array. The primary keeps the newest `backlog_size` bytes of the stream in a
+// ring. If the replica's offset is still in there it answers
+// `CONTINUE <replid>` and sends the stream from that offset (partial resync).
+// Otherwise it answers `FULLRESYNC <replid> <offset> <snapshot bytes>` and
+// sends a snapshot of the keyspace as SET commands, followed by the stream
+// (full sync). Both answers are arrays, so the replica parses and executes
+// everything its primary sends like the commands of any other connection.
+//
+// A replica adds the commands it applies to its own backlog with the same
+// offsets, so it can serve replicas of its own and resume after a restart of
+// its link. It rejects writes from its clients and acknowledges its offset
+// to the primary once per second, which INFO reports as replication lag.
+class Replication {
+ public:
+  static Replication& instance() {
+    static Replication instance;
+    return instance;
+  }
+
+  static constexpr size_t default_backlog_size = 1 << 20;
+  // Set before serving.
+  size_t backlog_size = default_backlog_size;
+
+  // False until this server has a primary or a replica. Until then no command
+  // pays for replication.
+  bool active() const { return is_replica() || !backlog.empty(); }
+  bool is_replica() const { return !primary_host.empty(); }
+
+  // Primary side. Answers `PSYNC` from `con` with a partial or full resync
+  // and streams all further writes to it.
+  void add_replica(Connection& con, std::string_view replid,
+                   std::optional<uint64_t> offset);
+  // `REPLCONF` from a replica.
+  void set_listening_port(Connection& con, int port);
+  void acknowledge(Connection& con, uint64_t offset);
+  // True while `con` still has its snapshot to send. Its output buffer
+  // limit only applies to the stream after it.
+  bool sending_snapshot(const Connection& con) const;
+
+  // Replica side. Replicates from `host`, dropping the current primary.
+  void replicate_from(std::string host, int port);
+  // Turns this replica into a primary, keeping its keyspace.
+  void stop_replicating();
+  // Starts connecting to the primary once it's time for another attempt.
+  // The event loop registers the returned socket as a connection and passes
+  // it to `attach_link`.
+  std::optional<int> connect_if_due();
+  // Makes `con` the link to the primary and queues the handshake.
+  void attach_link(Connection& con);
+  // Handles the primary's answer to the handshake. Returns false for
+  // everything else the link receives, which executes as usual.
+  bool handle_sync_reply(Connection& con, const CommandView& command);
+
+  // Called after every write command, `modified` tells whether it changed the
+  // keyspace. Adds it to the stream if it did or if it came from the primary.
+  void on_write(Connection& con, const CommandView& command, bool modified);
+  // Adds a write the server issued itself, like the deletes of a MIGRATE,
+  // to the stream. Main thread.
+  void replicate(std::span<const std::string_view> command);
+  void on_close(Connection& con);
+  // Acknowledges the replica's offset. Call about once per second.
+  void cron();
+
+  void write_info(std::ostream& out) const;
+
+ private:
+  Replication();
+  // Delete copy/move operations
+  Replication(const Replication&) = delete;
+  Replication& operator=(const Replication&) = delete;
+  Replication(Replication&&) = delete;
+  Replication& operator=(Replication&&) = delete;
+
+  struct Replica {
+    Connection* con;
+    int listening_port = 0;
+    uint64_t acked_offset = 0;
+    std::chrono::steady_clock::time_point acked_at;
+    // `con.outgoing.sent()` once the snapshot is out, 0 after a partial
+    // resync.
+    uint64_t snapshot_end = 0;
+  };
+
+  enum class LinkState { Connecting, Handshake, Syncing, Connected };
+
+  // Adds an encoded command to the backlog and queues it on every replica.
+  void propagate(std::string_view command);
+  // Starts a new backlog that begins at `offset`.
+  void reset_backlog();
+  // Oldest offset the backlog still holds.
+  uint64_t backlog_start() const;
+  void append_backlog(std::string_view bytes);
+  // Queues the backlog from `from` on `con`.
+  void send_backlog(Connection& con, uint64_t from) const;
+  Replica* find_replica(const Connection& con);
+  const Replica* find_replica(const Connection& con) const;
+  // Closes the link and all replicas, they resynchronize from scratch.
+  void disconnect_all();
+  // A new history: replicas of the old one may continue up to the current
+  // offset.
+  void start_new_history();
+
+  std::string replid;
+  // Previous replication ID and the offset up to which it is valid, so
+  // replicas can partially resync with a replica promoted to primary.
+  std::string previous_replid;
+  uint64_t previous_replid_end = 0;
+  // Bytes in the replication stream so far.
+  uint64_t offset = 0;
+  // Ring of the newest bytes of the stream, empty until the first replica
+  // connects or this server becomes one.
+  std::vector<char> backlog;
+  // Offset the backlog started at.
+  uint64_t backlog_origin = 0;
+  std::vector<Replica> replicas;
+  // Listening ports announced before `PSYNC` made the connection a replica.
+  std::unordered_map<const Connection*, int> pending_ports;
+  uint64_t full_syncs = 0;
+  uint64_t partial_syncs = 0;
+  // Reused to encode propagated commands.
+  std::string scratch;
+
+  std::string primary_host;
+  int primary_port = 0;
+  Connection* link = nullptr;
+  LinkState link_state = LinkState::Connecting;
+  // Snapshot bytes still to apply during a full sync.
+  uint64_t snapshot_left = 0;
+  std::chrono::steady_clock::time_point next_connect;
+  std::chrono::steady_clock::time_point link_down_since;
+  std::chrono::steady_clock::time_point last_io;
+  std::chrono::steady_clock::time_point last_cron;
+};
@@ -0,0 +1,79 @@
+#include "commands.h"
+#include "connection.h"
+#include "replication.h"
+
+// REPLICAOF host port | NO ONE: starts or stops replicating from a primary.
+// PSYNC and REPLCONF are the replica's side of the handshake, see
+// `Replication`.
+
+RespValue handle_replicaof(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for REPLICAOF");
+  }
+  auto &replication = Replication::instance();
+  const auto host = arguments[0].to_string();
+  if (equals_ignore_case(host, "no") &&
+      equals_ignore_case(arguments[1].to_string(), "one")) {
+    replication.stop_replicating();
+    return RespValue::make_string("OK");
+  }
+  const auto port = parse_integer(arguments[1]);
+  if (!port || *port <= 0 || *port > 65535) {
+    return RespValue::make_error("ERR Invalid master port");
+  }
+  replication.replicate_from(host, static_cast<int>(*port));
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_replicaof("replicaof", handle_replicaof,
+                                   CommandAccess::Server);
+CommandRegistrar _handle_slaveof("slaveof", handle_replicaof,
+                                 CommandAccess::Server);
+
+RespValue handle_psync(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for PSYNC");
+  }
+  Connection *con = current_connection();
+  if (!con) {
+    return RespValue::make_error("ERR PSYNC requires a connection");
+  }
+  if (con->replication_link) {
+    return RespValue::make_error("ERR PSYNC on a replication link");
+  }
+  const auto offset = parse_integer(arguments[1]);
+  std::optional<uint64_t> from;
+  if (offset && *offset >= 0) {
+    from = static_cast<uint64_t>(*offset);
+  }
+  // The answer is queued on `con`, which gets no replies from now on.
+  Replication::instance().add_replica(*con, arguments[0].to_string(), from);
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_psync("psync", handle_psync, CommandAccess::Server);
+
+RespValue handle_replconf(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for REPLCONF");
+  }
+  Connection *con = current_connection();
+  if (!con) {
+    return RespValue::make_error("ERR REPLCONF requires a connection");
+  }
+  const auto option = arguments[0].to_string();
+  const auto value = parse_integer(arguments[1]);
+  if (!value || *value < 0) {
+    return RespValue::make_error("ERR value is not an integer");
+  }
+  auto &replication = Replication::instance();
+  if (equals_ignore_case(option, "listening-port")) {
+    replication.set_listening_port(*con, static_cast<int>(*value));
+  } else if (equals_ignore_case(option, "ack")) {
+    replication.acknowledge(*con, static_cast<uint64_t>(*value));
+  } else {
+    return RespValue::make_error("ERR unsupported sub command for REPLCONF: " +
+                                 option);
+  }
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_replconf("replconf", handle_replconf,
+                                  CommandAccess::Server);
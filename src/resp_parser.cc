@@ -1,5 +1,7 @@
 #include "resp_parser.h"
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <variant>
 
@@ -34,6 +36,15 @@ auto resp_integer_parser =
          second(parse_char(':'), first(parse_int(), _sep_parser)));
 
 std::optional<RespValue> parse_resp_code(std::string input) {
+  auto parsed = parse_resp_prefix(input);
+  if (!parsed) {
+    return std::nullopt;
+  }
+  return std::move(parsed->first);
+}
+
+std::optional<std::pair<RespValue, size_t>> parse_resp_prefix(
+    std::string_view input) {
   std::function<ParseResult<RespValue>(std::string_view)>
       expr_parser_runner_impl;
   std::function<ParseResult<RespValue>(std::string_view)>
@@ -63,7 +74,241 @@ std::optional<RespValue> parse_resp_code(std::string input) {
   auto parse_result = resp_expr_parser.run(input);
   if (!parse_result) {
     return std::nullopt;
-  } else {
-    return std::get<0>(*parse_result);
   }
-}
\ No newline at end of file
+  auto& [value, rest] = *parse_result;
+  return std::make_pair(std::move(value), input.size() - rest.size());
+}
+
+namespace {
+
+// Upper bounds the regular parser doesn't enforce either, they just keep a
+// garbage length from being trusted.
+constexpr size_t max_arguments = 1024 * 1024;
+// An argument takes at least "$0\r\n\r\n", which bounds how many of them
+// the input at hand can hold.
+constexpr size_t min_argument_size = 6;
+constexpr size_t max_bulk_length = 512 * 1024 * 1024;
+
+// Parses `<prefix><length>\r\n` at `pos`. Returns false if the input is
+// malformed, sets `complete` to false if it ends before the line does.
+bool parse_length_line(std::string_view input, size_t &pos, char prefix,
+                       size_t max, size_t &length, bool &complete) {
+  complete = false;
+  if (pos >= input.size()) {
+    return true;
+  }
+  if (input[pos] != prefix) {
+    return false;
+  }
+  const size_t line_end = input.find("\r\n", pos + 1);
+  if (line_end == std::string_view::npos) {
+    return true;
+  }
+  const char *first = input.data() + pos + 1;
+  const char *last = input.data() + line_end;
+  const auto [ptr, ec] = std::from_chars(first, last, length);
+  if (ec != std::errc() || ptr != last || length > max) {
+    return false;
+  }
+  pos = line_end + 2;
+  complete = true;
+  return true;
+}
+
+}  // namespace
+
+std::optional<size_t> parse_command(std::string_view input,
+                                    CommandView &args) {
+  args.clear();
+  size_t pos = 0;
+  size_t count = 0;
+  bool complete = false;
+  if (!parse_length_line(input, pos, '*', max_arguments, count, complete)) {
+    return std::nullopt;
+  }
+  if (!complete) {
+    return 0;
+  }
+  // Not `count`, which a bogus header sets as large as it likes.
+  args.reserve(std::min(count, (input.size() - pos) / min_argument_size));
+  for (size_t i = 0; i < count; ++i) {
+    size_t length = 0;
+    if (!parse_length_line(input, pos, '$', max_bulk_length, length,
+                           complete)) {
+      return std::nullopt;
+    }
+    if (!complete || input.size() - pos < length + 2) {
+      return 0;
+    }
+    if (input.substr(pos + length, 2) != "\r\n") {
+      return std::nullopt;
+    }
+    args.push_back(input.substr(pos, length));
+    pos += length + 2;
+  }
+  return pos;
+}
+
+namespace {
+
+// Deeper replies are rejected rather than risking the stack.
+constexpr size_t max_reply_depth = 256;
+
+enum class ReplyStatus { Complete, Incomplete, Malformed };
+
+// Every reply takes at least this many bytes, which bounds how many elements
+// an aggregate can have given the input at hand.
+constexpr size_t min_reply_size = 3;
+
+ReplyStatus parse_reply_at(std::string_view input, size_t &pos,
+                           RespValue &value, size_t depth);
+
+// Parses `count` consecutive replies into `values`.
+ReplyStatus parse_reply_elements(std::string_view input, size_t &pos,
+                                 size_t count, RespArray &values,
+                                 size_t depth) {
+  values.reserve(std::min(count, (input.size() - pos) / min_reply_size));
+  for (size_t i = 0; i < count; ++i) {
+    RespValue element;
+    const auto status = parse_reply_at(input, pos, element, depth + 1);
+    if (status != ReplyStatus::Complete) {
+      return status;
+    }
+    values.push_back(std::move(element));
+  }
+  return ReplyStatus::Complete;
+}
+
+ReplyStatus parse_reply_at(std::string_view input, size_t &pos,
+                           RespValue &value, size_t depth) {
+  if (depth > max_reply_depth) {
+    return ReplyStatus::Malformed;
+  }
+  if (pos >= input.size()) {
+    return ReplyStatus::Incomplete;
+  }
+  const char type = input[pos];
+  const size_t line_end = input.find("\r\n", pos + 1);
+  if (line_end == std::string_view::npos) {
+    return ReplyStatus::Incomplete;
+  }
+  const std::string_view line = input.substr(pos + 1, line_end - pos - 1);
+  pos = line_end + 2;
+  switch (type) {
+    case '+':
+    case ',':
+    case '(':
+      value = RespString(line);
+      return ReplyStatus::Complete;
+    case '-':
+      value = RespValue::make_error(RespString(line));
+      return ReplyStatus::Complete;
+    case '_':
+      value = RespValue::make_null();
+      return line.empty() ? ReplyStatus::Complete : ReplyStatus::Malformed;
+    case '#':
+      value = RespInteger(line == "t");
+      return line == "t" || line == "f" ? ReplyStatus::Complete
+                                        : ReplyStatus::Malformed;
+  }
+  long number = 0;
+  const auto [ptr, ec] =
+      std::from_chars(line.data(), line.data() + line.size(), number);
+  if (ec != std::errc() || ptr != line.data() + line.size()) {
+    return ReplyStatus::Malformed;
+  }
+  if (type == ':') {
+    value = RespInteger(number);
+    return ReplyStatus::Complete;
+  }
+  // RESP2 nulls.
+  if (number == -1 && (type == '$' || type == '*')) {
+    value = RespValue::make_null();
+    return ReplyStatus::Complete;
+  }
+  if (number < 0) {
+    return ReplyStatus::Malformed;
+  }
+  const auto size = static_cast<size_t>(number);
+  switch (type) {
+    case '$':
+    case '!':
+    case '=': {
+      if (size > max_bulk_length) {
+        return ReplyStatus::Malformed;
+      }
+      if (input.size() - pos < size + 2) {
+        return ReplyStatus::Incomplete;
+      }
+      auto payload = input.substr(pos, size);
+      if (input.substr(pos + size, 2) != "\r\n") {
+        return ReplyStatus::Malformed;
+      }
+      pos += size + 2;
+      if (type == '!') {
+        value = RespValue::make_error(RespString(payload));
+        return ReplyStatus::Complete;
+      }
+      // Verbatim strings start with their format, e.g. "txt:".
+      if (type == '=') {
+        if (payload.size() < 4 || payload[3] != ':') {
+          return ReplyStatus::Malformed;
+        }
+        payload.remove_prefix(4);
+      }
+      value = RespString(payload);
+      return ReplyStatus::Complete;
+    }
+    case '*':
+    case '~':
+    case '>': {
+      RespArray values;
+      const auto status =
+          parse_reply_elements(input, pos, size, values, depth);
+      if (type == '>') {
+        value = RespValue::make_push(std::move(values));
+      } else {
+        value = std::move(values);
+      }
+      return status;
+    }
+    case '%':
+    case '|': {
+      RespArray pairs;
+      const auto status =
+          parse_reply_elements(input, pos, size * 2, pairs, depth);
+      if (status != ReplyStatus::Complete) {
+        return status;
+      }
+      // An attribute annotates the reply that follows it.
+      if (type == '|') {
+        return parse_reply_at(input, pos, value, depth + 1);
+      }
+      RespMap map;
+      map.reserve(size);
+      for (size_t i = 0; i < pairs.size(); i += 2) {
+        auto *key = std::get_if<RespString>(&pairs[i].value);
+        map.insert_or_assign(key ? std::move(*key) : pairs[i].to_string(),
+                             std::move(pairs[i + 1]));
+      }
+      value = std::move(map);
+      return ReplyStatus::Complete;
+    }
+  }
+  return ReplyStatus::Malformed;
+}
+
+}  // namespace
+
+std::optional<size_t> parse_reply(std::string_view input, RespValue &value) {
+  size_t pos = 0;
+  switch (parse_reply_at(input, pos, value, 0)) {
+    case ReplyStatus::Complete:
+      return pos;
+    case ReplyStatus::Incomplete:
+      return 0;
+    case ReplyStatus::Malformed:
+      break;
+  }
+  return std::nullopt;
+}
@@ -1,8 +1,35 @@
 #pragma once
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "resp_types.h"
 
-std::optional<RespValue> parse_resp_code(std::string input);
\ No newline at end of file
+std::optional<RespValue> parse_resp_code(std::string input);
+
+// Parses one value from the front of `input`. On success also returns the
+// number of bytes it occupied, so pipelined commands can be parsed one after
+// another from the same buffer.
+std::optional<std::pair<RespValue, size_t>> parse_resp_prefix(
+    std::string_view input);
+
+// Views of the name and arguments of one client request.
+using CommandView = std::pmr::vector<std::string_view>;
+
+// Fast path for client requests, which are arrays of bulk strings. Fills
+// `args` with views into `input` and returns the number of bytes consumed, 0
+// if the request is incomplete, or nullopt if `input` doesn't start with an
+// array of bulk strings.
+std::optional<size_t> parse_command(std::string_view input, CommandView& args);
+
+// Parses one server reply, RESP2 or RESP3, from the front of `input` into
+// `value`. Returns the number of bytes consumed, 0 if the reply is
+// incomplete, or nullopt if `input` doesn't start with a valid reply. RESP3
+// types without a `RespValue` counterpart are mapped to the closest one:
+// sets to arrays, booleans to integers, doubles, big numbers and verbatim
+// strings to strings. Attributes are skipped.
+std::optional<size_t> parse_reply(std::string_view input, RespValue& value);
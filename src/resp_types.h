@@ -1,7 +1,11 @@
 #pragma once
+#include <charconv>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -15,6 +19,23 @@ struct RespError {
 };
 using RespMap = std::unordered_map<RespString, RespValue>;
 struct RespNull {};
+// Immutable string shared by reference: large values in the keyspace are
+// stored like this so replies can send them without copying.
+struct RespSharedString {
+  std::shared_ptr<const std::string> data;
+};
+// String compressed with LZF, see compression.h. Only stored in the keyspace:
+// reads decompress it.
+struct RespCompressedString {
+  std::string data;
+  // Size decompressed.
+  size_t size;
+  void decompress(RespString& out) const;
+};
+// Out-of-band RESP3 push frame, e.g. a Pub/Sub message.
+struct RespPush {
+  RespArray values;
+};
 
 template <typename... Ts>
 struct Overload : Ts... {
@@ -24,7 +45,8 @@ template <class... Ts>
 Overload(Ts...) -> Overload<Ts...>;
 
 struct RespValue {
-  std::variant<RespString, RespInteger, RespArray, RespError, RespMap, RespNull>
+  std::variant<RespString, RespInteger, RespArray, RespError, RespMap, RespNull,
+               RespPush, RespSharedString, RespCompressedString>
       value;
   RespValue() = default;  // Default constructor
                           // Explicitly define copy operations
@@ -49,6 +71,10 @@ struct RespValue {
   RespValue(RespMap&& m) : value(std::move(m)) {}
   RespValue(const RespNull& n) : value(n) {}
   RespValue(RespNull&& n) : value(std::move(n)) {}
+  RespValue(const RespPush& p) : value(p) {}
+  RespValue(RespPush&& p) : value(std::move(p)) {}
+  RespValue(RespSharedString s) : value(std::move(s)) {}
+  RespValue(RespCompressedString s) : value(std::move(s)) {}
 
   static RespValue make_string(std::string s) {
     return RespValue(std::move(s));
@@ -62,6 +88,13 @@ struct RespValue {
     return RespValue(std::move(map));
   }
   static RespValue make_null() { return RespValue(RespNull{}); }
+  static RespValue make_shared_string(
+      std::shared_ptr<const std::string> data) {
+    return RespValue(RespSharedString{.data = std::move(data)});
+  }
+  static RespValue make_push(RespArray values) {
+    return RespValue(RespPush{.values = std::move(values)});
+  }
 
   std::string to_string() const {
     auto display_fn = Overload{
@@ -90,7 +123,16 @@ struct RespValue {
           oss << "}";
           return oss.str();
         },
-        [](RespNull _) -> std::string { return "NIL"; }};
+        [](RespNull _) -> std::string { return "NIL"; },
+        [](RespPush push) -> std::string {
+          return ">" + RespValue(push.values).to_string();
+        },
+        [](const RespSharedString& str) -> std::string { return *str.data; },
+        [](const RespCompressedString& str) -> std::string {
+          std::string out;
+          str.decompress(out);
+          return out;
+        }};
     return std::visit(display_fn, this->value);
   }
 
@@ -108,17 +150,38 @@ struct RespValue {
           return RespArray(arr);
         },
         [](RespNull _) { return RespArray({}); },
+        [](RespPush push) { return push.values; },
+        [](RespSharedString str) {
+          return RespArray(std::vector<RespValue>{str});
+        },
+        [](const RespCompressedString& str) {
+          std::string out;
+          str.decompress(out);
+          return RespArray(std::vector<RespValue>{std::move(out)});
+        },
     };
     return std::visit(visitor, this->value);
   }
 
+  // The whole string as a decimal integer, nullopt for anything else. Never
+  // throws.
+  static std::optional<RespInteger> parse_int(std::string_view str) {
+    RespInteger result = 0;
+    const char* end = str.data() + str.size();
+    const auto [ptr, ec] = std::from_chars(str.data(), end, result);
+    if (str.empty() || ec != std::errc() || ptr != end) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
   std::optional<RespInteger> to_int_safe() const {
     const auto visitor = Overload{
         [](RespArray arr) -> std::optional<RespInteger> {
           return std::nullopt;
         },
-        [](RespString str) -> std::optional<RespInteger> {
-          return RespInteger(std::stoi(str));
+        [](const RespString& str) -> std::optional<RespInteger> {
+          return parse_int(str);
         },
         [](RespInteger num) -> std::optional<RespInteger> { return num; },
         [](RespError err) -> std::optional<RespInteger> {
@@ -126,56 +189,150 @@ struct RespValue {
         },
         [](RespMap map) -> std::optional<RespInteger> { return std::nullopt; },
         [](RespNull _) -> std::optional<RespInteger> { return std::nullopt; },
+        [](RespPush _) -> std::optional<RespInteger> { return std::nullopt; },
+        [](const RespSharedString& str) -> std::optional<RespInteger> {
+          return parse_int(*str.data);
+        },
+        [](const RespCompressedString& str) -> std::optional<RespInteger> {
+          std::string out;
+          str.decompress(out);
+          return parse_int(out);
+        },
     };
     return std::visit(visitor, this->value);
   }
 
+  // Pointer to the string payload for in-place modification. Integer payloads
+  // are converted to their decimal representation first, shared strings are
+  // copied and compressed ones decompressed. Returns nullptr for all other
+  // types.
+  RespString* string_in_place() {
+    if (auto* num = std::get_if<RespInteger>(&value)) {
+      value = std::to_string(*num);
+    } else if (auto* shared = std::get_if<RespSharedString>(&value)) {
+      value = RespString(*shared->data);
+    } else if (auto* compressed = std::get_if<RespCompressedString>(&value)) {
+      RespString str;
+      compressed->decompress(str);
+      value = std::move(str);
+    }
+    return std::get_if<RespString>(&value);
+  }
+
+  // Read-only counterpart of `string_in_place`, integer payloads are rendered
+  // and compressed ones decompressed into `scratch` instead.
+  const RespString* read_string(RespString& scratch) const {
+    if (const auto* num = std::get_if<RespInteger>(&value)) {
+      scratch = std::to_string(*num);
+      return &scratch;
+    }
+    if (const auto* shared = std::get_if<RespSharedString>(&value)) {
+      return shared->data.get();
+    }
+    if (const auto* compressed = std::get_if<RespCompressedString>(&value)) {
+      compressed->decompress(scratch);
+      return &scratch;
+    }
+    return std::get_if<RespString>(&value);
+  }
+
   std::string to_protocol_representation() const {
+    std::string out;
+    encode(out);
+    return out;
+  }
+
+  // Appends the protocol representation to `out`.
+  void encode(std::string& out) const {
+    const auto append_header = [&out](char type, size_t size) {
+      char digits[24];
+      const auto result = std::to_chars(digits, digits + sizeof(digits), size);
+      out += type;
+      out.append(digits, result.ptr);
+      out += "\r\n";
+    };
     const auto visitor = Overload{
-        [](RespArray arr) {
-          std::ostringstream oss;
-          oss << "*" << arr.size() << "\r\n";
+        [&](const RespArray& arr) {
+          append_header('*', arr.size());
           for (const auto& el : arr) {
-            oss << el.to_protocol_representation();
+            el.encode(out);
           }
-          return oss.str();
         },
-        [](RespString str) {
-          std::ostringstream oss;
-          oss << "$" << str.length() << "\r\n" << str << "\r\n";
-          return oss.str();
+        [&](const RespString& str) {
+          append_header('$', str.length());
+          out += str;
+          out += "\r\n";
         },
-        [](RespInteger num) {
-          std::ostringstream oss;
-          oss << ":" << num << "\r\n";
-          return oss.str();
+        [&](RespInteger num) {
+          char digits[24];
+          const auto result =
+              std::to_chars(digits, digits + sizeof(digits), num);
+          out += ':';
+          out.append(digits, result.ptr);
+          out += "\r\n";
         },
-        [](RespError err) {
-          std::ostringstream oss;
-          oss << "-" << err.message << "\r\n";
-          return oss.str();
+        [&](const RespError& err) {
+          out += '-';
+          out += err.message;
+          out += "\r\n";
         },
-        [](RespMap map) {
-          std::ostringstream oss;
-          oss << "%" << map.size() << "\r\n";
+        [&](const RespMap& map) {
+          append_header('%', map.size());
           for (const auto& [k, v] : map) {
-            oss << RespValue::make_string(k).to_protocol_representation()
-                << v.to_protocol_representation();
+            append_header('$', k.length());
+            out += k;
+            out += "\r\n";
+            v.encode(out);
           }
-          return oss.str();
         },
-        [](RespNull _) { return std::string("_\r\n"); },
+        [&](const RespNull&) { out += "_\r\n"; },
+        [&](const RespPush& push) {
+          append_header('>', push.values.size());
+          for (const auto& el : push.values) {
+            el.encode(out);
+          }
+        },
+        [&](const RespSharedString& str) {
+          append_header('$', str.data->length());
+          out += *str.data;
+          out += "\r\n";
+        },
+        [&](const RespCompressedString& str) {
+          std::string decompressed;
+          str.decompress(decompressed);
+          append_header('$', decompressed.length());
+          out += decompressed;
+          out += "\r\n";
+        },
     };
-    return std::visit(visitor, this->value);
+    std::visit(visitor, this->value);
   }
   std::string debug_format_type() const {
     auto display_fn =
-        Overload{[](RespString _) -> std::string { return "RespString"; },
-                 [](RespInteger _) -> std::string { return "RespInteger"; },
-                 [](RespArray _) -> std::string { return "RespArray"; },
-                 [](RespError _) -> std::string { return "RespError"; },
-                 [](RespMap _) -> std::string { return "RespMap"; },
-                 [](RespNull _) -> std::string { return "RespNull"; }};
+        Overload{[](const RespString&) -> std::string { return "RespString"; },
+                 [](RespInteger) -> std::string { return "RespInteger"; },
+                 [](const RespArray&) -> std::string { return "RespArray"; },
+                 [](const RespError&) -> std::string { return "RespError"; },
+                 [](const RespMap&) -> std::string { return "RespMap"; },
+                 [](const RespNull&) -> std::string { return "RespNull"; },
+                 [](const RespPush&) -> std::string { return "RespPush"; },
+                 [](const RespSharedString&) -> std::string {
+                   return "RespSharedString";
+                 },
+                 [](const RespCompressedString&) -> std::string {
+                   return "RespCompressedString";
+                 }};
     return std::visit(display_fn, this->value);
   }
 };
+
+// Streams strings as they are, without the copy `to_string` makes.
+inline std::ostream& operator<<(std::ostream& os, const RespValue& value) {
+  if (const auto* str = std::get_if<RespString>(&value.value)) {
+    return os << *str;
+  }
+  if (const auto* shared = std::get_if<RespSharedString>(&value.value)) {
+    return os << *shared->data;
+  }
+  return os << value.to_string();
+}
@@ -0,0 +1,213 @@
+#include "slab.h"
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <new>
+
+#include "memory_accounting.h"
+
+namespace {
+
+constexpr size_t object_sizes[] = {16,  32,  48,  64,  80,  96,  112, 128,
+                                   160, 192, 224, 256, 320, 384, 448, 512};
+
+constexpr uint8_t unlinked = 0xff;
+constexpr size_t header_size = 64;
+
+}  // namespace
+
+// Lives at the start of every slab, objects follow at `header_size`.
+struct SlabAllocator::Slab {
+  void* free_list = nullptr;
+  uint32_t used = 0;
+  // Objects handed out from the never used tail of the slab.
+  uint32_t carved = 0;
+  uint16_t class_index;
+  uint8_t level = unlinked;
+  // Index in `SizeClass::partial[level]`.
+  uint32_t position = 0;
+};
+
+SlabAllocator::SlabAllocator() {
+  static_assert(sizeof(Slab) <= header_size);
+  for (const size_t size : object_sizes) {
+    classes.push_back(SizeClass{.object_size = size,
+                                .capacity = (slab_size - header_size) / size,
+                                .slabs = 0,
+                                .used = 0,
+                                .current = nullptr,
+                                .partial = {}});
+  }
+  uint8_t index = 0;
+  for (size_t i = 0; i < class_by_size.size(); ++i) {
+    while (object_sizes[index] < i * 16) {
+      ++index;
+    }
+    class_by_size[i] = index;
+  }
+}
+
+SlabAllocator::Slab* SlabAllocator::slab_of(const void* pointer) {
+  return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(pointer) &
+                                 ~(slab_size - 1));
+}
+
+size_t SlabAllocator::level(const SizeClass& size_class, size_t used) const {
+  return used * occupancy_levels / size_class.capacity;
+}
+
+void SlabAllocator::link(SizeClass& size_class, Slab* slab) {
+  slab->level = level(size_class, slab->used);
+  auto& list = size_class.partial[slab->level];
+  slab->position = list.size();
+  list.push_back(slab);
+}
+
+void SlabAllocator::unlink(SizeClass& size_class, Slab* slab) {
+  if (slab->level == unlinked) {
+    return;
+  }
+  auto& list = size_class.partial[slab->level];
+  list[slab->position] = list.back();
+  list[slab->position]->position = slab->position;
+  list.pop_back();
+  slab->level = unlinked;
+}
+
+SlabAllocator::Slab* SlabAllocator::map_slab(uint16_t class_index) {
+  // Map twice the size and trim, so the slab is aligned to its size and
+  // objects find their slab by masking their address.
+  void* mapping = mmap(nullptr, 2 * slab_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  const auto start = reinterpret_cast<uintptr_t>(mapping);
+  const auto aligned = (start + slab_size - 1) & ~(slab_size - 1);
+  if (aligned > start) {
+    munmap(mapping, aligned - start);
+  }
+  if (const auto end = start + 2 * slab_size; end > aligned + slab_size) {
+    munmap(reinterpret_cast<void*>(aligned + slab_size),
+           end - aligned - slab_size);
+  }
+  ++classes[class_index].slabs;
+  MemoryAccounting::instance().on_map(slab_size);
+  auto* slab = new (reinterpret_cast<void*>(aligned)) Slab();
+  slab->class_index = class_index;
+  return slab;
+}
+
+void SlabAllocator::unmap_slab(Slab* slab) {
+  --classes[slab->class_index].slabs;
+  munmap(slab, slab_size);
+  MemoryAccounting::instance().on_unmap(slab_size);
+}
+
+SlabAllocator::Slab* SlabAllocator::next_slab(uint16_t class_index) {
+  auto& size_class = classes[class_index];
+  for (size_t i = occupancy_levels; i-- > 0;) {
+    if (!size_class.partial[i].empty()) {
+      Slab* slab = size_class.partial[i].back();
+      unlink(size_class, slab);
+      return slab;
+    }
+  }
+  return map_slab(class_index);
+}
+
+void* SlabAllocator::allocate(size_t size) {
+  if (size > max_object_size) {
+    return ::operator new(size);
+  }
+  const uint8_t class_index = class_by_size[(size + 15) / 16];
+  auto& size_class = classes[class_index];
+  Slab* slab = size_class.current;
+  if (!slab || slab->used == size_class.capacity) {
+    slab = size_class.current = next_slab(class_index);
+  }
+  void* object;
+  if (slab->free_list) {
+    object = slab->free_list;
+    slab->free_list = *static_cast<void**>(object);
+  } else {
+    object = reinterpret_cast<std::byte*>(slab) + header_size +
+             slab->carved++ * size_class.object_size;
+  }
+  ++slab->used;
+  ++size_class.used;
+  return object;
+}
+
+void SlabAllocator::deallocate(void* pointer, size_t size) {
+  if (size > max_object_size) {
+    ::operator delete(pointer);
+    return;
+  }
+  Slab* slab = slab_of(pointer);
+  auto& size_class = classes[slab->class_index];
+  *static_cast<void**>(pointer) = slab->free_list;
+  slab->free_list = pointer;
+  --slab->used;
+  --size_class.used;
+  ++free_count;
+  if (slab == size_class.current) {
+    return;
+  }
+  if (slab->used == 0) {
+    unlink(size_class, slab);
+    unmap_slab(slab);
+    return;
+  }
+  if (slab->level != level(size_class, slab->used)) {
+    unlink(size_class, slab);
+    link(size_class, slab);
+  }
+}
+
+bool SlabAllocator::should_move(const void* pointer, size_t size) const {
+  if (size > max_object_size) {
+    return false;
+  }
+  const Slab* slab = slab_of(pointer);
+  const auto& size_class = classes[slab->class_index];
+  return slab != size_class.current &&
+         slab->used * size_class.slabs < size_class.used;
+}
+
+size_t SlabAllocator::allocation_size(size_t size) const {
+  if (size > max_object_size) {
+    return size;
+  }
+  return classes[class_by_size[(size + 15) / 16]].object_size;
+}
+
+std::vector<SlabAllocator::ClassStats> SlabAllocator::stats() const {
+  std::vector<ClassStats> result;
+  for (const auto& size_class : classes) {
+    result.push_back(ClassStats{
+        .object_size = size_class.object_size,
+        .slabs = size_class.slabs,
+        .used = size_class.used,
+        .capacity = size_class.slabs * size_class.capacity,
+    });
+  }
+  return result;
+}
+
+size_t SlabAllocator::used_bytes() const {
+  size_t total = 0;
+  for (const auto& size_class : classes) {
+    total += size_class.used * size_class.object_size;
+  }
+  return total;
+}
+
+size_t SlabAllocator::slab_bytes() const {
+  size_t total = 0;
+  for (const auto& size_class : classes) {
+    total += size_class.slabs * slab_size;
+  }
+  return total;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Size class allocator for the long-lived objects of the keyspace. Objects of
+// the same class share 64 KiB slabs mapped straight from the OS. New objects
+// go to the fullest slab that has room so sparse slabs drain, and a slab is
+// unmapped as soon as it is empty. `should_move` tells a defragmentation pass
+// which live objects to reallocate to empty out sparse slabs.
+//
+// Not thread-safe: only the writer allocates and frees.
+class SlabAllocator {
+ public:
+  static SlabAllocator& instance() {
+    static SlabAllocator instance;
+    return instance;
+  }
+
+  static constexpr size_t slab_size = 64 * 1024;
+  // Larger objects go to the global allocator.
+  static constexpr size_t max_object_size = 512;
+
+  void* allocate(size_t size);
+  void deallocate(void* pointer, size_t size);
+
+  // True if `pointer` sits in a slab that is sparser than the average of its
+  // class, so that reallocating it helps to free the slab.
+  bool should_move(const void* pointer, size_t size) const;
+
+  // Bytes an object of `size` takes, i.e. `size` rounded up to its class.
+  size_t allocation_size(size_t size) const;
+
+  struct ClassStats {
+    size_t object_size;
+    size_t slabs;
+    // Live objects and the number of objects the slabs can hold.
+    size_t used;
+    size_t capacity;
+  };
+  std::vector<ClassStats> stats() const;
+
+  // Bytes of live objects and bytes of slabs mapped for them.
+  size_t used_bytes() const;
+  size_t slab_bytes() const;
+  // Number of objects freed so far.
+  uint64_t frees() const { return free_count; }
+
+ private:
+  SlabAllocator();
+  // Slabs with live objects stay mapped until exit.
+  ~SlabAllocator() = default;
+  // Delete copy/move operations
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+  SlabAllocator(SlabAllocator&&) = delete;
+  SlabAllocator& operator=(SlabAllocator&&) = delete;
+
+  struct Slab;
+
+  // Partially used slabs are kept in lists by occupancy so the fullest one
+  // can be picked in constant time.
+  static constexpr size_t occupancy_levels = 8;
+
+  struct SizeClass {
+    size_t object_size;
+    size_t capacity;
+    size_t slabs = 0;
+    size_t used = 0;
+    // Objects are allocated from here. Not part of `partial`.
+    Slab* current = nullptr;
+    std::array<std::vector<Slab*>, occupancy_levels> partial;
+  };
+
+  static Slab* slab_of(const void* pointer);
+  size_t level(const SizeClass& size_class, size_t used) const;
+  void link(SizeClass& size_class, Slab* slab);
+  void unlink(SizeClass& size_class, Slab* slab);
+  Slab* map_slab(uint16_t class_index);
+  void unmap_slab(Slab* slab);
+  Slab* next_slab(uint16_t class_index);
+
+  std::vector<SizeClass> classes;
+  // Class index by (size + 15) / 16.
+  std::array<uint8_t, max_object_size / 16 + 1> class_by_size;
+  uint64_t free_count = 0;
+};
@@ -0,0 +1,156 @@
+#include "stats.h"
+
+#include <bit>
+#include <cmath>
+
+size_t LatencyHistogram::bucket_index(uint64_t value) {
+  if (value < sub_buckets) {
+    return value;
+  }
+  if (value >> max_exponent) {
+    value = (uint64_t{1} << max_exponent) - 1;
+  }
+  const size_t exponent = std::bit_width(value) - 1;
+  const size_t mantissa =
+      (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+  return (exponent - sub_bucket_bits + 1) * sub_buckets + mantissa;
+}
+
+uint64_t LatencyHistogram::upper_bound(size_t index) {
+  if (index < sub_buckets) {
+    return index;
+  }
+  const size_t exponent = index / sub_buckets + sub_bucket_bits - 1;
+  const uint64_t mantissa = index % sub_buckets;
+  const size_t shift = exponent - sub_bucket_bits;
+  return ((sub_buckets + mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration) {
+  const auto value =
+      static_cast<uint64_t>(std::max<int64_t>(0, duration.count()));
+  buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  sum_ns.fetch_add(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+  for (auto &bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  total.store(0, std::memory_order_relaxed);
+  sum_ns.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < bucket_count; ++i) {
+    buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+  }
+  total.fetch_add(other.count(), std::memory_order_relaxed);
+  sum_ns.fetch_add(other.sum_ns.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double percentile) const {
+  const uint64_t n = count();
+  if (n == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  const auto target = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(n * percentile / 100.0)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; ++i) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      return std::chrono::nanoseconds(upper_bound(i));
+    }
+  }
+  return std::chrono::nanoseconds(upper_bound(bucket_count - 1));
+}
+
+void ServerStats::reset() {
+  connections_received.store(0, std::memory_order_relaxed);
+  bytes_in.store(0, std::memory_order_relaxed);
+  bytes_out.store(0, std::memory_order_relaxed);
+  output_limit_disconnections.store(0, std::memory_order_relaxed);
+  query_limit_disconnections.store(0, std::memory_order_relaxed);
+  compressed_values.store(0, std::memory_order_relaxed);
+  incompressible_values.store(0, std::memory_order_relaxed);
+  compression_input_bytes.store(0, std::memory_order_relaxed);
+  compression_output_bytes.store(0, std::memory_order_relaxed);
+  compression_ns.store(0, std::memory_order_relaxed);
+  decompressions.store(0, std::memory_order_relaxed);
+  decompression_ns.store(0, std::memory_order_relaxed);
+  event_loop.reset();
+  for (auto &wakeups : events_per_wakeup) {
+    wakeups.store(0, std::memory_order_relaxed);
+  }
+}
+
+void SlowLog::configure(std::chrono::microseconds slower_than,
+                        size_t max_length) {
+  threshold_ns.store(slower_than.count() < 0 ? -1 : slower_than.count() * 1000,
+                     std::memory_order_relaxed);
+  std::lock_guard lock(mutex);
+  this->max_length = max_length;
+  while (entries.size() > max_length) {
+    entries.pop_back();
+  }
+}
+
+void SlowLog::add(std::chrono::nanoseconds duration, std::string_view name,
+                  const RespArray &arguments) {
+  // Like Redis, keep at most 32 arguments of at most 128 bytes each.
+  constexpr size_t max_arguments = 32;
+  constexpr size_t max_argument_length = 128;
+  // The id is assigned under the lock below.
+  Entry entry{
+      .id = 0,
+      .timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count(),
+      .duration =
+          std::chrono::duration_cast<std::chrono::microseconds>(duration),
+      .arguments = {},
+  };
+  entry.arguments.emplace_back(name);
+  for (const auto &argument : arguments) {
+    if (entry.arguments.size() == max_arguments - 1 &&
+        arguments.size() + 1 > max_arguments) {
+      entry.arguments.push_back(
+          "... (" + std::to_string(arguments.size() + 2 - max_arguments) +
+          " more arguments)");
+      break;
+    }
+    auto text = argument.to_string();
+    if (text.size() > max_argument_length) {
+      const size_t more = text.size() - max_argument_length;
+      text.resize(max_argument_length);
+      text += "... (" + std::to_string(more) + " more bytes)";
+    }
+    entry.arguments.push_back(std::move(text));
+  }
+  std::lock_guard lock(mutex);
+  entry.id = next_id++;
+  entries.push_front(std::move(entry));
+  while (entries.size() > max_length) {
+    entries.pop_back();
+  }
+}
+
+std::vector<SlowLog::Entry> SlowLog::get(size_t count) const {
+  std::lock_guard lock(mutex);
+  const auto n = std::min(count, entries.size());
+  return std::vector<Entry>(entries.begin(), entries.begin() + n);
+}
+
+size_t SlowLog::size() const {
+  std::lock_guard lock(mutex);
+  return entries.size();
+}
+
+void SlowLog::reset() {
+  std::lock_guard lock(mutex);
+  entries.clear();
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "resp_types.h"
+
+// Log-linear histogram in the style of HdrHistogram: 8 buckets per power of
+// two keep values with 12.5% precision from 1ns up to ~18 minutes in a fixed
+// 2.4 KiB. Recording is a few relaxed atomic increments, safe from any thread.
+class LatencyHistogram {
+ public:
+  static constexpr size_t sub_bucket_bits = 3;
+  static constexpr size_t sub_buckets = 1 << sub_bucket_bits;
+  // Values of 2^max_exponent ns and more land in the last bucket.
+  static constexpr size_t max_exponent = 40;
+  static constexpr size_t bucket_count =
+      (max_exponent - sub_bucket_bits + 1) * sub_buckets;
+
+  void record(std::chrono::nanoseconds duration);
+  void reset();
+  // Adds the counts of `other`, e.g. to combine per-thread histograms.
+  void merge(const LatencyHistogram& other);
+
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+  std::chrono::nanoseconds sum() const {
+    return std::chrono::nanoseconds(sum_ns.load(std::memory_order_relaxed));
+  }
+  // Upper bound of the bucket holding the `percentile`th value, zero while
+  // empty.
+  std::chrono::nanoseconds percentile(double percentile) const;
+
+  // Calls `visit(upper_bound, count)` for every non-empty bucket in order.
+  template <typename Visit>
+  void for_each_bucket(Visit&& visit) const {
+    for (size_t i = 0; i < bucket_count; ++i) {
+      if (const auto n = buckets[i].load(std::memory_order_relaxed)) {
+        visit(std::chrono::nanoseconds(upper_bound(i)), n);
+      }
+    }
+  }
+
+ private:
+  static size_t bucket_index(uint64_t value);
+  static uint64_t upper_bound(size_t index);
+
+  std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> sum_ns{0};
+};
+
+// Recorded by `CommandRegistry::execute_command` for every call.
+struct CommandStats {
+  std::atomic<uint64_t> calls{0};
+  // Calls that replied with an error.
+  std::atomic<uint64_t> failed_calls{0};
+  LatencyHistogram latency;
+};
+
+// Process wide counters for INFO. Updated from the event loop and the I/O
+// threads.
+class ServerStats {
+ public:
+  static ServerStats& instance() {
+    static ServerStats instance;
+    return instance;
+  }
+
+  // Wakeups with more events count as this many.
+  static constexpr size_t max_tracked_events = 64;
+
+  void record_wakeup(size_t events) {
+    events_per_wakeup[std::min(events, max_tracked_events)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+  // Resets the counters, but not the gauges.
+  void reset();
+
+  const std::chrono::steady_clock::time_point started =
+      std::chrono::steady_clock::now();
+  // TCP port the server listens on, set at startup.
+  int port = 0;
+  std::atomic<uint64_t> connections_received{0};
+  std::atomic<uint64_t> connected_clients{0};
+  std::atomic<uint64_t> bytes_in{0};
+  std::atomic<uint64_t> bytes_out{0};
+  // Clients closed for exceeding their output or query buffer limit.
+  std::atomic<uint64_t> output_limit_disconnections{0};
+  std::atomic<uint64_t> query_limit_disconnections{0};
+  // Values compressed when set, their sizes before and after, and those
+  // skipped for compressing poorly. Times are CPU time on the calling thread.
+  std::atomic<uint64_t> compressed_values{0};
+  std::atomic<uint64_t> incompressible_values{0};
+  std::atomic<uint64_t> compression_input_bytes{0};
+  std::atomic<uint64_t> compression_output_bytes{0};
+  std::atomic<uint64_t> compression_ns{0};
+  std::atomic<uint64_t> decompressions{0};
+  std::atomic<uint64_t> decompression_ns{0};
+  // Time the event loop spends on a batch of events, without waiting.
+  LatencyHistogram event_loop;
+  std::array<std::atomic<uint64_t>, max_tracked_events + 1>
+      events_per_wakeup{};
+
+ private:
+  ServerStats() = default;
+  // Delete copy/move operations
+  ServerStats(const ServerStats&) = delete;
+  ServerStats& operator=(const ServerStats&) = delete;
+  ServerStats(ServerStats&&) = delete;
+  ServerStats& operator=(ServerStats&&) = delete;
+};
+
+// Bounded log of the commands that took longer than a threshold, newest
+// first. Only slow commands take the lock and copy their arguments.
+class SlowLog {
+ public:
+  static SlowLog& instance() {
+    static SlowLog instance;
+    return instance;
+  }
+
+  struct Entry {
+    uint64_t id;
+    // Unix time in seconds.
+    int64_t timestamp;
+    std::chrono::microseconds duration;
+    std::vector<std::string> arguments;
+  };
+
+  // A negative threshold disables the log.
+  void configure(std::chrono::microseconds slower_than, size_t max_length);
+
+  bool is_slow(std::chrono::nanoseconds duration) const {
+    const auto threshold = threshold_ns.load(std::memory_order_relaxed);
+    return threshold >= 0 && duration.count() >= threshold;
+  }
+  void add(std::chrono::nanoseconds duration, std::string_view name,
+           const RespArray& arguments);
+
+  // The `count` newest entries.
+  std::vector<Entry> get(size_t count) const;
+  size_t size() const;
+  void reset();
+
+ private:
+  SlowLog() = default;
+  // Delete copy/move operations
+  SlowLog(const SlowLog&) = delete;
+  SlowLog& operator=(const SlowLog&) = delete;
+  SlowLog(SlowLog&&) = delete;
+  SlowLog& operator=(SlowLog&&) = delete;
+
+  // Same defaults as slowlog-log-slower-than and slowlog-max-len.
+  std::atomic<int64_t> threshold_ns{10'000'000};
+  mutable std::mutex mutex;
+  size_t max_length = 128;
+  uint64_t next_id = 0;
+  std::deque<Entry> entries;
+};
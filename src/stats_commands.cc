@@ -0,0 +1,314 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+#include "cluster.h"
+#include "commands.h"
+#include "database.h"
+#include "lazy_free.h"
+#include "memory_accounting.h"
+#include "replication.h"
+#include "slab.h"
+#include "stats.h"
+
+// INFO, LATENCY and SLOWLOG: introspection of the statistics recorded by the
+// command registry and the event loop.
+
+namespace {
+
+double to_usec(std::chrono::nanoseconds duration) {
+  return duration.count() / 1000.0;
+}
+
+void info_server(std::ostringstream &oss) {
+  const auto uptime = std::chrono::steady_clock::now() -
+                      ServerStats::instance().started;
+  oss << "# Server\r\n"
+      << "redis_mode:"
+      << (Cluster::instance().enabled() ? "cluster" : "standalone") << "\r\n"
+      << "process_id:" << getpid() << "\r\n"
+      << "tcp_port:" << ServerStats::instance().port << "\r\n"
+      << "uptime_in_seconds:"
+      << std::chrono::duration_cast<std::chrono::seconds>(uptime).count()
+      << "\r\n";
+}
+
+void info_clients(std::ostringstream &oss) {
+  oss << "# Clients\r\n"
+      << "connected_clients:"
+      << ServerStats::instance().connected_clients.load() << "\r\n";
+}
+
+void info_memory(std::ostringstream &oss) {
+  const auto &slabs = SlabAllocator::instance();
+  const auto &stats = ServerStats::instance();
+  const auto compressed_in = stats.compression_input_bytes.load();
+  const auto compressed_out = stats.compression_output_bytes.load();
+  const auto decompressions = stats.decompressions.load();
+  const auto decompression_ns = stats.decompression_ns.load();
+  const auto &accounting = MemoryAccounting::instance();
+  oss << "# Memory\r\n"
+      << "used_memory:" << accounting.used_bytes() << "\r\n"
+      << "used_memory_peak:" << accounting.peak_bytes() << "\r\n"
+      << "used_memory_startup:" << accounting.startup_bytes() << "\r\n"
+      << "used_memory_slabs:" << slabs.used_bytes() << "\r\n"
+      << "mapped_memory_slabs:" << slabs.slab_bytes() << "\r\n"
+      << "lazyfree_pending_objects:" << LazyFree::instance().pending()
+      << "\r\n"
+      << "lazyfreed_objects:" << LazyFree::instance().freed() << "\r\n"
+      << "compressed_values:" << stats.compressed_values.load() << "\r\n"
+      << "incompressible_values:" << stats.incompressible_values.load()
+      << "\r\n"
+      << "compression_ratio:"
+      << (compressed_out ? static_cast<double>(compressed_in) / compressed_out
+                         : 0.0)
+      << "\r\n"
+      << "compression_cpu_usec:"
+      << to_usec(std::chrono::nanoseconds(stats.compression_ns.load()))
+      << "\r\n"
+      << "decompressions:" << decompressions << "\r\n"
+      << "decompression_cpu_usec:"
+      << to_usec(std::chrono::nanoseconds(decompression_ns)) << "\r\n"
+      << "decompression_avg_usec:"
+      << (decompressions
+              ? to_usec(std::chrono::nanoseconds(decompression_ns)) /
+                    decompressions
+              : 0.0)
+      << "\r\n";
+}
+
+void info_stats(std::ostringstream &oss) {
+  const auto &stats = ServerStats::instance();
+  uint64_t commands = 0;
+  for (const auto &[_, command] :
+       CommandRegistry::instance().command_stats()) {
+    commands += command->calls.load(std::memory_order_relaxed);
+  }
+  uint64_t wakeups = 0;
+  uint64_t events = 0;
+  size_t max_events = 0;
+  for (size_t i = 0; i < stats.events_per_wakeup.size(); ++i) {
+    const auto n = stats.events_per_wakeup[i].load(std::memory_order_relaxed);
+    wakeups += n;
+    events += n * i;
+    if (n) {
+      max_events = i;
+    }
+  }
+  const auto &loop = stats.event_loop;
+  oss << "# Stats\r\n"
+      << "total_connections_received:" << stats.connections_received.load()
+      << "\r\n"
+      << "total_commands_processed:" << commands << "\r\n"
+      << "total_net_input_bytes:" << stats.bytes_in.load() << "\r\n"
+      << "total_net_output_bytes:" << stats.bytes_out.load() << "\r\n"
+      << "client_output_buffer_limit_disconnections:"
+      << stats.output_limit_disconnections.load() << "\r\n"
+      << "client_query_buffer_limit_disconnections:"
+      << stats.query_limit_disconnections.load() << "\r\n"
+      << "eventloop_cycles:" << loop.count() << "\r\n"
+      << "eventloop_duration_sum:"
+      << std::chrono::duration_cast<std::chrono::microseconds>(loop.sum())
+             .count()
+      << "\r\n"
+      << "eventloop_duration_p50_usec:" << to_usec(loop.percentile(50))
+      << "\r\n"
+      << "eventloop_duration_p99_usec:" << to_usec(loop.percentile(99))
+      << "\r\n"
+      << "events_per_wakeup_avg:"
+      << (wakeups ? static_cast<double>(events) / wakeups : 0.0) << "\r\n"
+      << "events_per_wakeup_max:" << max_events << "\r\n";
+}
+
+void info_replication(std::ostringstream &oss) {
+  Replication::instance().write_info(oss);
+}
+
+void info_cluster(std::ostringstream &oss) {
+  oss << "# Cluster\r\n"
+      << "cluster_enabled:" << (Cluster::instance().enabled() ? 1 : 0)
+      << "\r\n";
+}
+
+void info_keyspace(std::ostringstream &oss) {
+  auto &db = Database::instance();
+  oss << "# Keyspace\r\n";
+  if (db.size() > 0) {
+    oss << "db0:keys=" << db.size() << ",expires=" << db.expiring_size()
+        << "\r\n";
+  }
+}
+
+void info_commandstats(std::ostringstream &oss) {
+  oss << "# Commandstats\r\n";
+  for (const auto &[name, command] :
+       CommandRegistry::instance().command_stats()) {
+    const auto calls = command->calls.load(std::memory_order_relaxed);
+    if (calls == 0) {
+      continue;
+    }
+    const auto usec = to_usec(command->latency.sum());
+    oss << "cmdstat_" << name << ":calls=" << calls
+        << ",usec=" << static_cast<uint64_t>(usec)
+        << ",usec_per_call=" << usec / calls << ",rejected_calls=0"
+        << ",failed_calls=" << command->failed_calls.load() << "\r\n";
+  }
+}
+
+void info_latencystats(std::ostringstream &oss) {
+  oss << "# Latencystats\r\n";
+  for (const auto &[name, command] :
+       CommandRegistry::instance().command_stats()) {
+    const auto &latency = command->latency;
+    if (latency.count() == 0) {
+      continue;
+    }
+    oss << "latency_percentiles_usec_" << name
+        << ":p50=" << to_usec(latency.percentile(50))
+        << ",p99=" << to_usec(latency.percentile(99))
+        << ",p99.9=" << to_usec(latency.percentile(99.9)) << "\r\n";
+  }
+}
+
+struct InfoSection {
+  const char *name;
+  void (*write)(std::ostringstream &);
+  bool in_default;
+};
+
+constexpr InfoSection info_sections[] = {
+    {"server", info_server, true},
+    {"clients", info_clients, true},
+    {"memory", info_memory, true},
+    {"stats", info_stats, true},
+    {"replication", info_replication, true},
+    {"commandstats", info_commandstats, false},
+    {"latencystats", info_latencystats, false},
+    {"cluster", info_cluster, true},
+    {"keyspace", info_keyspace, true},
+};
+
+// Cumulative counts per power of two microseconds, like Redis reports them.
+RespValue latency_histogram(const CommandStats &stats) {
+  std::map<uint64_t, uint64_t> buckets;
+  stats.latency.for_each_bucket([&](auto upper_bound, uint64_t count) {
+    const auto usec = (upper_bound.count() + 999) / 1000;
+    buckets[std::bit_ceil(std::max<uint64_t>(1, usec))] += count;
+  });
+  RespMap histogram;
+  uint64_t cumulative = 0;
+  for (const auto &[usec, count] : buckets) {
+    cumulative += count;
+    histogram[std::to_string(usec)] = RespValue::make_integer(cumulative);
+  }
+  return RespValue::make_map(
+      {{"calls", RespValue::make_integer(stats.calls.load())},
+       {"histogram_usec", RespValue::make_map(std::move(histogram))}});
+}
+
+}  // namespace
+
+RespValue handle_info(const RespArray &arguments) {
+  std::vector<std::string> requested;
+  for (const auto &argument : arguments) {
+    requested.push_back(to_lower(argument.to_string()));
+  }
+  const auto wanted = [&requested](const InfoSection &section) {
+    if (requested.empty()) {
+      return section.in_default;
+    }
+    return std::ranges::any_of(requested, [&](const std::string &name) {
+      return name == section.name || name == "all" || name == "everything" ||
+             (name == "default" && section.in_default);
+    });
+  };
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(2);
+  for (const auto &section : info_sections) {
+    if (wanted(section)) {
+      if (oss.tellp() > 0) {
+        oss << "\r\n";
+      }
+      section.write(oss);
+    }
+  }
+  return RespValue::make_string(oss.str());
+}
+CommandRegistrar _handle_info("info", handle_info, CommandAccess::Server);
+
+RespValue handle_latency(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for LATENCY");
+  }
+  if (!equals_ignore_case(arguments[0].to_string(), "histogram")) {
+    return RespValue::make_error("ERR unsupported sub command for LATENCY: " +
+                                 arguments[0].to_string());
+  }
+  RespMap result;
+  for (const auto &[name, stats] :
+       CommandRegistry::instance().command_stats()) {
+    const bool requested =
+        arguments.size() == 1 ||
+        std::any_of(arguments.begin() + 1, arguments.end(),
+                    [&name](const RespValue &argument) {
+                      return equals_ignore_case(argument.to_string(), name);
+                    });
+    if (requested && stats->calls.load() > 0) {
+      result[name] = latency_histogram(*stats);
+    }
+  }
+  return RespValue::make_map(std::move(result));
+}
+CommandRegistrar _handle_latency("latency", handle_latency,
+                                 CommandAccess::Server);
+
+RespValue handle_slowlog(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for SLOWLOG");
+  }
+  auto &slowlog = SlowLog::instance();
+  const auto subcommand = arguments[0].to_string();
+  if (equals_ignore_case(subcommand, "len")) {
+    return RespValue::make_integer(slowlog.size());
+  }
+  if (equals_ignore_case(subcommand, "reset")) {
+    slowlog.reset();
+    return RespValue::make_string("OK");
+  }
+  if (!equals_ignore_case(subcommand, "get")) {
+    return RespValue::make_error("ERR unsupported sub command for SLOWLOG: " +
+                                 subcommand);
+  }
+  size_t count = 10;
+  if (arguments.size() > 1) {
+    const auto requested = parse_integer(arguments[1]);
+    if (!requested || *requested < -1) {
+      return RespValue::make_error(
+          "ERR count should be greater than or equal to -1");
+    }
+    count = *requested == -1 ? slowlog.size() : *requested;
+  }
+  RespArray result;
+  for (const auto &entry : slowlog.get(count)) {
+    RespArray command;
+    for (const auto &argument : entry.arguments) {
+      command.push_back(RespValue::make_string(argument));
+    }
+    result.push_back(RespValue::make_array({
+        RespValue::make_integer(entry.id),
+        RespValue::make_integer(entry.timestamp),
+        RespValue::make_integer(entry.duration.count()),
+        RespValue::make_array(std::move(command)),
+        // Client address and name.
+        RespValue::make_string(""),
+        RespValue::make_string(""),
+    }));
+  }
+  return RespValue::make_array(std::move(result));
+}
+CommandRegistrar _handle_slowlog("slowlog", handle_slowlog,
+                                 CommandAccess::Server);
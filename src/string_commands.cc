@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "commands.h"
+#include "database.h"
+
+// String commands beyond SET/GET. Like the bitmap commands they work on the
+// string stored in the `Database` in place: modifications append to or
+// overwrite it, relying on `std::string`'s geometric growth, and reads copy
+// nothing but the bytes of the reply.
+
+namespace {
+
+// Redis' 512MB string limit.
+constexpr size_t max_string_size = 512 * 1024 * 1024;
+
+RespValue too_large_error() {
+  return RespValue::make_error(
+      "ERR string exceeds maximum allowed size (proto-max-bulk-len)");
+}
+
+// The string stored at `key` in place, created empty if `key` doesn't exist.
+// Nothing if `key` holds another type.
+RespString *string_for_update(const std::string &key) {
+  return Database::instance()
+      .find_or_insert(key, RespValue::make_string(""))
+      .string_in_place();
+}
+
+}  // namespace
+
+// APPEND key value
+RespValue handle_append(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for APPEND");
+  }
+  const auto key = arguments[0].to_string();
+  RespString scratch;
+  const auto *suffix = arguments[1].read_string(scratch);
+  if (!suffix) {
+    return RespValue::make_error("ERR invalid value");
+  }
+  if (suffix->size() > max_string_size) {
+    return too_large_error();
+  }
+  auto *str = string_for_update(key);
+  if (!str) {
+    return wrong_type_error();
+  }
+  if (str->size() + suffix->size() > max_string_size) {
+    return too_large_error();
+  }
+  str->append(*suffix);
+  Database::instance().signal_modified(key);
+  return RespValue::make_integer(str->size());
+}
+CommandRegistrar _handle_append("append", handle_append, CommandAccess::Write,
+                                KeySpec{1, 1, 1});
+
+// STRLEN key
+RespValue handle_strlen(const RespArray &arguments) {
+  if (arguments.size() != 1) {
+    return RespValue::make_error("ERR wrong number of arguments for STRLEN");
+  }
+  const auto *value = Database::instance().lookup(arguments[0].to_string());
+  if (!value) {
+    return RespValue::make_integer(0);
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  return RespValue::make_integer(str->size());
+}
+CommandRegistrar _handle_strlen("strlen", handle_strlen,
+                                CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+// GETRANGE key start end, inclusive and counting from the end for negative
+// indexes.
+RespValue handle_getrange(const RespArray &arguments) {
+  if (arguments.size() != 3) {
+    return RespValue::make_error("ERR wrong number of arguments for GETRANGE");
+  }
+  auto start = parse_integer(arguments[1]);
+  auto end = parse_integer(arguments[2]);
+  if (!start || !end) {
+    return RespValue::make_error("ERR value is not an integer");
+  }
+  const auto *value = Database::instance().lookup(arguments[0].to_string());
+  if (!value) {
+    return RespValue::make_string("");
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  const auto length = static_cast<RespInteger>(str->size());
+  if (*start < 0 && *end < 0 && *start > *end) {
+    return RespValue::make_string("");
+  }
+  if (*start < 0) {
+    *start = std::max<RespInteger>(*start + length, 0);
+  }
+  if (*end < 0) {
+    *end = std::max<RespInteger>(*end + length, 0);
+  }
+  *end = std::min(*end, length - 1);
+  if (length == 0 || *start > *end) {
+    return RespValue::make_string("");
+  }
+  return RespValue::make_string(str->substr(*start, *end - *start + 1));
+}
+CommandRegistrar _handle_getrange("getrange", handle_getrange,
+                                  CommandAccess::ReadOnly, KeySpec{1, 1, 1});
+
+// SETRANGE key offset value: overwrites the string from `offset` on,
+// padding it with zero bytes if it is shorter.
+RespValue handle_setrange(const RespArray &arguments) {
+  if (arguments.size() != 3) {
+    return RespValue::make_error("ERR wrong number of arguments for SETRANGE");
+  }
+  const auto offset = parse_integer(arguments[1]);
+  if (!offset || *offset < 0) {
+    return RespValue::make_error("ERR offset is out of range");
+  }
+  RespString scratch;
+  const auto *patch = arguments[2].read_string(scratch);
+  if (!patch) {
+    return RespValue::make_error("ERR invalid value");
+  }
+  const auto key = arguments[0].to_string();
+  auto &db = Database::instance();
+  // An empty patch neither creates nor extends the string.
+  if (patch->empty()) {
+    const auto *value = db.lookup(key);
+    RespString value_scratch;
+    const auto *current = value ? value->read_string(value_scratch) : nullptr;
+    if (value && !current) {
+      return wrong_type_error();
+    }
+    return RespValue::make_integer(current ? current->size() : 0);
+  }
+  if (static_cast<size_t>(*offset) + patch->size() > max_string_size) {
+    return too_large_error();
+  }
+  auto *str = string_for_update(key);
+  if (!str) {
+    return wrong_type_error();
+  }
+  if (str->size() < *offset + patch->size()) {
+    str->resize(*offset + patch->size(), '\0');
+  }
+  str->replace(*offset, patch->size(), *patch);
+  db.signal_modified(key);
+  return RespValue::make_integer(str->size());
+}
+CommandRegistrar _handle_setrange("setrange", handle_setrange,
+                                  CommandAccess::Write, KeySpec{1, 1, 1});
+
+// GETDEL key: moves the value out of the keyspace into the reply.
+RespValue handle_getdel(const RespArray &arguments) {
+  if (arguments.size() != 1) {
+    return RespValue::make_error("ERR wrong number of arguments for GETDEL");
+  }
+  const auto key = arguments[0].to_string();
+  auto &db = Database::instance();
+  auto *value = db.find(key);
+  if (!value) {
+    return RespValue::make_null();
+  }
+  if (std::holds_alternative<RespSharedString>(value->value)) {
+    auto reply = std::move(*value);
+    db.erase(key);
+    return reply;
+  }
+  auto *str = value->string_in_place();
+  if (!str) {
+    return wrong_type_error();
+  }
+  auto reply = RespValue::make_string(std::move(*str));
+  db.erase(key);
+  return reply;
+}
+CommandRegistrar _handle_getdel("getdel", handle_getdel, CommandAccess::Write,
+                                KeySpec{1, 1, 1});
+
+// GETEX key [EX seconds | PX milliseconds | EXAT unix-time-seconds |
+//            PXAT unix-time-milliseconds | PERSIST]
+RespValue handle_getex(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for GETEX");
+  }
+  bool change_expiry = false;
+  std::optional<std::chrono::milliseconds> expire_in;
+  if (arguments.size() == 2 &&
+      equals_ignore_case(arguments[1].to_string(), "persist")) {
+    change_expiry = true;
+  } else if (arguments.size() == 3) {
+    const auto option = to_lower(arguments[1].to_string());
+    const auto time = parse_integer(arguments[2]);
+    if (!time) {
+      return RespValue::make_error("ERR value is not an integer");
+    }
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    if (option == "ex") {
+      expire_in = std::chrono::seconds(*time);
+    } else if (option == "px") {
+      expire_in = std::chrono::milliseconds(*time);
+    } else if (option == "exat") {
+      expire_in = std::chrono::seconds(*time) - now;
+    } else if (option == "pxat") {
+      expire_in = std::chrono::milliseconds(*time) - now;
+    } else {
+      return RespValue::make_error("ERR syntax error");
+    }
+    if (*time <= 0) {
+      return RespValue::make_error(
+          "ERR invalid expire time in 'getex' command");
+    }
+    // A time in the past expires the key right after the reply.
+    expire_in = std::max(*expire_in, std::chrono::milliseconds(0));
+    change_expiry = true;
+  } else if (arguments.size() != 1) {
+    return RespValue::make_error("ERR syntax error");
+  }
+  const auto key = arguments[0].to_string();
+  auto &db = Database::instance();
+  const auto *value = db.lookup(key);
+  if (!value) {
+    return RespValue::make_null();
+  }
+  RespString scratch;
+  const auto *str = value->read_string(scratch);
+  if (!str) {
+    return wrong_type_error();
+  }
+  auto reply = std::holds_alternative<RespSharedString>(value->value)
+                   ? *value
+                   : RespValue::make_string(*str);
+  if (change_expiry) {
+    db.set_expiry(key, expire_in);
+  }
+  return reply;
+}
+CommandRegistrar _handle_getex("getex", handle_getex, CommandAccess::Write,
+                               KeySpec{1, 1, 1});
+
+// SETNX key value: SET unless the key exists.
+RespValue handle_setnx(const RespArray &arguments) {
+  if (arguments.size() != 2) {
+    return RespValue::make_error("ERR wrong number of arguments for SETNX");
+  }
+  const auto key = arguments[0].to_string();
+  auto &db = Database::instance();
+  if (db.lookup(key)) {
+    return RespValue::make_integer(0);
+  }
+  db.set(key, arguments[1], std::nullopt);
+  return RespValue::make_integer(1);
+}
+CommandRegistrar _handle_setnx("setnx", handle_setnx, CommandAccess::Write,
+                               KeySpec{1, 1, 1});
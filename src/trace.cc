@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include "log.h"
+
+namespace {
+
+thread_local void *local_ring_pointer = nullptr;
+
+void append_json_string(std::string &out, std::string_view text) {
+  out += '"';
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20 || c == 0x7f) {
+      // Command names are client input, keep the JSON valid.
+      out += '?';
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// Chrome trace timestamps are in microseconds.
+void append_micros(std::string &out, int64_t nanos) {
+  out += std::to_string(nanos / 1000);
+  out += '.';
+  const auto fraction = std::to_string(1000 + nanos % 1000);
+  out += std::string_view(fraction).substr(1);
+}
+
+}  // namespace
+
+Tracer::Ring &Tracer::local_ring() {
+  if (!local_ring_pointer) {
+    std::lock_guard lock(mutex);
+    auto ring = std::make_unique<Ring>();
+    ring->thread_id = rings.size() + 1;
+    ring->thread_name = "thread " + std::to_string(ring->thread_id);
+    local_ring_pointer = ring.get();
+    rings.push_back(std::move(ring));
+  }
+  return *static_cast<Ring *>(local_ring_pointer);
+}
+
+void Tracer::name_thread(std::string_view name) {
+  auto &ring = local_ring();
+  std::lock_guard lock(mutex);
+  ring.thread_name = name;
+}
+
+void Tracer::record(const Span &span) {
+  auto &ring = local_ring();
+  if (!ring.spans) {
+    ring.spans = std::make_unique<Span[]>(ring_size);
+  }
+  ring.spans[ring.recorded % ring_size] = span;
+  ++ring.recorded;
+}
+
+void Tracer::set_dump_path(std::string path) {
+  std::lock_guard lock(mutex);
+  dump_path = std::move(path);
+}
+
+void Tracer::handle_requests() {
+  if (dump_requested.exchange(false, std::memory_order_relaxed)) {
+    std::string path;
+    {
+      std::lock_guard lock(mutex);
+      path = dump_path;
+    }
+    if (dump(path)) {
+      LOG(Info) << "Wrote trace to " << path;
+    }
+  }
+  if (reset_requested.exchange(false, std::memory_order_relaxed)) {
+    std::lock_guard lock(mutex);
+    for (auto &ring : rings) {
+      ring->recorded = 0;
+    }
+  }
+}
+
+bool Tracer::dump(const std::string &path) {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file) {
+    LOG(Error) << "Failed to open trace file " << path << ": "
+               << strerror(errno);
+    return false;
+  }
+  std::lock_guard lock(mutex);
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  const auto separate = [&] {
+    if (!first) {
+      out += ",\n";
+    }
+    first = false;
+  };
+  for (const auto &ring : rings) {
+    const auto tid = std::to_string(ring->thread_id);
+    separate();
+    out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid +
+           ",\"args\":{\"name\":";
+    append_json_string(out, ring->thread_name);
+    out += "}}";
+    const uint64_t kept =
+        ring->spans ? std::min<uint64_t>(ring->recorded, ring_size) : 0;
+    for (uint64_t i = ring->recorded - kept; i < ring->recorded; ++i) {
+      const Span &span = ring->spans[i % ring_size];
+      separate();
+      out += "{\"name\":";
+      append_json_string(out, span.name);
+      out += ",\"cat\":\"";
+      out += span.category;
+      out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+      append_micros(out, span.start);
+      out += ",\"dur\":";
+      append_micros(out, span.duration);
+      out += ",\"args\":{";
+      if (span.fd >= 0) {
+        out += "\"fd\":" + std::to_string(span.fd);
+      }
+      if (span.count >= 0) {
+        out += span.fd >= 0 ? "," : "";
+        out += "\"count\":" + std::to_string(span.count);
+      }
+      out += "}}";
+    }
+    // Flush per thread so the string stays bounded by one ring.
+    file << out;
+    out.clear();
+  }
+  file << "]}\n";
+  return static_cast<bool>(file);
+}
+
+void TraceSpan::start(const char *category, std::string_view name, int fd) {
+  span.category = category;
+  const size_t length = std::min(name.size(), Tracer::max_name_length);
+  std::memcpy(span.name, name.data(), length);
+  span.name[length] = '\0';
+  span.fd = fd;
+  span.count = -1;
+  span.start = Tracer::instance().now();
+}
+
+void TraceSpan::finish() {
+  auto &tracer = Tracer::instance();
+  span.duration = tracer.now() - span.start;
+  tracer.record(span);
+}
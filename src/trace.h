@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Opt-in tracing of the event loop for tail latency debugging. While
+// enabled, every thread records spans (loop wakeups, socket reads and
+// writes, parsing, command execution) into its own ring buffer, keeping the
+// newest `ring_size`. `dump` writes them as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open, one track per thread.
+//
+// While disabled a span costs one relaxed load.
+class Tracer {
+ public:
+  static Tracer& instance() {
+    static Tracer instance;
+    return instance;
+  }
+
+  static constexpr size_t ring_size = 1 << 16;
+  static constexpr size_t max_name_length = 23;
+
+  void set_enabled(bool enabled) {
+    active.store(enabled, std::memory_order_relaxed);
+  }
+  bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+  // Names the calling thread's track.
+  void name_thread(std::string_view name);
+
+  struct Span {
+    const char* category;
+    char name[max_name_length + 1];
+    int32_t fd;
+    // Wakeup events or bytes, -1 if none.
+    int64_t count;
+    // Nanoseconds since the tracer was created.
+    int64_t start;
+    int64_t duration;
+  };
+  void record(const Span& span);
+
+  // Asks the event loop to dump to the default path at the end of its
+  // current iteration, when no other thread records. Async-signal-safe.
+  void request_dump() { dump_requested.store(true, std::memory_order_relaxed); }
+  void set_dump_path(std::string path);
+  // Asks the event loop to drop all recorded spans, like `request_dump`.
+  void request_reset() {
+    reset_requested.store(true, std::memory_order_relaxed);
+  }
+  // Performs the requested dump and reset. Event loop thread only, between
+  // iterations.
+  void handle_requests();
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+ private:
+  Tracer() = default;
+  // Delete copy/move operations
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+  Tracer(Tracer&&) = delete;
+  Tracer& operator=(Tracer&&) = delete;
+
+  struct Ring {
+    uint32_t thread_id;
+    std::string thread_name;
+    // Spans recorded so far, the newest `ring_size` are kept.
+    uint64_t recorded = 0;
+    // Allocated by the first span, threads that never record don't pay.
+    std::unique_ptr<Span[]> spans;
+  };
+  // The calling thread's ring, created on first use.
+  Ring& local_ring();
+  // Writes all recorded spans to `path`, returns false if it can't be
+  // written. Other threads must not record meanwhile.
+  bool dump(const std::string& path);
+
+  const std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+  std::atomic<bool> active{false};
+  std::atomic<bool> dump_requested{false};
+  std::atomic<bool> reset_requested{false};
+  std::string dump_path = "redisxx-trace.json";
+  // Guards `rings`, each ring is only written by its thread.
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+};
+
+// Records the time from construction to destruction as one span, if tracing
+// is enabled at construction.
+class TraceSpan {
+ public:
+  TraceSpan(const char* category, std::string_view name, int fd = -1)
+      : active{Tracer::instance().enabled()} {
+    if (active) {
+      start(category, name, fd);
+    }
+  }
+  ~TraceSpan() {
+    if (active) {
+      finish();
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  void set_count(int64_t count) { span.count = count; }
+
+ private:
+  void start(const char* category, std::string_view name, int fd);
+  void finish();
+
+  const bool active;
+  Tracer::Span span;
+};
@@ -0,0 +1,31 @@
+#include "commands.h"
+#include "trace.h"
+
+// TRACE ON|OFF|RESET|DUMP: controls the event loop tracer. Dumps go to the
+// --trace-file path like on SIGUSR2, clients can't choose the file. Dumps and
+// resets happen at the end of the current event loop iteration.
+
+RespValue handle_trace(const RespArray &arguments) {
+  if (arguments.empty()) {
+    return RespValue::make_error("ERR wrong number of arguments for TRACE");
+  }
+  auto &tracer = Tracer::instance();
+  const auto subcommand = arguments[0].to_string();
+  if (arguments.size() != 1) {
+    return RespValue::make_error("ERR wrong number of arguments for TRACE");
+  }
+  if (equals_ignore_case(subcommand, "dump")) {
+    tracer.request_dump();
+  } else if (equals_ignore_case(subcommand, "on")) {
+    tracer.set_enabled(true);
+  } else if (equals_ignore_case(subcommand, "off")) {
+    tracer.set_enabled(false);
+  } else if (equals_ignore_case(subcommand, "reset")) {
+    tracer.request_reset();
+  } else {
+    return RespValue::make_error("ERR unsupported sub command for TRACE: " +
+                                 subcommand);
+  }
+  return RespValue::make_string("OK");
+}
+CommandRegistrar _handle_trace("trace", handle_trace, CommandAccess::Server);
@@ -0,0 +1,174 @@
+#include "tracking.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "resp_types.h"
+
+namespace {
+
+// Upper bound on tracked keys, like Redis' tracking-table-max-keys. Keys
+// evicted from the table are invalidated on the clients.
+constexpr size_t max_tracked_keys = 1'000'000;
+
+}  // namespace
+
+void Tracking::enable(Connection& con, Options options) {
+  disable(con);
+  if (options.bcast) {
+    if (options.prefixes.empty()) {
+      options.prefixes.emplace_back();
+    }
+    for (const auto& prefix : options.prefixes) {
+      prefixes[prefix].insert(con.id);
+    }
+    ++bcast_clients;
+  }
+  clients.insert_or_assign(con.id,
+                           Client{.con = &con, .options = std::move(options)});
+}
+
+void Tracking::disable(Connection& con) {
+  const auto it = clients.find(con.id);
+  if (it == clients.end()) {
+    return;
+  }
+  if (it->second.options.bcast) {
+    for (const auto& prefix : it->second.options.prefixes) {
+      const auto entry = prefixes.find(prefix);
+      entry->second.erase(con.id);
+      if (entry->second.empty()) {
+        prefixes.erase(entry);
+      }
+    }
+    --bcast_clients;
+  }
+  // Keys this client read stay in the table and are dropped lazily when they
+  // get invalidated.
+  clients.erase(it);
+}
+
+bool Tracking::is_enabled(const Connection& con) const {
+  return clients.contains(con.id);
+}
+
+bool Tracking::set_caching(Connection& con, bool yes) {
+  const auto it = clients.find(con.id);
+  if (it == clients.end() ||
+      !(it->second.options.optin || it->second.options.optout)) {
+    return false;
+  }
+  it->second.caching_command = con.commands_processed + 1;
+  it->second.caching_yes = yes;
+  return true;
+}
+
+void Tracking::on_key_read(const std::string& key) {
+  if (clients.empty()) {
+    return;
+  }
+  const Connection* con = current_connection();
+  if (!con) {
+    return;
+  }
+  const auto it = clients.find(con->id);
+  if (it == clients.end() || it->second.options.bcast) {
+    return;
+  }
+  const auto& client = it->second;
+  const bool overridden = client.caching_command == con->commands_processed;
+  if (client.options.optin && !(overridden && client.caching_yes)) {
+    return;
+  }
+  if (client.options.optout && overridden && !client.caching_yes) {
+    return;
+  }
+  auto& ids = table[key];
+  const auto pos = std::lower_bound(ids.begin(), ids.end(), con->id);
+  if (pos == ids.end() || *pos != con->id) {
+    ids.insert(pos, con->id);
+  }
+  if (table.size() > max_tracked_keys) {
+    evict_keys();
+  }
+}
+
+void Tracking::on_key_modified(const std::string& key) {
+  invalidate(key, current_connection());
+}
+
+void Tracking::on_key_expired(const std::string& key) {
+  invalidate(key, nullptr);
+}
+
+void Tracking::on_flush() {
+  table.clear();
+  if (clients.empty()) {
+    return;
+  }
+  // A null key list invalidates everything.
+  const auto frame = std::make_shared<const std::string>(
+      RespValue::make_push(
+          {RespValue::make_string("invalidate"), RespValue::make_null()})
+          .to_protocol_representation());
+  for (auto& [_, client] : clients) {
+    client.con->outgoing.append_shared(frame);
+    request_write(*client.con);
+  }
+}
+
+void Tracking::invalidate(const std::string& key, const Connection* modifier) {
+  std::vector<uint64_t> ids;
+  if (const auto it = table.find(key); it != table.end()) {
+    ids = std::move(it->second);
+    table.erase(it);
+  }
+  if (bcast_clients > 0) {
+    for (const auto& [prefix, prefix_ids] : prefixes) {
+      if (key.starts_with(prefix)) {
+        ids.insert(ids.end(), prefix_ids.begin(), prefix_ids.end());
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  }
+  if (!ids.empty()) {
+    send_invalidation(key, ids, modifier);
+  }
+}
+
+void Tracking::send_invalidation(const std::string& key,
+                                 const std::vector<uint64_t>& client_ids,
+                                 const Connection* modifier) {
+  // Encoded once and shared by all receiving connections.
+  std::shared_ptr<const std::string> frame;
+  for (const uint64_t id : client_ids) {
+    const auto it = clients.find(id);
+    if (it == clients.end()) {
+      continue;
+    }
+    Connection& con = *it->second.con;
+    if (it->second.options.noloop && &con == modifier) {
+      continue;
+    }
+    if (!frame) {
+      frame = std::make_shared<const std::string>(
+          RespValue::make_push(
+              {RespValue::make_string("invalidate"),
+               RespValue::make_array({RespValue::make_string(key)})})
+              .to_protocol_representation());
+    }
+    con.outgoing.append_shared(frame);
+    request_write(con);
+  }
+}
+
+void Tracking::evict_keys() {
+  while (table.size() > max_tracked_keys) {
+    auto it = table.begin();
+    const std::string key = it->first;
+    const auto ids = std::move(it->second);
+    table.erase(it);
+    send_invalidation(key, ids, nullptr);
+  }
+}
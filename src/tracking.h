@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "connection.h"
+
+// Server assisted client side caching (CLIENT TRACKING). Remembers which
+// clients read which keys and pushes a RESP3 `invalidate` message to them
+// when such a key is modified or expires.
+class Tracking {
+ public:
+  static Tracking& instance() {
+    static Tracking instance;
+    return instance;
+  }
+
+  struct Options {
+    bool bcast = false;
+    bool optin = false;
+    bool optout = false;
+    bool noloop = false;
+    std::vector<std::string> prefixes;
+  };
+
+  void enable(Connection& con, Options options);
+  void disable(Connection& con);
+  bool is_enabled(const Connection& con) const;
+
+  // CLIENT CACHING yes|no, applies to the next command of `con`. Returns
+  // false unless `con` tracks in OPTIN or OPTOUT mode.
+  bool set_caching(Connection& con, bool yes);
+
+  // Called for every key lookup done on behalf of the current connection.
+  void on_key_read(const std::string& key);
+  // Called when `key` is modified or deleted by the current connection.
+  void on_key_modified(const std::string& key);
+  // Called when `key` expired. NOLOOP does not apply to expirations.
+  void on_key_expired(const std::string& key);
+  // Called when every key was removed, so clients drop their whole cache.
+  void on_flush();
+
+  size_t tracked_keys() const { return table.size(); }
+
+ private:
+  Tracking() = default;
+  // Delete copy/move operations
+  Tracking(const Tracking&) = delete;
+  Tracking& operator=(const Tracking&) = delete;
+  Tracking(Tracking&&) = delete;
+  Tracking& operator=(Tracking&&) = delete;
+
+  struct Client {
+    Connection* con;
+    Options options;
+    // Value of `Connection::commands_processed` during which the CLIENT
+    // CACHING override applies.
+    uint64_t caching_command = 0;
+    bool caching_yes = false;
+  };
+
+  // Pushes an invalidation for `key` to `client_ids`, skipping `modifier` if
+  // it asked for NOLOOP.
+  void invalidate(const std::string& key, const Connection* modifier);
+  void send_invalidation(const std::string& key,
+                         const std::vector<uint64_t>& client_ids,
+                         const Connection* modifier);
+  void evict_keys();
+
+  std::unordered_map<uint64_t, Client> clients;
+  // Key -> ids of clients that may have it cached. Small sorted vectors keep
+  // the table compact, it is bounded by `max_tracked_keys`.
+  std::unordered_map<std::string, std::vector<uint64_t>> table;
+  // BCAST prefix -> ids of clients interested in keys starting with it.
+  std::unordered_map<std::string, std::unordered_set<uint64_t>> prefixes;
+  size_t bcast_clients = 0;
+};